@@ -0,0 +1,90 @@
+// CounterReader.cpp : Prints the operational counters of a running Multikeys Core.
+
+/*
+
+Opens the shared page where the core keeps its counters (see MultikeysCore/Counters.h)
+read-only, and prints every counter to standard output, one per line:
+	CounterReader				prints the counters once
+	CounterReader 1000			prints them again every 1000 ms, until interrupted
+The core is never asked for anything; reading the page costs it nothing.
+Exits with 1 if the page doesn't exist (the core isn't running) or has a layout
+this reader doesn't know.
+
+Only standard C++ and the API to open the page are used, so this builds both with
+Windows and on Linux (see ../CMakeLists.txt), where it reads the page of the tests.
+
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "../MultikeysCore/CounterPage.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>			// shm_open
+#include <sys/mman.h>		// mmap
+#include <unistd.h>			// close
+#endif
+
+using namespace Multikeys::Counters;
+
+
+// Maps the counter page read-only; null if it doesn't exist.
+static const CounterPage* OpenCounterPage()
+{
+#ifdef _WIN32
+	HANDLE mappingHandle = OpenFileMapping(FILE_MAP_READ, FALSE, L"Local\\MultikeysCoreCounters");
+	if (mappingHandle == NULL)
+		return nullptr;
+	const CounterPage* page = (const CounterPage*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, sizeof(CounterPage));
+	CloseHandle(mappingHandle);		// The view keeps the mapping alive
+	return page;
+#else
+	int descriptor = shm_open("/MultikeysCoreCounters", O_RDONLY, 0);
+	if (descriptor < 0)
+		return nullptr;
+	void* page = mmap(nullptr, sizeof(CounterPage), PROT_READ, MAP_SHARED, descriptor, 0);
+	close(descriptor);				// So does the mapping
+	return page == MAP_FAILED ? nullptr : (const CounterPage*)page;
+#endif
+}
+
+
+int main(int argc, char* argv[])
+{
+	int interval = argc > 1 ? atoi(argv[1]) : 0;
+
+	const CounterPage* page = OpenCounterPage();
+	if (page == nullptr)
+	{
+		fprintf(stderr, "The counters of Multikeys Core could not be opened; is it running?\n");
+		return 1;
+	}
+	if (page->version != LAYOUT_VERSION)
+	{
+		fprintf(stderr, "The counters have layout %u; this reader only knows layout %u.\n",
+			page->version, LAYOUT_VERSION);
+		return 1;
+	}
+
+	// A newer core may have counters appended that this reader has no names for
+	unsigned int count = page->counterCount < (unsigned int)COUNTER_COUNT ? page->counterCount : (unsigned int)COUNTER_COUNT;
+	while (true)
+	{
+		for (unsigned int i = 0; i < count; i++)
+		{
+			printf("%-26s %llu\n", COUNTER_NAMES[i],
+				(unsigned long long)page->counters[i].value.load(std::memory_order_relaxed));
+		}
+		fflush(stdout);
+
+		if (interval <= 0)
+			return 0;
+		std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+		printf("\n");
+	}
+}
@@ -0,0 +1,252 @@
+// Shared decision table between the core and the hook DLL.
+//
+// For keystrokes whose decision needs no action from the core (let the key pass, or block it
+// without executing anything), the core publishes the decision in this table as soon as Raw Input
+// arrives. The hook procedure, running inside whichever process has focus, claims the decision
+// from the table and answers the hook by itself, without the SendMessage round trip to the core.
+// On a miss, the hook falls back to SendMessage as before.
+//
+// The table lives in a named file mapping. Every entry is a single 64-bit word, so publishing,
+// claiming and retiring are each one interlocked operation and nobody ever takes a lock.
+// This header is included by both the DLL and the core; it only depends on Windows.h.
+// Elsewhere (for the tests in ../Tests) the few Windows functions it uses are defined below
+// on top of the compiler's atomics, and the table lives in a POSIX shared memory object.
+
+#pragma once
+
+#ifdef _WIN32
+
+#include <Windows.h>
+
+// Name of the file mapping holding the DecisionTable; created by the core.
+#define DECISION_TABLE_NAME L"Local\\MultikeysDecisionTable"
+
+#else
+
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>			// shm_open
+#include <sys/mman.h>		// mmap
+#include <unistd.h>			// ftruncate, close
+
+// Name of the shared memory object holding the DecisionTable; created with shm_open.
+#define DECISION_TABLE_NAME "/MultikeysDecisionTable"
+
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef uint32_t DWORD;
+typedef int64_t LONG64;
+typedef unsigned int UINT;
+typedef int BOOL;
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+#ifndef OUT
+#define OUT
+#endif
+
+// Same results as their Windows namesakes, with the same full barriers
+inline LONG InterlockedIncrement(volatile LONG* addend)
+{
+	return __atomic_add_fetch(addend, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG64 InterlockedExchange64(volatile LONG64* target, LONG64 value)
+{
+	return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONG64 InterlockedCompareExchange64(volatile LONG64* destination, LONG64 exchange, LONG64 comparand)
+{
+	__atomic_compare_exchange_n(destination, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return comparand;		// Holds the initial value either way
+}
+
+// Milliseconds of a monotonic clock, wrapping around like GetTickCount does
+inline DWORD GetTickCount()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (DWORD)((uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000);
+}
+
+#endif
+
+// Incremented whenever the layout of DecisionTable changes.
+#define DECISION_TABLE_VERSION 1
+
+// Number of entries; must be a power of two. Only recent keystrokes ever need to be in the table.
+#define DECISION_TABLE_SIZE 64
+
+// Decisions older than this (in ms) are never claimed by the hook. Past that, the keystroke that
+// published it is assumed to have reached no hook (for instance, it went to an elevated window).
+#define DECISION_TABLE_MAX_AGE 50
+
+
+// Layout of an entry word:
+// bits 0-1		state (one of the DECISION_STATE values)
+// bit 2		decision: 1 to block the key, 0 to let it through
+// bits 3-20	key: virtual key (8 bits), scancode (8 bits), extended flag, keyup flag
+// bits 21-52	generation; makes every published word unique, so a stale copy never matches
+#define DECISION_STATE_EMPTY 0			// Never used
+#define DECISION_STATE_PUBLISHED 1		// Waiting for the hook
+#define DECISION_STATE_CLAIMED 2		// Taken by the hook, or retired by the core
+
+#define DECISION_STATE_MASK 3LL
+#define DECISION_BLOCK_BIT 4LL
+#define DECISION_KEY_SHIFT 3
+#define DECISION_KEY_MASK (0x3ffffLL << DECISION_KEY_SHIFT)
+#define DECISION_GENERATION_SHIFT 21
+
+
+struct DecisionTableEntry
+{
+	volatile LONG64 word;
+	volatile DWORD publishTime;		// GetTickCount when published; only a freshness hint
+	DWORD padding;
+};
+
+struct DecisionTable
+{
+	volatile LONG version;			// DECISION_TABLE_VERSION of the core
+	volatile LONG active;			// Nonzero while the core is publishing decisions
+	volatile LONG nextGeneration;	// Incremented by the core's publishing threads; wraps around
+	DecisionTableEntry entries[DECISION_TABLE_SIZE];
+};
+
+
+// Packs a keystroke into the key field of an entry word.
+// virtualKey and scancode are truncated to a byte, like in the hook's parameters.
+inline LONG64 DecisionTableKey(UINT virtualKey, UINT scancode, BOOL isExtended, BOOL isKeyup)
+{
+	LONG64 key = (virtualKey & 0xff)
+		| ((scancode & 0xff) << 8)
+		| ((isExtended ? 1 : 0) << 16)
+		| ((isKeyup ? 1 : 0) << 17);
+	return key << DECISION_KEY_SHIFT;
+}
+
+
+// Core only; may be called from several threads at once.
+// Publishes a decision in the oldest slot; whatever was there is dropped.
+// Writes the slot index and the published word into out_slot and out_word, which the
+// core needs to claim or retire the decision later.
+inline void DecisionTablePublish(DecisionTable* const table, LONG64 key, BOOL block,
+	OUT LONG* const out_slot, OUT LONG64* const out_word)
+{
+	ULONG generation = (ULONG)InterlockedIncrement(&table->nextGeneration) - 1;
+	LONG slot = (LONG)(generation & (DECISION_TABLE_SIZE - 1));
+	LONG64 word = ((LONG64)generation << DECISION_GENERATION_SHIFT)
+		| key
+		| (block ? DECISION_BLOCK_BIT : 0)
+		| DECISION_STATE_PUBLISHED;
+
+	table->entries[slot].publishTime = GetTickCount();
+	InterlockedExchange64(&table->entries[slot].word, word);		// full barrier; time is written first
+
+	*out_slot = slot;
+	*out_word = word;
+}
+
+
+// Takes a published word away from the hook. Returns FALSE if the hook claimed it first
+// (or the slot was reused since).
+inline BOOL DecisionTableRetire(DecisionTable* const table, LONG slot, LONG64 publishedWord)
+{
+	LONG64 claimedWord = (publishedWord & ~DECISION_STATE_MASK) | DECISION_STATE_CLAIMED;
+	return InterlockedCompareExchange64(&table->entries[slot].word, claimedWord, publishedWord) == publishedWord;
+}
+
+
+// Hook only. Looks for the oldest fresh decision for the key and claims it.
+// Returns TRUE if one was claimed, in which case *out_block holds the decision.
+inline BOOL DecisionTableClaim(DecisionTable* const table, LONG64 key, OUT BOOL* const out_block)
+{
+	if (!table->active || table->version != DECISION_TABLE_VERSION)
+		return FALSE;
+
+	DWORD now = GetTickCount();
+
+	// Scan from the oldest slot to the newest one, so that two decisions for the same key
+	// are claimed in the order they were published.
+	ULONG newest = (ULONG)table->nextGeneration;
+	for (ULONG age = DECISION_TABLE_SIZE; age > 0; age--)
+	{
+		ULONG generation = newest - age;		// Slots never published are EMPTY, and skipped below
+		DecisionTableEntry* entry = &table->entries[generation & (DECISION_TABLE_SIZE - 1)];
+		LONG64 word = entry->word;
+		if ((word & DECISION_STATE_MASK) != DECISION_STATE_PUBLISHED
+			|| (word & DECISION_KEY_MASK) != key)
+			continue;
+		if (now - entry->publishTime > DECISION_TABLE_MAX_AGE)
+			continue;
+
+		if (DecisionTableRetire(table, (LONG)(generation & (DECISION_TABLE_SIZE - 1)), word))
+		{
+			*out_block = (word & DECISION_BLOCK_BIT) != 0;
+			return TRUE;
+		}
+		// Someone else took it; keep looking
+	}
+	return FALSE;
+}
+
+
+#ifndef _WIN32
+
+// Where there's no file mapping, the table is shared through POSIX shared memory. The core
+// creates it, as SharedDecisions::Initialize does with CreateFileMapping, and the hooks open
+// it by name. Both return null on failure.
+
+// Core only. Creates (or takes over) the table, and starts publishing.
+inline DecisionTable* DecisionTableCreate()
+{
+	int descriptor = shm_open(DECISION_TABLE_NAME, O_CREAT | O_RDWR, 0600);
+	if (descriptor < 0)
+		return nullptr;
+
+	void* mapping = MAP_FAILED;
+	if (ftruncate(descriptor, sizeof(DecisionTable)) == 0)
+		mapping = mmap(nullptr, sizeof(DecisionTable), PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+	close(descriptor);		// The mapping keeps the object alive
+	if (mapping == MAP_FAILED)
+	{
+		shm_unlink(DECISION_TABLE_NAME);
+		return nullptr;
+	}
+
+	// Start over, in case an earlier core left the object behind
+	DecisionTable* table = (DecisionTable*)mapping;
+	__atomic_store_n(&table->active, 0, __ATOMIC_SEQ_CST);
+	for (int i = 0; i < DECISION_TABLE_SIZE; i++)
+		InterlockedExchange64(&table->entries[i].word, DECISION_STATE_EMPTY);
+	table->nextGeneration = 0;
+	table->version = DECISION_TABLE_VERSION;
+	__atomic_store_n(&table->active, 1, __ATOMIC_SEQ_CST);
+	return table;
+}
+
+// Hook only. Maps the table the core created.
+inline DecisionTable* DecisionTableOpen()
+{
+	int descriptor = shm_open(DECISION_TABLE_NAME, O_RDWR, 0);
+	if (descriptor < 0)
+		return nullptr;
+
+	void* mapping = mmap(nullptr, sizeof(DecisionTable), PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+	close(descriptor);
+	return mapping == MAP_FAILED ? nullptr : (DecisionTable*)mapping;
+}
+
+// Core only. Stops publishing, unmaps the table and removes its name; hooks that still have it
+// mapped only see it inactive.
+inline void DecisionTableDestroy(DecisionTable* table)
+{
+	__atomic_store_n(&table->active, 0, __ATOMIC_SEQ_CST);
+	munmap(table, sizeof(DecisionTable));
+	shm_unlink(DECISION_TABLE_NAME);
+}
+
+#endif
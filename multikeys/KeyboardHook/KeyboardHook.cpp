@@ -3,6 +3,7 @@
 #include "stdafx.h"
 #include <stdio.h>
 #include "KeyboardHook.h"
+#include "DecisionTable.h"
 
 // Creating the shared data segment (between the main program and the DLL)
 // The specific name for the shared segment is not important.
@@ -22,6 +23,13 @@ HWND hwndServer = NULL;
 HINSTANCE instanceHandle;
 HHOOK hookHandle;
 
+// Decision table published by the core, mapped into this process on the first keystroke.
+// Stays null if it can't be opened (for instance, from a sandboxed process); the hook then
+// always asks the core.
+DecisionTable* decisionTable = nullptr;
+HANDLE decisionTableHandle = NULL;
+BOOL decisionTableOpened = FALSE;		// Whether opening was attempted
+
 BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserved)
 {
 	switch (ul_reason_for_call)
@@ -30,6 +38,12 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserv
 		instanceHandle = hModule;
 		hookHandle = NULL;
 		break;
+	case DLL_PROCESS_DETACH:
+		if (decisionTable != nullptr)
+			UnmapViewOfFile(decisionTable);
+		if (decisionTableHandle != NULL)
+			CloseHandle(decisionTableHandle);
+		break;
 	default:
 		break;
 	}
@@ -67,7 +81,30 @@ static LRESULT CALLBACK KeyboardProc(int code, WPARAM wParam, LPARAM lParam)
 	}
 	
 
-	// Report the event to the main window.
+	// If the core already published the decision for this keystroke, take it from there.
+	// Only decisions that need nothing else from the core are published.
+	if (!decisionTableOpened)
+	{
+		decisionTableOpened = TRUE;
+		decisionTableHandle = OpenFileMapping(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, DECISION_TABLE_NAME);
+		if (decisionTableHandle != NULL)
+			decisionTable = (DecisionTable*)MapViewOfFile(decisionTableHandle, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(DecisionTable));
+	}
+	if (decisionTable != nullptr)
+	{
+		BOOL block;
+		if (DecisionTableClaim(decisionTable,
+			DecisionTableKey((UINT)wParam, (lParam >> 16) & 0xff, (lParam >> 24) & 1, (lParam >> 31) & 1),
+			&block))
+		{
+			if (block)
+				return 1;
+			return CallNextHookEx(hookHandle, code, wParam, lParam);
+		}
+	}
+
+
+	// Otherwise, report the event to the main window.
 	// Return value of 1 means block the input,
 	// return value of 0 means pass it along the hook chain
 	// (sends a nonqueued message to hwndServer)
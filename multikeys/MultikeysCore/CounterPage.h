@@ -0,0 +1,69 @@
+#pragma once
+
+// Layout of the page that holds the operational counters (see Counters.h).
+// Readers in other processes only need this header, so it uses nothing but standard C++;
+// CounterReader includes it as well, on any platform.
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+
+namespace Multikeys
+{
+	namespace Counters
+	{
+		// Incremented whenever the layout of CounterPage changes.
+		const uint32_t LAYOUT_VERSION = 1;
+
+		// Size of a cache line; each counter gets one of its own, so that counters
+		// incremented by different threads never contend for the same line.
+		const size_t CACHE_LINE_SIZE = 64;
+
+		// Events that are counted. New counters must be appended at the end,
+		// since readers index the page by these values.
+		enum Counter
+		{
+			HookTimeouts,				// Hook gave up waiting for its Raw Input message
+			UnmatchedDecisions,			// Decision records discarded without any hook message asking for them
+			FakeShiftCorrections,		// Fake shifts (shift + numpad with NumLock) that had to be fixed
+			PauseBreakSpecialCases,		// Pause/Break keystrokes
+			PrintScreenSpecialCases,	// PrintScreen keyups that needed a fake keydown
+			FailedCommands,				// Commands whose simulated input (SendInput) failed
+			RawInputBufferRegrowths,	// Raw Input buffer had to be reallocated
+			DeviceNameBufferRegrowths,	// Device name buffer had to be reallocated
+			DecisionsClaimedByHook,		// Decisions the hook took from the shared decision table
+			DeviceLookups,				// Devices looked up by name, the first time they sent input
+
+			COUNTER_COUNT
+		};
+
+		// Names of the counters, for readers; same order as the Counter enum.
+		static const char* const COUNTER_NAMES[COUNTER_COUNT] = {
+			"HookTimeouts",
+			"UnmatchedDecisions",
+			"FakeShiftCorrections",
+			"PauseBreakSpecialCases",
+			"PrintScreenSpecialCases",
+			"FailedCommands",
+			"RawInputBufferRegrowths",
+			"DeviceNameBufferRegrowths",
+			"DecisionsClaimedByHook",
+			"DeviceLookups"
+		};
+
+		// A single counter, alone in its cache line.
+		struct alignas(CACHE_LINE_SIZE) PaddedCounter
+		{
+			std::atomic<uint64_t> value;
+			unsigned char padding[CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)];
+		};
+
+		// Layout of the shared page.
+		struct alignas(CACHE_LINE_SIZE) CounterPage
+		{
+			uint32_t version;			// LAYOUT_VERSION of the writer
+			uint32_t counterCount;		// COUNTER_COUNT of the writer
+			PaddedCounter counters[COUNTER_COUNT];
+		};
+	}
+}
@@ -0,0 +1,133 @@
+#include "stdafx.h"
+
+// Implementation of methods in Counters.h
+#include "Counters.h"
+
+#ifndef _WIN32
+#include <fcntl.h>			// shm_open
+#include <sys/mman.h>		// mmap
+#include <unistd.h>			// ftruncate, close
+#endif
+
+namespace Multikeys
+{
+	namespace Counters
+	{
+		// Used before the shared page exists, or if it can't be created. Its header is set by
+		// Initialize, like that of the shared page; nothing reads it before.
+		static CounterPage privatePage = {};
+
+		// Page that is currently being written to; never null, so incrementing needs no checks.
+		// Threads that are never joined (the launcher, the macro scheduler) increment through it,
+		// so it's swapped atomically, and a shared page is never unmapped once published.
+		static std::atomic<CounterPage*> page(&privatePage);
+
+#ifdef _WIN32
+		// Handle of the file mapping, if one was created.
+		static HANDLE mappingHandle = NULL;
+#else
+		// Descriptor of the shared memory object, if one was created; -1 otherwise.
+		static int mappingHandle = -1;
+#endif
+
+
+		// Creates and maps the shared page; null if it can't be.
+		static CounterPage* MapSharedPage()
+		{
+#ifdef _WIN32
+			mappingHandle = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+				0, sizeof(CounterPage), SHARED_PAGE_NAME);
+			if (mappingHandle == NULL)
+				return nullptr;
+
+			CounterPage* sharedPage = (CounterPage*)MapViewOfFile(mappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(CounterPage));
+			if (sharedPage == nullptr)
+			{
+				CloseHandle(mappingHandle);
+				mappingHandle = NULL;
+			}
+			return sharedPage;
+#else
+			mappingHandle = shm_open(SHARED_PAGE_NAME, O_CREAT | O_RDWR, 0644);
+			if (mappingHandle < 0)
+				return nullptr;
+
+			void* sharedPage = MAP_FAILED;
+			if (ftruncate(mappingHandle, sizeof(CounterPage)) == 0)
+				sharedPage = mmap(nullptr, sizeof(CounterPage), PROT_READ | PROT_WRITE, MAP_SHARED, mappingHandle, 0);
+			if (sharedPage == MAP_FAILED)
+			{
+				close(mappingHandle);
+				shm_unlink(SHARED_PAGE_NAME);
+				mappingHandle = -1;
+				return nullptr;
+			}
+			return (CounterPage*)sharedPage;
+#endif
+		}
+
+
+		bool Initialize()
+		{
+#ifdef _WIN32
+			if (mappingHandle != NULL)
+#else
+			if (mappingHandle >= 0)
+#endif
+				return true;		// Already initialized
+
+			privatePage.version = LAYOUT_VERSION;
+			privatePage.counterCount = COUNTER_COUNT;
+
+			CounterPage* sharedPage = MapSharedPage();
+			if (sharedPage == nullptr)
+				return false;
+
+			// Carry over whatever was counted before the page existed.
+			// A new mapping is zero-filled, so this also initializes it.
+			CounterPage* previousPage = page.load(std::memory_order_acquire);
+			if (previousPage != sharedPage)
+			{
+				for (int i = 0; i < COUNTER_COUNT; i++)
+				{
+					sharedPage->counters[i].value.store(
+						previousPage->counters[i].value.load(std::memory_order_relaxed),
+						std::memory_order_relaxed);
+				}
+			}
+			sharedPage->version = LAYOUT_VERSION;
+			sharedPage->counterCount = COUNTER_COUNT;
+
+			page.store(sharedPage, std::memory_order_release);
+			return true;
+		}
+
+		void Release()
+		{
+			// Only the handle is closed. The view stays mapped, and counted into, until the process
+			// exits: a thread that's still running could be incrementing through it right now.
+#ifdef _WIN32
+			if (mappingHandle == NULL)
+				return;
+			CloseHandle(mappingHandle);
+			mappingHandle = NULL;
+#else
+			if (mappingHandle < 0)
+				return;
+			close(mappingHandle);
+			shm_unlink(SHARED_PAGE_NAME);
+			mappingHandle = -1;
+#endif
+		}
+
+		void Increment(Counter counter, uint64_t amount)
+		{
+			page.load(std::memory_order_acquire)->counters[counter].value.fetch_add(amount, std::memory_order_relaxed);
+		}
+
+		uint64_t Read(Counter counter)
+		{
+			return page.load(std::memory_order_acquire)->counters[counter].value.load(std::memory_order_relaxed);
+		}
+	}
+}
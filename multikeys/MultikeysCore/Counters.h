@@ -0,0 +1,41 @@
+#pragma once
+
+// Operational counters for the core.
+// These count events that otherwise only show up in the debug output (timeouts, fixes
+// applied to odd keystrokes, failed simulations...). They live in a named shared memory
+// page so that other processes can poll them without ever talking to the core.
+
+#include "stdafx.h"
+#include "CounterPage.h"
+
+namespace Multikeys
+{
+	namespace Counters
+	{
+#ifdef _WIN32
+		// Name of the file mapping that holds the CounterPage.
+		// Readers should open it with OpenFileMapping(FILE_MAP_READ, ...) and map it read-only.
+		const WCHAR* const SHARED_PAGE_NAME = L"Local\\MultikeysCoreCounters";
+#else
+		// Name of the shared memory object that holds the CounterPage, where the counters are
+		// built without Windows (for the tests). Readers should shm_open it with O_RDONLY.
+		const char* const SHARED_PAGE_NAME = "/MultikeysCoreCounters";
+#endif
+
+		// Creates the shared page. Until this is called (or if it fails), counters are
+		// still incremented, but only in this process's private memory.
+		// Returns false if the shared page could not be created.
+		bool Initialize();
+
+		// Closes the handle of the shared page (and, without Windows, removes its name). The page
+		// itself stays mapped until the process exits, since threads that are never joined may
+		// still be incrementing through it.
+		void Release();
+
+		// Adds amount to a counter. Lock-free; may be called from any thread.
+		void Increment(Counter counter, uint64_t amount = 1);
+
+		// Reads the current value of a counter.
+		uint64_t Read(Counter counter);
+	}
+}
@@ -0,0 +1,174 @@
+#include "stdafx.h"
+
+// Implementation of the shards described in EvaluationShards.h
+#include "EvaluationShards.h"
+#include "RawInputThread.h"
+#include "Metrics.h"
+
+
+// A worker thread with its own queues; the keyboards pinned to it keep their state in the remapper,
+// but only this thread ever evaluates them.
+struct Shard
+{
+	// Keystrokes from the raw input thread
+	Multikeys::SpscQueue<ShardJob, SHARD_QUEUE_CAPACITY> jobs;
+
+	// Decisions for the hook window
+	Multikeys::SpscQueue<DecisionRecord, SHARD_QUEUE_CAPACITY> decisions;
+
+	// Auto-reset event, signaled when a job is submitted or the shard should stop
+	HANDLE jobEvent;
+
+	// Auto-reset event, signaled when the shard takes a job while the raw input thread waits for
+	// room in jobs; see SubmitToShard.
+	HANDLE spaceEvent;
+	std::atomic<bool> submitterWaiting;
+
+	HANDLE thread;
+	std::atomic<bool> stopping;
+};
+
+static Shard shards[MAX_SHARDS];
+static int shardCount = 0;
+
+static Multikeys::PRemapper shardRemapper = nullptr;
+
+
+static DWORD WINAPI ShardThreadProc(LPVOID parameter)
+{
+	Shard* shard = (Shard*)parameter;
+	ShardJob job;
+
+	while (true)
+	{
+		WaitForSingleObject(shard->jobEvent, INFINITE);
+		if (shard->stopping.load())
+			return 0;
+
+		while (shard->jobs.tryPop(&job))
+		{
+			// Lets a waiting raw input thread submit again; the fence pairs with the one in SubmitToShard
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (shard->submitterWaiting.exchange(false))
+				SetEvent(shard->spaceEvent);
+
+			if (job.isReleaseAll)
+			{
+				shardRemapper->releaseAllKeys(job.keyboardIndex);
+				continue;
+			}
+
+			DecisionRecord record;
+			if (job.isExpire)
+			{
+				DWORD remaining = shardRemapper->expire(job.keyboardIndex);
+				if (remaining > 0)
+					ScheduleExpiry(job.keyboardIndex, remaining);
+				record.sequence = job.sequence;
+				record.fromTimer = TRUE;
+				CollectDeferredActions(shardRemapper, job.keyboardIndex, &record);
+			}
+			else
+			{
+				Multikeys::PKeystrokeCommand possibleAction = nullptr;
+				bool repeated = false;
+				METRICS_TIMESTAMP(evaluateStart);
+				BOOL DoBlock = shardRemapper->evaluateKeyOnKeyboard(job.keyboardIndex, &job.keyboardInput, &possibleAction, &repeated);
+				METRICS_RECORD(EvaluateKey, evaluateStart);
+
+				record = DecisionRecord(job.keyboardInput, possibleAction, DoBlock);
+				record.repeated = repeated;
+				record.sequence = job.sequence;
+				CollectDeferredActions(shardRemapper, job.keyboardIndex, &record);
+				if (!job.isFakeShift)
+					FinishEvaluation(&record);
+			}
+
+			while (!shard->decisions.tryPush(record))
+				WaitForDecisionSpace();
+			SetEvent(decisionEvent);
+			if (record.fromTimer)
+				RequestCollection();		// No hook message is coming for it
+		}
+	}
+}
+
+
+BOOL StartShards(int count, Multikeys::PRemapper remapper)
+{
+	if (shardCount > 0 || count <= 0)
+		return FALSE;
+	if (count > MAX_SHARDS)
+		count = MAX_SHARDS;
+
+	shardRemapper = remapper;
+
+	for (int i = 0; i < count; i++)
+	{
+		shards[i].stopping.store(false);
+		shards[i].submitterWaiting.store(false);
+		shards[i].jobEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+		shards[i].spaceEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+		shards[i].thread = (shards[i].jobEvent == NULL || shards[i].spaceEvent == NULL) ? NULL
+			: CreateThread(NULL, 0, ShardThreadProc, &shards[i], 0, NULL);
+		if (shards[i].thread == NULL)
+		{
+			if (shards[i].jobEvent != NULL)
+				CloseHandle(shards[i].jobEvent);
+			if (shards[i].spaceEvent != NULL)
+				CloseHandle(shards[i].spaceEvent);
+			shardCount = i;		// Stop the ones already running
+			StopShards();
+			return FALSE;
+		}
+	}
+
+	shardCount = count;
+	return TRUE;
+}
+
+
+void StopShards()
+{
+	for (int i = 0; i < shardCount; i++)
+	{
+		shards[i].stopping.store(true);
+		SetEvent(shards[i].jobEvent);
+		WaitForSingleObject(shards[i].thread, INFINITE);
+		CloseHandle(shards[i].thread);
+		CloseHandle(shards[i].jobEvent);
+		CloseHandle(shards[i].spaceEvent);
+	}
+	shardCount = 0;
+}
+
+
+int GetShardCount()
+{
+	return shardCount;
+}
+
+
+void SubmitToShard(const ShardJob& job)
+{
+	Shard& shard = shards[job.keyboardIndex % shardCount];
+	while (!shard.jobs.tryPush(job))
+	{
+		// The shard is behind. Say so before looking again, so that a job it takes meanwhile
+		// either makes room for this look or signals spaceEvent; then sleep until it takes one.
+		// Raw input waits in the meantime, which holds the devices' next keystrokes back.
+		shard.submitterWaiting.store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (shard.jobs.tryPush(job))
+			break;
+		SetEvent(shard.jobEvent);		// In case it missed it
+		WaitForSingleObject(shard.spaceEvent, INFINITE);
+	}
+	SetEvent(shard.jobEvent);
+}
+
+
+BOOL TakeShardDecision(int shard, OUT DecisionRecord* const out_record)
+{
+	return shards[shard].decisions.tryPop(out_record);
+}
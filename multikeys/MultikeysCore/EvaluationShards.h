@@ -0,0 +1,61 @@
+#pragma once
+
+// Optional execution mode where keys are evaluated by several worker threads (shards)
+// instead of the raw input thread. Each configured keyboard is pinned to one shard, so a burst
+// of keystrokes on one device only delays the devices that share its shard.
+//
+// The raw input thread numbers every keystroke and hands it to the keyboard's shard through
+// a single-producer/single-consumer queue. Each shard evaluates its keystrokes in order, and
+// hands the decisions to the hook window through a second such queue. The hook window merges
+// the decisions of all shards back into arrival order, which is the order the hook asks for
+// them and the order commands get injected in; evaluation itself runs in parallel.
+
+#include "stdafx.h"
+#include "MultikeysCore.h"
+#include "SpscQueue.h"
+
+// Maximum number of shards
+const int MAX_SHARDS = 8;
+
+// Maximum number of keystrokes or decisions waiting in each of a shard's queues
+const size_t SHARD_QUEUE_CAPACITY = 256;
+
+// A keystroke waiting to be evaluated by a shard
+struct ShardJob
+{
+	RAWKEYBOARD keyboardInput;
+	int keyboardIndex;			// As returned by IRemapper::findKeyboard
+	ULONGLONG sequence;			// Arrival order, assigned by the raw input thread
+
+	// Whether this is one of the records made up by the fake shift fix; those are only
+	// evaluated, with none of the other work done after evaluating a key.
+	BOOL isFakeShift;
+
+	// Instead of a keystroke, this asks the shard to release every key held down on the keyboard.
+	// No decision comes out of it, so it takes no sequence number.
+	BOOL isReleaseAll;
+
+	// Instead of a keystroke, this asks the shard to resolve the keystrokes the keyboard holds back,
+	// which yields a decision with no keystroke (see DecisionRecord::fromTimer).
+	BOOL isExpire;
+};
+
+// Starts shardCount shards (at most MAX_SHARDS).
+// remapper - already loaded remapper; shards only evaluate keys with evaluateKeyOnKeyboard.
+// Must be called before the raw input thread is started.
+// Returns FALSE if any shard couldn't be started; in that case, none is left running.
+BOOL StartShards(int shardCount, Multikeys::PRemapper remapper);
+
+// Stops all shards and waits for them to end. Must be called after the raw input thread is stopped.
+// Keystrokes not yet evaluated are dropped.
+void StopShards();
+
+// Number of running shards; 0 when keys are evaluated by the raw input thread.
+int GetShardCount();
+
+// Raw input thread only. Hands a keystroke to the shard its keyboard is pinned to; if the shard
+// has SHARD_QUEUE_CAPACITY keystrokes waiting already, sleeps until it takes one.
+void SubmitToShard(const ShardJob& job);
+
+// Hook window only. Takes the oldest decision a shard has finished.
+BOOL TakeShardDecision(int shard, OUT DecisionRecord* const out_record);
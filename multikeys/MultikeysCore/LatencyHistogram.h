@@ -0,0 +1,161 @@
+#pragma once
+
+#include "stdafx.h"
+
+// Fixed-size latency histogram, in the style of HdrHistogram.
+// Header only; no cpp implementation file exists.
+
+namespace Multikeys
+{
+
+	// Records durations (in nanoseconds) into log-linear buckets: every power of two
+	// is split into 16 linear sub-buckets, which keeps the relative error of any reported
+	// value under 1/16 (about 6%) across the whole range.
+	// All memory is allocated up front (no allocation when recording), and recording is
+	// lock-free, so this is safe to use from any thread on the input path.
+	class LatencyHistogram
+	{
+	public:
+
+		// 16 sub-buckets per power of two
+		static const unsigned int SUB_BUCKET_BITS = 4;
+		static const unsigned int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+
+		// Highest power of two that is tracked; 2^40 ns is a bit over 18 minutes,
+		// and anything above that is clamped into the last bucket.
+		static const unsigned int MAX_EXPONENT = 39;
+
+		static const unsigned int BUCKET_COUNT =
+			SUB_BUCKET_COUNT + (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+
+		// Plain copy of a histogram's counters, taken at one point in time.
+		// Percentiles are computed on snapshots so that readers never block writers.
+		struct Snapshot
+		{
+			uint32_t counts[BUCKET_COUNT];
+			uint64_t totalCount;
+			uint64_t maxValue;
+			uint64_t sum;
+
+			// Returns the smallest recorded value (rounded to its bucket) such that
+			// at least 'percentile' percent of all recorded values are less than or equal to it.
+			// percentile - number between 0 and 100.
+			uint64_t valueAtPercentile(double percentile) const
+			{
+				if (totalCount == 0) return 0;
+				if (percentile >= 100.0) return maxValue;
+
+				// Number of values that must be covered; at least one
+				uint64_t target = (uint64_t)((percentile / 100.0) * totalCount + 0.5);
+				if (target == 0) target = 1;
+
+				uint64_t covered = 0;
+				for (unsigned int i = 0; i < BUCKET_COUNT; i++)
+				{
+					covered += counts[i];
+					if (covered >= target)
+					{
+						// Report the upper edge of the bucket, but never above the real maximum
+						uint64_t value = bucketUpperBound(i);
+						return value < maxValue ? value : maxValue;
+					}
+				}
+				return maxValue;
+			}
+
+			// Average of all recorded values
+			uint64_t mean() const
+			{
+				return totalCount == 0 ? 0 : sum / totalCount;
+			}
+		};
+
+
+		LatencyHistogram()
+		{
+			reset();
+		}
+
+		// Adds one value (in nanoseconds) to this histogram.
+		void record(uint64_t value)
+		{
+			counts[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+			totalCount.fetch_add(1, std::memory_order_relaxed);
+			sum.fetch_add(value, std::memory_order_relaxed);
+
+			// Raise the maximum if necessary; losing the race to a larger value is fine.
+			uint64_t currentMax = maxValue.load(std::memory_order_relaxed);
+			while (value > currentMax
+				&& !maxValue.compare_exchange_weak(currentMax, value, std::memory_order_relaxed))
+			{ }
+		}
+
+		// Copies the current counters into out_snapshot.
+		// Values recorded while the copy is made may or may not be included.
+		void snapshot(OUT Snapshot* const out_snapshot) const
+		{
+			for (unsigned int i = 0; i < BUCKET_COUNT; i++)
+				out_snapshot->counts[i] = counts[i].load(std::memory_order_relaxed);
+			out_snapshot->totalCount = totalCount.load(std::memory_order_relaxed);
+			out_snapshot->maxValue = maxValue.load(std::memory_order_relaxed);
+			out_snapshot->sum = sum.load(std::memory_order_relaxed);
+		}
+
+		// Sets every counter back to zero.
+		void reset()
+		{
+			for (unsigned int i = 0; i < BUCKET_COUNT; i++)
+				counts[i].store(0, std::memory_order_relaxed);
+			totalCount.store(0, std::memory_order_relaxed);
+			maxValue.store(0, std::memory_order_relaxed);
+			sum.store(0, std::memory_order_relaxed);
+		}
+
+
+		// Index of the bucket that holds a given value.
+		static unsigned int bucketIndex(uint64_t value)
+		{
+			// Values smaller than the sub-bucket count have a bucket each
+			if (value < SUB_BUCKET_COUNT)
+				return (unsigned int)value;
+
+			// Position of the most significant bit
+			unsigned int exponent = 0;
+			for (uint64_t v = value; v > 1; v >>= 1)
+				exponent++;
+			if (exponent > MAX_EXPONENT)
+				return BUCKET_COUNT - 1;		// clamp
+
+			// The bits right after the most significant one select the sub-bucket
+			unsigned int subBucket = (unsigned int)(value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1);
+			return SUB_BUCKET_COUNT + (exponent - SUB_BUCKET_BITS) * SUB_BUCKET_COUNT + subBucket;
+		}
+
+		// Largest value that falls into the bucket at index.
+		static uint64_t bucketUpperBound(unsigned int index)
+		{
+			if (index < SUB_BUCKET_COUNT)
+				return index;
+
+			unsigned int exponent = (index - SUB_BUCKET_COUNT) / SUB_BUCKET_COUNT + SUB_BUCKET_BITS;
+			unsigned int subBucket = (index - SUB_BUCKET_COUNT) % SUB_BUCKET_COUNT;
+			uint64_t width = (uint64_t)1 << (exponent - SUB_BUCKET_BITS);
+			uint64_t lowerBound = ((uint64_t)1 << exponent) + subBucket * width;
+			return lowerBound + width - 1;
+		}
+
+	private:
+
+		std::atomic<uint32_t> counts[BUCKET_COUNT];
+		std::atomic<uint64_t> totalCount;
+		std::atomic<uint64_t> maxValue;
+		std::atomic<uint64_t> sum;
+
+		// Histograms are meant to live in one place (usually static storage).
+		LatencyHistogram(const LatencyHistogram&) = delete;
+		LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+	};
+
+}
@@ -0,0 +1,109 @@
+#include "stdafx.h"
+
+// Implementation of methods in Metrics.h
+#include "Metrics.h"
+
+#if METRICS
+
+namespace Multikeys
+{
+	namespace Metrics
+	{
+		// One histogram per stage. These are large (a few kilobytes each), so they
+		// live in static storage and are never copied.
+		static LatencyHistogram histograms[STAGE_COUNT];
+
+		// Names used when dumping; same order as the Stage enum.
+		static const wchar_t* const stageNames[STAGE_COUNT] = {
+			L"Raw input receipt",
+			L"Device name",
+			L"Evaluate key",
+			L"Decision match",
+			L"Command execution",
+			L"Hook reply"
+		};
+
+		// Ticks per second of the performance counter; fixed at boot, so read it only once.
+		static LONGLONG GetFrequency()
+		{
+			LARGE_INTEGER frequency;
+			QueryPerformanceFrequency(&frequency);
+			return frequency.QuadPart;
+		}
+		static const LONGLONG ticksPerSecond = GetFrequency();
+
+
+		LONGLONG Now()
+		{
+			LARGE_INTEGER counter;
+			QueryPerformanceCounter(&counter);
+			return counter.QuadPart;
+		}
+
+		void Record(Stage stage, LONGLONG startTicks)
+		{
+			LONGLONG elapsed = Now() - startTicks;
+			if (elapsed < 0) elapsed = 0;
+			// Split the conversion to avoid overflowing when multiplying by 10^9
+			uint64_t nanoseconds =
+				(uint64_t)(elapsed / ticksPerSecond) * 1000000000ULL
+				+ (uint64_t)(elapsed % ticksPerSecond) * 1000000000ULL / ticksPerSecond;
+			histograms[stage].record(nanoseconds);
+		}
+
+		void Snapshot(Stage stage, OUT LatencyHistogram::Snapshot* const out_snapshot)
+		{
+			histograms[stage].snapshot(out_snapshot);
+		}
+
+		void Dump()
+		{
+			// Snapshots are too big for the stack of a window procedure
+			LatencyHistogram::Snapshot* snapshot = new LatencyHistogram::Snapshot;
+			WCHAR text[256];
+
+			OutputDebugString(L"Latency (microseconds): count, mean, p50, p90, p99, p99.9, max\n");
+			for (int i = 0; i < STAGE_COUNT; i++)
+			{
+				histograms[i].snapshot(snapshot);
+				swprintf_s(text, 256, L"  %-18ls %8llu %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n",
+					stageNames[i],
+					snapshot->totalCount,
+					snapshot->mean() / 1000.0,
+					snapshot->valueAtPercentile(50.0) / 1000.0,
+					snapshot->valueAtPercentile(90.0) / 1000.0,
+					snapshot->valueAtPercentile(99.0) / 1000.0,
+					snapshot->valueAtPercentile(99.9) / 1000.0,
+					snapshot->maxValue / 1000.0);
+				OutputDebugString(text);
+			}
+
+			delete snapshot;
+
+			// What the remapper does off the pipeline; counted since start, not reset
+			BackgroundStats background;
+			GetBackgroundStats(&background);
+			unsigned long long launches = background.launched + background.launchFailed;
+			swprintf_s(text, 256, L"Launches: %llu launched, %llu failed, %llu dropped, %llu debounced\n",
+				background.launched, background.launchFailed, background.launchDropped, background.launchDebounced);
+			OutputDebugString(text);
+			swprintf_s(text, 256, L"  Latency (microseconds): mean %.1f, max %llu\n",
+				launches > 0 ? (double)background.launchTotalLatency / launches : 0.0,
+				background.launchMaxLatency);
+			OutputDebugString(text);
+			swprintf_s(text, 256, L"Timed macros: %llu started, %llu restarted, %llu completed, %llu dropped\n",
+				background.macrosStarted, background.macrosRestarted, background.macrosCompleted, background.macrosDropped);
+			OutputDebugString(text);
+			swprintf_s(text, 256, L"  Latest step (ms): %llu\n", background.macroMaxLateness);
+			OutputDebugString(text);
+		}
+
+		void Reset()
+		{
+			for (int i = 0; i < STAGE_COUNT; i++)
+				histograms[i].reset();
+		}
+	}
+}
+
+#endif
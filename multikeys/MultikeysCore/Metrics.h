@@ -0,0 +1,62 @@
+#pragma once
+
+// Latency instrumentation for the input pipeline.
+// Every stage between the Raw Input message and the hook's reply has a histogram of
+// its own. When METRICS is set to 0 in stdafx.h, the macros below expand to nothing
+// and none of this is compiled into the executable.
+
+#include "stdafx.h"
+
+#if METRICS
+
+#include "LatencyHistogram.h"
+
+namespace Multikeys
+{
+	namespace Metrics
+	{
+		// Stages of the input pipeline that are measured separately.
+		enum Stage
+		{
+			RawInputReceipt,		// Reading the Raw Input structure (GetRawInputData)
+			DeviceNameResolution,	// Retrieving the name of a device the first time it sends input
+			EvaluateKey,			// Remapper::evaluateKey
+			DecisionMatch,			// Searching the decision buffer for the hook's record
+			CommandExecution,		// Executing the mapped command (injecting input)
+			HookReply,				// Whole handling of a hook message, until it gets its answer
+
+			STAGE_COUNT
+		};
+
+		// Reads the high-resolution monotonic clock (QueryPerformanceCounter), in ticks.
+		LONGLONG Now();
+
+		// Records the time elapsed since startTicks (obtained from Now()) into the
+		// histogram of the given stage.
+		void Record(Stage stage, LONGLONG startTicks);
+
+		// Takes a snapshot of a stage's histogram.
+		void Snapshot(Stage stage, OUT LatencyHistogram::Snapshot* const out_snapshot);
+
+		// Writes percentiles of every stage to the debug output, followed by the
+		// statistics of the remapper's background work (GetBackgroundStats).
+		// Triggered by Ctrl+Alt+Shift+F11, or IDM_DUMP_METRICS posted to the core's window (see Resource.h).
+		void Dump();
+
+		// Clears every histogram.
+		// Triggered by Ctrl+Alt+Shift+F12, or IDM_RESET_METRICS posted to the core's window.
+		void Reset();
+	}
+}
+
+// Declares a variable holding the current time.
+#define METRICS_TIMESTAMP(name)			const LONGLONG name = Multikeys::Metrics::Now()
+// Records the time since a timestamp declared with METRICS_TIMESTAMP.
+#define METRICS_RECORD(stage, start)	Multikeys::Metrics::Record(Multikeys::Metrics::stage, start)
+
+#else
+
+#define METRICS_TIMESTAMP(name)
+#define METRICS_RECORD(stage, start)
+
+#endif
@@ -21,14 +21,44 @@ struct DecisionRecord
 	// FALSE - this keypress should not be blocked, and there is no mapped input to be carried out
 	BOOL decision;
 
+	// TRUE if the keypress repeats a key already held down on its keyboard
+	BOOL repeated;
+
+	// Slot in the shared decision table where this decision was also published for the hook,
+	// or -1 if it wasn't; tableWord is the word that was published there.
+	LONG tableSlot;
+	LONG64 tableWord;
+
+	// Order in which the Raw Input message arrived; decisions reach the hook window in this order,
+	// even when they're evaluated by different threads.
+	ULONGLONG sequence;
+
+	// Commands resolved by this evaluation for keystrokes held back earlier (see IRemapper);
+	// they're executed before mappedAction, and even if this record is never asked for.
+	Multikeys::PKeystrokeCommand deferredActions[Multikeys::MAX_DEFERRED_ACTIONS];
+	int deferredCount;
+
+	// TRUE if this record comes from a keyboard's timeout rather than from a keystroke; it only
+	// carries deferred actions, and no hook message ever matches it.
+	BOOL fromTimer;
+
+	DecisionRecord()
+		: keyboardInput(), mappedAction(nullptr), decision(FALSE), repeated(FALSE), tableSlot(-1), tableWord(0), sequence(0),
+		deferredCount(0), fromTimer(FALSE)
+	{
+		// Empty record, to be filled in when taken out of a queue
+	}
+
 	DecisionRecord(RAWKEYBOARD _keyboardInput, BOOL _decision)
-		: keyboardInput(_keyboardInput), mappedAction(nullptr), decision(_decision)
+		: keyboardInput(_keyboardInput), mappedAction(nullptr), decision(_decision), repeated(FALSE), tableSlot(-1), tableWord(0), sequence(0),
+		deferredCount(0), fromTimer(FALSE)
 	{
 		// Constructor
 	}
 
 	DecisionRecord(RAWKEYBOARD _keyboardInput, Multikeys::PKeystrokeCommand _mappedInput, BOOL _decision)
-		: keyboardInput(_keyboardInput), mappedAction(_mappedInput), decision(_decision)
+		: keyboardInput(_keyboardInput), mappedAction(_mappedInput), decision(_decision), repeated(FALSE), tableSlot(-1), tableWord(0), sequence(0),
+		deferredCount(0), fromTimer(FALSE)
 	{
 		// Constructor
 	}
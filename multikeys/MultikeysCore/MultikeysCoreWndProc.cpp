@@ -8,6 +8,11 @@
 #include "stdafx.h"
 #include "MultikeysCore.h"
 #include "Scancodes.h"
+#include "Metrics.h"
+#include "Counters.h"
+#include "RawInputThread.h"
+#include "SharedDecisions.h"
+#include "EvaluationShards.h"
 
 
 #define MAX_LOADSTRING 100
@@ -28,19 +33,6 @@ DWORD maxWaitingTime = 50;		// Hopefully no legitimate keystroke should have a d
 								// Flag for AltGr. Used in the AltGr fix.
 BOOL AltGrBlockNextLCtrl = FALSE;
 
-// Buffer for keyboard Raw Input struct
-UINT rawKeyboardBufferSize = 32;
-LPBYTE rawKeyboardBuffer = new BYTE[rawKeyboardBufferSize];		// These buffers should be enough,	
-																// Buffer for keyboard name										// but do allocate more space if needed.
-UINT keyboardNameBufferSize = 128;
-WCHAR * keyboardNameBuffer = new WCHAR[keyboardNameBufferSize];
-
-// Structure to contain a Raw Input pointer
-RAWINPUT * raw;
-
-// Structure used in the function ResetKey.
-INPUT * input;
-
 // Remapper
 Multikeys::PRemapper remapper;	// PRemapper is a pointer type
 								// Must be initialized
@@ -53,9 +45,16 @@ WCHAR* debugTextBeingBlocked = new WCHAR[DEBUG_TEXT_SIZE];
 // Variables to hold timer values
 DWORD currentTime, startTime;
 
-// Buffer for the decisions whether to block the input with Hook
+// Buffer for the decisions whether to block the input with Hook (used only by the thread answering the hook)
 std::deque<DecisionRecord> decisionBuffer;
 // Deque because we'll need to iterate through it.
+// Records beyond this many are considered stale, and dropped from the front.
+const size_t MAX_PENDING_DECISIONS = 256;
+
+// Decisions collected ahead of an earlier one still being evaluated (by another shard), by sequence
+std::map<ULONGLONG, DecisionRecord> earlyDecisions;
+// Sequence of the next decision to be appended to decisionBuffer
+ULONGLONG nextSequence = 0;
 
 
 
@@ -81,6 +80,11 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 		return FALSE;
 	}
 
+	// The hook opens the shared decision table the first time it runs in each process,
+	// so the table must exist before the hook is installed.
+	if (!Multikeys::SharedDecisions::Initialize())
+		OutputDebugString(L"Could not create the shared decision table");
+
 	// Perform application initialization:
 	if (!InitInstance(hInstance, nCmdShow))
 	{
@@ -94,8 +98,10 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 	MSG msg;
 
 	// Evaluate arguments (path to configuration file)
-	LPWSTR * szArgList;			// to hold arguments (0: name of exe, 1: path to config file)
+	LPWSTR * szArgList;			// to hold arguments (0: name of exe, 1: path to config file, or /safe, 2: number of shards, optional)
 	int argCount;
+	int shardCount = 0;			// keys are evaluated by the raw input thread unless told otherwise
+	bool loaded = false;		// whether some settings were loaded
 	szArgList = CommandLineToArgvW(GetCommandLineW(), &argCount);
 
 	Multikeys::Create(&remapper);
@@ -103,33 +109,60 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 	if (szArgList == NULL)
 	{					// Eventually we'll have to make these fail cases just fail.
 		OutputDebugString(L"No arguments found. Initializing with default file");
-		remapper->loadSettings(L"C:\\MultiKeys\\MultiKeys.xml");
+		loaded = remapper->loadSettings(L"C:\\MultiKeys\\MultiKeys.xml");
 	}
-	else if (argCount != 2)
+	else if (argCount != 2 && argCount != 3)
 	{
 		OutputDebugString(L"Incorrect number of arguments. Initializing with default file");
-		remapper->loadSettings(L"C:\\MultiKeys\\MultiKeys.xml");
+		loaded = remapper->loadSettings(L"C:\\MultiKeys\\MultiKeys.xml");
+	}
+	else if (wcscmp(szArgList[1], L"/safe") == 0)
+	{
+		// Safe mode: the layout built into the remapper, without reading any file
+		loaded = remapper->loadFallback();
+		if (argCount == 3)
+			shardCount = _wtoi(szArgList[2]);
 	}
 	else
 	{
 		// try this
-		if (!remapper->loadSettings(std::wstring(szArgList[1])))
+		loaded = remapper->loadSettings(std::wstring(szArgList[1]));
+		if (!loaded)
 		{
 			OutputDebugString(L"Failed to open file. Initializing with default file");
-			remapper->loadSettings(L"C:\\MultiKeys\\MultiKeys.xml");
+			loaded = remapper->loadSettings(L"C:\\MultiKeys\\MultiKeys.xml");
 		}
+		if (argCount == 3)
+			shardCount = _wtoi(szArgList[2]);
+	}
+
+	// Rather than running with nothing loaded, use the layout built into the remapper
+	if (!loaded)
+	{
+		OutputDebugString(L"Failed to open the default file. Initializing with the built-in layout");
+		remapper->loadFallback();
 	}
 
 	// return of CommandLineToArgvW is a contiguous memory of pointers
 	LocalFree(szArgList);
 
-	// Initialize the work INPUT structure for use in the ResetKey function
-	input = new INPUT;
-	input->type = INPUT_KEYBOARD;
-	input->ki.dwExtraInfo = 0;
-	input->ki.dwFlags = KEYEVENTF_EXTENDEDKEY | KEYEVENTF_KEYUP;
-	input->ki.wScan = 0;
-	input->ki.time = 0;
+	// Publish the operational counters; if that fails they are still kept privately
+	if (!Multikeys::Counters::Initialize())
+		OutputDebugString(L"Could not create the shared page for counters");
+
+	// Optionally, evaluate keys on several shards, each with its own set of keyboards.
+	// No point in having more shards than keyboards.
+	if (shardCount > remapper->getKeyboardCount())
+		shardCount = remapper->getKeyboardCount();
+	if (shardCount > 0 && !StartShards(shardCount, remapper))
+		OutputDebugString(L"Could not start the shards. Evaluating keys in the raw input thread");
+
+	// Raw Input is received and evaluated in a thread of its own; this thread only answers the hook.
+	if (!StartRawInputThread(hInstance, remapper, mainHwnd))
+	{
+		OutputDebugString(L"Could not start the raw input thread");
+		return FALSE;
+	}
 
 
 									// Main message loop:
@@ -205,196 +238,181 @@ BOOL InitInstance(HINSTANCE hInstance, int nCmdShow)
 	// UpdateWindow(hWnd);
 
 
-	// Register for receiving Raw Input for keyboards
-	RAWINPUTDEVICE rawInputDevice[1];
-	rawInputDevice[0].usUsagePage = 1;		// usage page = 1 is generic and usage = 6 is for keyboards
-	rawInputDevice[0].usUsage = 6;				// (2 is mouse, 4 is joystick, 6 is keyboard, there are others)
-	rawInputDevice[0].dwFlags = RIDEV_INPUTSINK;		// Receive input even if the registered window is in the background
-	rawInputDevice[0].hwndTarget = hWnd;				// Handle to the target window (NULL would make it follow kb focus)
-	RegisterRawInputDevices(rawInputDevice, 1, sizeof(rawInputDevice[0]));
-
 	// Setup the keyboard hook (from the dll)
 	InstallHook(hWnd);
 	// The hook needs to be executed from a separate dll because it's a global hook.
 
+#if METRICS
+	// The window is never shown, so the latency report has no menu; these hotkeys send its commands.
+	// Other processes may post the same WM_COMMANDs to this window (see Resource.h).
+	RegisterHotKey(hWnd, IDM_DUMP_METRICS, MOD_CONTROL | MOD_ALT | MOD_SHIFT | MOD_NOREPEAT, VK_F11);
+	RegisterHotKey(hWnd, IDM_RESET_METRICS, MOD_CONTROL | MOD_ALT | MOD_SHIFT | MOD_NOREPEAT, VK_F12);
+#endif
+
 
 
 	return TRUE;
 }
 
-// Simulates an up keystroke of the specified key.
-// Mostly useful for resetting the alt key.
-BOOL ResetKey(SHORT vKey)
+
+// Executes the commands a record resolved for keystrokes held back earlier.
+// Must be called exactly once for each record, whether it's ever asked for or not.
+void ExecuteDeferred(const DecisionRecord& record)
 {
-	// input is already initialized for sending a release keystroke.
-	input->ki.wVk = vKey;
-	return SendInput(1, input, sizeof(INPUT));
+	if (record.deferredCount == 0)
+		return;
+	for (int i = 0; i < record.deferredCount; i++)
+	{
+		if (!record.deferredActions[i]->execute(false, false))
+			Multikeys::Counters::Increment(Multikeys::Counters::FailedCommands);
+	}
+	Multikeys::SharedDecisions::EndDeferred();
 }
 
-
-//
-//  FUNCTION: WndProc(HWND, UINT, WPARAM, LPARAM)
-//
-//  PURPOSE:  Processes messages for the main window.
-//
-//  WM_COMMAND  - process the application menu
-//  WM_PAINT    - Paint the main window
-//  WM_DESTROY  - post a quit message and return
-//
-//
-LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
+// Removes the first count records from decisionBuffer, none of which will ever be asked for.
+// Their decisions are also taken back from the shared table, but their deferred actions are still executed.
+void DiscardDecisions(size_t count)
 {
-	switch (message)
+	for (size_t i = 0; i < count; i++)
 	{
-		// Raw Input Message:
-	case WM_INPUT:				// case of UINTs
-	{	// brackets for locality
-
-		UINT bufferSize = 0;		// work variable
-
-									// Get data from the raw input structure
-									// Parameters:
-									// 1. HRAWINPUT - a handle to the raw input structure (in this case stored in the long param of the message)
-									// 2. UINT - a flag containing what to return, either RID_HEADER (header) or RID_INPUT (raw data)
-									// 3. LPVOID, out param - a pointer to the data that comes from the RAW INPUT structure
-									//		If this is null, the next parameter will contain the required size of the buffer
-									// 4. PUINT, in or out param - size of the data, or required size if previous param is NULL
-									// 5. UINT - size in bytes of the header
-
-									// get required buffer size, check if it's larger than what we have
-		GetRawInputData((HRAWINPUT)lParam, RID_INPUT, NULL, &bufferSize, sizeof(RAWINPUTHEADER));
-		if (bufferSize > rawKeyboardBufferSize)
+		const DecisionRecord& record = decisionBuffer.front();
+		ExecuteDeferred(record);
+		if (!record.fromTimer)		// Nothing was expected to ask for those
 		{
-			// Oh, no! Needs more space than we have! Let's replace our buffer with a better one.
-			rawKeyboardBufferSize = bufferSize;
-			delete[] rawKeyboardBuffer;
-			rawKeyboardBuffer = new BYTE[rawKeyboardBufferSize];
-			if (DEBUG) OutputDebugString(L"Needed more space for keyboard buffer");
+			if (Multikeys::SharedDecisions::Retire(record))
+				Multikeys::Counters::Increment(Multikeys::Counters::UnmatchedDecisions);
+			else
+				Multikeys::Counters::Increment(Multikeys::Counters::DecisionsClaimedByHook);
 		}
+		decisionBuffer.pop_front();
+	}
+}
 
-		// load data into buffer
-		GetRawInputData((HRAWINPUT)lParam, RID_INPUT, rawKeyboardBuffer, &rawKeyboardBufferSize, sizeof(RAWINPUTHEADER));
+// Removes the records at the front of decisionBuffer that came from timeouts, executing their
+// deferred actions; there are no earlier keystrokes left for those to wait for.
+void DiscardTimerDecisions()
+{
+	while (!decisionBuffer.empty() && decisionBuffer.front().fromTimer)
+		DiscardDecisions(1);
+}
 
-		// cast the contents of the buffer into our rawinput pointer
-		raw = (RAWINPUT*)rawKeyboardBuffer;
+// Moves every decision published by the raw input thread into decisionBuffer.
+// Records that the hook already claimed from the shared table are dropped from the front, and
+// so are records that pile up without any hook message asking for them.
+// Appends a collected decision to decisionBuffer, keeping the buffer in arrival order.
+void AcceptDecision(const DecisionRecord& record)
+{
+	if (record.sequence != nextSequence)
+	{
+		// An earlier keystroke is still being evaluated; hold this one back
+		earlyDecisions.emplace(record.sequence, record);
+		return;
+	}
 
-#if DEBUG
-		WCHAR * text = new WCHAR[128];		// <- unnecessary allocation, but this is just for debug
-		swprintf_s(text, 128, L"Raw Input: Virtual key %X scancode %s%s%X (%s)\n",
-			raw->data.keyboard.VKey,		// virtual keycode
-			(raw->data.keyboard.Flags & RI_KEY_E0 ? L"e0 " : L""),
-			(raw->data.keyboard.Flags & RI_KEY_E1 ? L"e1 " : L""),
-			raw->data.keyboard.MakeCode,	// scancode
-			raw->data.keyboard.Flags & RI_KEY_BREAK ? L"up" : L"down");		// keydown or keyup (make/break)
-		OutputDebugString(text);
-		memcpy_s(debugText, DEBUG_TEXT_SIZE, text, 128);	// will redraw later
-		delete[] text;
-#endif
+	decisionBuffer.push_back(record);
+	nextSequence++;
 
+	// It may have been the one holding others back
+	auto early = earlyDecisions.begin();
+	while (early != earlyDecisions.end() && early->first == nextSequence)
+	{
+		decisionBuffer.push_back(early->second);
+		nextSequence++;
+		early = earlyDecisions.erase(early);
+	}
+}
 
-		// We'll get the device name
-		// Check that our buffer is enough for the task:
-		GetRawInputDeviceInfo(raw->header.hDevice, RIDI_DEVICENAME, NULL, &bufferSize);
-		if (bufferSize > keyboardNameBufferSize)		// It needs more space than we have!
+void CollectDecisions()
+{
+	DecisionRecord record;
+	while (decisionQueue.tryPop(&record))
+		AcceptDecision(record);
+	for (int shard = 0; shard < GetShardCount(); shard++)
+		while (TakeShardDecision(shard, &record))
+			AcceptDecision(record);
+
+	while (!decisionBuffer.empty())
+	{
+		if (decisionBuffer.front().fromTimer)
+			DiscardTimerDecisions();
+		else if (Multikeys::SharedDecisions::IsClaimed(decisionBuffer.front()))
 		{
-			keyboardNameBufferSize = bufferSize;
-			delete[] keyboardNameBuffer;
-			keyboardNameBuffer = new WCHAR[keyboardNameBufferSize];
-#if DEBUG
-			OutputDebugString(L"Needed more space for device name buffer");
-#endif
+			// Never published with deferred actions, so there are none to execute
+			Multikeys::Counters::Increment(Multikeys::Counters::DecisionsClaimedByHook);
+			decisionBuffer.pop_front();
 		}
+		else
+			break;
+	}
 
-		// Load the device name into the buffer
-		GetRawInputDeviceInfo(raw->header.hDevice, RIDI_DEVICENAME, keyboardNameBuffer, &keyboardNameBufferSize);
-		// Now the buffer contains the name of the device that sent the signal
-
+	if (decisionBuffer.size() > MAX_PENDING_DECISIONS)
+		DiscardDecisions(decisionBuffer.size() - MAX_PENDING_DECISIONS);
+}
 
-		/*----Fix for Fake shift----*/
-		// When shift + numpad key is pressed while numlock is on, a fake shift up is pressed on keydown,
-		// and a fake shift down is pressed on keyup to simulate unshifted behavior (similar to capslock
-		// and shift, but that doesn't cause fake shifts).
-		// We look for a virtual-key code translated from a scancode that normally wouldn't produce it.
-		if (raw->data.keyboard.VKey == VK_SHIFT		// (legit) shift, either side
-			&& raw->data.keyboard.MakeCode != SCANCODE_LEFT_SHIFT	// scancode is not left shift
-			&& raw->data.keyboard.MakeCode != SCANCODE_RIGHT_SHIFT)	// and is not right shift
+// Looks in decisionBuffer for the record matching a hook message.
+// If found, copies it into *out_record and removes it and all records preceding it
+// (the preceding ones will never be asked for).
+BOOL TakeDecision(USHORT virtualKeyCode, USHORT scancode, USHORT keyPressed, USHORT isExtended, OUT DecisionRecord* const out_record)
+{
+	int index = 0;
+	for (std::deque<DecisionRecord>::iterator iterator = decisionBuffer.begin();
+		iterator != decisionBuffer.end();
+		iterator++, index++)
+	{
+		if (!iterator->fromTimer
+			&& iterator->keyboardInput.VKey == virtualKeyCode
+			&& iterator->keyboardInput.MakeCode == scancode
+			&& !(iterator->keyboardInput.Flags & RI_KEY_BREAK) == keyPressed
+			&& ((iterator->keyboardInput.Flags & RI_KEY_E0) == RI_KEY_E0) == (isExtended > 0))		// match!
 		{
-			// then it must be an illegitimate shift, not produced by a physical keystroke
-			// but there is a Hook message for a legitimate (although faked) shift waiting for it
-			// Instead of storing the decision for this keystroke, store the decision for both a
-			// left shift and a right shift, since we don't know which one produced this message
-			OutputDebugString(L"Raw Input: Fake shift detected, storing two shift decisions.\n");
-			Multikeys::PKeystrokeCommand possibleAction;
-
-			// keyup and keydown is wrong
-			if (raw->data.keyboard.Flags & RI_KEY_BREAK)
-				raw->data.keyboard.Flags &= 0xfffe;		// unset last bit
-			else raw->data.keyboard.Flags |= RI_KEY_BREAK;	// set last bit
-
-															// pretend this is a left shift
-			raw->data.keyboard.MakeCode = 0x2a;
-			bool DoBlock = remapper->evaluateKey(&(raw->data.keyboard), keyboardNameBuffer, &possibleAction);
-			decisionBuffer.push_back(DecisionRecord(raw->data.keyboard, possibleAction, DoBlock));	// remember the answer
-
-																									// pretend this is a right shift
-			raw->data.keyboard.MakeCode = 0x36;
-			DoBlock = remapper->evaluateKey(&(raw->data.keyboard), keyboardNameBuffer, &possibleAction);		// ask
-			decisionBuffer.push_back(DecisionRecord(raw->data.keyboard, possibleAction, DoBlock));	// remember the answer
-
-			return 0;
-		}
-		// This fix prevents most timeouts, but occasional lag and wrong behavior still occur.
-		// There is a copy of this on the delayed message loop.
-		/*---End of fix for Fake shift----*/
-
-
-#if DEBUG
-		memcpy_s(debugTextKeyboardName, DEBUG_TEXT_SIZE, keyboardNameBuffer, keyboardNameBufferSize);
-		text = new WCHAR[200];
-		swprintf_s(text, 200, L"Raw Input: Keyboard name is %ls\n", keyboardNameBuffer);
-		OutputDebugString(text);
-		delete[] text;
-		RedrawWindow(hWnd, NULL, NULL, RDW_INVALIDATE);
-#endif
-
-
-		// Call the function that decides whether to block or allow this keystroke
-		// Store that decision in the decisionBuffer; look for it when the hook asks.
+			// Actually, this doesn't guarantee a match;
+			// Keys in two different keyboards corresponding to the same virtual key may be pressed in rapid succession
+			// We have to assume that people don't do that normally.
 
-		// Check whether to block this key, and store the decision for when the hook asks for it
-		Multikeys::PKeystrokeCommand possibleAction = nullptr;		// <- we don't know yet if our key maps to anything
-		BOOL DoBlock = remapper->evaluateKey(&(raw->data.keyboard), keyboardNameBuffer, &possibleAction);		// ask
-
-#if DEBUG
-		if (DoBlock)
-			OutputDebugString(L"Raw Input: This key should be blocked. Recording it in the decision record.\n");
-		else
-			OutputDebugString(L"Raw Input: This key should not be blocked, and will not be recorded.\n");
-#endif
-
-		decisionBuffer.push_back(DecisionRecord(raw->data.keyboard, possibleAction, DoBlock));	// remember the answer
+			// If the hook took this decision from the shared table, it was for an earlier keystroke; keep looking.
+			if (!Multikeys::SharedDecisions::Retire(*iterator))
+				continue;
 
+			*out_record = *iterator;
 
-		/*
-		* Special handling for the Alt keys:
-		* If the received key was either a Left Alt or a Right Alt that was blocked, then the state of the keyboard
-		* must be reset. This prevents subsequent simulated keystrokes to be sent with the Alt modifier.
-		* */
-		if ((raw->data.keyboard.MakeCode == SCANCODE_ALT && DoBlock))
-		{
-			if (DEBUG)
-				OutputDebugString(L"Raw Input: Got a blocked Alt; resetting keyboard state.\n");
-			if (raw->data.keyboard.Flags & RI_KEY_E0)	// <- if it's RAlt
-				ResetKey(VK_RMENU);
-			else
-				ResetKey(VK_LMENU);
+			DiscardDecisions(index);
+			ExecuteDeferred(*out_record);	// before the record's own action
+			decisionBuffer.pop_front();		// <- this one
+			DiscardTimerDecisions();		// those right after it were only waiting for it
+			return TRUE;
 		}
+	}
+	return FALSE;
+}
 
-		return 0;	// exit Wndproc
-
-	}	// end of case WM_INPUT
+// Whether decisionBuffer holds a Right Alt (AltGr) record, either down or up.
+BOOL IsRightAltPending(USHORT keyPressed)
+{
+	for (const DecisionRecord& record : decisionBuffer)
+	{
+		if (record.keyboardInput.MakeCode == SCANCODE_ALT		// <- Raw Input is Alt key
+			&& record.keyboardInput.Flags & RI_KEY_E0			// Right variant
+			&& !(record.keyboardInput.Flags & RI_KEY_BREAK) == keyPressed)
+			return TRUE;
+	}
+	return FALSE;
+}
 
 
+//
+//  FUNCTION: WndProc(HWND, UINT, WPARAM, LPARAM)
+//
+//  PURPOSE:  Processes messages for the main window.
+//
+//  WM_COMMAND  - process the application menu
+//  WM_PAINT    - Paint the main window
+//  WM_DESTROY  - post a quit message and return
+//
+//
+LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
+{
+	switch (message)
+	{
 		// Message from Hooking DLL
 		// It means we need to look for a corresponding Raw Input message that should have arrived before
 		// That message is the one that can tell us whether or not to block the key,
@@ -406,6 +424,9 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 		// and long parameter contains whether or not the keypress is a down key.
 		USHORT virtualKeyCode = (USHORT)wParam;
 
+		// Time until this message gets its answer, whichever way it leaves
+		METRICS_TIMESTAMP(hookStart);
+
 		// USHORT repeatCount = (lParam & 0xffff);		// extract the two last bytes
 		// Repeat count doesn't increment when user holds down a key
 		// which is weird; I suspect it only increments when messages fail to be sent in time
@@ -454,6 +475,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			// Is pause/break
 			extractedScancode = 0x1d;		// Will wait for (virtual key = 0x13, scancode = 1d) instead.
 											// That's why we don't declare everything const. Things change here.
+			Multikeys::Counters::Increment(Multikeys::Counters::PauseBreakSpecialCases);
 #if DEBUG
 			OutputDebugString(L"Hook: Received a Pause/Break, will look for raw vkey13 sc=1d\n");
 #endif
@@ -477,6 +499,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			// we send a keypress down (keyboard name shouldn't matter)
 			LPARAM mockLParam = lParam;
 			mockLParam &= 0x7fffffff;		// set thirty-first bit to 0 (flag for keypress up)
+			Multikeys::Counters::Increment(Multikeys::Counters::PrintScreenSpecialCases);
 
 #if DEBUG
 			OutputDebugString(L"Hook: Up PrintScreen received, will send fake keypress down to self\n");
@@ -498,250 +521,93 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 		/*----Finished dealing with PrintScreen----*/
 
 
-		// Check the Raw Input buffer to see if this Hook message is supposed to be blocked; this WdnProc returns 1 if it is
-		bool blockThisHook = false;
-		bool recordFound = false;
-		if (!decisionBuffer.empty())
-		{
-			int index = 0;
-			// Search the buffer for the matching record (it should exist)
-			for (std::deque<DecisionRecord>::iterator iterator = decisionBuffer.begin();
-				iterator != decisionBuffer.end();
-				iterator++, index++)
-			{
-				if (iterator->keyboardInput.VKey == virtualKeyCode
-					&& iterator->keyboardInput.MakeCode == extractedScancode
-					&& !(iterator->keyboardInput.Flags & RI_KEY_BREAK) == keyPressed
-					&& ((iterator->keyboardInput.Flags & RI_KEY_E0) == RI_KEY_E0) == (isExtended > 0))		// match!
-				{
-					// Actually, this doesn't guarantee a match;
-					// Keys in two different keyboards corresponding to the same virtual key may be pressed in rapid succession
-					// We have to assume that people don't do that normally.
-
-#if DEBUG
-					if (iterator->decision) OutputDebugString(L"Hook: Must block this key.\n");
-					else if (iterator->decision == FALSE) OutputDebugString(L"Hook: Must let this key through.\n");
-#endif
-
-
-					// Now, if the decision was to block the hook, we must act on it at this point, just before popping it
-					if (iterator->decision) {
-
-						if (!iterator->mappedAction->execute(!keyPressed, previousStateFlagWasDown && keyPressed)) {
-#if DEBUG
-							OutputDebugString(L"Simulation failed!!\n");
-#endif
-						}
-					}
-
-					recordFound = TRUE;		// set the flags
-					blockThisHook = iterator->decision;
-
-					// Then, remove this and all preceding messages from the buffer
-					for (int i = 0; i <= index; i++)		// <- up until and including this one
-						decisionBuffer.pop_front();
-
-					// We found the item, so we break the for loop to stop looking:
-					break;
-
-				} // end if match
-
-			} // end for search
-
-		} // end if buffer.empty
-
-		  // At this point, recordFound is either TRUE or FALSE, and if TRUE, blockThisHook has the correct choice.
-
-		  // Wait for the matching Raw Input message if the decision buffer was empty or the matching record wasn't there
-
-
-		  // Variables used for timers are startTime and currentTime
+		// Look for the decision made for this keystroke by the raw input thread; this WndProc returns 1 if it is to be blocked.
+		// Usually the decision is already there. If it isn't, wait for the raw input thread to publish more,
+		// but not longer than maxWaitingTime.
+		DecisionRecord record;
+		METRICS_TIMESTAMP(matchStart);
 		startTime = GetTickCount();			// <- record start time
-
-											// Will only fall into this if we didn't find the correct record.
-											// It's a lot of work, but hopefully won't happen frequently.
-		while (!recordFound)
+		while (true)
 		{
-			MSG rawMessage;		// We're peeking the message; that is, we're trusting that the very next raw input message
-								// will be the one we're waiting for.
-								// Also, we can't wait for the other case in this switch to be called, because we'd need
-								// to interrupt this case.
-			while (!PeekMessage(&rawMessage, mainHwnd, WM_INPUT, WM_INPUT, PM_REMOVE))		// this does not remove the message
+			CollectDecisions();
+			if (TakeDecision(virtualKeyCode, extractedScancode, keyPressed, isExtended, &record))
+				break;
+
+			/*--Checking for AltGr--*/
+			// AltGr generates a fake LCtrl that has no Raw Input message of its own;
+			// the Raw Input message for the Right Alt comes instead.
+			if (extractedScancode == SCANCODE_CONTROL		// Hook message generated by left control (scancode of LCtrl in translated set 2)
+				&& isExtended == FALSE			// left variant
+				&& virtualKeyCode == VK_CONTROL	// <- Control key (left variant, since isExtended is false)
+				&& keyPressed == 1				// <- down
+				&& IsRightAltPending(1))
 			{
-				// Message didn't arrive!
-
-				// Test for the maxWaitingTime
-				currentTime = GetTickCount();
-				// If current time is less than start, the time rolled over to 0
-				if ((currentTime < startTime ? ULONG_MAX - startTime + currentTime : currentTime - startTime) > maxWaitingTime)
-				{
-					// Ignore the Hook message if it exceeded the limit
-#if DEBUG
-					WCHAR text[128];
-					swprintf_s(text, 128, L"Hook timed out: %X (%d)\n", virtualKeyCode, keyPressed);
-					OutputDebugString(text);
-#endif
-					return 0;
-				}
+				// then we won't wait for the LCtrl Raw Input message because it'll never happen.
+				AltGrBlockNextLCtrl = TRUE;
 
-				// Take a nap until checking again.
-				Sleep(10);			// Take this out if it causes problems.
+				METRICS_RECORD(HookReply, hookStart);
+				return TRUE;	// <- will block
 			}
-
-			// The Raw Input message has arrived; decide whether to block the input
-			// We're still in that case that the raw message took long to arrive.
-			UINT bufferSize;
-
-			// See if we'll need more space
-			GetRawInputData((HRAWINPUT)rawMessage.lParam, RID_INPUT, NULL, &bufferSize, sizeof(RAWINPUTHEADER));
-			if (bufferSize > rawKeyboardBufferSize)
+			// if a LCtrl keydown was blocked because it was part of an AltGr,
+			// we should block the very next LCtrl up. Except if another LCtrl down was sent along the way.
+			if (extractedScancode == SCANCODE_CONTROL	// scancode of Ctrl
+				&& isExtended == FALSE		//		<- left variant of
+				&& virtualKeyCode == VK_CONTROL	//	<- Control
+				&& keyPressed == 0				//	<- up
+				&& AltGrBlockNextLCtrl			// after a fake LCtrl down from an AltGr
+				&& IsRightAltPending(0))
 			{
-				// Need more space!
-				rawKeyboardBufferSize = bufferSize;
-				delete[] rawKeyboardBuffer;
-				rawKeyboardBuffer = new BYTE[rawKeyboardBufferSize];
-#if DEBUG
-				OutputDebugString(L"Needed more space for the delayed raw input message.");
-#endif
+				AltGrBlockNextLCtrl = FALSE;
+				METRICS_RECORD(HookReply, hookStart);
+				return TRUE;
 			}
-			// Load data into the buffer
-			GetRawInputData((HRAWINPUT)rawMessage.lParam, RID_INPUT, rawKeyboardBuffer, &rawKeyboardBufferSize, sizeof(RAWINPUTHEADER));
-
-			RAWINPUT* raw = (RAWINPUT*)rawKeyboardBuffer;		// <- casting into correct type for convenience
-
-
-
-																// A lot of code here is similar to that in the WM_INPUT case.
-#if DEBUG
-			WCHAR text[128];		// <- unnecessary allocation, but this is just for debug
-			swprintf_s(text, 128, L"(delayed) Raw Input: virtual key %X scancode %s%s%X (%s)\n",
-				raw->data.keyboard.VKey,		// virtual keycode
-				raw->data.keyboard.Flags & RI_KEY_E0 ? L"e0 " : L"",
-				raw->data.keyboard.Flags & RI_KEY_E1 ? L"e1 " : L"",
-				raw->data.keyboard.MakeCode,
-				raw->data.keyboard.Flags & RI_KEY_BREAK ? L"up" : L"down");		// keydown or keyup (make/break)
-			OutputDebugString(text);
-			memcpy_s(debugText, DEBUG_TEXT_SIZE, text, 128);	// will redraw later
-#endif
-
-																// Prepare string buffer for the device name
-			GetRawInputDeviceInfo(raw->header.hDevice, RIDI_DEVICENAME, NULL, &bufferSize);
-			if (bufferSize > keyboardNameBufferSize)
+			// A Ctrl press while AltGr is down will cause AltGr to lose effect.
+			// That's okay because that happens normally. Do not be alarmed.
+			// Let's hope all keyboards we find use the translated scancode set 2.
+			// Or we'll have to implement support for different scancode sets.
+			/*--Finished checking for AltGr--*/
+
+			// Test for the maxWaitingTime (unsigned subtraction survives the rollover to 0)
+			currentTime = GetTickCount();
+			DWORD elapsedTime = currentTime - startTime;
+			if (elapsedTime >= maxWaitingTime)
 			{
-				// Need more space than we have!
-				keyboardNameBufferSize = bufferSize;
-				delete[] keyboardNameBuffer;
-				keyboardNameBuffer = new WCHAR[keyboardNameBufferSize];
+				// Ignore the Hook message if it exceeded the limit
+				Multikeys::Counters::Increment(Multikeys::Counters::HookTimeouts);
 #if DEBUG
-				OutputDebugString(L"Needed more space for keyboard name in the delayed raw input message");
+				WCHAR text[128];
+				swprintf_s(text, 128, L"Hook timed out: %X (%d)\n", virtualKeyCode, keyPressed);
+				OutputDebugString(text);
 #endif
+				METRICS_RECORD(HookReply, hookStart);
+				return 0;
 			}
-			// Load the device name into the buffer
-			GetRawInputDeviceInfo(raw->header.hDevice, RIDI_DEVICENAME, keyboardNameBuffer, &keyboardNameBufferSize);
-
-			/*----Fix for fake shift----*/
-			// There is another copy of this on the Raw Input case, for when the message arrives in time.
-			// In there, we don't know which version of Shift (left or right) produced the raw message
-			// But if we're in here, we have that information. We check differently:
-			// 1. If this message is either shift:
-			// 2.		If the delayed raw input is a shift from a scancode that shouldn't produce it
-			// 3.				Then we change that message's scancode (and flip the keyup flag, which is wrong)
-			// 4. Continue normally.
-			if (virtualKeyCode == 0x10		// This is a shift
-				&& (extractedScancode == 0x2a || extractedScancode == 0x36))	// yep. shift.
-			{
-				if (raw->data.keyboard.VKey == VK_SHIFT				// delayed signal is a shift
-					&& raw->data.keyboard.MakeCode != SCANCODE_LEFT_SHIFT		// but not produced by left shift physical key
-					&& raw->data.keyboard.MakeCode != SCANCODE_RIGHT_SHIFT)		// nor right shift physical key
-				{
-					// keyup flag will be wrong; invert it.
-					if (raw->data.keyboard.Flags & RI_KEY_BREAK)
-						raw->data.keyboard.Flags &= 0xfffe;		// unset last bit
-					else raw->data.keyboard.Flags |= RI_KEY_BREAK;	// set last bit
-
-					raw->data.keyboard.MakeCode = extractedScancode;				// *You're the same as us*
-																					// That'll make this Hook continue, and recognize this delayed message as its match.
-				}
-			}
-			// (I wish we could fake RawInput messages. Doesn't seem like so).
-			/*---End of fix for Fake shift----*/
 
+			// Sleep until the raw input thread publishes something
+			WaitForSingleObject(decisionEvent, maxWaitingTime - elapsedTime);
+		}
+		METRICS_RECORD(DecisionMatch, matchStart);
 
+#if DEBUG
+		if (record.decision) OutputDebugString(L"Hook: Must block this key.\n");
+		else OutputDebugString(L"Hook: Must let this key through.\n");
+#endif
 
-			// Evaluate and take action depending on whether the message is the one we were expecting:
+		// Now, if the decision was to block the hook, we must act on it at this point
+		if (record.decision) {
 
-			// If the raw input message doesn't match the hook, push it into the buffer and continue waiting
-			if (virtualKeyCode != raw->data.keyboard.VKey
-				|| extractedScancode != raw->data.keyboard.MakeCode
-				|| keyPressed != (raw->data.keyboard.Flags & RI_KEY_BREAK ? 1 : 0)
-				|| (isExtended > 0) != ((raw->data.keyboard.Flags & RI_KEY_E0) == RI_KEY_E0))	// Plenty of checks here
-			{
-				// Turns out this raw input message wasn't the one we were looking for.
-				// Put it in the queue just like we did in the WM_INPUT case, and keep waiting.
-				Multikeys::PKeystrokeCommand possibleInput;
-				BOOL doBlock = remapper->evaluateKey(&(raw->data.keyboard), keyboardNameBuffer, &possibleInput);
-				decisionBuffer.push_back(DecisionRecord(raw->data.keyboard, possibleInput, doBlock));
-
-
-
-
-				/*--Checking for AltGr--*/
-				// Checking here because it never happens early
-				if (extractedScancode == SCANCODE_CONTROL		// Hook message generated by left control (scancode of LCtrl in translated set 2)
-					&& isExtended == FALSE			// left variant
-					&& virtualKeyCode == VK_CONTROL	// <- Control key (left variant, since isExtended is false)
-					&& keyPressed == 1)			// <- down
-				{
-					if (raw->data.keyboard.MakeCode == SCANCODE_ALT		// <- Raw Input is Alt key
-						&& raw->data.keyboard.Flags & RI_KEY_E0)	// Right variant
-					{
-						// then we won't wait for the LCtrl Raw Input message because it'll never happen.
-						AltGrBlockNextLCtrl = TRUE;
-
-						return TRUE;	// <- will block
-					}
-				}
-				// if a LCtrl keydown was blocked because it was part of an AltGr,
-				// we should block the very next LCtrl up. Except if another LCtrl down was sent along the way.
-				if (extractedScancode == SCANCODE_CONTROL	// scancode of Ctrl
-					&& isExtended == FALSE		//		<- left variant of
-					&& virtualKeyCode == VK_CONTROL	//	<- Control
-					&& keyPressed == 0)				//	<- up
-				{
-					if (AltGrBlockNextLCtrl)	// after a fake LCtrl down from an AltGr
-					{
-						AltGrBlockNextLCtrl = FALSE;
-						if (extractedScancode == SCANCODE_CONTROL && isExtended == FALSE && keyPressed == 0)
-							return TRUE;
-					}
-				}
-				// A Ctrl press while AltGr is down will cause AltGr to lose effect.
-				// That's okay because that happens normally. Do not be alarmed.
-				// Let's hope all keyboards we find use the translated scancode set 2.
-				// Or we'll have to implement support for different scancode sets.
-				/*--Finished checking for AltGr--*/
-			}
-			else
-			{
-				// This is truly the message we were looking for.
-				recordFound = TRUE;		// This will get us out of the loop.
-										// (the other way to exit the loop is by timing out)
-										// But we still didn't evaluate the raw message (it just arrived!)
-				Multikeys::PKeystrokeCommand possibleOutput;
-				blockThisHook = remapper->evaluateKey(&(raw->data.keyboard), keyboardNameBuffer, &possibleOutput);
-				// Immediately act on the input if there is one, since this decision won't be stored in the buffer
-				if (blockThisHook) {
-
-					if (!possibleOutput->execute(!keyPressed, previousStateFlagWasDown && keyPressed)) {
+			METRICS_TIMESTAMP(executionStart);
+			if (!record.mappedAction->execute(!keyPressed, record.repeated != FALSE)) {
+				Multikeys::Counters::Increment(Multikeys::Counters::FailedCommands);
 #if DEBUG
-						OutputDebugString(L"WndProc: Command failed!!\n");
+				OutputDebugString(L"Simulation failed!!\n");
 #endif
-					}
-				}
 			}
-
+			METRICS_RECORD(CommandExecution, executionStart);
 		}
 
+		bool blockThisHook = record.decision != FALSE;
+
 #if DEBUG
 		if (blockThisHook)
 		{
@@ -760,6 +626,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 		}
 #endif
 
+		METRICS_RECORD(HookReply, hookStart);
 		return blockThisHook;	// exit WndProc, the message caller receives 1 or 0
 								// Message caller is the hook dll. It sends a message to this window (this message) upon receival of a hook signal,
 								// and blocks it if this message returns 1.
@@ -767,6 +634,12 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 	}	// end of case WM_HOOK
 
 
+		// A queue of decisions is full, or holds a timeout's decision; take its contents now.
+	case WM_COLLECT_DECISIONS:
+		CollectDecisions();
+		return 0;
+
+
 	case WM_COMMAND:
 	{
 		int wmId = LOWORD(wParam);
@@ -779,11 +652,25 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 		case IDM_EXIT:
 			DestroyWindow(hWnd);
 			break;
+#if METRICS
+		case IDM_DUMP_METRICS:
+			// Other processes may post this command to get a report in the debug output
+			Multikeys::Metrics::Dump();
+			break;
+		case IDM_RESET_METRICS:
+			Multikeys::Metrics::Reset();
+			break;
+#endif
 		default:
 			return DefWindowProc(hWnd, message, wParam, lParam);
 		}
 	}
 	break;
+#if METRICS
+		// Hotkeys registered in InitInstance; their ids are the commands they send
+	case WM_HOTKEY:
+		return WndProc(hWnd, WM_COMMAND, MAKEWPARAM((WORD)wParam, 0), 0);
+#endif
 	case WM_PAINT: break;		// we break because the window is no longer shown. May remove this code completely.
 //	{
 //		PAINTSTRUCT ps;
@@ -798,6 +685,14 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 //	break;
 	case WM_DESTROY:
 		UninstallHook();		// Done using it.
+#if METRICS
+		UnregisterHotKey(hWnd, IDM_DUMP_METRICS);
+		UnregisterHotKey(hWnd, IDM_RESET_METRICS);
+#endif
+		StopRawInputThread();		// No more decisions will be published
+		StopShards();
+		Multikeys::SharedDecisions::Release();
+		Multikeys::Counters::Release();
 		PostQuitMessage(0);
 		return 0;
 	case WM_CLOSE:
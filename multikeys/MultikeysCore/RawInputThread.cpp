@@ -0,0 +1,575 @@
+#include "stdafx.h"
+
+// Implementation of the raw input thread described in RawInputThread.h
+#include "RawInputThread.h"
+#include "Scancodes.h"
+#include "Metrics.h"
+#include "Counters.h"
+#include "SharedDecisions.h"
+#include "EvaluationShards.h"
+#include "../Remapper/TimerWheel.h"
+#include <WtsApi32.h>		// session notifications
+
+#pragma comment(lib, "Wtsapi32.lib")
+
+
+// Class of the message-only window that receives Raw Input
+static const WCHAR* const RAW_INPUT_WINDOW_CLASS = L"Multikeys Core Raw Input";
+
+DecisionQueue decisionQueue;
+HANDLE decisionEvent = NULL;
+
+// Thread handle, and the event it signals once it is ready (or failed to start)
+static HANDLE threadHandle = NULL;
+static HANDLE readyEvent = NULL;
+static BOOL threadReady = FALSE;
+
+// Message-only window owned by the raw input thread
+static HWND rawInputHwnd = NULL;
+
+// Parameters given to StartRawInputThread
+static HINSTANCE instance = NULL;
+static Multikeys::PRemapper threadRemapper = nullptr;
+static HWND hookHwnd = NULL;
+
+
+// Everything below is used by the raw input thread only.
+
+// Buffer for keyboard Raw Input struct
+static UINT rawKeyboardBufferSize = 32;
+static LPBYTE rawKeyboardBuffer = new BYTE[rawKeyboardBufferSize];	// These buffers should be enough,
+																		// but do allocate more space if needed.
+// Buffer for keyboard name
+static UINT keyboardNameBufferSize = 128;
+static WCHAR * keyboardNameBuffer = new WCHAR[keyboardNameBufferSize];
+
+// Keyboard (index in the remapper, or -1) of each device that has sent input, by its Raw Input handle.
+// A device is only looked up by name the first time; its handle is forgotten when it's removed,
+// since Windows may give the same handle to another device.
+static std::unordered_map<HANDLE, int> deviceKeyboards;
+
+// Arrival order of the next keystroke
+static ULONGLONG nextSequence = 0;
+
+// Keyboards that hold keystrokes back have a timer each, whose context is the keyboard index.
+// It's restarted by every keystroke of the keyboard, so it only fires once the keyboard is idle;
+// keystrokes still held back then are not due yet, and set it again for when they are.
+// Sized once the thread starts, so the timers never move.
+static std::vector<Multikeys::TimerNode> expiryTimers;
+
+static Multikeys::TimerTime WheelClock()
+{
+	return GetTickCount64();
+}
+static Multikeys::TimerWheel expiryWheel(WheelClock);
+
+// The wheel is advanced by a single Windows timer, set for when it next has something to do.
+// Restarting a keyboard's timer only moves it later, so the Windows timer is left alone.
+static const UINT_PTR WHEEL_TIMER_ID = 1;
+static ULONGLONG wheelWakeTime = 0;		// When the Windows timer is due; 0 if it isn't set
+
+// Posted to the raw input window by ScheduleExpiry; wParam is the keyboard index, lParam the delay.
+static UINT const WM_SCHEDULE_EXPIRY = WM_APP + 3;
+
+
+// Simulates an up keystroke of the specified key.
+// Mostly useful for resetting the alt key. May be called from any thread.
+static UINT ResetKey(SHORT vKey)
+{
+	INPUT input;
+	input.type = INPUT_KEYBOARD;
+	input.ki.dwExtraInfo = 0;
+	input.ki.dwFlags = KEYEVENTF_EXTENDEDKEY | KEYEVENTF_KEYUP;
+	input.ki.wScan = 0;
+	input.ki.time = 0;
+	input.ki.wVk = vKey;
+	return SendInput(1, &input, sizeof(INPUT));
+}
+
+
+void RequestCollection()
+{
+	PostMessage(hookHwnd, WM_COLLECT_DECISIONS, 0, 0);
+}
+
+
+void WaitForDecisionSpace()
+{
+	// The hook thread only collects decisions when it's answering the hook.
+	// If nobody asked for them in a long while, ask it to collect them now, and give it a moment.
+	RequestCollection();
+	Sleep(1);
+}
+
+
+void ScheduleExpiry(int keyboardIndex, DWORD delay)
+{
+	PostMessage(rawInputHwnd, WM_SCHEDULE_EXPIRY, (WPARAM)keyboardIndex, (LPARAM)delay);
+}
+
+
+void CollectDeferredActions(Multikeys::PRemapper remapper, int keyboardIndex, DecisionRecord* const record)
+{
+	Multikeys::PKeystrokeCommand action;
+	while (record->deferredCount < Multikeys::MAX_DEFERRED_ACTIONS
+		&& remapper->takeDeferredAction(keyboardIndex, &action))
+		record->deferredActions[record->deferredCount++] = action;
+
+	if (record->deferredCount > 0)
+		Multikeys::SharedDecisions::BeginDeferred();
+}
+
+
+// Hands a decision over to the hook thread.
+static void PublishDecision(const DecisionRecord& record)
+{
+	while (!decisionQueue.tryPush(record))
+		WaitForDecisionSpace();
+	SetEvent(decisionEvent);
+}
+
+
+void FinishEvaluation(DecisionRecord* const record)
+{
+	// If the hook can act on this decision by itself, let it take it from the shared table
+	Multikeys::SharedDecisions::Publish(record);
+
+	/*
+	* Special handling for the Alt keys:
+	* If the received key was either a Left Alt or a Right Alt that was blocked, then the state of the keyboard
+	* must be reset. This prevents subsequent simulated keystrokes to be sent with the Alt modifier.
+	* */
+	if ((record->keyboardInput.MakeCode == SCANCODE_ALT && record->decision))
+	{
+		if (DEBUG)
+			OutputDebugString(L"Raw Input: Got a blocked Alt; resetting keyboard state.\n");
+		UINT sent;
+		if (record->keyboardInput.Flags & RI_KEY_E0)	// <- if it's RAlt
+			sent = ResetKey(VK_RMENU);
+		else
+			sent = ResetKey(VK_LMENU);
+		if (sent != 1)
+			Multikeys::Counters::Increment(Multikeys::Counters::FailedCommands);
+	}
+}
+
+
+// Sets the Windows timer for when the wheel next has something to do, unless it's already set for sooner.
+static void ScheduleWheel()
+{
+	Multikeys::TimerTime delay = expiryWheel.timeUntilNext();
+	if (delay == 0)
+		return;		// No timer armed
+	ULONGLONG wakeTime = GetTickCount64() + delay;
+	if (wheelWakeTime != 0 && wheelWakeTime <= wakeTime)
+		return;
+	SetTimer(rawInputHwnd, WHEEL_TIMER_ID, (UINT)delay, NULL);
+	wheelWakeTime = wakeTime;
+}
+
+
+// Arms the timer of a keyboard to fire after delay (in ms).
+static void ArmExpiryTimer(int keyboardIndex, DWORD delay)
+{
+	expiryWheel.arm(&expiryTimers[keyboardIndex], delay);
+	ScheduleWheel();
+}
+
+
+// Restarts the timer of a keyboard that holds keystrokes back, if it does.
+static void RestartExpiryTimer(int keyboardIndex)
+{
+	DWORD timeout = threadRemapper->getTimeout(keyboardIndex);
+	if (timeout > 0)
+		ArmExpiryTimer(keyboardIndex, timeout);
+}
+
+
+// Index of the keyboard whose remaps apply to the device, or -1 if there is none.
+// The name of the device is only retrieved and matched the first time it sends input.
+static int FindDeviceKeyboard(HANDLE device)
+{
+	auto found = deviceKeyboards.find(device);
+	if (found != deviceKeyboards.end())
+		return found->second;
+
+	// We'll get the device name
+	// Check that our buffer is enough for the task:
+	METRICS_TIMESTAMP(deviceNameStart);
+	UINT bufferSize = 0;
+	GetRawInputDeviceInfo(device, RIDI_DEVICENAME, NULL, &bufferSize);
+	if (bufferSize > keyboardNameBufferSize)		// It needs more space than we have!
+	{
+		keyboardNameBufferSize = bufferSize;
+		delete[] keyboardNameBuffer;
+		keyboardNameBuffer = new WCHAR[keyboardNameBufferSize];
+		Multikeys::Counters::Increment(Multikeys::Counters::DeviceNameBufferRegrowths);
+#if DEBUG
+		OutputDebugString(L"Needed more space for device name buffer");
+#endif
+	}
+
+	// Load the device name into the buffer
+	// Input injected by software may come without a device; it has no name, so only a keyboard for all devices applies
+	if (GetRawInputDeviceInfo(device, RIDI_DEVICENAME, keyboardNameBuffer, &keyboardNameBufferSize) == (UINT)-1)
+		keyboardNameBuffer[0] = L'\0';
+	// Now the buffer contains the name of the device that sent the signal
+	METRICS_RECORD(DeviceNameResolution, deviceNameStart);
+
+#if DEBUG
+	WCHAR text[200];
+	swprintf_s(text, 200, L"Raw Input: Keyboard name is %ls\n", keyboardNameBuffer);
+	OutputDebugString(text);
+#endif
+
+	int keyboardIndex = threadRemapper->findKeyboard(keyboardNameBuffer);
+	deviceKeyboards[device] = keyboardIndex;
+	Multikeys::Counters::Increment(Multikeys::Counters::DeviceLookups);
+	return keyboardIndex;
+}
+
+
+// Evaluates a keystroke from the keyboard (-1 if none remaps its device), and publishes the decision.
+// When running with shards, the keystroke is handed to its keyboard's shard instead.
+// isFakeShift - the keystroke was made up by the fake shift fix; it's only evaluated.
+static void Evaluate(RAWKEYBOARD* const keyboard, int keyboardIndex, BOOL isFakeShift)
+{
+	ULONGLONG sequence = nextSequence++;
+
+	METRICS_TIMESTAMP(evaluateStart);
+	if (keyboardIndex >= 0)
+		RestartExpiryTimer(keyboardIndex);
+
+	if (GetShardCount() > 0 && keyboardIndex >= 0)
+	{
+		ShardJob job = { *keyboard, keyboardIndex, sequence, isFakeShift, FALSE, FALSE };
+		SubmitToShard(job);
+		return;
+	}
+	// Without shards, or if no keyboard remaps this device (there's nothing worth handing to a shard)
+
+	// Call the function that decides whether to block or allow this keystroke
+	// Publish that decision; the hook thread looks for it when the hook asks.
+	Multikeys::PKeystrokeCommand possibleAction = nullptr;		// <- we don't know yet if our key maps to anything
+	bool repeated = false;
+	BOOL DoBlock = FALSE;		// If no keyboard matches, there's no remap and input shouldn't be blocked
+	if (keyboardIndex >= 0)
+		DoBlock = threadRemapper->evaluateKeyOnKeyboard(keyboardIndex, keyboard, &possibleAction, &repeated);		// ask
+	METRICS_RECORD(EvaluateKey, evaluateStart);
+
+#if DEBUG
+	if (DoBlock)
+		OutputDebugString(L"Raw Input: This key should be blocked. Recording it in the decision record.\n");
+	else
+		OutputDebugString(L"Raw Input: This key should not be blocked, and will not be recorded.\n");
+#endif
+
+	DecisionRecord record(*keyboard, possibleAction, DoBlock);
+	record.repeated = repeated;
+	record.sequence = sequence;
+	if (keyboardIndex >= 0)
+		CollectDeferredActions(threadRemapper, keyboardIndex, &record);
+	if (!isFakeShift)
+		FinishEvaluation(&record);
+	PublishDecision(record);	// remember the answer
+}
+
+
+// The keyboard has been idle for its whole timeout: resolves the keystrokes it holds back,
+// and publishes the result as a decision of its own, in arrival order with the keystrokes.
+static void Expire(int keyboardIndex)
+{
+	if (GetShardCount() > 0)
+	{
+		// The keyboard's state belongs to its shard
+		ShardJob job = { };
+		job.keyboardIndex = keyboardIndex;
+		job.sequence = nextSequence++;
+		job.isExpire = TRUE;
+		SubmitToShard(job);
+		return;
+	}
+
+	DWORD remaining = threadRemapper->expire(keyboardIndex);
+	if (remaining > 0)
+		ArmExpiryTimer(keyboardIndex, remaining);
+
+	DecisionRecord record;
+	record.fromTimer = TRUE;
+	CollectDeferredActions(threadRemapper, keyboardIndex, &record);
+	if (record.deferredCount == 0)
+		return;		// Nothing was due; no need to bother the hook window
+	record.sequence = nextSequence++;
+	PublishDecision(record);
+	RequestCollection();		// No hook message is coming for it
+}
+
+static void OnExpiryTimer(Multikeys::TimerNode* node)
+{
+	Expire((int)node->context);
+}
+
+
+// Forgets the keys held down on every keyboard. Called when the session is locked, unlocked or
+// switched: keys released meanwhile never reach us, and would look held down until pressed again.
+static void ReleaseAllKeys()
+{
+	int keyboardCount = threadRemapper->getKeyboardCount();
+	for (int i = 0; i < keyboardCount; i++)
+	{
+		if (GetShardCount() > 0)
+		{
+			// The keyboard's state belongs to its shard
+			ShardJob job = { };
+			job.keyboardIndex = i;
+			job.isReleaseAll = TRUE;
+			SubmitToShard(job);
+		}
+		else
+			threadRemapper->releaseAllKeys(i);
+	}
+}
+
+
+// Reads one Raw Input message, evaluates it and publishes the decision.
+static void EvaluateRawInput(HRAWINPUT rawInputHandle)
+{
+	UINT bufferSize = 0;		// work variable
+
+	METRICS_TIMESTAMP(receiptStart);
+								// Get data from the raw input structure
+								// Parameters:
+								// 1. HRAWINPUT - a handle to the raw input structure (in this case stored in the long param of the message)
+								// 2. UINT - a flag containing what to return, either RID_HEADER (header) or RID_INPUT (raw data)
+								// 3. LPVOID, out param - a pointer to the data that comes from the RAW INPUT structure
+								//		If this is null, the next parameter will contain the required size of the buffer
+								// 4. PUINT, in or out param - size of the data, or required size if previous param is NULL
+								// 5. UINT - size in bytes of the header
+
+								// get required buffer size, check if it's larger than what we have
+	GetRawInputData(rawInputHandle, RID_INPUT, NULL, &bufferSize, sizeof(RAWINPUTHEADER));
+	if (bufferSize > rawKeyboardBufferSize)
+	{
+		// Oh, no! Needs more space than we have! Let's replace our buffer with a better one.
+		rawKeyboardBufferSize = bufferSize;
+		delete[] rawKeyboardBuffer;
+		rawKeyboardBuffer = new BYTE[rawKeyboardBufferSize];
+		Multikeys::Counters::Increment(Multikeys::Counters::RawInputBufferRegrowths);
+		if (DEBUG) OutputDebugString(L"Needed more space for keyboard buffer");
+	}
+
+	// load data into buffer
+	GetRawInputData(rawInputHandle, RID_INPUT, rawKeyboardBuffer, &rawKeyboardBufferSize, sizeof(RAWINPUTHEADER));
+
+	// cast the contents of the buffer into our rawinput pointer
+	RAWINPUT * raw = (RAWINPUT*)rawKeyboardBuffer;
+	METRICS_RECORD(RawInputReceipt, receiptStart);
+
+#if DEBUG
+	WCHAR text[200];
+	swprintf_s(text, 200, L"Raw Input: Virtual key %X scancode %s%s%X (%s)\n",
+		raw->data.keyboard.VKey,		// virtual keycode
+		(raw->data.keyboard.Flags & RI_KEY_E0 ? L"e0 " : L""),
+		(raw->data.keyboard.Flags & RI_KEY_E1 ? L"e1 " : L""),
+		raw->data.keyboard.MakeCode,	// scancode
+		raw->data.keyboard.Flags & RI_KEY_BREAK ? L"up" : L"down");		// keydown or keyup (make/break)
+	OutputDebugString(text);
+#endif
+
+
+	// Find the keyboard of the device that sent the signal
+	int keyboardIndex = FindDeviceKeyboard(raw->header.hDevice);
+
+
+	/*----Fix for Fake shift----*/
+	// When shift + numpad key is pressed while numlock is on, a fake shift up is pressed on keydown,
+	// and a fake shift down is pressed on keyup to simulate unshifted behavior (similar to capslock
+	// and shift, but that doesn't cause fake shifts).
+	// We look for a virtual-key code translated from a scancode that normally wouldn't produce it.
+	if (raw->data.keyboard.VKey == VK_SHIFT		// (legit) shift, either side
+		&& raw->data.keyboard.MakeCode != SCANCODE_LEFT_SHIFT	// scancode is not left shift
+		&& raw->data.keyboard.MakeCode != SCANCODE_RIGHT_SHIFT)	// and is not right shift
+	{
+		// then it must be an illegitimate shift, not produced by a physical keystroke
+		// but there is a Hook message for a legitimate (although faked) shift waiting for it
+		// Instead of storing the decision for this keystroke, store the decision for both a
+		// left shift and a right shift, since we don't know which one produced this message
+		OutputDebugString(L"Raw Input: Fake shift detected, storing two shift decisions.\n");
+		Multikeys::Counters::Increment(Multikeys::Counters::FakeShiftCorrections);
+
+		// keyup and keydown is wrong
+		if (raw->data.keyboard.Flags & RI_KEY_BREAK)
+			raw->data.keyboard.Flags &= 0xfffe;		// unset last bit
+		else raw->data.keyboard.Flags |= RI_KEY_BREAK;	// set last bit
+
+		// pretend this is a left shift
+		raw->data.keyboard.MakeCode = 0x2a;
+		Evaluate(&(raw->data.keyboard), keyboardIndex, TRUE);		// remember the answer
+
+		// pretend this is a right shift
+		raw->data.keyboard.MakeCode = 0x36;
+		Evaluate(&(raw->data.keyboard), keyboardIndex, TRUE);		// remember the answer
+
+		return;
+	}
+	// The hook thread doesn't need to know about this fix; it simply finds
+	// the decision for whichever shift it was asked about.
+	/*---End of fix for Fake shift----*/
+
+
+	Evaluate(&(raw->data.keyboard), keyboardIndex, FALSE);
+}
+
+
+// Window procedure of the message-only window; runs in the raw input thread.
+static LRESULT CALLBACK RawInputWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
+{
+	switch (message)
+	{
+	case WM_INPUT:
+		EvaluateRawInput((HRAWINPUT)lParam);
+		return 0;
+	case WM_INPUT_DEVICE_CHANGE:
+		// A handle that arrives may have belonged to a device removed before; either way, it's looked up again
+		deviceKeyboards.erase((HANDLE)lParam);
+		return 0;
+	case WM_WTSSESSION_CHANGE:
+		ReleaseAllKeys();
+		return 0;
+	case WM_TIMER:
+		if (wParam == WHEEL_TIMER_ID)
+		{
+			KillTimer(hWnd, WHEEL_TIMER_ID);
+			wheelWakeTime = 0;
+			expiryWheel.advance();		// calls Expire for each keyboard whose timer is due
+			ScheduleWheel();
+		}
+		return 0;
+	case WM_SCHEDULE_EXPIRY:
+	{
+		// A keystroke since may need the timer sooner; it restarted it with getTimeout()
+		int keyboardIndex = (int)wParam;
+		DWORD delay = (DWORD)lParam;
+		if (delay > threadRemapper->getTimeout(keyboardIndex))
+			delay = threadRemapper->getTimeout(keyboardIndex);
+		ArmExpiryTimer(keyboardIndex, delay);
+		return 0;
+	}
+	case WM_CLOSE:
+		DestroyWindow(hWnd);
+		return 0;
+	case WM_DESTROY:
+		WTSUnRegisterSessionNotification(hWnd);
+		PostQuitMessage(0);		// ends this thread's message loop only
+		return 0;
+	default:
+		return DefWindowProc(hWnd, message, wParam, lParam);
+	}
+}
+
+
+static DWORD WINAPI RawInputThreadProc(LPVOID parameter)
+{
+	UNREFERENCED_PARAMETER(parameter);
+
+	// Window that receives the Raw Input; it's never shown, so it can be message-only
+	WNDCLASSEXW wcex = { };
+	wcex.cbSize = sizeof(WNDCLASSEX);
+	wcex.lpfnWndProc = RawInputWndProc;
+	wcex.hInstance = instance;
+	wcex.lpszClassName = RAW_INPUT_WINDOW_CLASS;
+	if (!RegisterClassExW(&wcex))
+	{
+		SetEvent(readyEvent);		// threadReady stays FALSE
+		return 1;
+	}
+
+	rawInputHwnd = CreateWindowW(RAW_INPUT_WINDOW_CLASS, L"", 0,
+		0, 0, 0, 0, HWND_MESSAGE, nullptr, instance, nullptr);
+	if (!rawInputHwnd)
+	{
+		SetEvent(readyEvent);
+		return 1;
+	}
+
+	// Register for receiving Raw Input for keyboards
+	RAWINPUTDEVICE rawInputDevice[1];
+	rawInputDevice[0].usUsagePage = 1;		// usage page = 1 is generic and usage = 6 is for keyboards
+	rawInputDevice[0].usUsage = 6;				// (2 is mouse, 4 is joystick, 6 is keyboard, there are others)
+	rawInputDevice[0].dwFlags = RIDEV_INPUTSINK		// Receive input even if the registered window is in the background
+		| RIDEV_DEVNOTIFY;								// and WM_INPUT_DEVICE_CHANGE when keyboards are plugged in or removed
+	rawInputDevice[0].hwndTarget = rawInputHwnd;		// Handle to the target window (NULL would make it follow kb focus)
+	if (!RegisterRawInputDevices(rawInputDevice, 1, sizeof(rawInputDevice[0])))
+	{
+		DestroyWindow(rawInputHwnd);
+		rawInputHwnd = NULL;
+		SetEvent(readyEvent);
+		return 1;
+	}
+
+	// Hear about the session being locked or switched; without it, keys released in the meantime
+	// are only found out about when they're pressed again.
+	WTSRegisterSessionNotification(rawInputHwnd, NOTIFY_FOR_THIS_SESSION);
+
+	threadReady = TRUE;
+	SetEvent(readyEvent);
+
+	// This thread's message loop; it only ever sees Raw Input, session changes and its timers
+	MSG msg;
+	while (GetMessage(&msg, nullptr, 0, 0))
+	{
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+	}
+
+	return 0;
+}
+
+
+BOOL StartRawInputThread(HINSTANCE hInstance, Multikeys::PRemapper remapper, HWND hookWindow)
+{
+	if (threadHandle != NULL)
+		return FALSE;		// Already started
+
+	instance = hInstance;
+	threadRemapper = remapper;
+	hookHwnd = hookWindow;
+
+	expiryTimers.assign(remapper->getKeyboardCount(), Multikeys::TimerNode());
+	for (size_t i = 0; i < expiryTimers.size(); i++)
+	{
+		expiryTimers[i].callback = OnExpiryTimer;
+		expiryTimers[i].context = i;
+	}
+
+	decisionEvent = CreateEvent(NULL, FALSE, FALSE, NULL);		// auto-reset
+	readyEvent = CreateEvent(NULL, TRUE, FALSE, NULL);			// manual reset
+	if (decisionEvent == NULL || readyEvent == NULL)
+		return FALSE;
+
+	threadHandle = CreateThread(NULL, 0, RawInputThreadProc, NULL, 0, NULL);
+	if (threadHandle == NULL)
+		return FALSE;
+
+	// Wait until the thread has registered for Raw Input (or failed to)
+	WaitForSingleObject(readyEvent, INFINITE);
+	CloseHandle(readyEvent);
+	readyEvent = NULL;
+
+	return threadReady;
+}
+
+
+void StopRawInputThread()
+{
+	if (threadHandle == NULL)
+		return;
+
+	if (rawInputHwnd != NULL)
+		PostMessage(rawInputHwnd, WM_CLOSE, 0, 0);
+	WaitForSingleObject(threadHandle, INFINITE);
+	CloseHandle(threadHandle);
+	threadHandle = NULL;
+	rawInputHwnd = NULL;
+	threadReady = FALSE;
+}
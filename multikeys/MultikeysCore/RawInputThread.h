@@ -0,0 +1,56 @@
+#pragma once
+
+// The raw input thread receives every Raw Input message, evaluates it with the remapper,
+// and publishes the resulting decision for the thread that answers the keyboard hook.
+// The two threads only share a lock-free queue and an event, so a slow hook reply never
+// delays the evaluation of the next keystroke, and the other way around.
+
+#include "stdafx.h"
+#include "MultikeysCore.h"
+#include "SpscQueue.h"
+
+// Maximum number of decisions that may be waiting in the handoff queue.
+const size_t DECISION_QUEUE_CAPACITY = 1024;
+
+typedef Multikeys::SpscQueue<DecisionRecord, DECISION_QUEUE_CAPACITY> DecisionQueue;
+
+// Posted to the hook window when a queue of decisions is full, or holds a decision no hook
+// message will ask for; the hook window then collects the decisions without waiting for one.
+UINT const WM_COLLECT_DECISIONS = WM_APP + 2;
+
+// Decisions published by the raw input thread, in the order the keystrokes arrived.
+// The raw input thread is the only producer, and the hook window's thread the only consumer.
+extern DecisionQueue decisionQueue;
+
+// Auto-reset event, signaled whenever a decision is published.
+extern HANDLE decisionEvent;
+
+// Creates the raw input thread, which registers itself for Raw Input from all keyboards.
+// hInstance - handle to this application instance
+// remapper - already loaded remapper; from now on, only the raw input thread may evaluate keys with it.
+// hookWindow - window that answers the hook and consumes decisionQueue
+// Returns FALSE if the thread could not be started or could not register for Raw Input.
+BOOL StartRawInputThread(HINSTANCE hInstance, Multikeys::PRemapper remapper, HWND hookWindow);
+
+// Stops receiving Raw Input and waits for the raw input thread to end.
+void StopRawInputThread();
+
+// Work done right after a key is evaluated, on whichever thread evaluated it: publishes the decision
+// in the shared decision table if possible, and resets the keyboard state after a blocked Alt.
+void FinishEvaluation(DecisionRecord* const record);
+
+// Called by a thread that found a queue of decisions full; asks the hook window to collect them
+// and gives it a moment to do so.
+void WaitForDecisionSpace();
+
+// Asks the hook window to collect the decisions published so far, without waiting for a hook message.
+void RequestCollection();
+
+// Asks the raw input thread to call IRemapper::expire for the keyboard again after delay (in ms),
+// unless a keystroke of the keyboard brings that forward. May be called from any thread.
+void ScheduleExpiry(int keyboardIndex, DWORD delay);
+
+// Right after evaluating a keystroke or a timeout of a keyboard, on the same thread: moves the
+// keyboard's deferred actions into the record, and keeps the shared decision table from
+// answering later keystrokes until the hook window has executed them.
+void CollectDeferredActions(Multikeys::PRemapper remapper, int keyboardIndex, DecisionRecord* const record);
@@ -10,6 +10,11 @@
 #define IDD_ABOUTBOX			103
 #define IDM_ABOUT				104
 #define IDM_EXIT				105
+// Latency report (see Metrics.h), written to the debug output. Sent by the hotkeys Ctrl+Alt+Shift+F11
+// (dump) and Ctrl+Alt+Shift+F12 (reset), or by any process posting WM_COMMAND with this id as wParam
+// to the window of class "Multikeys Core".
+#define IDM_DUMP_METRICS		106
+#define IDM_RESET_METRICS		110
 #define IDI_MULTIKEYS			107
 #define IDI_SMALL				108
 #define IDC_MULTIKEYS			109
@@ -26,6 +31,6 @@
 #define _APS_NEXT_RESOURCE_VALUE	129
 #define _APS_NEXT_COMMAND_VALUE		32771
 #define _APS_NEXT_CONTROL_VALUE		1000
-#define _APS_NEXT_SYMED_VALUE		110
+#define _APS_NEXT_SYMED_VALUE		111
 #endif
 #endif
@@ -0,0 +1,114 @@
+#include "stdafx.h"
+
+// Implementation of methods in SharedDecisions.h
+#include "SharedDecisions.h"
+
+namespace Multikeys
+{
+	namespace SharedDecisions
+	{
+		// Table mapped into this process; null if it doesn't exist.
+		static DecisionTable* table = nullptr;
+
+		// Handle of the file mapping
+		static HANDLE mappingHandle = NULL;
+
+		// Records with deferred actions not yet executed
+		static std::atomic<LONG> pendingDeferred(0);
+
+
+		BOOL Initialize()
+		{
+			if (mappingHandle != NULL)
+				return TRUE;		// Already initialized
+
+			mappingHandle = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+				0, sizeof(DecisionTable), DECISION_TABLE_NAME);
+			if (mappingHandle == NULL)
+				return FALSE;
+
+			table = (DecisionTable*)MapViewOfFile(mappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(DecisionTable));
+			if (table == nullptr)
+			{
+				CloseHandle(mappingHandle);
+				mappingHandle = NULL;
+				return FALSE;
+			}
+
+			// A new mapping is zero-filled, but processes may still hold one left behind by an
+			// earlier instance of the core; start over either way.
+			InterlockedExchange(&table->active, 0);
+			for (int i = 0; i < DECISION_TABLE_SIZE; i++)
+				InterlockedExchange64(&table->entries[i].word, DECISION_STATE_EMPTY);
+			table->nextGeneration = 0;
+			table->version = DECISION_TABLE_VERSION;
+			InterlockedExchange(&table->active, 1);
+
+			return TRUE;
+		}
+
+		void Release()
+		{
+			if (mappingHandle == NULL)
+				return;
+
+			InterlockedExchange(&table->active, 0);
+			UnmapViewOfFile(table);
+			table = nullptr;
+			CloseHandle(mappingHandle);
+			mappingHandle = NULL;
+		}
+
+		void Publish(DecisionRecord* const record)
+		{
+			if (table == nullptr)
+				return;
+
+			// Only decisions that need nothing else from the core
+			if (record->decision && record->mappedAction->hasEffect())
+				return;
+
+			// Nor while deferred actions (this record's or an earlier one's) wait to be executed
+			if (pendingDeferred.load() > 0)
+				return;
+
+			// Keys the hook window treats specially must always get there
+			const RAWKEYBOARD& keyboard = record->keyboardInput;
+			if (keyboard.VKey == VK_SNAPSHOT		// PrintScreen: only a keyup reaches the hook
+				|| keyboard.VKey == VK_PAUSE		// Pause/Break: the hook sees a different scancode
+				|| keyboard.VKey == VK_CONTROL		// Control: the AltGr fix needs to see all of them
+				|| keyboard.Flags & RI_KEY_E1)
+				return;
+
+			DecisionTablePublish(table,
+				DecisionTableKey(keyboard.VKey, keyboard.MakeCode,
+					keyboard.Flags & RI_KEY_E0, keyboard.Flags & RI_KEY_BREAK),
+				record->decision,
+				&record->tableSlot, &record->tableWord);
+		}
+
+		BOOL Retire(const DecisionRecord& record)
+		{
+			if (record.tableSlot < 0 || table == nullptr)
+				return TRUE;
+			return DecisionTableRetire(table, record.tableSlot, record.tableWord);
+		}
+
+		void BeginDeferred()
+		{
+			pendingDeferred++;
+		}
+
+		void EndDeferred()
+		{
+			pendingDeferred--;
+		}
+
+		BOOL IsClaimed(const DecisionRecord& record)
+		{
+			if (record.tableSlot < 0 || table == nullptr)
+				return FALSE;
+			return table->entries[record.tableSlot].word != record.tableWord;
+		}
+	}
+}
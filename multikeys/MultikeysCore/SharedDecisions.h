@@ -0,0 +1,46 @@
+#pragma once
+
+// Core side of the shared decision table (see KeyboardHook/DecisionTable.h).
+// The raw input thread publishes the decisions the hook may take by itself;
+// the hook window retires them once it has answered the hook for them.
+
+#include "stdafx.h"
+#include "MultikeysCore.h"
+#include "../KeyboardHook/DecisionTable.h"
+
+namespace Multikeys
+{
+	namespace SharedDecisions
+	{
+		// Creates the shared table. Should be called before installing the hook, since each
+		// process only tries to open the table once. Until this is called (or if it fails),
+		// nothing is published and the hook always asks the core.
+		// Returns FALSE if the table could not be created.
+		BOOL Initialize();
+
+		// Marks the table inactive and unmaps it.
+		void Release();
+
+		// Evaluating thread only. Publishes the decision in the table if the hook can act on it
+		// alone: the key passes through, or is blocked with a command that does nothing.
+		// Keys that need special handling in the hook window are never published.
+		// If published, the record remembers where, in tableSlot and tableWord.
+		void Publish(DecisionRecord* const record);
+
+		// Hook window only. Takes the record's decision back from the table, so that the hook
+		// won't claim it anymore. Returns FALSE if the hook has already claimed it, in which
+		// case the hook window must not act on the record.
+		// Records that were never published always return TRUE.
+		BOOL Retire(const DecisionRecord& record);
+
+		// Called when a record with deferred actions is made, and again once the hook window has
+		// executed them. In between, nothing is published: the hook would answer later keystrokes
+		// by itself, ahead of the deferred actions. May be called from any thread.
+		void BeginDeferred();
+		void EndDeferred();
+
+		// Whether the hook has already claimed the record's decision (or it was dropped from
+		// the table). Records that were never published always return FALSE.
+		BOOL IsClaimed(const DecisionRecord& record);
+	}
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+// Bounded single-producer/single-consumer queue.
+// Only standard C++ is used here, so this header does not depend on the Windows API.
+// Header only; no cpp implementation file exists.
+
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <cstddef>
+
+// Marks output parameters, like the Windows headers do
+#ifndef OUT
+#define OUT
+#endif
+
+namespace Multikeys
+{
+
+	// Lock-free ring buffer for handing items from exactly one producer thread to
+	// exactly one consumer thread. Neither side ever blocks or allocates; a full queue
+	// makes tryPush fail, and an empty one makes tryPop fail.
+	// T - type of the items; must be copy-constructible.
+	// Capacity - maximum number of items in the queue; must be a power of two.
+	template <typename T, size_t Capacity>
+	class SpscQueue
+	{
+		static_assert(Capacity > 1 && (Capacity & (Capacity - 1)) == 0,
+			"Capacity of an SpscQueue must be a power of two");
+
+	public:
+
+		SpscQueue() : head(0), cachedTail(0), tail(0), cachedHead(0) { }
+
+		// Producer only. Copies item into the queue; returns false if the queue is full.
+		bool tryPush(const T& item)
+		{
+			const size_t currentTail = tail.load(std::memory_order_relaxed);
+			if (currentTail - cachedHead == Capacity)
+			{
+				// Looks full; see how far the consumer really is
+				cachedHead = head.load(std::memory_order_acquire);
+				if (currentTail - cachedHead == Capacity)
+					return false;
+			}
+			new (&slots[currentTail & (Capacity - 1)]) T(item);
+			// Release: the item must be fully written before the consumer can see it
+			tail.store(currentTail + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Consumer only. Moves the oldest item into *out_item; returns false if the queue is empty.
+		bool tryPop(OUT T* const out_item)
+		{
+			const size_t currentHead = head.load(std::memory_order_relaxed);
+			if (currentHead == cachedTail)
+			{
+				// Looks empty; see how far the producer really is
+				cachedTail = tail.load(std::memory_order_acquire);
+				if (currentHead == cachedTail)
+					return false;
+			}
+			T* slot = reinterpret_cast<T*>(&slots[currentHead & (Capacity - 1)]);
+			*out_item = *slot;
+			slot->~T();
+			// Release: the slot must be read before the producer may overwrite it
+			head.store(currentHead + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Number of items in the queue. Exact only when called from one of the two
+		// threads while the other is idle; otherwise it's an estimate.
+		size_t size() const
+		{
+			return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+		}
+
+		~SpscQueue()
+		{
+			// Destroy whatever was never consumed
+			for (size_t i = head.load(); i != tail.load(); i++)
+				reinterpret_cast<T*>(&slots[i & (Capacity - 1)])->~T();
+		}
+
+	private:
+
+		// Head and tail only ever increase; positions wrap around through the mask.
+		// Each index is written by one side only, and lives in a cache line of its own
+		// together with that side's cached copy of the other index.
+
+		// Written by the consumer
+		alignas(64) std::atomic<size_t> head;
+		size_t cachedTail;		// consumer's last view of tail
+
+		// Written by the producer
+		alignas(64) std::atomic<size_t> tail;
+		size_t cachedHead;		// producer's last view of head
+
+		alignas(64) typename std::aligned_storage<sizeof(T), alignof(T)>::type slots[Capacity];
+
+		SpscQueue(const SpscQueue&) = delete;
+		SpscQueue& operator=(const SpscQueue&) = delete;
+	};
+
+}
@@ -5,38 +5,53 @@
 
 #pragma once
 
+// Only the portable parts of the core (counters, queues) are also built elsewhere, for the
+// tests in ../Tests; everything that needs Windows is left out of those builds.
+#ifdef _WIN32
 #include "targetver.h"
 
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
+#endif
 
 // SET THIS TO 0 TO DISABLE ALL DEBUG OUTPUT
 #define DEBUG				1
 #define DEBUG_TEXT_SIZE		128
 
+// SET THIS TO 0 TO COMPILE OUT THE LATENCY HISTOGRAMS (see Metrics.h)
+#define METRICS				1
+
 
 
 // C RunTime Header Files
 #include <stdlib.h>
-#include <malloc.h>
 #include <memory.h>
-#include <tchar.h>
+#include <stdint.h>
 
 
 // Additional headers
 #include <deque>			// double-ended queues for holding decision records
+#include <atomic>			// lock-free counters for instrumentation
 #include <string>			// std::string and std::wstring
 #include <vector>			// contiguous, iterable containers for keyboard structures
 #include <map>				// maps for dead keys
 #include <unordered_map>	// hash maps for storing the set of remaps for each keyboard
 #include <fstream>			// for reading the configuration file
-#include <Windows.h>		// for the Windows API
 #include <locale>			// setting locale
 #include <codecvt>			// for converting strings between different encodings
 #include <cctype>			// make sure things like hex digit checking will work (that's also in locale)
+
+#ifdef _WIN32
+#include <malloc.h>
+#include <tchar.h>
+#include <Windows.h>		// for the Windows API
 #include <shellapi.h>		// to get arguments passed to main
 
 
 #include "../Remapper/RemapperAPI.h"		// Remapper static library
 #include "../KeyboardHook/KeyboardHook.h"	// Keyboard Hook DLL, which must be a separate dynamic library.
+#else
+// Marks output parameters, like the Windows headers do
+#define OUT
+#endif
 
 
@@ -0,0 +1,119 @@
+#include "stdafx.h"
+
+// Implementation of the pool described in CommandPool.h
+#include "CommandPool.h"
+
+namespace Multikeys
+{
+	CommandPool::CommandPool()
+		: stats()
+	{ }
+
+
+	UnicodeCommand* CommandPool::internUnicode(const std::vector<unsigned int>& codepoints, bool triggerOnRepeat)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.requested++;
+		UnicodeCommand*& command = unicodeCommands[std::make_pair(codepoints, triggerOnRepeat)];
+		if (!command)
+		{
+			command = new UnicodeCommand(codepoints.data(), (UINT)codepoints.size(), triggerOnRepeat);
+			stats.created++;
+		}
+		return command;
+	}
+
+
+	MacroCommand* CommandPool::internMacro(const std::vector<unsigned short>& keypresses, bool triggerOnRepeat)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.requested++;
+		MacroCommand*& command = macroCommands[std::make_pair(keypresses, triggerOnRepeat)];
+		if (!command)
+		{
+			command = new MacroCommand(keypresses.data(), keypresses.size(), triggerOnRepeat);
+			stats.created++;
+		}
+		return command;
+	}
+
+
+	CommandSequence* CommandPool::internSequence(const BaseKeystrokeCommand* first, const BaseKeystrokeCommand* second)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.requested++;
+		CommandSequence*& command = sequenceCommands[std::make_pair(first, second)];
+		if (!command)
+		{
+			command = new CommandSequence(first, second);
+			stats.created++;
+		}
+		return command;
+	}
+
+
+	BaseKeystrokeCommand* CommandPool::adopt(BaseKeystrokeCommand* command)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.requested++;
+		stats.created++;
+		adoptedCommands.push_back(command);
+		return command;
+	}
+
+
+	CommandPool::Stats CommandPool::getStats() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return stats;
+	}
+
+
+	size_t CommandPool::getMemoryUsage() const
+	{
+		// Map nodes hold a key and a value, plus about three pointers and a color
+		const size_t mapNodeOverhead = 4 * sizeof(void*);
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		size_t usage = sizeof(*this) + adoptedCommands.capacity() * sizeof(BaseKeystrokeCommand*);
+		for (auto it = unicodeCommands.begin(); it != unicodeCommands.end(); it++)
+		{
+			const INPUT* inputs;
+			size_t inputCount;
+			it->second->getInputs(false, false, &inputs, &inputCount);
+			usage += mapNodeOverhead + sizeof(*it) + it->first.first.capacity() * sizeof(unsigned int)
+				+ sizeof(UnicodeCommand) + inputCount * sizeof(INPUT);
+		}
+		for (auto it = macroCommands.begin(); it != macroCommands.end(); it++)
+		{
+			usage += mapNodeOverhead + sizeof(*it) + it->first.first.capacity() * sizeof(unsigned short)
+				+ sizeof(MacroCommand) + it->first.first.size() * sizeof(INPUT);
+		}
+		for (auto it = sequenceCommands.begin(); it != sequenceCommands.end(); it++)
+		{
+			// Joined inputs for a press, a repeat and a release
+			const INPUT* inputs;
+			size_t inputCount;
+			if (!it->second->getInputs(false, false, &inputs, &inputCount))
+				inputCount = 0;
+			usage += mapNodeOverhead + sizeof(*it) + sizeof(CommandSequence) + 3 * inputCount * sizeof(INPUT);
+		}
+		for (size_t i = 0; i < adoptedCommands.size(); i++)
+			usage += sizeof(BaseKeystrokeCommand);		// At least; their contents vary
+		return usage;
+	}
+
+
+	CommandPool::~CommandPool()
+	{
+		for (auto it = unicodeCommands.begin(); it != unicodeCommands.end(); it++)
+			delete it->second;
+		for (auto it = macroCommands.begin(); it != macroCommands.end(); it++)
+			delete it->second;
+		for (auto it = sequenceCommands.begin(); it != sequenceCommands.end(); it++)
+			delete it->second;
+		for (size_t i = 0; i < adoptedCommands.size(); i++)
+			delete adoptedCommands[i];
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "stdafx.h"
+#include "KeystrokeCommands.h"
+
+namespace Multikeys
+{
+	// Owner of every command read from the settings. Commands that only send keystrokes are
+	// interned by content: the same characters or virtual keys, wherever they appear (on
+	// several layers, several keyboards, or in dead key replacements), get a single object, so
+	// two of them are equal exactly when they are the same pointer.
+	// Other commands (dead keys, executables, timed macros...) are only kept, to be deleted with
+	// the pool; timed macros in particular hold a run per object, which must not be shared.
+	// Filled while loading, and by layers built on first activation, which may happen on any
+	// thread; it must outlive the keyboards using it.
+	class CommandPool
+	{
+	public:
+
+		// Counters, for diagnostics
+		struct Stats
+		{
+			size_t requested;		// Commands asked for, interned or not
+			size_t created;			// Commands actually created, interned or not
+		};
+
+		CommandPool();
+
+		// The command that sends these codepoints; created the first time it's asked for.
+		UnicodeCommand* internUnicode(const std::vector<unsigned int>& codepoints, bool triggerOnRepeat);
+
+		// The command that sends these virtual keys, encoded as for MacroCommand; created the
+		// first time it's asked for.
+		MacroCommand* internMacro(const std::vector<unsigned short>& keypresses, bool triggerOnRepeat);
+
+		// The command that sends first, then second; created the first time it's asked for.
+		// Neither is owned by it; they must belong to this pool too, or outlive it.
+		CommandSequence* internSequence(const BaseKeystrokeCommand* first, const BaseKeystrokeCommand* second);
+
+		// Takes ownership of a command that isn't shared; returns it.
+		BaseKeystrokeCommand* adopt(BaseKeystrokeCommand* command);
+
+		Stats getStats() const;
+
+		// Approximate memory used by the commands and the indexes, in bytes
+		size_t getMemoryUsage() const;
+
+		~CommandPool();
+
+	private:
+
+		std::map<std::pair<std::vector<unsigned int>, bool>, UnicodeCommand*> unicodeCommands;
+		std::map<std::pair<std::vector<unsigned short>, bool>, MacroCommand*> macroCommands;
+		std::map<std::pair<const BaseKeystrokeCommand*, const BaseKeystrokeCommand*>, CommandSequence*> sequenceCommands;
+		std::vector<BaseKeystrokeCommand*> adoptedCommands;
+
+		Stats stats;
+
+		// Every method takes it, since layers are built by whichever thread first needs them
+		mutable std::mutex mutex;
+
+		CommandPool(const CommandPool&) = delete;
+		CommandPool& operator=(const CommandPool&) = delete;
+	};
+}
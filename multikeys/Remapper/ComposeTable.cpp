@@ -0,0 +1,153 @@
+#include "stdafx.h"
+
+// Implementation of the table described in ComposeTable.h
+#include "ComposeTable.h"
+
+#include <algorithm>	// for std::lower_bound
+
+namespace Multikeys
+{
+	// Code points of a UTF-16 string, for a UnicodeCommand
+	static std::vector<unsigned int> ToCodepoints(const std::wstring& text)
+	{
+		std::vector<unsigned int> codepoints;
+		for (size_t i = 0; i < text.size(); i++)
+		{
+			unsigned int unit = text[i];
+			if (unit >= 0xd800 && unit <= 0xdbff && i + 1 < text.size()
+				&& text[i + 1] >= 0xdc00 && text[i + 1] <= 0xdfff)
+			{
+				codepoints.push_back(0x10000 + ((unit - 0xd800) << 10) + (text[i + 1] - 0xdc00));
+				i++;
+			}
+			else
+				codepoints.push_back(unit);
+		}
+		return codepoints;
+	}
+
+
+	ComposeTable::ComposeTable(const std::vector<ComposeDefinition>& definitions)
+	{
+		// 1. A plain trie first, easy to insert into; children are kept sorted by the maps
+		struct BuildNode
+		{
+			std::map<wchar_t, size_t> children;
+			int definition;		// Index in definitions; -1 if none ends here
+		};
+		std::vector<BuildNode> trie(1);
+		trie[0].definition = -1;
+		for (size_t i = 0; i < definitions.size(); i++)
+		{
+			const std::wstring& sequence = definitions[i].sequence;
+			if (sequence.empty())
+				continue;
+
+			size_t node = 0;
+			for (size_t j = 0; j < sequence.size(); j++)
+			{
+				auto child = trie[node].children.find(sequence[j]);
+				if (child != trie[node].children.end())
+				{
+					node = child->second;
+					continue;
+				}
+				trie[node].children[sequence[j]] = trie.size();
+				node = trie.size();
+				trie.push_back(BuildNode());
+				trie.back().definition = -1;
+			}
+			trie[node].definition = (int)i;		// Later definitions win
+		}
+
+		// 2. Flattened breadth first, so that the children of each node get consecutive states
+		// and their edges consecutive places. BFS order is also the order of the new states.
+		std::vector<size_t> order(1, 0);
+		nodes.reserve(trie.size());
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			const BuildNode& buildNode = trie[order[i]];
+
+			Node node;
+			node.firstEdge = (unsigned int)edgeCharacters.size();
+			node.edgeCount = (unsigned int)buildNode.children.size();
+			node.output = -1;
+			for (auto child = buildNode.children.begin(); child != buildNode.children.end(); child++)
+			{
+				edgeCharacters.push_back(child->first);
+				edgeTargets.push_back((State)order.size());
+				order.push_back(child->second);
+			}
+
+			// Only leaves complete a sequence; see the constructor's comment
+			if (node.edgeCount == 0 && buildNode.definition >= 0)
+			{
+				node.output = (int)outputs.size();
+				outputs.push_back(new UnicodeCommand(ToCodepoints(definitions[buildNode.definition].output), false));
+			}
+			nodes.push_back(node);
+		}
+	}
+
+
+	ComposeTable::State ComposeTable::next(State state, wchar_t character) const
+	{
+		const Node& node = nodes[state];
+		const wchar_t* first = edgeCharacters.data() + node.firstEdge;
+		const wchar_t* last = first + node.edgeCount;
+		const wchar_t* edge = std::lower_bound(first, last, character);
+		if (edge == last || *edge != character)
+			return NO_STATE;
+		return edgeTargets[edge - edgeCharacters.data()];
+	}
+
+
+	bool ComposeTable::isComplete(State state) const
+	{
+		return nodes[state].edgeCount == 0;
+	}
+
+
+	UnicodeCommand* ComposeTable::getOutput(State state) const
+	{
+		int output = nodes[state].output;
+		return output < 0 ? nullptr : outputs[output];
+	}
+
+
+	size_t ComposeTable::getSequenceCount() const
+	{
+		return outputs.size();
+	}
+
+
+	size_t ComposeTable::getStateCount() const
+	{
+		return nodes.size();
+	}
+
+
+	size_t ComposeTable::getMemoryUsage() const
+	{
+		size_t usage = sizeof(*this)
+			+ nodes.capacity() * sizeof(Node)
+			+ edgeCharacters.capacity() * sizeof(wchar_t)
+			+ edgeTargets.capacity() * sizeof(State)
+			+ outputs.capacity() * sizeof(UnicodeCommand*);
+		for (size_t i = 0; i < outputs.size(); i++)
+		{
+			const INPUT* inputs;
+			size_t inputCount;
+			outputs[i]->getInputs(false, false, &inputs, &inputCount);
+			usage += sizeof(UnicodeCommand) + inputCount * sizeof(INPUT);
+		}
+		return usage;
+	}
+
+
+	ComposeTable::~ComposeTable()
+	{
+		for (size_t i = 0; i < outputs.size(); i++)
+			delete outputs[i];
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "stdafx.h"
+#include "KeystrokeCommands.h"
+
+namespace Multikeys
+{
+	// A compose sequence: typing the characters of sequence after the compose key sends output
+	struct ComposeDefinition
+	{
+		std::wstring sequence;
+		std::wstring output;
+	};
+
+
+	// Compose sequences compiled into a trie kept in a few flat arrays: a node per prefix of some
+	// sequence, with its edges stored next to each other and sorted by character. Following a
+	// character is a binary search among the edges of a single node; nothing is allocated per node.
+	// Immutable once built.
+	class ComposeTable
+	{
+	public:
+
+		// A node of the trie: the characters typed so far after the compose key
+		typedef unsigned int State;
+
+		// Only the compose key typed so far
+		static const State START = 0;
+
+		// No sequence begins with the characters typed
+		static const State NO_STATE = (State)-1;
+
+		// definitions - sequences in order; a later one replaces an earlier one with the same characters.
+		// A sequence that is the beginning of a longer one is never completed, and is left out; so are
+		// empty ones.
+		ComposeTable(const std::vector<ComposeDefinition>& definitions);
+
+		// The state after the character is typed in the given one; NO_STATE if no sequence goes on with it.
+		State next(State state, wchar_t character) const;
+
+		// Whether a sequence ends in this state; no other one can go on from it.
+		bool isComplete(State state) const;
+
+		// What the sequence ending in this state sends; null if it isn't complete.
+		UnicodeCommand* getOutput(State state) const;
+
+		// Size of the table, for diagnostics
+		size_t getSequenceCount() const;
+		size_t getStateCount() const;
+
+		// Approximate memory used by the trie and the outputs, in bytes
+		size_t getMemoryUsage() const;
+
+		~ComposeTable();
+
+	private:
+
+		struct Node
+		{
+			unsigned int firstEdge;		// Index of its first edge in edgeCharacters and edgeTargets
+			unsigned int edgeCount;		// 0 for complete sequences
+			int output;					// Index in outputs; -1 if none
+		};
+
+		std::vector<Node> nodes;
+		std::vector<wchar_t> edgeCharacters;
+		std::vector<State> edgeTargets;
+
+		// Output of each complete sequence
+		std::vector<UnicodeCommand*> outputs;
+
+		ComposeTable(const ComposeTable&) = delete;
+		ComposeTable& operator=(const ComposeTable&) = delete;
+	};
+}
@@ -0,0 +1,140 @@
+#include "stdafx.h"
+
+// Implementation of the pattern described in DevicePattern.h
+#include "DevicePattern.h"
+
+namespace Multikeys
+{
+	// Value of a hexadecimal digit; -1 if it isn't one
+	static int HexDigit(wchar_t c)
+	{
+		if (c >= L'0' && c <= L'9')
+			return c - L'0';
+		if (c >= L'A' && c <= L'F')
+			return c - L'A' + 10;
+		if (c >= L'a' && c <= L'f')
+			return c - L'a' + 10;
+		return -1;
+	}
+
+
+	// Reads the ID after the first of the markers found in the text; -1 if none is there.
+	// Bluetooth names put a source before the ID (0002 for classic, 02 for Low Energy), so only
+	// the last 16 bits of the hexadecimal digits are the ID.
+	static int FindId(const std::wstring& text, const wchar_t* marker, const wchar_t* otherMarker)
+	{
+		size_t position = text.find(marker);
+		size_t length = wcslen(marker);
+		if (position == std::wstring::npos && otherMarker)
+		{
+			position = text.find(otherMarker);
+			length = wcslen(otherMarker);
+		}
+		if (position == std::wstring::npos)
+			return -1;
+
+		unsigned int value = 0;
+		int digits = 0;
+		for (position += length; position < text.size() && HexDigit(text[position]) >= 0; position++, digits++)
+			value = (value << 4) | HexDigit(text[position]);
+		return digits ? (int)(value & 0xffff) : -1;
+	}
+
+
+	DeviceIdentity ParseDeviceName(const wchar_t* deviceName)
+	{
+		std::wstring name(deviceName);
+		for (size_t i = 0; i < name.size(); i++)
+			name[i] = towupper(name[i]);
+
+		// \\?\<enumerator>#<hardware ID>#<instance ID>#{<interface class>}
+		std::vector<std::wstring> segments;
+		size_t start = 0;
+		for (size_t end; (end = name.find(L'#', start)) != std::wstring::npos; start = end + 1)
+			segments.push_back(name.substr(start, end - start));
+		segments.push_back(name.substr(start));
+
+		// IDs are only looked for in the hardware ID, since instance IDs are made up of hexadecimal
+		// numbers too; names not in this form are searched whole.
+		const std::wstring& hardwareId = segments.size() > 1 ? segments[1] : name;
+
+		DeviceIdentity identity;
+		identity.vendorId = FindId(hardwareId, L"VID_", L"VID&");
+		identity.productId = FindId(hardwareId, L"PID_", L"PID&");
+		identity.interfaceNumber = FindId(hardwareId, L"MI_", NULL);
+		if (segments.size() > 2)
+			identity.instance = segments[2];
+		return identity;
+	}
+
+
+	DevicePattern::DevicePattern()
+		: vendorId(-1), productId(-1), interfaceNumber(-1), instanceIsPrefix(false)
+	{ }
+
+
+	bool DevicePattern::parse(const std::wstring& vendorId, const std::wstring& productId,
+		const std::wstring& interfaceNumber, const std::wstring& instance, OUT DevicePattern *const out_pattern)
+	{
+		DevicePattern pattern;
+		if (!_parseId(vendorId, &pattern.vendorId) || !_parseId(productId, &pattern.productId)
+			|| !_parseId(interfaceNumber, &pattern.interfaceNumber))
+			return false;
+
+		pattern.instance = instance;
+		for (size_t i = 0; i < pattern.instance.size(); i++)
+			pattern.instance[i] = towupper(pattern.instance[i]);
+		if (!pattern.instance.empty() && pattern.instance.back() == L'*')
+		{
+			pattern.instance.pop_back();
+			pattern.instanceIsPrefix = true;
+		}
+
+		*out_pattern = pattern;
+		return true;
+	}
+
+
+	bool DevicePattern::isEmpty() const
+	{
+		return vendorId < 0 && productId < 0 && interfaceNumber < 0 && instance.empty() && !instanceIsPrefix;
+	}
+
+
+	bool DevicePattern::matches(const DeviceIdentity& identity) const
+	{
+		if (vendorId >= 0 && vendorId != identity.vendorId)
+			return false;
+		if (productId >= 0 && productId != identity.productId)
+			return false;
+		if (interfaceNumber >= 0 && interfaceNumber != identity.interfaceNumber)
+			return false;
+
+		if (instanceIsPrefix)
+			return identity.instance.compare(0, instance.size(), instance) == 0;
+		return instance.empty() || instance == identity.instance;
+	}
+
+
+	bool DevicePattern::_parseId(const std::wstring& text, OUT int *const out_id)
+	{
+		if (text.empty())
+		{
+			*out_id = -1;
+			return true;
+		}
+		if (text.size() > 4)
+			return false;
+
+		int value = 0;
+		for (size_t i = 0; i < text.size(); i++)
+		{
+			int digit = HexDigit(text[i]);
+			if (digit < 0)
+				return false;
+			value = (value << 4) | digit;
+		}
+		*out_id = value;
+		return true;
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "stdafx.h"
+
+namespace Multikeys
+{
+	// What a device name (the path of its device interface, as Raw Input gives it) tells about the device, e.g.
+	// \\?\HID#VID_046D&PID_C52B&MI_00&Col01#8&16c55830&0&0000#{884b96c3-56ef-11d1-bc8c-00a0c91405dd}
+	// is vendor 046D, product C52B, interface 0, instance 8&16C55830&0&0000.
+	struct DeviceIdentity
+	{
+		int vendorId;			// -1 if the name has none, as with PS/2 keyboards
+		int productId;			// -1 if the name has none
+		int interfaceNumber;	// The MI_xx of composite devices; -1 if the name has none
+		std::wstring instance;	// Instance ID in uppercase, between the second and the third '#'; empty if none
+	};
+
+
+	// Reads the identity of a device from its name. IDs are read both from USB names (VID_xxxx&PID_xxxx)
+	// and from Bluetooth ones (VID&0002xxxx_PID&xxxx); whatever can't be found is left out.
+	DeviceIdentity ParseDeviceName(const wchar_t* deviceName);
+
+
+	// Which devices a keyboard is for, by the fields of their names instead of the whole name, so
+	// that the same keyboard is found whatever port or receiver it's plugged into.
+	// Every field is optional; a device matches if it has the same value for all the fields given.
+	class DevicePattern
+	{
+	public:
+
+		// Pattern without fields. It matches any device, but keyboards use it to mean that
+		// they're found by name instead.
+		DevicePattern();
+
+		// Reads a pattern from the texts of its fields; empty texts are fields left out.
+		// vendorId, productId - in hexadecimal, as in device names, e.g. 046D
+		// interfaceNumber - in hexadecimal too, e.g. 00 for MI_00
+		// instance - instance ID, compared ignoring case; if it ends in '*', any instance
+		//		beginning with the rest matches
+		// Returns false if an ID isn't a 16-bit hexadecimal number.
+		static bool parse(const std::wstring& vendorId, const std::wstring& productId,
+			const std::wstring& interfaceNumber, const std::wstring& instance, OUT DevicePattern *const out_pattern);
+
+		// Whether no field was given
+		bool isEmpty() const;
+
+		bool matches(const DeviceIdentity& identity) const;
+
+	private:
+
+		// -1 for fields left out
+		int vendorId;
+		int productId;
+		int interfaceNumber;
+
+		// In uppercase, without the final '*'; empty if left out
+		std::wstring instance;
+		bool instanceIsPrefix;
+
+		// Reads a hexadecimal ID into out_id, or -1 if the text is empty; false if it's not valid
+		static bool _parseId(const std::wstring& text, OUT int *const out_id);
+	};
+}
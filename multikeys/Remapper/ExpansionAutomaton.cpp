@@ -0,0 +1,172 @@
+#include "stdafx.h"
+
+// Implementation of the automaton described in ExpansionAutomaton.h
+#include "ExpansionAutomaton.h"
+
+namespace Multikeys
+{
+	// Marks a missing edge of the trie, while the table is being built
+	static const ExpansionAutomaton::State NO_STATE = (ExpansionAutomaton::State)-1;
+
+	// Number of characters (not UTF-16 code values) in a string
+	static size_t CountCharacters(const std::wstring& text)
+	{
+		size_t count = 0;
+		for (size_t i = 0; i < text.size(); i++)
+		{
+			if (text[i] < 0xdc00 || text[i] > 0xdfff)		// low surrogates end a character already counted
+				count++;
+		}
+		return count;
+	}
+
+
+	ExpansionAutomaton::ExpansionAutomaton(const std::vector<ExpansionDefinition>& definitions)
+		: columnCount(1)
+	{
+		asciiColumns.fill(0);
+
+		// 1. Give a column to each character used in a trigger
+		std::vector<std::wstring> triggers;
+		for (auto definition = definitions.begin(); definition != definitions.end(); definition++)
+		{
+			std::wstring trigger = definition->trigger;
+			for (size_t i = 0; i < trigger.size(); i++)
+			{
+				trigger[i] = _fold(trigger[i]);
+				if (_columnOf(trigger[i]) != 0)
+					continue;
+				if ((size_t)trigger[i] < asciiColumns.size())
+					asciiColumns[trigger[i]] = (unsigned short)columnCount;
+				else
+					otherColumns[trigger[i]] = (unsigned short)columnCount;
+				columnCount++;
+			}
+			triggers.push_back(trigger);
+		}
+
+		// 2. The trie of the triggers; its missing edges are filled in below
+		transitions.assign(columnCount, NO_STATE);
+		outputs.push_back(-1);
+		for (size_t i = 0; i < triggers.size(); i++)
+		{
+			if (triggers[i].empty())
+				continue;
+
+			State state = START;
+			for (size_t j = 0; j < triggers[i].size(); j++)
+			{
+				State& edge = transitions[state * columnCount + _columnOf(triggers[i][j])];
+				if (edge == NO_STATE)
+				{
+					edge = (State)outputs.size();
+					transitions.resize(transitions.size() + columnCount, NO_STATE);
+					outputs.push_back(-1);
+				}
+				state = transitions[state * columnCount + _columnOf(triggers[i][j])];	// edge may have moved
+			}
+
+			if (outputs[state] < 0)		// The first of duplicate triggers wins
+			{
+				outputs[state] = (int)expansions.size();
+				expansions.push_back(new ExpansionCommand(
+					CountCharacters(definitions[i].trigger) - 1, definitions[i].replacement));
+			}
+		}
+
+		// 3. Breadth first, so that the failure state of each state (the state of its longest proper
+		// suffix) is complete before it's needed. A missing edge goes wherever the same character
+		// goes from the failure state; from the start, back to the start.
+		std::vector<State> failures(outputs.size(), START);
+		std::deque<State> queue;
+		queue.push_back(START);
+		while (!queue.empty())
+		{
+			State state = queue.front();
+			queue.pop_front();
+
+			for (size_t column = 0; column < columnCount; column++)
+			{
+				State& edge = transitions[state * columnCount + column];
+				State fallback = (state == START) ? START : transitions[failures[state] * columnCount + column];
+				if (edge == NO_STATE)
+				{
+					edge = fallback;
+					continue;
+				}
+
+				failures[edge] = fallback;
+				// A trigger ending here is longer than any ending in its suffix
+				if (outputs[edge] < 0)
+					outputs[edge] = outputs[fallback];
+				queue.push_back(edge);
+			}
+		}
+	}
+
+
+	ExpansionAutomaton::State ExpansionAutomaton::next(State state, wchar_t character) const
+	{
+		return transitions[state * columnCount + _columnOf(_fold(character))];
+	}
+
+
+	ExpansionCommand* ExpansionAutomaton::getExpansion(State state) const
+	{
+		int output = outputs[state];
+		return output < 0 ? nullptr : expansions[output];
+	}
+
+
+	size_t ExpansionAutomaton::getStateCount() const
+	{
+		return outputs.size();
+	}
+
+
+	size_t ExpansionAutomaton::getAlphabetSize() const
+	{
+		return columnCount;
+	}
+
+
+	size_t ExpansionAutomaton::getMemoryUsage() const
+	{
+		size_t usage = sizeof(*this)
+			+ transitions.capacity() * sizeof(State)
+			+ outputs.capacity() * sizeof(int)
+			+ otherColumns.size() * (sizeof(wchar_t) + sizeof(unsigned short) + 2 * sizeof(void*))
+			+ expansions.capacity() * sizeof(ExpansionCommand*);
+		for (size_t i = 0; i < expansions.size(); i++)
+		{
+			const INPUT* inputs;
+			size_t inputCount;
+			expansions[i]->getInputs(false, false, &inputs, &inputCount);
+			usage += sizeof(ExpansionCommand) + inputCount * sizeof(INPUT);
+		}
+		return usage;
+	}
+
+
+	unsigned short ExpansionAutomaton::_columnOf(wchar_t folded) const
+	{
+		if ((size_t)folded < asciiColumns.size())
+			return asciiColumns[folded];
+		auto column = otherColumns.find(folded);
+		return column == otherColumns.end() ? 0 : column->second;
+	}
+
+
+	wchar_t ExpansionAutomaton::_fold(wchar_t character)
+	{
+		// With the high word clear, CharLower converts the character itself instead of a string
+		return (wchar_t)(ULONG_PTR)CharLowerW((LPWSTR)(ULONG_PTR)character);
+	}
+
+
+	ExpansionAutomaton::~ExpansionAutomaton()
+	{
+		for (size_t i = 0; i < expansions.size(); i++)
+			delete expansions[i];
+	}
+}
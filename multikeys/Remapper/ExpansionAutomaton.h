@@ -0,0 +1,79 @@
+#pragma once
+
+#include "stdafx.h"
+#include "KeystrokeCommands.h"
+
+namespace Multikeys
+{
+	// A text expansion: typing the trigger replaces it with the replacement
+	struct ExpansionDefinition
+	{
+		std::wstring trigger;
+		std::wstring replacement;
+	};
+
+
+	// Aho-Corasick automaton over the characters typed on a keyboard, which finds the trigger of an
+	// expansion as soon as its last character is typed, whatever came before it. Following a
+	// character is a single lookup in a dense table, however many triggers there are.
+	// Triggers are matched case-insensitively, since the state of Caps Lock isn't known for
+	// keys the remapper lets through. The table only has a column per character used in some trigger; every
+	// other character shares column 0, which always leads back to the start.
+	// Immutable once built, so it may be shared by every keyboard running a spec.
+	class ExpansionAutomaton
+	{
+	public:
+
+		// Position in the automaton: the longest end of the text typed so far that may still become a trigger
+		typedef unsigned int State;
+
+		// Nothing typed yet, or nothing that may become a trigger
+		static const State START = 0;
+
+		// definitions - expansions in document order; if two have the same trigger, the first one is used.
+		// Empty triggers are ignored.
+		ExpansionAutomaton(const std::vector<ExpansionDefinition>& definitions);
+
+		// The state after the character is typed in the given one.
+		State next(State state, wchar_t character) const;
+
+		// The command replacing the longest trigger that ends in this state, having been typed
+		// with one keystroke for its last character; null if no trigger ends here.
+		ExpansionCommand* getExpansion(State state) const;
+
+		// Size of the automaton, for diagnostics
+		size_t getStateCount() const;
+		size_t getAlphabetSize() const;
+
+		// Approximate memory used by the tables and the commands, in bytes
+		size_t getMemoryUsage() const;
+
+		~ExpansionAutomaton();
+
+	private:
+
+		// Column of each character in the table; characters in no trigger have none (0).
+		// ASCII, where most triggers are written, takes an array; the rest a map.
+		std::array<unsigned short, 128> asciiColumns;
+		std::unordered_map<wchar_t, unsigned short> otherColumns;
+		size_t columnCount;
+
+		// Next state for each state and column, row by row
+		std::vector<State> transitions;
+
+		// Index in expansions of the longest trigger ending in each state; -1 if none.
+		std::vector<int> outputs;
+
+		// One command per different trigger
+		std::vector<ExpansionCommand*> expansions;
+
+		ExpansionAutomaton(const ExpansionAutomaton&) = delete;
+		ExpansionAutomaton& operator=(const ExpansionAutomaton&) = delete;
+
+		// Column of a character, already folded to lowercase
+		unsigned short _columnOf(wchar_t folded) const;
+
+		// Same case for every character that may be typed either way
+		static wchar_t _fold(wchar_t character);
+	};
+}
@@ -0,0 +1,67 @@
+#include "stdafx.h"
+
+// The keyboard of Remapper::loadFallback, from the tables generated into FallbackLayout.h
+#include "Remapper.h"
+#include "FallbackLayout.h"
+
+namespace Multikeys
+{
+	// Scancode as written in the tables
+	static Scancode TableScancode(unsigned short code)
+	{
+		if (code <= 0xff)
+			return Scancode(code & 0xff);
+		return Scancode(code >> 8, code & 0xff);
+	}
+
+
+	std::shared_ptr<const KeyboardSpec> MakeFallbackSpec(CommandPool* const pool)
+	{
+		using namespace Fallback;
+
+		// Modifiers, as ParseModifier would make them
+		std::vector<PModifier> modifiers;
+		for (unsigned int i = 0; i < MODIFIER_COUNT; i++)
+		{
+			const ModifierEntry& entry = MODIFIERS[i];
+			PModifier modifier;
+			if (entry.scancodeCount == 1)
+				modifier = new SimpleModifier(entry.name, TableScancode(MODIFIER_SCANCODES[entry.firstScancode]));
+			else
+			{
+				std::vector<Scancode> scancodes;
+				for (unsigned int k = 0; k < entry.scancodeCount; k++)
+					scancodes.push_back(TableScancode(MODIFIER_SCANCODES[entry.firstScancode + k]));
+				modifier = new CompositeModifier(entry.name, scancodes);
+			}
+			modifier->tapTimeout = entry.tapTimeout;
+			modifiers.push_back(modifier);
+		}
+
+		// Layers, with their commands taken from the pool like those of settings files
+		std::vector<std::shared_ptr<const Layer>> layers;
+		for (unsigned int i = 0; i < LAYER_COUNT; i++)
+		{
+			const LayerEntry& entry = LAYERS[i];
+			std::vector<std::wstring> modifierCombination(
+				LAYER_MODIFIERS + entry.firstModifier, LAYER_MODIFIERS + entry.firstModifier + entry.modifierCount);
+
+			std::unordered_map<Scancode, BaseKeystrokeCommand*> layout;
+			for (unsigned int j = entry.firstRemap; j < (unsigned int)entry.firstRemap + entry.remapCount; j++)
+			{
+				const RemapEntry& remap = REMAPS[j];
+				const unsigned int* first = CODES + remap.firstCode;
+				const unsigned int* last = first + remap.codeCount;
+				if (remap.isMacro)
+					layout[TableScancode(remap.scancode)] =
+						pool->internMacro(std::vector<unsigned short>(first, last), remap.triggerOnRepeat);
+				else
+					layout[TableScancode(remap.scancode)] =
+						pool->internUnicode(std::vector<unsigned int>(first, last), remap.triggerOnRepeat);
+			}
+			layers.push_back(std::make_shared<const Layer>(modifierCombination, layout));
+		}
+
+		return std::make_shared<const KeyboardSpec>(KEYBOARD_NAME, layers, modifiers, DEFAULT_CHORD_WINDOW, nullptr, pool);
+	}
+}
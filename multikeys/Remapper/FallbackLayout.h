@@ -0,0 +1,96 @@
+#pragma once
+
+// Generated by GenerateFallbackLayout.py from Fallback.xml; do not edit.
+
+namespace Multikeys
+{
+	namespace Fallback
+	{
+		// A modifier, and its keys: MODIFIER_SCANCODES[firstScancode] onwards
+		struct ModifierEntry
+		{
+			const wchar_t* name;
+			unsigned short firstScancode;
+			unsigned short scancodeCount;
+			unsigned int tapTimeout;
+		};
+
+		// The modifiers that trigger a layer, LAYER_MODIFIERS[firstModifier] onwards, and its keys,
+		// REMAPS[firstRemap] onwards
+		struct LayerEntry
+		{
+			unsigned short firstModifier;
+			unsigned short modifierCount;
+			unsigned short firstRemap;
+			unsigned short remapCount;
+		};
+
+		// A key, and what it sends: CODES[firstCode] onwards, which are code points, or the virtual
+		// keys of a macro (with 0x8000 set for a key up)
+		struct RemapEntry
+		{
+			unsigned short scancode;
+			bool isMacro;
+			bool triggerOnRepeat;
+			unsigned short firstCode;
+			unsigned short codeCount;
+		};
+
+		// Scancodes are written as in settings files: E0 and E1 ones as E0xx and E1xx.
+		static constexpr wchar_t KEYBOARD_NAME[] = L"";
+
+		static constexpr unsigned int MODIFIER_COUNT = 2;
+		static constexpr ModifierEntry MODIFIERS[] = {
+			{ L"AltGr", 0, 1, 0 },
+			{ L"Shift", 1, 2, 0 },
+		};
+		static constexpr unsigned short MODIFIER_SCANCODES[] = {
+			0xe038,
+			0x002a,
+			0x0036,
+		};
+
+		static constexpr unsigned int LAYER_COUNT = 2;
+		static constexpr LayerEntry LAYERS[] = {
+			{ 0, 1, 0, 9 },
+			{ 1, 2, 9, 5 },
+		};
+		static constexpr const wchar_t* LAYER_MODIFIERS[] = {
+			L"AltGr",
+			L"Shift",
+			L"AltGr",
+		};
+		static constexpr RemapEntry REMAPS[] = {
+			{ 0x000c, false, true, 0, 1 },
+			{ 0x000d, false, true, 1, 1 },
+			{ 0x0012, false, true, 2, 1 },
+			{ 0x001a, false, true, 3, 1 },
+			{ 0x001b, false, true, 4, 1 },
+			{ 0x0028, false, true, 5, 1 },
+			{ 0x0034, false, true, 6, 1 },
+			{ 0x0035, false, true, 7, 1 },
+			{ 0x0039, false, true, 8, 1 },
+			{ 0x000c, false, true, 9, 1 },
+			{ 0x001a, false, true, 10, 1 },
+			{ 0x001b, false, true, 11, 1 },
+			{ 0x0033, false, true, 12, 1 },
+			{ 0x0034, false, true, 13, 1 },
+		};
+		static constexpr unsigned int CODES[] = {
+			0x2013,
+			0x00d7,
+			0x20ac,
+			0x201c,
+			0x201d,
+			0x2019,
+			0x2026,
+			0x00f7,
+			0x00a0,
+			0x2014,
+			0x2018,
+			0x2019,
+			0x00ab,
+			0x00bb,
+		};
+	}
+}
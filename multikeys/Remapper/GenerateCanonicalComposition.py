@@ -0,0 +1,52 @@
+# Generates CanonicalComposition.h, the table of canonical composition pairs used by dead keys
+# with a combining mark, from the Unicode Character Database of this Python's unicodedata.
+#
+#   python GenerateCanonicalComposition.py > CanonicalComposition.h
+#
+# A pair is a character with a canonical decomposition into exactly two characters that NFC
+# composes back into it; so singletons, composition exclusions and Hangul syllables (composed
+# by arithmetic, not by the table) are left out.
+
+import sys
+import unicodedata
+
+pairs = []
+for codepoint in range(sys.maxunicode + 1):
+    character = chr(codepoint)
+    decomposition = unicodedata.decomposition(character)
+    if not decomposition or decomposition.startswith('<'):
+        continue
+    parts = [int(part, 16) for part in decomposition.split()]
+    if len(parts) != 2:
+        continue
+    base, mark = parts
+    if unicodedata.normalize('NFC', chr(base) + chr(mark)) != character:
+        continue
+    pairs.append((mark, base, codepoint))
+pairs.sort()
+
+lines = []
+lines.append('#pragma once')
+lines.append('')
+lines.append('// Generated by GenerateCanonicalComposition.py from Unicode %s; do not edit.'
+             % unicodedata.unidata_version)
+lines.append('')
+lines.append('namespace Multikeys')
+lines.append('{')
+lines.append('\t// A base character followed by a combining mark, and the character they compose into.')
+lines.append('\tstruct CanonicalPair')
+lines.append('\t{')
+lines.append('\t\tunsigned int mark;')
+lines.append('\t\tunsigned int base;')
+lines.append('\t\tunsigned int composed;')
+lines.append('\t};')
+lines.append('')
+lines.append('\t// Every pair of canonical composition (NFC), sorted by mark, then by base')
+lines.append('\tstatic const CanonicalPair CANONICAL_PAIRS[] = {')
+for i in range(0, len(pairs), 4):
+    row = ', '.join('{ 0x%04x, 0x%04x, 0x%04x }' % pair for pair in pairs[i:i + 4])
+    lines.append('\t\t' + row + ',')
+lines.append('\t};')
+lines.append('}')
+
+sys.stdout.buffer.write(('\n'.join(lines) + '\n').encode('ascii'))
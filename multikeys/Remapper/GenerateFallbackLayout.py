@@ -0,0 +1,171 @@
+# Generates FallbackLayout.h, the layout built into the remapper (see Remapper::loadFallback), from a
+# settings file with a single keyboard:
+#
+#   python GenerateFallbackLayout.py ../XML/Fallback.xml > FallbackLayout.h
+#
+# Only what can be kept as plain tables is accepted: modifiers (with their TapTimeout), and layers of
+# unicode and macro remaps, the latter made only of vkeys. Anything else is an error, so that the
+# built-in layout never silently differs from its file.
+
+import os
+import sys
+import xml.etree.ElementTree as ElementTree
+
+
+def fail(message):
+    sys.stderr.write('GenerateFallbackLayout: %s\n' % message)
+    sys.exit(1)
+
+
+def scancode(text):
+    # Written in hexadecimal, optionally with a colon between its bytes (e.g. E0:38)
+    value = int(text.strip().replace(':', ''), 16)
+    if value > 0xffff:
+        fail('scancode %s is too large' % text)
+    return value
+
+
+def wide(text):
+    if any(ord(c) > 0x7f or c in '"\\' for c in text):
+        fail('name %r must be plain ASCII' % text)
+    return 'L"%s"' % text
+
+
+def table(lines, declaration, rows, empty):
+    # Arrays may not be empty, so one without rows gets a placeholder that's never read
+    lines.append('\t\tstatic constexpr %s[] = {' % declaration)
+    for row in rows or [empty]:
+        lines.append('\t\t\t' + row + ',')
+    lines.append('\t\t};')
+
+
+if len(sys.argv) != 2:
+    fail('usage: GenerateFallbackLayout.py <settings file>')
+
+root = ElementTree.parse(sys.argv[1]).getroot()
+if root.findall('template'):
+    fail('templates are not supported')
+keyboards = root.findall('keyboard')
+if len(keyboards) != 1:
+    fail('there must be exactly one keyboard')
+keyboard = keyboards[0]
+for attribute in ('Template', 'VendorId', 'ProductId', 'Interface', 'Instance'):
+    if keyboard.get(attribute) is not None:
+        fail('keyboard attribute %s is not supported' % attribute)
+if keyboard.findall('expansion'):
+    fail('expansions are not supported')
+
+# Modifiers, in the order ParseModifier gives them: by name
+modifierKeys = {}
+tapTimeouts = {}
+for element in keyboard.findall('modifiers/modifier'):
+    name = element.get('Name')
+    modifierKeys.setdefault(name, []).append(scancode(element.text))
+    if element.get('TapTimeout') is not None:
+        tapTimeouts[name] = int(element.get('TapTimeout'))
+
+modifierRows = []
+modifierScancodes = []
+for name in sorted(modifierKeys):
+    modifierRows.append('{ %s, %d, %d, %d }' % (wide(name), len(modifierScancodes), len(modifierKeys[name]),
+                                                tapTimeouts.get(name, 0)))
+    modifierScancodes.extend(modifierKeys[name])
+
+# Layers, in document order
+layerRows = []
+layerModifiers = []
+remapRows = []
+codes = []
+for layer in keyboard.findall('layer'):
+    if layer.get('Transparent') is not None:
+        fail('transparent layers are not supported')
+    names = []
+    for element in layer.findall('modifier'):
+        state = element.get('State', 'Pressed')
+        if state == 'Ignored':
+            fail('ignored layer modifiers are not supported')
+        if state == 'Pressed':
+            names.append(element.text.strip())
+    for name in names:
+        if name not in modifierKeys:
+            fail('layer modifier %s is not a modifier of the keyboard' % name)
+    firstModifier = len(layerModifiers)
+    firstRemap = len(remapRows)
+    layerModifiers.extend(wide(name) for name in names)
+
+    for remap in layer:
+        if remap.tag == 'modifier':
+            continue
+        triggerOnRepeat = 'true' if remap.get('TriggerOnRepeat') == 'True' else 'false'
+        first = len(codes)
+        if remap.tag == 'unicode':
+            codes.extend(int(element.text, 16) for element in remap.findall('codepoint'))
+            isMacro = 'false'
+        elif remap.tag == 'macro':
+            for element in remap:
+                if element.tag != 'vkey':
+                    fail('macro element %s is not supported' % element.tag)
+                vkey = int(element.text, 16)
+                codes.append(vkey | 0x8000 if element.get('Keypress') == 'Up' else vkey)
+            isMacro = 'true'
+        else:
+            fail('remap %s is not supported' % remap.tag)
+        remapRows.append('{ 0x%04x, %s, %s, %d, %d }' % (scancode(remap.get('Scancode')), isMacro, triggerOnRepeat,
+                                                        first, len(codes) - first))
+    layerRows.append('{ %d, %d, %d, %d }' % (firstModifier, len(names), firstRemap, len(remapRows) - firstRemap))
+
+lines = []
+lines.append('#pragma once')
+lines.append('')
+lines.append('// Generated by GenerateFallbackLayout.py from %s; do not edit.' % os.path.basename(sys.argv[1]))
+lines.append('')
+lines.append('namespace Multikeys')
+lines.append('{')
+lines.append('\tnamespace Fallback')
+lines.append('\t{')
+lines.append('\t\t// A modifier, and its keys: MODIFIER_SCANCODES[firstScancode] onwards')
+lines.append('\t\tstruct ModifierEntry')
+lines.append('\t\t{')
+lines.append('\t\t\tconst wchar_t* name;')
+lines.append('\t\t\tunsigned short firstScancode;')
+lines.append('\t\t\tunsigned short scancodeCount;')
+lines.append('\t\t\tunsigned int tapTimeout;')
+lines.append('\t\t};')
+lines.append('')
+lines.append('\t\t// The modifiers that trigger a layer, LAYER_MODIFIERS[firstModifier] onwards, and its keys,')
+lines.append('\t\t// REMAPS[firstRemap] onwards')
+lines.append('\t\tstruct LayerEntry')
+lines.append('\t\t{')
+lines.append('\t\t\tunsigned short firstModifier;')
+lines.append('\t\t\tunsigned short modifierCount;')
+lines.append('\t\t\tunsigned short firstRemap;')
+lines.append('\t\t\tunsigned short remapCount;')
+lines.append('\t\t};')
+lines.append('')
+lines.append('\t\t// A key, and what it sends: CODES[firstCode] onwards, which are code points, or the virtual')
+lines.append('\t\t// keys of a macro (with 0x8000 set for a key up)')
+lines.append('\t\tstruct RemapEntry')
+lines.append('\t\t{')
+lines.append('\t\t\tunsigned short scancode;')
+lines.append('\t\t\tbool isMacro;')
+lines.append('\t\t\tbool triggerOnRepeat;')
+lines.append('\t\t\tunsigned short firstCode;')
+lines.append('\t\t\tunsigned short codeCount;')
+lines.append('\t\t};')
+lines.append('')
+lines.append('\t\t// Scancodes are written as in settings files: E0 and E1 ones as E0xx and E1xx.')
+lines.append('\t\tstatic constexpr wchar_t KEYBOARD_NAME[] = %s;' % wide(keyboard.get('Name', '')))
+lines.append('')
+lines.append('\t\tstatic constexpr unsigned int MODIFIER_COUNT = %d;' % len(modifierRows))
+table(lines, 'ModifierEntry MODIFIERS', modifierRows, '{ L"", 0, 0, 0 }')
+table(lines, 'unsigned short MODIFIER_SCANCODES', ['0x%04x' % code for code in modifierScancodes], '0')
+lines.append('')
+lines.append('\t\tstatic constexpr unsigned int LAYER_COUNT = %d;' % len(layerRows))
+table(lines, 'LayerEntry LAYERS', layerRows, '{ 0, 0, 0, 0 }')
+table(lines, 'const wchar_t* LAYER_MODIFIERS', layerModifiers, 'L""')
+table(lines, 'RemapEntry REMAPS', remapRows, '{ 0, false, false, 0, 0 }')
+table(lines, 'unsigned int CODES', ['0x%04x' % code for code in codes], '0')
+lines.append('\t}')
+lines.append('}')
+
+sys.stdout.buffer.write(('\n'.join(lines) + '\n').encode('ascii'))
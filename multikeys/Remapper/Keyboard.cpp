@@ -6,53 +6,92 @@
 
 namespace Multikeys
 {
-	Keyboard::Keyboard(const std::wstring name,
-		const std::vector<Layer*>& layers, ModifierStateMap* modifiers)
-		: layers(layers), modifierStateMap(modifiers), deviceName(name)
+	Keyboard::Keyboard(std::shared_ptr<const KeyboardSpec> spec)
+		: spec(spec), state(spec->initialState()), layoutWindow(NULL), layout(NULL), layoutTime(0)
+	{ }
+
+
+	const KeyboardSpec& Keyboard::getSpec() const
 	{
-		noAction = new EmptyCommand();
-		activeDeadKey = nullptr;
+		return *spec;
+	}
 
-		// Initialize the current layer to whichever layer activates with no modifier
-		// Note: iterator dereferences into a pointer
-		this->activeLayer = nullptr;
-		for (auto it = this->layers.begin(); it != this->layers.end(); it++)
-		{
-			if (this->modifierStateMap->checkState(*it))
-			{
-				this->activeLayer = *it;
-				break;
-			}
-		}
+
+	const std::wstring& Keyboard::getDeviceName() const
+	{
+		return spec->deviceName;
+	}
+
+	const DevicePattern& Keyboard::getDevicePattern() const
+	{
+		return spec->devicePattern;
 	}
 
 
 	bool Keyboard::_updateKeyboardState(Scancode sc, bool flag_keyup)
 	{
-		// Update the state map
-		// If sc is not a modifier, this method will return false:
-		if (!modifierStateMap->updateState(sc, !flag_keyup))
+		// If sc is not a modifier, nothing changes:
+		ModifierMask modifier = spec->findModifier(sc);
+		if (!modifier)
 			return false;
 
-		// Then, if a modifier changed state, update the currently active layer
-		// Note: iterator dereferences into a pointer
-		this->activeLayer = nullptr;
-		for (auto it = this->layers.begin(); it != this->layers.end(); it++)
-		{
-			if (this->modifierStateMap->checkState(*it))
-			{
-				this->activeLayer = *it;
-				break;
-			}
-		}
+		// Update the pressed modifiers, then the layer they select
+		if (flag_keyup)
+			state.modifiers &= ~modifier;
+		else
+			state.modifiers |= modifier;
+		state.activeLayer = spec->findLayer(state.modifiers);
 		return true;
 	}
 
 
 	bool Keyboard::evaluateKey(
 		Scancode scancode, BYTE vKey, bool flag_keyup,
-		OUT PKeystrokeCommand*const out_action)
+		OUT PKeystrokeCommand*const out_action,
+		OUT bool*const out_repeated)
 	{
+		// A compose key pressed now only starts its sequence with the next press
+		bool composing = state.activeCompose != nullptr;
+
+		bool blocked = _evaluateKeystroke(scancode, vKey, flag_keyup, out_action, out_repeated);
+
+		// Shift as the system sees it, for the characters of keys let through
+		if (vKey == VK_SHIFT)
+		{
+			BYTE shiftKey = (scancode.makeCode == 0x36) ? 2 : 1;
+			if (flag_keyup)
+				state.shiftKeys &= ~shiftKey;
+			else if (!blocked)
+				state.shiftKeys |= shiftKey;
+		}
+
+		// Compose sequences and text expansions look at what the keystroke ends up typing, so they
+		// come last; a composed character may complete a trigger.
+		if (flag_keyup)
+			return blocked;
+		if (*out_repeated)
+		{
+			// Holding a key down isn't how triggers are typed
+			state.expansionState = ExpansionAutomaton::START;
+			return blocked;
+		}
+		if (composing && state.activeCompose)
+			blocked = _compose(scancode, vKey, blocked, out_action);
+		if (spec->getExpansions())
+			blocked = _expand(scancode, vKey, blocked, out_action);
+		return blocked;
+	}
+
+
+	bool Keyboard::_evaluateKeystroke(
+		Scancode scancode, BYTE vKey, bool flag_keyup,
+		OUT PKeystrokeCommand*const out_action,
+		OUT bool*const out_repeated)
+	{
+		USHORT key = PressedKeys::indexOf(scancode);
+		DWORD now = GetTickCount();
+		*out_repeated = false;
+
 		// 1. Correct vKey code (left and right variants)
 		// This step is currently skipped because the corrected vkeycodes
 		// are not used anywhere else.
@@ -74,96 +113,603 @@ namespace Multikeys
 				LRvKey = (scancode.flgE0? VK_RMENU : VK_LMENU);
 				newFlag_E0 = 0;
 			}			// MENU is Alt key
+			(void)LRvKey;
+			(void)newFlag_E0;
+
+		}
+
+		// 2. Keys held back for a chord: a fresh press may join them, if that still leads to a chord
+		// within the chord window. Any other keystroke resolves them first, so that they keep
+		// their place before it.
+		if (state.chord.layer)
+		{
+			const Layer* chordLayer = state.chord.layer;
+			ChordMask chordKey = chordLayer->getChordKey(scancode);
+			ChordMask grown = state.chord.keys | chordKey;
+			if (chordKey && !flag_keyup && !state.pressedKeys.isPressed(key)
+				&& state.chord.count < MAX_CHORD_KEYS
+				&& now - state.chord.firstPressTime < spec->getChordWindow()
+				&& (chordLayer->isChordPrefix(grown) || chordLayer->getChord(grown)))
+			{
+				_holdChordKey(key, scancode, vKey, chordKey, now);
+				if (!chordLayer->isChordPrefix(grown))
+				{
+					// The chord is complete, and no longer one includes it; no need to wait
+					*out_action = chordLayer->getChord(grown);
+					state.chord.layer = nullptr;
+					return true;
+				}
+				*out_action = spec->getNoAction();
+				return true;
+			}
+			_resolveChord(now);
+		}
 
+		// 3. A dual-role modifier is down, and may still be a tap or a hold. It's a hold once it's
+		// down for its whole timeout, or once a key pressed after it is released. It's a tap if
+		// it's released first. Until then, keys pressed after it are held back.
+		if (state.tapHold.modifier)
+		{
+			if (now - state.tapHold.pressTime >= state.tapHold.timeout)
+				_resolveTapHold(true, now);
+			else if (scancode == state.tapHold.scancode)
+			{
+				if (!flag_keyup)
+				{
+					// It repeats, but does nothing until resolved
+					*out_repeated = true;
+					*out_action = spec->getNoAction();
+					return true;
+				}
+
+				// Tapped: its release goes to the command the tap got
+				_resolveTapHold(false, now);
+				size_t tapSlot = state.pressedKeys.findSlot(key);
+				BaseKeystrokeCommand* tapCommand =
+					tapSlot != PressedKeys::NO_SLOT ? state.pressedKeys.slotCommands[tapSlot] : nullptr;
+				state.pressedKeys.release(key);
+				*out_action = tapCommand;	// even if it's null
+				return tapCommand;			// true if command is not null
+			}
+			else if (flag_keyup)
+			{
+				// Keys pressed before the dual-role modifier are just released
+				if (_isHeldForTapHold(scancode))
+					_resolveTapHold(true, now);
+			}
+			else if (!state.pressedKeys.isPressed(key))
+			{
+				ModifierMask modifier = spec->findModifier(scancode);
+				if (!modifier && state.tapHold.count < MAX_TAP_HOLD_KEYS)
+				{
+					state.tapHold.scancodes[state.tapHold.count] = scancode;
+					state.tapHold.virtualKeys[state.tapHold.count] = vKey;
+					state.tapHold.count++;
+					// Until resolved, the key does nothing on repeat or release
+					state.pressedKeys.press(key, now, spec->getNoAction());
+					*out_action = spec->getNoAction();
+					return true;
+				}
+				// Too many keys to hold back, or another dual-role modifier: this one is being held.
+				// Plain modifiers go through as usual.
+				if (!modifier || spec->getTapTimeout(modifier))
+					_resolveTapHold(true, now);
+			}
+		}
+
+		// 4. A fresh press of a dual-role modifier doesn't press the modifier yet; see step 3.
+		if (!flag_keyup && !state.pressedKeys.isPressed(key))
+		{
+			ModifierMask modifier = spec->findModifier(scancode);
+			DWORD tapTimeout = modifier ? spec->getTapTimeout(modifier) : 0;
+			if (tapTimeout)
+			{
+				state.tapHold.modifier = modifier;
+				state.tapHold.scancode = scancode;
+				state.tapHold.virtualKey = vKey;
+				state.tapHold.pressTime = now;
+				state.tapHold.timeout = tapTimeout;
+				state.tapHold.layer = state.activeLayer;
+				state.tapHold.count = 0;
+				state.pressedKeys.press(key, now, nullptr);
+				*out_action = spec->getNoAction();
+				return true;
+			}
 		}
 
-		// 2. Check if received key is a modifier.
+		// 5. Check if received key is a modifier.
 		if (_updateKeyboardState(scancode, flag_keyup))
 		{
+			// Modifiers are tracked as pressed keys too, but need no slot; their command never changes.
+			if (flag_keyup)
+				state.pressedKeys.release(key);
+			else
+			{
+				*out_repeated = state.pressedKeys.isPressed(key);
+				state.pressedKeys.press(key, now, nullptr);
+			}
 			// If so, return no action but still block the input.
 			// No scancode registered as modifier is allowed to also
 			// be mapped into something else.
-			*out_action = noAction;
+			*out_action = spec->getNoAction();
 			return true;	// Since no action should be taken, input should also be blocked.
 		}
 
-		// 3. Ask the currently active layer for the action corresponding to this.
+		// 6. Releases and repeats go to the command the key got when it was pressed,
+		// even if the modifiers changed since.
+		size_t slot = state.pressedKeys.findSlot(key);
+		bool hasSlot = slot != PressedKeys::NO_SLOT;
+		if (hasSlot && (flag_keyup || now - state.pressedKeys.slotTimes[slot] <= PressedKeys::MAX_REPEAT_INTERVAL))
+		{
+			BaseKeystrokeCommand* pressCommand = state.pressedKeys.slotCommands[slot];
+			if (flag_keyup)
+				state.pressedKeys.release(key);
+			else
+			{
+				state.pressedKeys.slotTimes[slot] = now;
+				*out_repeated = true;
+			}
+			*out_action = pressCommand;		// even if it's null
+			return pressCommand;				// true if command is not null
+		}
+		// A press of a key with a stale slot is a fresh press; its release was lost.
+		bool repeated = !flag_keyup && !hasSlot && state.pressedKeys.isPressed(key);
+		if (hasSlot)
+			state.pressedKeys.release(key);
+
+		// 7. Ask the currently active layer for the action corresponding to this.
 		// If there is no currently active layer (probably because of an invalid
 		// combination of modifiers), then the resulting action should be no action.
 		BaseKeystrokeCommand* command;
-		if (activeLayer == nullptr)
+		if (state.activeLayer == nullptr)
 		{
-			command = noAction;
+			command = spec->getNoAction();
 		}
 		else
 		{
-			command = activeLayer->getCommand(scancode);
+			command = state.activeLayer->getCommand(scancode);
 		}
 
 
-		// 4. In case of a keyup, we should not check for dead keys. That is, return immediately.
-		if (flag_keyup)
+		// 8. In case of a keyup (of a key pressed with all slots taken, or before this keyboard
+		// was reset), or a repeat of a key pressed with all slots taken, we should not check
+		// for dead keys. That is, return immediately.
+		if (flag_keyup || repeated)
 		{
+			if (flag_keyup)
+				state.pressedKeys.release(key);
+			*out_repeated = repeated;
 			*out_action = command;	// <- even if it's null.
 			return command;			// true if command is not null
 		}
 
-		// 5. If there is an active dead key, the obtained command goes to it,
-		// then the dead key (containing the new command) is returned.
-		if (activeDeadKey)
+		// 9. A key that may begin a chord is held back until the chord is complete,
+		// or turns out not to be one. Not while a dual-role modifier holds keys back (a key
+		// pressed again after its slot went stale gets here), so that a single resolution never
+		// replays the keys of both.
+		if (state.activeLayer && !state.tapHold.modifier)
 		{
-			if (command)		// Even if the command is not Unicode.
-				activeDeadKey->setNextCommand(command);
-			else
-				activeDeadKey->setNextCommand(vKey);
+			ChordMask chordKey = state.activeLayer->getChordKey(scancode);
+			if (chordKey && state.activeLayer->isChordPrefix(chordKey))
+			{
+				state.chord.layer = state.activeLayer;
+				state.chord.keys = 0;
+				state.chord.firstPressTime = now;
+				state.chord.count = 0;
+				_holdChordKey(key, scancode, vKey, chordKey, now);
+				*out_action = spec->getNoAction();
+				return true;
+			}
+		}
 
-			*out_action = activeDeadKey;
-			activeDeadKey = nullptr;
-			return true;
+		return _evaluatePress(key, now, command, out_action);
+	}
+
+
+	bool Keyboard::_evaluatePress(USHORT key, DWORD now, BaseKeystrokeCommand* command,
+		OUT PKeystrokeCommand*const out_action)
+	{
+		// 0. A dead key that waited too long is sent by itself, before the key that ends up following it
+		if (state.activeDeadKey && _deadKeyTimeLeft(now) == 0)
+		{
+			_defer(state.activeDeadKey);
+			state.activeDeadKey = nullptr;
 		}
-		// 6. If obtained command is a dead key, it gets stored in this keyboard
+
+		// 1. If there is an active dead key, it's combined with the obtained command:
+		// a replacement if the dead key has one for it, or else the character its combining mark
+		// composes, otherwise the dead key followed by the command (see DeadKeyOutput; the spec
+		// made them all when it compiled the layers).
+		// Pressing the same dead key twice sends it twice.
+		// Repeats of the key only send the replacement, or the command alone.
+		if (state.activeDeadKey)
+		{
+			if (!command)
+			{
+				// Unmapped key; only the dead key is sent
+				state.pressedKeys.press(key, now, nullptr);
+				*out_action = state.activeDeadKey;
+				state.activeDeadKey = nullptr;
+				return true;
+			}
+			const DeadKeyOutput* output = spec->findDeadKeyOutput(state.activeDeadKey, command);
+			if (output)
+			{
+				state.pressedKeys.press(key, now, output->pressed);
+				*out_action = output->action;
+				state.activeDeadKey = nullptr;
+				return true;
+			}
+
+			// A command of no layer (a key let through as it was): the dead key goes first, by
+			// itself, and the key is then pressed like any other.
+			_defer(state.activeDeadKey);
+			state.activeDeadKey = nullptr;
+		}
+		// 2. If obtained command is a dead key, it gets stored in this keyboard
 		// Try to cast it into a dead key; that will check if the object is a DeadKeyCommand,
 		// and will also result in the already cast pointer.
 		DeadKeyCommand* deadKeyCommand = dynamic_cast<DeadKeyCommand*>(command);
 		if (deadKeyCommand)
 		{
-			activeDeadKey = deadKeyCommand;
-			*out_action = noAction;
+			// Holding a dead key down doesn't press it again
+			state.pressedKeys.press(key, now, spec->getNoAction());
+			state.activeDeadKey = deadKeyCommand;
+			state.deadKeyTime = now;
+			*out_action = spec->getNoAction();
 			return true;
 		}
 
-		// 7. Return the actual command
+		// 3. A compose key starts a sequence; the keys after it are followed in evaluateKey
+		ComposeCommand* composeCommand = dynamic_cast<ComposeCommand*>(command);
+		if (composeCommand)
+		{
+			state.pressedKeys.press(key, now, spec->getNoAction());
+			state.activeCompose = composeCommand;
+			state.composeState = ComposeTable::START;
+			*out_action = spec->getNoAction();
+			return true;
+		}
+
+		// 4. Return the actual command, and remember it for the repeats and the release
+		state.pressedKeys.press(key, now, command);
 		*out_action = command;	// even if it's null
 		return command;			// returns true if non-null
-
 	}
 
 
-	void Keyboard::resetModifierState()
+	Keyboard::TypedText Keyboard::_typedText(Scancode scancode, BYTE vKey, bool blocked, PKeystrokeCommand action,
+		OUT wchar_t *const out_characters, OUT size_t *const out_count)
 	{
-		// Lets the modifier state take care of this
-		this->modifierStateMap->resetAllModifiers();
-		// But also update the current layer
-		for (auto it = this->layers.begin(); it != this->layers.end(); it++)
+		if (blocked)
 		{
-			if (this->modifierStateMap->checkState(*it))
+			const INPUT* inputs = nullptr;
+			size_t inputCount = 0;
+			if (!action || !static_cast<BaseKeystrokeCommand*>(action)->getInputs(false, false, &inputs, &inputCount))
+				return TypedText::Other;
+			// Virtual keys (macros), or more text than any keystroke should type
+			if (inputCount > MAX_KEYSTROKE_TEXT)
+				return TypedText::Other;
+			for (size_t i = 0; i < inputCount; i++)
 			{
-				this->activeLayer = *it;
-				break;
+				if (!(inputs[i].ki.dwFlags & KEYEVENTF_UNICODE))
+					return TypedText::Other;
+				out_characters[i] = inputs[i].ki.wScan;
 			}
-			this->activeLayer = nullptr;
+			*out_count = inputCount;
+			return inputCount ? TypedText::Characters : TypedText::Nothing;
 		}
-		return;
+
+		if (vKey == VK_SHIFT || vKey == VK_LSHIFT || vKey == VK_RSHIFT || vKey == VK_CAPITAL)
+			return TypedText::Nothing;
+
+		// The layout of the window being typed in, not of this thread. Flag 4 keeps ToUnicodeEx from
+		// changing the keyboard state of the system, so that a dead key there isn't used up.
+		BYTE keyState[256] = { 0 };
+		if (state.shiftKeys)
+			keyState[VK_SHIFT] = 0x80;
+		UINT scan = scancode.makeCode | (scancode.flgE0 ? 0xe000 : 0);
+		int count = ToUnicodeEx(vKey, scan, keyState, out_characters, (int)MAX_KEYSTROKE_TEXT, 4, _foregroundLayout());
+
+		// Not a character (arrows, Enter, Backspace...), or a dead key
+		if (count <= 0 || out_characters[0] < 0x20)
+			return TypedText::Other;
+		*out_count = (size_t)count;
+		return TypedText::Characters;
 	}
 
-	Keyboard::~Keyboard()
+
+	HKL Keyboard::_foregroundLayout()
+	{
+		HWND window = GetForegroundWindow();
+		DWORD now = GetTickCount();
+		if (window != layoutWindow || layout == NULL || now - layoutTime > LAYOUT_CACHE_TIME)
+		{
+			layoutWindow = window;
+			layout = GetKeyboardLayout(GetWindowThreadProcessId(window, NULL));
+			layoutTime = now;
+		}
+		return layout;
+	}
+
+
+	bool Keyboard::_compose(Scancode scancode, BYTE vKey, bool blocked, OUT PKeystrokeCommand*const out_action)
+	{
+		wchar_t characters[MAX_KEYSTROKE_TEXT];
+		size_t characterCount = 0;
+		TypedText typed = _typedText(scancode, vKey, blocked, *out_action, characters, &characterCount);
+		if (typed == TypedText::Nothing)
+			return blocked;		// Like shift, or a dead key waiting; the sequence goes on
+
+		const ComposeTable& table = state.activeCompose->getTable();
+		ComposeTable::State composeState = (typed == TypedText::Other) ? ComposeTable::NO_STATE : state.composeState;
+		for (size_t i = 0; i < characterCount && composeState != ComposeTable::NO_STATE; i++)
+		{
+			// A complete sequence can't go on
+			if (table.isComplete(composeState))
+				composeState = ComposeTable::NO_STATE;
+			else
+				composeState = table.next(composeState, characters[i]);
+		}
+
+		if (composeState == ComposeTable::NO_STATE)
+		{
+			// Not a sequence: the compose key is let go, and the key does what it would have done
+			state.activeCompose = nullptr;
+			return blocked;
+		}
+
+		BaseKeystrokeCommand* result;
+		if (table.isComplete(composeState))
+		{
+			result = table.getOutput(composeState);
+			state.activeCompose = nullptr;
+		}
+		else
+		{
+			result = spec->getNoAction();
+			state.composeState = composeState;
+		}
+
+		// Its repeats and release go to the same command
+		size_t slot = state.pressedKeys.findSlot(PressedKeys::indexOf(scancode));
+		if (slot != PressedKeys::NO_SLOT)
+			state.pressedKeys.slotCommands[slot] = result;
+		*out_action = result;
+		return true;
+	}
+
+
+	bool Keyboard::_expand(Scancode scancode, BYTE vKey, bool blocked, OUT PKeystrokeCommand*const out_action)
+	{
+		const ExpansionAutomaton* expansions = spec->getExpansions();
+
+		// 1. Find out the characters typed
+		wchar_t characters[MAX_KEYSTROKE_TEXT];
+		size_t characterCount = 0;
+		TypedText typed = _typedText(scancode, vKey, blocked, *out_action, characters, &characterCount);
+		if (typed == TypedText::Nothing)
+			return blocked;		// Like a modifier, or a dead key waiting; the trigger may go on
+		if (typed == TypedText::Other)
+		{
+			state.expansionState = ExpansionAutomaton::START;
+			return blocked;
+		}
+
+		// 2. Follow them
+		for (size_t i = 0; i < characterCount; i++)
+			state.expansionState = expansions->next(state.expansionState, characters[i]);
+
+		// 3. Expansions assume their trigger was typed a character per keystroke, and only the last
+		// one is still to be sent; the keystroke sends the expansion instead.
+		bool singleCharacter = characterCount == 1
+			|| (characterCount == 2 && characters[1] >= 0xdc00 && characters[1] <= 0xdfff);
+		ExpansionCommand* expansion = singleCharacter ? expansions->getExpansion(state.expansionState) : nullptr;
+		if (!expansion)
+			return blocked;
+
+		// Its repeats and release go to the expansion too, which ignores them
+		size_t slot = state.pressedKeys.findSlot(PressedKeys::indexOf(scancode));
+		if (slot != PressedKeys::NO_SLOT)
+			state.pressedKeys.slotCommands[slot] = expansion;
+		*out_action = expansion;
+		// The expansion's text doesn't continue a trigger
+		state.expansionState = ExpansionAutomaton::START;
+		return true;
+	}
+
+
+	void Keyboard::_holdChordKey(USHORT key, Scancode scancode, BYTE vKey, ChordMask chordKey, DWORD now)
+	{
+		state.chord.scancodes[state.chord.count] = scancode;
+		state.chord.virtualKeys[state.chord.count] = vKey;
+		state.chord.count++;
+		state.chord.keys |= chordKey;
+
+		// Until the chord is resolved, its keys do nothing on repeat or release
+		state.pressedKeys.press(key, now, spec->getNoAction());
+	}
+
+
+	void Keyboard::_resolveChord(DWORD now)
+	{
+		const Layer* chordLayer = state.chord.layer;
+		state.chord.layer = nullptr;
+
+		// The held keys make a chord, even if a longer one could have followed
+		BaseKeystrokeCommand* chordCommand = chordLayer->getChord(state.chord.keys);
+		if (chordCommand)
+		{
+			_defer(chordCommand);
+			return;
+		}
+
+		// Otherwise, every held key is pressed by itself, in order, as if it had never been held.
+		for (size_t i = 0; i < state.chord.count; i++)
+			_deferPress(chordLayer, state.chord.scancodes[i], state.chord.virtualKeys[i], now);
+	}
+
+
+	bool Keyboard::_isHeldForTapHold(Scancode scancode) const
+	{
+		for (size_t i = 0; i < state.tapHold.count; i++)
+		{
+			if (state.tapHold.scancodes[i] == scancode)
+				return true;
+		}
+		return false;
+	}
+
+
+	void Keyboard::_resolveTapHold(bool held, DWORD now)
+	{
+		ModifierMask modifier = state.tapHold.modifier;
+		state.tapHold.modifier = 0;
+
+		// Held: the modifier is pressed from now on (and released with its key, like any other)
+		if (held)
+		{
+			state.modifiers |= modifier;
+			state.activeLayer = spec->findLayer(state.modifiers);
+		}
+		// Tapped: it's pressed as a key, in the layer it was pressed in
+		else
+			_deferPress(state.tapHold.layer, state.tapHold.scancode, state.tapHold.virtualKey, now);
+
+		// Then the keys pressed meanwhile, in order, in the layer that's now active
+		for (size_t i = 0; i < state.tapHold.count; i++)
+			_deferPress(state.activeLayer, state.tapHold.scancodes[i], state.tapHold.virtualKeys[i], now);
+	}
+
+
+	void Keyboard::_deferPress(const Layer* layer, Scancode scancode, BYTE vKey, DWORD now)
+	{
+		// Keys without a command of their own are sent as they were
+		BaseKeystrokeCommand* command = layer ? layer->getCommand(scancode) : nullptr;
+		if (!command)
+			command = spec->getPassthrough(vKey);
+
+		PKeystrokeCommand action = nullptr;
+		if (_evaluatePress(PressedKeys::indexOf(scancode), now, command, &action) && action->hasEffect())
+			_defer(action);
+	}
+
+
+	void Keyboard::_defer(PKeystrokeCommand action)
 	{
-		// Destroy all layers
-		for (auto it = this->layers.begin(); it != this->layers.end(); it++)
+		// Never full: a single evaluation defers at most a dead key and the keys of one chord, or
+		// a dual-role modifier and the keys held after it (see MAX_DEFERRED_ACTIONS and
+		// MAX_TAP_HOLD_KEYS), and they're all taken right after it.
+		if (state.deferred.count == MAX_DEFERRED_ACTIONS)
 		{
-			delete (*it);
+#if DEBUG
+			OutputDebugString(L"Too many deferred actions; one was dropped\n");
+#endif
+			return;
 		}
-		// Destroy the modifier state map
-		delete this->modifierStateMap;
+		state.deferred.actions[(state.deferred.first + state.deferred.count) % MAX_DEFERRED_ACTIONS] = action;
+		state.deferred.count++;
+
+		// What it types isn't followed in the expansions; a trigger can't go on across it
+		state.expansionState = ExpansionAutomaton::START;
+	}
+
+
+	DWORD Keyboard::_deadKeyTimeLeft(DWORD now) const
+	{
+		DWORD timeout = state.activeDeadKey->timeout;
+		if (timeout == 0)
+			return INFINITE;
+		DWORD elapsed = now - state.deadKeyTime;
+		return elapsed < timeout ? timeout - elapsed : 0;
+	}
+
+
+	DWORD Keyboard::expire()
+	{
+		DWORD now = GetTickCount();
+		DWORD next = INFINITE;		// Time left until the earliest of those still waiting
+
+		// At most one of them holds keys back at a time. Resolving them may still end a dead key.
+		if (state.chord.layer)
+		{
+			DWORD elapsed = now - state.chord.firstPressTime;
+			if (elapsed < spec->getChordWindow())
+				next = spec->getChordWindow() - elapsed;
+			else
+				_resolveChord(now);
+		}
+		if (state.tapHold.modifier)
+		{
+			DWORD elapsed = now - state.tapHold.pressTime;
+			if (elapsed < state.tapHold.timeout)
+				next = state.tapHold.timeout - elapsed;
+			else
+				_resolveTapHold(true, now);
+		}
+
+		// A dead key alone waits for the next key, not for keys held back
+		if (state.activeDeadKey && !state.chord.layer && !state.tapHold.modifier)
+		{
+			DWORD left = _deadKeyTimeLeft(now);
+			if (left == 0)
+			{
+				_defer(state.activeDeadKey);
+				state.activeDeadKey = nullptr;
+			}
+			else if (left < next)
+				next = left;
+		}
+
+		return next == INFINITE ? 0 : next;
+	}
+
+
+	bool Keyboard::takeDeferredAction(OUT PKeystrokeCommand*const out_action)
+	{
+		if (state.deferred.count == 0)
+			return false;
+		*out_action = state.deferred.actions[state.deferred.first];
+		state.deferred.first = (BYTE)((state.deferred.first + 1) % MAX_DEFERRED_ACTIONS);
+		state.deferred.count--;
+		return true;
+	}
+
+
+	void Keyboard::resetModifierState()
+	{
+		state.modifiers = 0;
+		state.activeLayer = spec->findLayer(0);
+	}
+
+	void Keyboard::releaseAllKeys()
+	{
+		state.pressedKeys.clear();
+		state.chord.layer = nullptr;		// Keys held for a chord or a dual-role modifier are dropped
+		state.tapHold.modifier = 0;
+		state.activeCompose = nullptr;
+		state.shiftKeys = 0;
+		state.expansionState = ExpansionAutomaton::START;
+		resetModifierState();
+	}
+
+	void Keyboard::resetState()
+	{
+		state = spec->initialState();
+	}
+
+	KeyboardState Keyboard::snapshotState() const
+	{
+		return state;
+	}
+
+	void Keyboard::restoreState(const KeyboardState& snapshot)
+	{
+		state = snapshot;
+	}
+
+
+	Keyboard::~Keyboard()
+	{
 	}
 }
\ No newline at end of file
@@ -1,33 +1,37 @@
 #pragma once
 
 #include "stdafx.h"
-#include "Layer.h"
-#include "Modifier.h"
+#include "KeyboardSpec.h"
 
 namespace Multikeys
 {
+	// A keyboard in use: a shared, immutable KeyboardSpec plus the state of this instance.
+	// Many keyboards may share one spec; each costs the size of a KeyboardState, and nothing is
+	// allocated while keys are evaluated.
+	// The state has a single writer: evaluateKey must never run concurrently for the same
+	// Keyboard. Different keyboards may be evaluated by different threads, even if they share a spec.
 	class Keyboard
 	{
 	private:
 
-		// Set of modifiers registered in this keyboard. This object will listen to
-		// these specific keys as modifiers and keep track of their state internally.
-		ModifierStateMap * modifierStateMap;
+		// Layers, modifiers and commands of this keyboard
+		const std::shared_ptr<const KeyboardSpec> spec;
 
-		// Initialize in constructor - keep an empty command in memory, since it's
-		// frequently returned.
-		BaseKeystrokeCommand* noAction;
+		// Pressed modifiers, active layer and dead key
+		KeyboardState state;
 
-		// All layers belonging to this keyboard's layout
-		const std::vector<Layer*> layers;
-		// Const containers return const references.
+		// Layout of the foreground window, as last looked up for text typed without remapping,
+		// the window it was looked up for, and when. Only touched by the evaluating thread.
+		HWND layoutWindow;
+		HKL layout;
+		DWORD layoutTime;
 
-		// Currently active layer; null if the current combination of modifiers corresponds
-		// to no layer.
-		Layer* activeLayer;
+		// How long (in ms) the layout is kept while the foreground window stays the same; the
+		// user may switch the layout of a window, and nothing tells this keyboard.
+		static const DWORD LAYOUT_CACHE_TIME = 1000;
 
-		// Pointer to a dead key waiting for the next character; null when no dead key is active.
-		DeadKeyCommand * activeDeadKey;
+		Keyboard(const Keyboard&) = delete;
+		Keyboard& operator=(const Keyboard&) = delete;
 
 		// Call this function to check for modifiers.
 		// If the key described by the parameters is a modifier, the internal state of
@@ -36,16 +40,84 @@ namespace Multikeys
 		// false is returned.
 		bool _updateKeyboardState(Scancode sc, bool flag_keyup);
 
+		// Evaluates a fresh press of a key whose command is known, combining it with the
+		// active dead key; the key is remembered as pressed with whatever command it got.
+		bool _evaluatePress(USHORT key, DWORD now, BaseKeystrokeCommand* command,
+			OUT PKeystrokeCommand*const out_action);
+
+		// Adds a pressed key to state.chord, which must already have its layer set.
+		void _holdChordKey(USHORT key, Scancode scancode, BYTE vKey, ChordMask chordKey, DWORD now);
+
+		// Resolves the keys held in state.chord into deferred actions: the chord they make, or else
+		// each key pressed by itself. state.chord is left empty.
+		void _resolveChord(DWORD now);
+
+		// Whether the key was pressed after the dual-role modifier in state.tapHold, and held back.
+		bool _isHeldForTapHold(Scancode scancode) const;
+
+		// Resolves the dual-role modifier in state.tapHold as held (the modifier gets pressed) or
+		// tapped (its key gets pressed), then presses the keys held back after it, as deferred actions.
+		void _resolveTapHold(bool held, DWORD now);
+
+		// Evaluates a fresh press of a key held back earlier, in the given layer, and queues its action.
+		void _deferPress(const Layer* layer, Scancode scancode, BYTE vKey, DWORD now);
+
+		// Time (in ms) until the active dead key, which must not be null, times out:
+		// 0 if it already did, INFINITE if it never does.
+		DWORD _deadKeyTimeLeft(DWORD now) const;
+
+		// Queues an action to be taken with takeDeferredAction.
+		void _defer(PKeystrokeCommand action);
+
+		// Remaps a keystroke, as described in evaluateKey, without looking for text expansions.
+		bool _evaluateKeystroke(
+			Scancode scancode, BYTE vKey, bool flag_keyup,
+			OUT PKeystrokeCommand*const out_action,
+			OUT bool*const out_repeated);
+
+		// What a fresh press types
+		enum class TypedText
+		{
+			Characters,		// Some text
+			Nothing,		// Nothing at all, like a modifier or a dead key waiting
+			Other			// Anything else, like virtual keys or launching a program
+		};
+
+		// Finds what a fresh press types: the Unicode inputs of its action if blocked, or the
+		// characters of the key in the foreground window's layout if not. out_characters must have
+		// room for MAX_KEYSTROKE_TEXT code values; out_count is only set for TypedText::Characters.
+		TypedText _typedText(Scancode scancode, BYTE vKey, bool blocked, PKeystrokeCommand action,
+			OUT wchar_t *const out_characters, OUT size_t *const out_count);
+
+		// The layout of the foreground window; looked up again only when the window changes,
+		// or when the one known is older than LAYOUT_CACHE_TIME.
+		HKL _foregroundLayout();
+
+		// Follows what a fresh press typed in the sequences of the active compose key. Until a sequence
+		// is complete, its keys type nothing; then the last one gets its output, and true is returned.
+		// If the press doesn't go on with any sequence, the compose key is let go, and the press keeps
+		// its action; blocked is returned.
+		bool _compose(Scancode scancode, BYTE vKey, bool blocked, OUT PKeystrokeCommand*const out_action);
+
+		// Follows what a fresh press typed in the spec's expansions. If it completes a trigger, the
+		// press gets its expansion instead, and true is returned; otherwise returns blocked, and the
+		// action is left alone.
+		bool _expand(Scancode scancode, BYTE vKey, bool blocked, OUT PKeystrokeCommand*const out_action);
+
 	public:
 
-		// Public name of this device; wide string in conformity with the Raw Input API.
-		const std::wstring deviceName;
+		// spec - Compiled keyboard; may be shared with other Keyboard objects.
+		// Starts with no modifier pressed.
+		Keyboard(std::shared_ptr<const KeyboardSpec> spec);
 
-		// name - Name to serve as unique identifier for this keyboard.
-		// layers - Pointers to layers; may delete after calling this.
-		// modifers - structure of ModiferStateMap already initialized with Modifiers
-		//			ownership of pointer is transferred to this Keyboard object.
-		Keyboard(const std::wstring name, const std::vector<Layer*>& layers, ModifierStateMap* modifiers);
+		// The spec this keyboard runs
+		const KeyboardSpec& getSpec() const;
+
+		// Public name of this device; same as the spec's.
+		const std::wstring& getDeviceName() const;
+
+		// Devices this keyboard is for, if not found by name; same as the spec's.
+		const DevicePattern& getDevicePattern() const;
 
 		// Receives information about a keypress, and returns true if the keystroke should
 		// be blocked.
@@ -54,14 +126,43 @@ namespace Multikeys
 		// flag_keyup - true if this keystroke information is for a key release
 		// out_action - pointer to an IKeystrokeCommand*; if this function returns TRUE,
 		//			that pointer will point to the remapped command to be executed.
+		// out_repeated - set to true if this is a press of a key that was already down.
+		// Repeats and the release of a key get the same command as its press.
+		// Presses after a compose key make up its sequence, and the last one gets its output.
+		// A press that completes the trigger of a text expansion gets the expansion instead.
 		bool evaluateKey(
 			Scancode scancode, BYTE vKey, bool flag_keyup,
-			OUT PKeystrokeCommand*const out_action);
+			OUT PKeystrokeCommand*const out_action,
+			OUT bool*const out_repeated);
+
+		// Resolves the keys held back for a chord or a dual-role modifier, and sends a dead key
+		// that waited for the next key, if their time is up. The results are taken with
+		// takeDeferredAction. Returns the time (in ms) until the next of them still waiting
+		// is due, or 0 if there are none.
+		DWORD expire();
+
+		// Takes the oldest action resolved late, for keys held back earlier.
+		// Returns false if there's none. See IRemapper.
+		bool takeDeferredAction(OUT PKeystrokeCommand*const out_action);
 
 		// Set the internal state of all modifiers to unpressed.
 		void resetModifierState();
 
-		// Destructor
+		// Forgets every pressed key and modifier, as if all of them had been released; for when
+		// their releases can't arrive (like on the secure desktop). No command is executed.
+		void releaseAllKeys();
+
+		// Back to the initial state: no modifier pressed and no dead key active.
+		void resetState();
+
+		// Copy of the current state, to be given back to restoreState later.
+		KeyboardState snapshotState() const;
+
+		// Replaces the current state with one taken from a keyboard with the same spec.
+		// The snapshot may refer to commands of that keyboard, so it must outlive this state.
+		void restoreState(const KeyboardState& snapshot);
+
+		// Deletes the commands this keyboard made up.
 		~Keyboard();
 
 	};
@@ -0,0 +1,390 @@
+#include "stdafx.h"
+#include "KeyboardSpec.h"
+#include "KeystrokeCommands.h"
+
+#include <algorithm>	// for std::find and std::stable_sort
+
+// Implementation of methods defined in KeyboardSpec.h
+
+namespace Multikeys
+{
+	// Number of modifiers in a mask
+	static size_t CountModifiers(ModifierMask mask)
+	{
+		size_t count = 0;
+		for (; mask != 0; mask &= mask - 1)
+			count++;
+		return count;
+	}
+
+
+	KeyboardSpec::KeyboardSpec(const std::wstring name,
+		const std::vector<std::shared_ptr<const Layer>>& layers, const std::vector<PModifier>& modifiers,
+		DWORD chordWindow, const ExpansionAutomaton* expansions, CommandPool *const pool,
+		const DevicePattern& devicePattern)
+		: modifiers(modifiers), layers(layers), chordWindow(0), expansions(expansions), flattenedMemoryUsage(0),
+		timeout(0), pool(pool), deadKeyTableCount(0), deviceName(name), devicePattern(devicePattern)
+	{
+		noAction = new EmptyCommand();
+		for (size_t i = 0; i < passthroughs.size(); i++)
+			passthroughs[i] = new PassthroughCommand((BYTE)i);
+
+		// Keys are only ever held back for chords, and only by keyboards that have some
+		for (auto layer = this->layers.begin(); layer != this->layers.end(); layer++)
+		{
+			if ((*layer)->hasChords())
+				this->chordWindow = chordWindow;
+		}
+
+		// The timer of a keyboard must fire as soon as the earliest of these is due
+		timeout = this->chordWindow;
+		for (size_t i = 0; i < this->modifiers.size() && i < MAX_MODIFIERS; i++)
+		{
+			DWORD tapTimeout = this->modifiers[i]->tapTimeout;
+			if (tapTimeout > 0 && (timeout == 0 || tapTimeout < timeout))
+				timeout = tapTimeout;
+		}
+		for (auto layer = this->layers.begin(); layer != this->layers.end(); layer++)
+		{
+			DWORD deadKeyTimeout = (*layer)->getDeadKeyTimeout();
+			if (deadKeyTimeout > 0 && (timeout == 0 || deadKeyTimeout < timeout))
+				timeout = deadKeyTimeout;
+		}
+
+		// Translate the modifier names of each layer into bits, once, so that matching a layer is
+		// a single AND and compare. Names that aren't modifiers of this keyboard are ignored.
+		for (auto layer = this->layers.begin(); layer != this->layers.end(); layer++)
+		{
+			ModifierMask mask = 0;
+			ModifierMask careMask = 0;
+			for (size_t i = 0; i < this->modifiers.size() && i < MAX_MODIFIERS; i++)
+			{
+				const std::vector<std::wstring>& names = (*layer)->modifierCombination;
+				const std::vector<std::wstring>& ignored = (*layer)->ignoredModifiers;
+				if (std::find(ignored.begin(), ignored.end(), this->modifiers[i]->name) != ignored.end())
+					continue;
+				careMask |= 1ULL << i;
+				if (std::find(names.begin(), names.end(), this->modifiers[i]->name) != names.end())
+					mask |= 1ULL << i;
+			}
+			layerMasks.push_back(mask);
+			layerCareMasks.push_back(careMask);
+		}
+
+		// Where several layers match, the one ignoring fewer modifiers wins: it was written for
+		// that state in particular. The first in document order wins a tie.
+		layerPrecedence.resize(this->layers.size());
+		for (size_t i = 0; i < layerPrecedence.size(); i++)
+			layerPrecedence[i] = i;
+		std::stable_sort(layerPrecedence.begin(), layerPrecedence.end(), [this](size_t a, size_t b)
+		{
+			return CountModifiers(layerCareMasks[a]) > CountModifiers(layerCareMasks[b]);
+		});
+
+		// The first modifier matching a scancode wins, as if they were asked in order
+		modifierIndex.fill(0);
+		for (size_t prefix = 0; prefix < 3; prefix++)
+		{
+			for (size_t makeCode = 0; makeCode < 256; makeCode++)
+			{
+				Scancode sc(prefix == 2, prefix == 1, (BYTE)makeCode);
+				for (size_t i = 0; i < this->modifiers.size() && i < MAX_MODIFIERS; i++)
+				{
+					if (this->modifiers[i]->matches(sc))
+					{
+						modifierIndex[_modifierIndexOf(sc)] = (unsigned char)(i + 1);
+						break;
+					}
+				}
+			}
+		}
+
+		_flattenTransparentLayers();
+
+		// A table for the layers built so far, and one for each of the others at most
+		deadKeyTables.reset(new std::unique_ptr<const DeadKeyOutputTable>[this->layers.size() + 1]);
+		layerReady.reset(new std::atomic<bool>[this->layers.size()]);
+		std::vector<size_t> built;
+		for (size_t i = 0; i < this->layers.size(); i++)
+		{
+			layerReady[i] = false;
+			bool isBuilt = true;
+			for (const Layer* layer = this->layers[i].get(); layer; layer = layer->getBase())
+				isBuilt = isBuilt && layer->isBuilt();
+			if (isBuilt)
+				built.push_back(i);
+		}
+		_addDeadKeyOutputs(built);
+	}
+
+
+	size_t KeyboardSpec::_modifierIndexOf(Scancode sc)
+	{
+		return sc.makeCode + (sc.flgE1 ? 2 * 256 : sc.flgE0 ? 256 : 0);
+	}
+
+
+	void KeyboardSpec::_flattenTransparentLayers()
+	{
+		// Layers with fewer modifiers first, so that the layer below each one is already flattened
+		std::vector<size_t> order(layers.size());
+		for (size_t i = 0; i < order.size(); i++)
+			order[i] = i;
+		std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b)
+		{
+			return CountModifiers(layerMasks[a]) < CountModifiers(layerMasks[b]);
+		});
+
+		for (size_t k = 0; k < order.size(); k++)
+		{
+			size_t i = order[k];
+			if (!layers[i]->transparent)
+				continue;
+
+			// The layer below: most modifiers among those whose modifiers are a proper subset of
+			// this one's, the first one in document order on a tie
+			size_t below = layers.size();
+			for (size_t j = 0; j < layers.size(); j++)
+			{
+				bool isSubset = (layerMasks[j] & ~layerMasks[i]) == 0 && layerMasks[j] != layerMasks[i];
+				if (isSubset && (below == layers.size()
+					|| CountModifiers(layerMasks[j]) > CountModifiers(layerMasks[below])))
+					below = j;
+			}
+			if (below == layers.size())
+				continue;		// Nothing to fall through to
+
+			// This layer's keys first, then those of the (already flattened) stack below it.
+			// The original stays as the base, for its chords; it's never asked for keys.
+			std::unordered_map<Scancode, BaseKeystrokeCommand*> table;
+			layers[i]->getMappings(&table);
+			layers[below]->getMappings(&table);
+			std::shared_ptr<const Layer> flattened = std::make_shared<const Layer>(
+				layers[i]->modifierCombination, table, std::vector<ChordDefinition>(), layers[i], false,
+				layers[i]->ignoredModifiers);
+			flattenedMemoryUsage += flattened->getMemoryUsage();
+			layers[i] = flattened;
+		}
+	}
+
+
+	// What deadKey followed by command sends; see DeadKeyOutput
+	static DeadKeyOutput CombineDeadKey(DeadKeyCommand* deadKey, BaseKeystrokeCommand* command, CommandPool* pool)
+	{
+		UnicodeCommand* replacement = deadKey->findReplacement(command);
+		if (!replacement)
+		{
+			// Like replacements, composed characters are sent again by each repeat of the key
+			unsigned int composed = deadKey->findComposition(command);
+			if (composed)
+				replacement = pool->internUnicode(std::vector<unsigned int>(1, composed), true);
+		}
+		if (replacement)
+			return DeadKeyOutput{ replacement, replacement };
+		return DeadKeyOutput{ pool->internSequence(deadKey, command), command };
+	}
+
+
+	void KeyboardSpec::_addDeadKeyOutputs(const std::vector<size_t>& layerIndices) const
+	{
+		std::lock_guard<std::mutex> lock(deadKeyMutex);
+
+		// Commands of the layers not covered yet; another thread may have just done some of them
+		std::vector<size_t> added;
+		std::vector<BaseKeystrokeCommand*> newCommands;
+		std::vector<DeadKeyCommand*> newDeadKeys;
+		for (size_t k = 0; k < layerIndices.size(); k++)
+		{
+			size_t i = layerIndices[k];
+			if (layerReady[i].load(std::memory_order_relaxed))
+				continue;
+			added.push_back(i);
+
+			std::unordered_map<Scancode, BaseKeystrokeCommand*> mappings;
+			layers[i]->getMappings(&mappings);		// Builds the layer and its base
+			for (auto it = mappings.begin(); it != mappings.end(); it++)
+			{
+				if (!it->second || !tabledCommands.insert(it->second).second)
+					continue;
+				newCommands.push_back(it->second);
+				DeadKeyCommand* deadKey = dynamic_cast<DeadKeyCommand*>(it->second);
+				if (deadKey)
+					newDeadKeys.push_back(deadKey);
+			}
+		}
+
+		// Dead keys covered already, followed by the new commands; then the new dead keys,
+		// followed by every command (the new ones included)
+		std::unique_ptr<DeadKeyOutputTable> table(new DeadKeyOutputTable());
+		for (size_t d = 0; d < tabledDeadKeys.size(); d++)
+		{
+			for (size_t c = 0; c < newCommands.size(); c++)
+				(*table)[DeadKeyPair(tabledDeadKeys[d], newCommands[c])] = CombineDeadKey(tabledDeadKeys[d], newCommands[c], pool);
+		}
+		for (size_t d = 0; d < newDeadKeys.size(); d++)
+		{
+			for (auto command = tabledCommands.begin(); command != tabledCommands.end(); command++)
+				(*table)[DeadKeyPair(newDeadKeys[d], *command)] = CombineDeadKey(newDeadKeys[d], *command, pool);
+		}
+		tabledDeadKeys.insert(tabledDeadKeys.end(), newDeadKeys.begin(), newDeadKeys.end());
+
+		// Published before the layers are marked ready, so that keyboards using them find every output
+		if (!table->empty())
+		{
+			size_t count = deadKeyTableCount.load(std::memory_order_relaxed);
+			deadKeyTables[count] = std::move(table);
+			deadKeyTableCount.store(count + 1, std::memory_order_release);
+		}
+		for (size_t k = 0; k < added.size(); k++)
+			layerReady[added[k]].store(true, std::memory_order_release);
+	}
+
+
+	size_t KeyboardSpec::DeadKeyPairHash::operator()(const DeadKeyPair& pair) const
+	{
+		return std::hash<const void*>()(pair.first) * 31 + std::hash<const void*>()(pair.second);
+	}
+
+
+	void KeyboardSpec::buildLayer(size_t index) const
+	{
+		if (!layerReady[index].load(std::memory_order_acquire))
+			_addDeadKeyOutputs(std::vector<size_t>(1, index));
+	}
+
+
+	const DeadKeyOutput* KeyboardSpec::findDeadKeyOutput(const DeadKeyCommand* deadKey, const BaseKeystrokeCommand* command) const
+	{
+		// A table per activation of a layer built late at most, and usually a single one
+		size_t count = deadKeyTableCount.load(std::memory_order_acquire);
+		DeadKeyPair pair(deadKey, command);
+		for (size_t i = 0; i < count; i++)
+		{
+			auto found = deadKeyTables[i]->find(pair);
+			if (found != deadKeyTables[i]->end())
+				return &found->second;
+		}
+		return nullptr;
+	}
+
+
+	size_t KeyboardSpec::getDeadKeyOutputCount() const
+	{
+		size_t count = deadKeyTableCount.load(std::memory_order_acquire);
+		size_t outputs = 0;
+		for (size_t i = 0; i < count; i++)
+			outputs += deadKeyTables[i]->size();
+		return outputs;
+	}
+
+
+	ModifierMask KeyboardSpec::findModifier(Scancode sc) const
+	{
+		unsigned char position = modifierIndex[_modifierIndexOf(sc)];
+		return position ? 1ULL << (position - 1) : 0;
+	}
+
+
+	const Layer* KeyboardSpec::findLayer(ModifierMask pressedModifiers) const
+	{
+		// Each modifier required by the layer must be pressed, and every other it cares about must not.
+		for (size_t k = 0; k < layerPrecedence.size(); k++)
+		{
+			size_t i = layerPrecedence[k];
+			if ((pressedModifiers & layerCareMasks[i]) == layerMasks[i])
+			{
+				buildLayer(i);
+				return layers[i].get();
+			}
+		}
+		return nullptr;
+	}
+
+
+	KeyboardState KeyboardSpec::initialState() const
+	{
+		KeyboardState state;
+		state.modifiers = 0;
+		state.activeLayer = findLayer(0);
+		state.activeDeadKey = nullptr;
+		state.deadKeyTime = 0;
+		state.activeCompose = nullptr;
+		state.composeState = ComposeTable::START;
+		state.shiftKeys = 0;
+		state.pressedKeys.clear();
+		state.chord.layer = nullptr;
+		state.chord.keys = 0;
+		state.chord.count = 0;
+		state.tapHold.modifier = 0;
+		state.tapHold.count = 0;
+		state.deferred.first = 0;
+		state.deferred.count = 0;
+		state.expansionState = ExpansionAutomaton::START;
+		return state;
+	}
+
+
+	BaseKeystrokeCommand* KeyboardSpec::getNoAction() const
+	{
+		return noAction;
+	}
+
+
+	DWORD KeyboardSpec::getTimeout() const
+	{
+		return timeout;
+	}
+
+
+	size_t KeyboardSpec::getFlattenedMemoryUsage() const
+	{
+		return flattenedMemoryUsage;
+	}
+
+
+	const std::vector<std::shared_ptr<const Layer>>& KeyboardSpec::getLayers() const
+	{
+		return layers;
+	}
+
+
+	DWORD KeyboardSpec::getChordWindow() const
+	{
+		return chordWindow;
+	}
+
+
+	DWORD KeyboardSpec::getTapTimeout(ModifierMask modifier) const
+	{
+		for (size_t i = 0; i < modifiers.size() && i < MAX_MODIFIERS; i++)
+		{
+			if (modifier == 1ULL << i)
+				return modifiers[i]->tapTimeout;
+		}
+		return 0;
+	}
+
+
+	const ExpansionAutomaton* KeyboardSpec::getExpansions() const
+	{
+		return expansions;
+	}
+
+
+	PassthroughCommand* KeyboardSpec::getPassthrough(BYTE virtualKey) const
+	{
+		return passthroughs[virtualKey];
+	}
+
+
+	KeyboardSpec::~KeyboardSpec()
+	{
+		// Destroy all modifiers
+		for (auto it = this->modifiers.begin(); it != this->modifiers.end(); it++)
+			delete (*it);
+		for (size_t i = 0; i < passthroughs.size(); i++)
+			delete passthroughs[i];
+		delete expansions;
+		delete noAction;
+	}
+}
@@ -0,0 +1,295 @@
+#pragma once
+
+#include "stdafx.h"
+#include "Layer.h"
+#include "Modifier.h"
+#include "PressedKeys.h"
+#include "ExpansionAutomaton.h"
+#include "ComposeTable.h"
+#include "DevicePattern.h"
+#include "CommandPool.h"
+
+namespace Multikeys
+{
+	// Time (in ms) the keys of a chord may take to be all pressed, unless the keyboard sets another
+	const DWORD DEFAULT_CHORD_WINDOW = 50;
+
+	// An incomplete chord is resolved into a press of each of its keys, and maybe the dead key
+	// that timed out before them; they must all fit among the deferred actions.
+	static_assert(MAX_CHORD_KEYS + 1 <= (size_t)MAX_DEFERRED_ACTIONS, "Deferred actions can't hold a resolved chord");
+
+	// Keys held back while they may still become a chord
+	struct ChordBuffer
+	{
+		// Layer the keys were pressed in; null while no key is held back
+		const Layer* layer;
+
+		// Chord bits of the held keys, in that layer
+		ChordMask keys;
+
+		// GetTickCount of the first key; the chord must be complete within the chord window from then
+		DWORD firstPressTime;
+
+		// Held keys, in the order they were pressed
+		BYTE count;
+		Scancode scancodes[MAX_CHORD_KEYS];
+		BYTE virtualKeys[MAX_CHORD_KEYS];
+	};
+
+	// Maximum number of keys held back while a dual-role modifier is resolved; its tap, each of
+	// them and the dead key that timed out before them may all become deferred actions.
+	const size_t MAX_TAP_HOLD_KEYS = MAX_DEFERRED_ACTIONS - 2;
+
+	// A dual-role modifier pressed, which may still turn out to be a tap or a hold,
+	// and the keys pressed after it, held back until it does.
+	struct TapHoldBuffer
+	{
+		// Bit of the modifier; 0 while no dual-role modifier is waiting
+		ModifierMask modifier;
+
+		// Layer active when it was pressed, where its tap is looked up
+		const Layer* layer;
+
+		// When it was pressed, for how long it must be held, and its key
+		DWORD pressTime;
+		DWORD timeout;
+		Scancode scancode;
+		BYTE virtualKey;
+
+		// Keys pressed since, in order
+		BYTE count;
+		Scancode scancodes[MAX_TAP_HOLD_KEYS];
+		BYTE virtualKeys[MAX_TAP_HOLD_KEYS];
+	};
+
+	// Most UTF-16 code values a keystroke may type and still be followed in compose sequences and
+	// expansions; text longer than that breaks any sequence or trigger being typed.
+	const size_t MAX_KEYSTROKE_TEXT = 16;
+
+	// Commands resolved for keystrokes held back earlier, waiting to be taken
+	struct DeferredActions
+	{
+		PKeystrokeCommand actions[MAX_DEFERRED_ACTIONS];
+		BYTE first;
+		BYTE count;
+	};
+
+
+	// Live state of one keyboard: which keys and modifiers are pressed, the layer the modifiers
+	// select and the dead key waiting for the next character. Plain data, so creating, copying
+	// (snapshotting) and resetting it are all constant time. Its fields are ordered so that
+	// none is padded: it's 560 bytes in x64 builds, of which pressedKeys takes 320 and the
+	// buffers of keys held back most of the rest.
+	struct KeyboardState
+	{
+		// Bit i is set while the i-th modifier of the spec is pressed
+		ModifierMask modifiers;
+
+		// Layer selected by the modifiers; null if no layer matches them.
+		const Layer* activeLayer;
+
+		// Dead key waiting for the next character; null when no dead key is active.
+		DeadKeyCommand* activeDeadKey;
+
+		// Compose key whose sequence is being typed, and how far it got; null when none is active.
+		const ComposeCommand* activeCompose;
+		ComposeTable::State composeState;
+
+		// GetTickCount when the active dead key was pressed, for its timeout
+		DWORD deadKeyTime;
+
+		// Where the characters typed so far lead in the spec's expansions
+		ExpansionAutomaton::State expansionState;
+
+		// Shift keys let through to the system, and held down: bit 0 is the left one, bit 1 the right one
+		BYTE shiftKeys;
+
+		// Keys held down, modifiers included, and the commands they got when pressed
+		PressedKeys pressedKeys;
+
+		// Keys that may still be part of a chord
+		ChordBuffer chord;
+
+		// Dual-role modifier not yet resolved
+		TapHoldBuffer tapHold;
+
+		// Commands of keystrokes resolved late
+		DeferredActions deferred;
+	};
+
+
+	// What a dead key followed by a command sends: the dead key's replacement for the command, or
+	// else the character its combining mark composes with it, otherwise both, one after the other,
+	// as a single CommandSequence. Worked out by the spec, before any keystroke needs it.
+	struct DeadKeyOutput
+	{
+		BaseKeystrokeCommand* action;		// Sent by the press
+		BaseKeystrokeCommand* pressed;		// Command the key's repeats and release go to
+	};
+
+
+	// Compiled, read-only description of a keyboard: its name, modifiers and layers.
+	// A spec is never modified after construction, but for layers built on first activation and
+	// the dead key outputs they bring, which are added safely for readers; so a single one may be
+	// shared by any number of Keyboard instances (and threads); each of them only keeps a KeyboardState.
+	class KeyboardSpec
+	{
+	private:
+
+		// Modifiers of this keyboard; the position of each is its bit in a ModifierMask.
+		const std::vector<PModifier> modifiers;
+
+		// All layers belonging to this keyboard's layout; those of templates are shared with other specs.
+		// Transparent layers are replaced by a flattened copy, built in the constructor, which maps
+		// every key of the stack below them; so finding a command is a single lookup however deep it is.
+		std::vector<std::shared_ptr<const Layer>> layers;
+
+		// Modifiers that trigger each layer, in the same order as layers.
+		std::vector<ModifierMask> layerMasks;
+
+		// Modifiers whose state matters to each layer: all but those it ignores, in the same order as layers.
+		// A layer is triggered when (pressed & layerCareMasks[i]) == layerMasks[i].
+		std::vector<ModifierMask> layerCareMasks;
+
+		// Positions in layers, in the order findLayer tries them: those ignoring fewer modifiers first,
+		// then in document order.
+		std::vector<size_t> layerPrecedence;
+
+		// Position + 1 of the modifier each scancode triggers, or 0 if it triggers none; built in the
+		// constructor, so that finding a modifier is a single lookup instead of asking each of them.
+		// Indexed by _modifierIndexOf: a byte per scancode keeps the whole table in a few cache lines.
+		std::array<unsigned char, 3 * 256> modifierIndex;
+
+		// Initialize in constructor - keep an empty command in memory, since it's
+		// frequently returned.
+		BaseKeystrokeCommand* noAction;
+
+		// Time (in ms) keys are held back while they may be part of a chord; 0 if no layer has chords.
+		DWORD chordWindow;
+
+		// Text expansions; null if the keyboard has none
+		const ExpansionAutomaton* const expansions;
+
+		// Memory used by the tables flattened from transparent layers, in bytes
+		size_t flattenedMemoryUsage;
+
+		// Shortest time (in ms) keys may be held back for, by a chord or a dual-role modifier,
+		// or a dead key may wait for the next key; 0 if never.
+		DWORD timeout;
+
+		// Passthrough commands, by virtual key; all of them are built in the constructor, so that
+		// keyboards sharing the spec only ever read this.
+		std::array<PassthroughCommand*, 256> passthroughs;
+
+		// Owner of the commands that dead key outputs are made of; shared with the other specs.
+		CommandPool *const pool;
+
+		typedef std::pair<const DeadKeyCommand*, const BaseKeystrokeCommand*> DeadKeyPair;
+		struct DeadKeyPairHash
+		{
+			size_t operator()(const DeadKeyPair& pair) const;
+		};
+		typedef std::unordered_map<DeadKeyPair, DeadKeyOutput, DeadKeyPairHash> DeadKeyOutputTable;
+
+		// Outputs of every dead key in the layers followed by every command in them, by both: a
+		// table for the layers built when the spec is compiled, then one for each layer built later,
+		// added when it's first activated. Only the first deadKeyTableCount are in use, and a table
+		// is never modified once counted, so keystrokes look outputs up without a lock.
+		std::unique_ptr<std::unique_ptr<const DeadKeyOutputTable>[]> deadKeyTables;
+		mutable std::atomic<size_t> deadKeyTableCount;
+
+		// Whether each layer, and the outputs it brings, is built; in the same order as layers.
+		std::unique_ptr<std::atomic<bool>[]> layerReady;
+
+		// Tables are added one at a time, under this; so are the commands and dead keys they cover.
+		mutable std::mutex deadKeyMutex;
+		mutable std::unordered_set<BaseKeystrokeCommand*> tabledCommands;
+		mutable std::vector<DeadKeyCommand*> tabledDeadKeys;
+
+		KeyboardSpec(const KeyboardSpec&) = delete;
+		KeyboardSpec& operator=(const KeyboardSpec&) = delete;
+
+		// Replaces each transparent layer that has a layer below it by a flattened copy; needs layerMasks.
+		void _flattenTransparentLayers();
+
+		// Position of a scancode in modifierIndex: plain ones first, then E0, then E1 ones
+		static size_t _modifierIndexOf(Scancode sc);
+
+		// Builds these layers, then adds a table of the outputs they bring: those of their dead keys
+		// followed by any command, and of any dead key followed by their commands. Marks them ready.
+		void _addDeadKeyOutputs(const std::vector<size_t>& layerIndices) const;
+
+	public:
+
+		// Public name of this device; wide string in conformity with the Raw Input API.
+		const std::wstring deviceName;
+
+		// Fields of the names of the devices this keyboard is for; if it's empty, it's found by deviceName.
+		const DevicePattern devicePattern;
+
+		// name - Name to serve as unique identifier for this keyboard.
+		// layers - Layers, in order of precedence; they may be shared with other specs.
+		// modifiers - Pointers to modifiers, at most MAX_MODIFIERS; ownership is transferred to this spec.
+		// chordWindow - Time (in ms) the keys of a chord may take to be all pressed.
+		// expansions - Text expansions, or null; ownership is transferred to this spec.
+		// pool - Where the commands of dead key outputs are interned; it must outlive this spec.
+		// devicePattern - Devices this keyboard is for, if not found by name.
+		// The outputs of the dead keys in layers already built are worked out here.
+		KeyboardSpec(const std::wstring name, const std::vector<std::shared_ptr<const Layer>>& layers, const std::vector<PModifier>& modifiers,
+			DWORD chordWindow, const ExpansionAutomaton* expansions, CommandPool *const pool,
+			const DevicePattern& devicePattern = DevicePattern());
+
+		// Returns the bit of the modifier triggered by sc, or 0 if sc is not a modifier.
+		ModifierMask findModifier(Scancode sc) const;
+
+		// Returns the layer triggered by this set of pressed modifiers, or null if there is none.
+		// If several are, the one ignoring fewer modifiers wins, then the first in document order.
+		// This is where layers are activated, so a layer left unbuilt at load is built here, the
+		// first time it's found; see buildLayer.
+		const Layer* findLayer(ModifierMask pressedModifiers) const;
+
+		// Builds a layer left unbuilt at load (see Layer::build), and works out the outputs its dead
+		// keys and commands bring; does nothing if it was done already, and waits if it's being done.
+		// index - position of the layer in getLayers().
+		void buildLayer(size_t index) const;
+
+		// What this dead key followed by this command sends; null if the command is in no layer of
+		// this spec (like a passthrough), or is null itself.
+		const DeadKeyOutput* findDeadKeyOutput(const DeadKeyCommand* deadKey, const BaseKeystrokeCommand* command) const;
+
+		// Number of dead key outputs worked out so far
+		size_t getDeadKeyOutputCount() const;
+
+		// State of a keyboard with no key pressed and no dead key active.
+		KeyboardState initialState() const;
+
+		// Command that does nothing; never null.
+		BaseKeystrokeCommand* getNoAction() const;
+
+		// Shortest time (in ms) after a keystroke when keys it held back may have to be resolved;
+		// 0 if a keyboard running this spec never holds keys back.
+		DWORD getTimeout() const;
+
+		// Time (in ms) the keys of a chord may take to be all pressed; 0 if no layer has chords.
+		DWORD getChordWindow() const;
+
+		// Time (in ms) the modifier must be held to act as one, if it's dual-role; 0 otherwise.
+		// modifier - a bit returned by findModifier.
+		DWORD getTapTimeout(ModifierMask modifier) const;
+
+		// Text expansions of this keyboard; null if it has none.
+		const ExpansionAutomaton* getExpansions() const;
+
+		// Approximate memory used by the tables flattened from transparent layers, in bytes; 0 if there are none.
+		size_t getFlattenedMemoryUsage() const;
+
+		// Layers, in order of precedence; transparent ones are already flattened.
+		const std::vector<std::shared_ptr<const Layer>>& getLayers() const;
+
+		// Returns the command that sends the virtual key itself.
+		PassthroughCommand* getPassthrough(BYTE virtualKey) const;
+
+		// Destructor
+		~KeyboardSpec();
+	};
+}
@@ -2,6 +2,12 @@
 
 /*--Implementations of methods in KeystrokeCommands.h--*/
 #include "KeystrokeCommands.h"
+#include "Launcher.h"
+#include "MacroScheduler.h"
+#include "ComposeTable.h"
+#include "CanonicalComposition.h"
+
+#include <algorithm>	// for std::lower_bound
 
 namespace Multikeys
 {
@@ -48,6 +54,13 @@ namespace Multikeys
 		VirtualKeyPrototypeUp.ki.dwFlags |= KEYEVENTF_KEYUP;
 	}
 
+	bool BaseKeystrokeCommand::getInputs(bool /*keyup*/, bool /*repeated*/,
+		OUT const INPUT* *const /*out_inputs*/, OUT size_t *const /*out_count*/) const
+	{
+		// Unless a command says otherwise, it does more than sending keystrokes
+		return false;
+	}
+
 	// pure virtual destructor still needs implementation.
 	BaseKeystrokeCommand::~BaseKeystrokeCommand() { }
 
@@ -97,6 +110,16 @@ namespace Multikeys
 		else return TRUE;
 	}
 
+	bool MacroCommand::getInputs(bool keyup, bool repeated,
+		OUT const INPUT* *const out_inputs, OUT size_t *const out_count) const
+	{
+		// Same conditions as execute
+		bool sends = !keyup && (!repeated || triggerOnRepeat);
+		*out_inputs = sends ? keystrokes : nullptr;
+		*out_count = sends ? inputCount : 0;
+		return true;
+	}
+
 	MacroCommand::~MacroCommand()
 	{
 		delete[] keystrokes;
@@ -104,11 +127,76 @@ namespace Multikeys
 
 
 
+	/*
+	TimedMacroCommand
+	*/
+
+	TimedMacroCommand::TimedMacroCommand(const std::vector<unsigned short>& keypresses,
+		const std::vector<MacroStep>& steps, bool triggerOnRepeat)
+		: BaseKeystrokeCommand(), steps(steps), triggerOnRepeat(triggerOnRepeat)
+	{
+		// Same encoding as MacroCommand
+		keystrokes.reserve(keypresses.size());
+		for (size_t i = 0; i < keypresses.size(); i++)
+		{
+			INPUT keystroke = VirtualKeyPrototypeDown;
+			keystroke.ki.wVk = keypresses[i] & 0xff;
+			if ((keypresses[i] >> 15) & 1)
+				keystroke.ki.dwFlags |= KEYEVENTF_KEYUP;
+			keystrokes.push_back(keystroke);
+		}
+	}
+
+	KeystrokeOutputType TimedMacroCommand::getType() const
+	{
+		return KeystrokeOutputType::TimedMacroCommand;
+	}
+
+	bool TimedMacroCommand::execute(bool keyup, bool repeated) const
+	{
+		if (keyup || steps.empty())
+			return TRUE;
+		else if (!repeated || triggerOnRepeat)
+			return MacroScheduler::shared().start(this);
+		else return TRUE;
+	}
+
+	size_t TimedMacroCommand::getStepCount() const
+	{
+		return steps.size();
+	}
+
+	const MacroStep& TimedMacroCommand::getStep(size_t step) const
+	{
+		return steps[step];
+	}
+
+	const INPUT* TimedMacroCommand::getStepInputs(size_t step) const
+	{
+		return keystrokes.data() + steps[step].firstInput;
+	}
+
+	INPUT TimedMacroCommand::getRelease(BYTE virtualKey) const
+	{
+		INPUT release = VirtualKeyPrototypeUp;
+		release.ki.wVk = virtualKey;
+		return release;
+	}
+
+	TimedMacroCommand::~TimedMacroCommand()
+	{
+		// The scheduler would otherwise keep playing a command that no longer exists
+		MacroScheduler::cancelShared(this);
+	}
+
+
+
 	/*
 	UnicodeCommand
 	*/
 
 	UnicodeCommand::UnicodeCommand(const std::vector<unsigned int>& codepoints, const bool triggerOnRepeat)
+		: BaseKeystrokeCommand(), triggerOnRepeat(triggerOnRepeat)
 	{
 		inputCount = codepoints.size();
 		for (size_t i = 0; i < codepoints.size(); i++)
@@ -199,7 +287,17 @@ namespace Multikeys
 		else return TRUE;
 	}
 
-	inline bool UnicodeCommand::operator==(const UnicodeCommand& rhs) const
+	bool UnicodeCommand::getInputs(bool keyup, bool repeated,
+		OUT const INPUT* *const out_inputs, OUT size_t *const out_count) const
+	{
+		// Same conditions as execute
+		bool sends = !keyup && (!repeated || triggerOnRepeat);
+		*out_inputs = sends ? keystrokes : nullptr;
+		*out_count = sends ? inputCount : 0;
+		return true;
+	}
+
+	bool UnicodeCommand::operator==(const UnicodeCommand& rhs) const
 	{
 		if (inputCount != rhs.inputCount) return false;
 		// One by one, compare the keystroke inputs by codepoint.
@@ -235,15 +333,10 @@ namespace Multikeys
 		if (repeated || keyup) return TRUE;
 
 		// start process at filename
-
-		HINSTANCE retVal =
-			ShellExecute(NULL, L"open", filename.c_str(), arguments.c_str(), NULL, SW_SHOWNORMAL);
-		if ((LONG)retVal <= 32)
-			return FALSE;
-		// TODO: handle errors
-
-
-		return TRUE;
+		// This only queues the launch; the launcher's worker thread calls ShellExecute,
+		// so the hook gets its answer without waiting for the process to start.
+		// Failures of the launch itself are counted in the launcher's statistics.
+		return Launcher::shared().enqueue(filename, arguments);
 	}
 
 	ExecutableCommand::~ExecutableCommand() { }
@@ -254,122 +347,295 @@ namespace Multikeys
 	DeadKeyCommand
 	*/
 
-	void DeadKeyCommand::_setNextCommand(BaseKeystrokeCommand*const command, const USHORT vKey)
+	UnicodeCommand* DeadKeyCommand::findReplacement(const BaseKeystrokeCommand* const nextCommand) const
 	{
-		if (command == nullptr)
+		// first, make sure that the command is unicode (dead keys inherit from it):
+		// All those that are not unicode never have a replacement
+		if (nextCommand == nullptr
+			|| (nextCommand->getType() != KeystrokeOutputType::UnicodeCommand
+				&& nextCommand->getType() != KeystrokeOutputType::DeadKeyCommand))
+			return nullptr;
+
+		// It's a unicode (or dead key):
+		// Unicode commands are interned, so the same characters are the same pointer
+		const UnicodeCommand* nextUnicode = static_cast<const UnicodeCommand*>(nextCommand);
+		if (nextCommand->getType() == KeystrokeOutputType::UnicodeCommand)
 		{
-			// means that the input is not supposed to be blocked
-			// Might implement: Do not send this dead key's character if next key is either
-			//		escape or tab.
-			_nextCommand = nullptr;
-			_nextCommandType = 1;
+			auto found = replacements.find(nextUnicode);
+			return found == replacements.end() ? nullptr : found->second;
 		}
-		else
+
+		// Dead keys aren't, so their independent characters are compared one by one
+		for (auto iterator = replacements.begin(); iterator != replacements.end(); iterator++)
 		{
-			// first, make sure that the command is unicode (dead keys inherit from it):
+			if (*(iterator->first) == *nextUnicode)
+				return iterator->second;
+		}
+		// didn't find a suitable replacement
+		return nullptr;
+	}
 
-			// All those that are not unicode are just placed as next command
-			if (command->getType() != KeystrokeOutputType::UnicodeCommand
-				&& command->getType() != KeystrokeOutputType::DeadKeyCommand)
-			{
-				_nextCommand = command;
-				_nextCommandType = 3;
-				return;
-			}
+	unsigned int DeadKeyCommand::findComposition(const BaseKeystrokeCommand* const nextCommand) const
+	{
+		// Dead keys are left alone: two of them in a row are sent one after the other
+		if (combiningMark == 0 || nextCommand == nullptr
+			|| nextCommand->getType() != KeystrokeOutputType::UnicodeCommand)
+			return 0;
+
+		// The next command must send a single code point: one UTF-16 code value, or a surrogate pair
+		const INPUT* inputs;
+		size_t inputCount;
+		nextCommand->getInputs(false, false, &inputs, &inputCount);
+		unsigned int base;
+		if (inputCount == 1)
+			base = inputs[0].ki.wScan;
+		else if (inputCount == 2 && inputs[0].ki.wScan >= 0xd800 && inputs[0].ki.wScan <= 0xdbff)
+			base = 0x10000 + ((inputs[0].ki.wScan - 0xd800) << 10) + (inputs[1].ki.wScan - 0xdc00);
+		else
+			return 0;
 
-			// It's a unicode (or dead key):
-			// compare its input sequence with the replacement list
-			// The map of replacements contains pointers, so using find() would actually
-			//		search by pointer. That doesn't work.
-			for (auto iterator = replacements.begin(); iterator != replacements.end(); iterator++)
+		// Binary search of the generated table, ordered by mark and then by base
+		const CanonicalPair* first = CANONICAL_PAIRS;
+		const CanonicalPair* last = CANONICAL_PAIRS + sizeof(CANONICAL_PAIRS) / sizeof(CANONICAL_PAIRS[0]);
+		const CanonicalPair* pair = std::lower_bound(first, last, std::make_pair(combiningMark, base),
+			[](const CanonicalPair& entry, const std::pair<unsigned int, unsigned int>& key)
 			{
-				// try to find the correct one (dereference pointers before comparing)
-				// The actual UnicodeCommand objects are different, so comparing pointers won't work.
-				if (*(iterator->first) == *(dynamic_cast<UnicodeCommand*>(command)))
-				{
-					// replace it
-					_nextCommand = iterator->second;
-					_nextCommandType = 4;
-					return;
-				}
-			}
-			// didn't find a suitable replacement
-			_nextCommand = command;
-			_nextCommandType = 2;
-
-		}
+				return entry.mark < key.first || (entry.mark == key.first && entry.base < key.second);
+			});
+		if (pair == last || pair->mark != combiningMark || pair->base != base)
+			return 0;
+		return pair->composed;
 	}
 
 	DeadKeyCommand::
 		DeadKeyCommand(const std::vector<unsigned int>& independentCodepoints,
-		const std::unordered_map<UnicodeCommand*, UnicodeCommand*>& replacements)
+		const std::unordered_map<const UnicodeCommand*, UnicodeCommand*>& replacements,
+		DWORD timeout, unsigned int combiningMark)
 		: UnicodeCommand(independentCodepoints, true),
-		replacements(replacements) { }
+		replacements(replacements), timeout(timeout), combiningMark(combiningMark) { }
 
 	DeadKeyCommand::
 		DeadKeyCommand(UINT*const independentCodepoints, UINT const independentCodepointsCount,
 		UnicodeCommand**const replacements_from, UnicodeCommand**const replacements_to,
 		UINT const replacements_count)
-		: UnicodeCommand(independentCodepoints, independentCodepointsCount, true),
-		_nextCommand(nullptr), _nextCommandType(0)
+		: UnicodeCommand(independentCodepoints, independentCodepointsCount, true), timeout(0), combiningMark(0)
 	{
 		for (unsigned int i = 0; i < replacements_count; i++) {
 			replacements[replacements_from[i]] = replacements_to[i];
 		}
 	}
 
-	void DeadKeyCommand::setNextCommand(BaseKeystrokeCommand*const command)
+	KeystrokeOutputType DeadKeyCommand::getType() const
 	{
-		_setNextCommand(command, 0);
+		return KeystrokeOutputType::DeadKeyCommand;
 	}
-	void DeadKeyCommand::setNextCommand(const USHORT vKey)
+
+	// Replacements belong to the CommandPool
+	DeadKeyCommand::~DeadKeyCommand() { }
+
+
+
+	/*
+	CommandSequence
+	*/
+
+	CommandSequence::CommandSequence(const BaseKeystrokeCommand* const first, const BaseKeystrokeCommand* const second)
+		: BaseKeystrokeCommand(), first(first), second(second)
 	{
-		_setNextCommand(nullptr, vKey);
+		joined = _join(true, false, &releaseInputs)
+			&& _join(false, false, &pressInputs)
+			&& _join(false, true, &repeatInputs);
 	}
 
-	KeystrokeOutputType DeadKeyCommand::getType() const
+	bool CommandSequence::_join(bool keyup, bool repeated, OUT std::vector<INPUT> *const out_joined) const
 	{
-		return KeystrokeOutputType::DeadKeyCommand;
+		const INPUT* firstInputs;
+		const INPUT* secondInputs;
+		size_t firstCount, secondCount;
+
+		// Same flags as execute gives to each command
+		if (!first->getInputs(keyup, false, &firstInputs, &firstCount)
+			|| !second->getInputs(keyup, repeated, &secondInputs, &secondCount))
+			return false;
+
+		out_joined->assign(firstInputs, firstInputs + firstCount);
+		out_joined->insert(out_joined->end(), secondInputs, secondInputs + secondCount);
+		return true;
+	}
+
+	const std::vector<INPUT>& CommandSequence::_joinedInputs(bool keyup, bool repeated) const
+	{
+		if (keyup)
+			return releaseInputs;
+		return repeated ? repeatInputs : pressInputs;
 	}
 
-	bool DeadKeyCommand::execute(bool keyup, bool repeated) const
+	KeystrokeOutputType CommandSequence::getType() const
 	{
-		if (keyup) return TRUE;	// because unicode keyups do nothing
+		return KeystrokeOutputType::CommandSequence;
+	}
 
-								// First, check for an edge case: If the next input is this one
-								// That means infinite recursion because there's only one instance
-								// of each given dead key (so every of its pointers will point there)
-		if (_nextCommand == (BaseKeystrokeCommand*)this)
+	bool CommandSequence::execute(bool keyup, bool repeated) const
+	{
+		if (joined)
 		{
-			// just send this key twice
-			SendInput(inputCount, keystrokes, sizeof(INPUT));
-			SendInput(inputCount, keystrokes, sizeof(INPUT));
-			// then clear the next pointer
-			_nextCommand = nullptr;
+			const std::vector<INPUT>& inputs = _joinedInputs(keyup, repeated);
+			if (inputs.empty())
+				return TRUE;
+			// SendInput doesn't modify the array
+			UINT inputCount = (UINT)inputs.size();
+			return (SendInput(inputCount, const_cast<INPUT*>(inputs.data()), sizeof(INPUT)) == inputCount ? TRUE : FALSE);
 		}
 
-		// there is a replacement:
-		if (_nextCommandType == 4)
+		// One of the commands does something else than sending keystrokes
+		bool firstResult = first->execute(keyup, false);
+		bool secondResult = second->execute(keyup, repeated);
+		return firstResult && secondResult;
+	}
+
+	bool CommandSequence::getInputs(bool keyup, bool repeated,
+		OUT const INPUT* *const out_inputs, OUT size_t *const out_count) const
+	{
+		if (!joined)
+			return false;
+		const std::vector<INPUT>& inputs = _joinedInputs(keyup, repeated);
+		*out_inputs = inputs.empty() ? nullptr : inputs.data();
+		*out_count = inputs.size();
+		return true;
+	}
+
+
+
+	/*
+	PassthroughCommand
+	*/
+
+	PassthroughCommand::PassthroughCommand(BYTE virtualKey)
+		: BaseKeystrokeCommand()
+	{
+		// Sent like the keys of a macro, so that our hook ignores them
+		keyDown = VirtualKeyPrototypeDown;
+		keyDown.ki.wVk = virtualKey;
+		keyUp = VirtualKeyPrototypeUp;
+		keyUp.ki.wVk = virtualKey;
+	}
+
+	KeystrokeOutputType PassthroughCommand::getType() const
+	{
+		return KeystrokeOutputType::PassthroughCommand;
+	}
+
+	bool PassthroughCommand::execute(bool keyup, bool /*repeated*/) const
+	{
+		INPUT input = keyup ? keyUp : keyDown;
+		return SendInput(1, &input, sizeof(INPUT)) == 1 ? TRUE : FALSE;
+	}
+
+	bool PassthroughCommand::getInputs(bool keyup, bool /*repeated*/,
+		OUT const INPUT* *const out_inputs, OUT size_t *const out_count) const
+	{
+		*out_inputs = keyup ? &keyUp : &keyDown;
+		*out_count = 1;
+		return true;
+	}
+
+
+
+	/*
+	ExpansionCommand
+	*/
+
+	ExpansionCommand::ExpansionCommand(size_t eraseCount, const std::wstring& text)
+		: BaseKeystrokeCommand()
+	{
+		INPUT key = VirtualKeyPrototypeDown;
+		INPUT keyUp = VirtualKeyPrototypeUp;
+
+		key.ki.wVk = keyUp.ki.wVk = VK_BACK;
+		for (size_t i = 0; i < eraseCount; i++)
 		{
-			return (_nextCommand->execute(keyup, repeated));
+			keystrokes.push_back(key);
+			keystrokes.push_back(keyUp);
 		}
 
-		// Situation is normal; send this key, then the next
-		SendInput(inputCount, keystrokes, sizeof(INPUT));
-		if (_nextCommand != nullptr)
-			return (_nextCommand->execute(keyup, repeated));
-		else
+		// Sent like a UnicodeCommand, one UTF-16 code value at a time; applications take a new line
+		// better as a press of Enter than as a character
+		key.ki.wVk = keyUp.ki.wVk = VK_RETURN;
+		for (size_t i = 0; i < text.size(); i++)
+		{
+			if (text[i] == L'\r')
+				continue;
+			if (text[i] == L'\n')
+			{
+				keystrokes.push_back(key);
+				keystrokes.push_back(keyUp);
+				continue;
+			}
+			INPUT character = unicodePrototype;
+			character.ki.wScan = text[i];
+			keystrokes.push_back(character);
+		}
+	}
+
+	KeystrokeOutputType ExpansionCommand::getType() const
+	{
+		return KeystrokeOutputType::ExpansionCommand;
+	}
+
+	bool ExpansionCommand::execute(bool keyup, bool repeated) const
+	{
+		if (keyup || repeated || keystrokes.empty())
 			return TRUE;
+		UINT inputCount = (UINT)keystrokes.size();
+		return SendInput(inputCount, const_cast<INPUT*>(keystrokes.data()), sizeof(INPUT)) == inputCount ? TRUE : FALSE;
 	}
 
-	DeadKeyCommand::~DeadKeyCommand()
+	bool ExpansionCommand::getInputs(bool keyup, bool repeated,
+		OUT const INPUT* *const out_inputs, OUT size_t *const out_count) const
 	{
-		// is it necessary? --> delete _nextCommand;
-		for (auto iterator = replacements.begin(); iterator != replacements.end(); iterator++)
-		{
-			delete iterator->first;
-			delete iterator->second;
-		}
+		// Same conditions as execute
+		bool sends = !keyup && !repeated;
+		*out_inputs = sends ? keystrokes.data() : nullptr;
+		*out_count = sends ? keystrokes.size() : 0;
+		return true;
+	}
+
+
+
+	/*
+	ComposeCommand
+	*/
+
+	ComposeCommand::ComposeCommand(const ComposeTable* table)
+		: BaseKeystrokeCommand(), table(table)
+	{ }
+
+	const ComposeTable& ComposeCommand::getTable() const
+	{
+		return *table;
+	}
+
+	KeystrokeOutputType ComposeCommand::getType() const
+	{
+		return KeystrokeOutputType::ComposeCommand;
+	}
+
+	bool ComposeCommand::execute(bool /*keyup*/, bool /*repeated*/) const
+	{
+		return TRUE;
+	}
+
+	bool ComposeCommand::getInputs(bool /*keyup*/, bool /*repeated*/,
+		OUT const INPUT* *const out_inputs, OUT size_t *const out_count) const
+	{
+		*out_inputs = nullptr;
+		*out_count = 0;
+		return true;
+	}
+
+	ComposeCommand::~ComposeCommand()
+	{
+		delete table;
 	}
 
 
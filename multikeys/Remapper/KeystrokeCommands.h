@@ -7,6 +7,7 @@
 
 namespace Multikeys
 {
+	class ComposeTable;
 
 	// enum classes are strongly typed
 	enum class KeystrokeOutputType
@@ -15,7 +16,12 @@ namespace Multikeys
 		MacroCommand,
 		ScriptCommand,
 		DeadKeyCommand,
-		EmptyCommand
+		EmptyCommand,
+		CommandSequence,
+		PassthroughCommand,
+		TimedMacroCommand,
+		ExpansionCommand,
+		ComposeCommand
 	};
 
 	/*
@@ -37,6 +43,13 @@ namespace Multikeys
 
 		virtual bool execute(bool keyup, bool repeated) const override = 0;
 
+		// For commands whose execution does nothing but send keystrokes: points out_inputs at
+		// the keystrokes that execute(keyup, repeated) would send, and returns true. out_inputs
+		// may be left null if out_count is 0. The array belongs to the command.
+		// Returns false for commands that do anything else when executed.
+		virtual bool getInputs(bool keyup, bool repeated,
+			OUT const INPUT* *const out_inputs, OUT size_t *const out_count) const;
+
 		virtual ~BaseKeystrokeCommand() override = 0;
 	};
 
@@ -71,10 +84,62 @@ namespace Multikeys
 
 		bool execute(bool keyup, bool repeated) const override;
 
+		bool getInputs(bool keyup, bool repeated,
+			OUT const INPUT* *const out_inputs, OUT size_t *const out_count) const override;
+
 		~MacroCommand() override;
 
 	};
 
+	// Keystrokes of a timed macro sent together, and the pause before the next ones
+	struct MacroStep
+	{
+		size_t firstInput;		// Index of its first keystroke in the macro
+		size_t inputCount;
+		DWORD pauseAfter;		// In ms; that of the last step is ignored
+	};
+
+	// Macro that pauses between some of its keystrokes, e.g. to hold a key down for a while.
+	// Executing it only starts it: the MacroScheduler sends each step when it's due, off the
+	// thread that executes commands. Pressing its key again while it's still playing starts it over.
+	class TimedMacroCommand : public BaseKeystrokeCommand
+	{
+
+	private:
+
+		std::vector<INPUT> keystrokes;
+		std::vector<MacroStep> steps;
+		bool triggerOnRepeat;
+
+	public:
+
+		// keypresses - virtual keys to be sent, encoded as for MacroCommand.
+		// steps - how keypresses is split into steps, in order; together they must cover it all.
+		// The caller may let these containers go out of scope.
+		TimedMacroCommand(const std::vector<unsigned short>& keypresses, const std::vector<MacroStep>& steps,
+			bool triggerOnRepeat);
+
+		KeystrokeOutputType getType() const override;
+
+		// Starts the macro on a press (and a repeat, if it triggers on repeat); returns
+		// false if the scheduler couldn't start it.
+		bool execute(bool keyup, bool repeated) const override;
+
+		size_t getStepCount() const;
+
+		const MacroStep& getStep(size_t step) const;
+
+		// First keystroke of the step; there are getStep(step).inputCount of them.
+		const INPUT* getStepInputs(size_t step) const;
+
+		// Keystroke releasing a virtual key, sent like the ones of this macro
+		INPUT getRelease(BYTE virtualKey) const;
+
+		// Stops the macro, if it's still playing
+		~TimedMacroCommand() override;
+
+	};
+
 	class UnicodeCommand : public BaseKeystrokeCommand
 	{
 
@@ -103,8 +168,11 @@ namespace Multikeys
 
 		bool execute(bool keyup, bool repeated) const override;
 
+		bool getInputs(bool keyup, bool repeated,
+			OUT const INPUT* *const out_inputs, OUT size_t *const out_count) const override;
+
 		// Comparing unicode keystrokes is important for a dead key.
-		inline bool operator==(const UnicodeCommand& rhs) const;
+		bool operator==(const UnicodeCommand& rhs) const;
 
 		~UnicodeCommand() override;
 	};
@@ -125,6 +193,8 @@ namespace Multikeys
 		// std::wstring arguments - arguments to be passed to executable; multiple arguments must be
 		//		separated by space
 		// In practice, the file does not need to be an .exe executable specifically.
+		// The file is opened asynchronously by the Launcher; execute() only fails if
+		// the launcher's queue is full.
 		ExecutableCommand(std::wstring filename, std::wstring arguments = std::wstring());
 
 		KeystrokeOutputType getType() const override;
@@ -136,43 +206,35 @@ namespace Multikeys
 	};
 
 	// Dead keys are pressed before the key it modifies
+	// A dead key holds no state of its own; the keyboard that pressed it remembers it as active,
+	// and combines it with the next command (see Keyboard::evaluateKey). Executing a dead key
+	// by itself sends its independent characters, inherited from UnicodeCommand.
 	class DeadKeyCommand : public UnicodeCommand
 	{
 		// Inherits keystrokes, keystroke count and trigger on repeat from UnicodeCommand
 		// Those fields describe this dead key as a standalone
-	private:
-		// 0 : no next command
-		// 1 : unblocked command
-		// 2 : remapped to unicode without valid substitute
-		// 3 : remapped to non-unicode
-		// 4 : remapped to unicode with a substitute
-		// (another dead key will behave like a unicode)
-		USHORT _nextCommandType;
-
-		// Pointer to hold the command after this one.
-		// NULL until input is received; remains null if the next input
-		//		is not remapped (i. e. not blocked)
-		mutable BaseKeystrokeCommand * _nextCommand;
-		// mutable because this class's execute() is a const method that needs to modify it.
-
-		// If this command is being remembered as active, then the next keystroke will cause
-		// this method to be called.
-		// command - The next command pressed on the same keyboard, null if the key pressed
-		//		does not correspond to a remap.
-		// vKey - Virtual key code of the keystroke that generated this. Only for checking
-		//		special keys (esc, tab), and only present (non-zero) if command is null.
-		void _setNextCommand(BaseKeystrokeCommand*const command, const USHORT vKey);
-
 	public:
 
 
-		// Replacements from Unicode codepoint sequence to Unicode outputs
-		std::unordered_map<UnicodeCommand*, UnicodeCommand*> replacements;
+		// Replacements from Unicode codepoint sequence to Unicode outputs.
+		// Both are interned by the CommandPool, which owns them, so the command pressed after the
+		// dead key is looked up by pointer; each sequence appears with and without trigger on repeat.
+		std::unordered_map<const UnicodeCommand*, UnicodeCommand*> replacements;
+
+		// Time (in ms) after which the dead key, if nothing followed it, is sent by itself.
+		// 0 if it waits for the next key however long it takes.
+		DWORD timeout;
+
+		// Combining mark that this dead key adds to the character after it, when they have a
+		// precomposed character in Unicode (e.g. U+0301 turns 'e' into U+00E9); 0 if none.
+		// Replacements take precedence over it.
+		unsigned int combiningMark;
 
 
 		// STL constructor
 		DeadKeyCommand(const std::vector<unsigned int>& independentCodepoints,
-			const std::unordered_map<UnicodeCommand*, UnicodeCommand*>& replacements);
+			const std::unordered_map<const UnicodeCommand*, UnicodeCommand*>& replacements,
+			DWORD timeout = 0, unsigned int combiningMark = 0);
 
 		// UINT* independentCodepoints - the Unicode character for this dead key
 		//								Array may be deleted after passing
@@ -189,28 +251,152 @@ namespace Multikeys
 
 
 
-		// Call when next input is received. This object needs to know the next key, in order to decide
-		//		what action to take when execute() is called on it.
-		// IkeystrokeOutput* const command - pointer to the command to be executed right after this key;
-		//		might be replaced if a match exists.
-		void setNextCommand(BaseKeystrokeCommand*const command);
+		// Looks for the replacement of the command pressed after this dead key.
+		// Returns the command to be sent instead of both, or null if there is none
+		// (commands that aren't unicode never have a replacement).
+		UnicodeCommand* findReplacement(const BaseKeystrokeCommand* const nextCommand) const;
 
-		// Call when next input is received, before using this dead key
-		// const USHORT vKey - the virtual key input by the user
-		void setNextCommand(const USHORT vKey);
+		// Looks for the character that the command pressed after this dead key composes into
+		// with its combining mark, by canonical composition. Returns its code point, or 0 if there
+		// is none (the command doesn't send a single character, or it has no such composition).
+		unsigned int findComposition(const BaseKeystrokeCommand* const nextCommand) const;
 
 
 		KeystrokeOutputType getType() const override;
 
+		~DeadKeyCommand() override;
 
-		bool execute(bool keyup, bool repeated = FALSE) const override;
+	};
 
-		~DeadKeyCommand() override;
 
+
+
+	// Two commands executed one after the other; used for a dead key followed by a key that
+	// it doesn't combine with. Immutable; neither command is owned.
+	// When both commands only send keystrokes, their keystrokes are joined at construction,
+	// so the whole sequence is sent with a single SendInput and nothing can get in between.
+	class CommandSequence : public BaseKeystrokeCommand
+	{
+	private:
+
+		const BaseKeystrokeCommand* const first;
+		const BaseKeystrokeCommand* const second;
+
+		// True if both commands provided their inputs, and the arrays below are in use
+		bool joined;
+
+		// Keystrokes of both commands, for a key release, a fresh press and a repeated press
+		std::vector<INPUT> releaseInputs;
+		std::vector<INPUT> pressInputs;
+		std::vector<INPUT> repeatInputs;
+
+		// Appends the inputs of both commands for these flags to out_joined; false if either
+		// command can't provide them.
+		bool _join(bool keyup, bool repeated, OUT std::vector<INPUT> *const out_joined) const;
+
+		// The array of joined inputs for these flags
+		const std::vector<INPUT>& _joinedInputs(bool keyup, bool repeated) const;
+
+	public:
+
+		CommandSequence(const BaseKeystrokeCommand* const first, const BaseKeystrokeCommand* const second);
+
+		KeystrokeOutputType getType() const override;
+
+		// The first command is always executed as a fresh press; the second one also gets
+		// to know whether its key is being repeated.
+		bool execute(bool keyup, bool repeated) const override;
+
+		bool getInputs(bool keyup, bool repeated,
+			OUT const INPUT* *const out_inputs, OUT size_t *const out_count) const override;
+
+		~CommandSequence() override {}
+	};
+
+
+
+	// Sends the virtual key of a user keystroke that was blocked while the remapper couldn't tell
+	// what to do with it (like a key that might have been part of a chord), and turned out to
+	// have no remap. Presses send a key down, releases a key up.
+	class PassthroughCommand : public BaseKeystrokeCommand
+	{
+	private:
+
+		INPUT keyDown;
+		INPUT keyUp;
+
+	public:
+
+		PassthroughCommand(BYTE virtualKey);
+
+		KeystrokeOutputType getType() const override;
+
+		bool execute(bool keyup, bool repeated) const override;
+
+		bool getInputs(bool keyup, bool repeated,
+			OUT const INPUT* *const out_inputs, OUT size_t *const out_count) const override;
+
+		~PassthroughCommand() override {}
+	};
+
+
+
+	// Replaces text just typed with other text: erases some characters with backspace, then types
+	// the replacement. Used for text expansions (see ExpansionAutomaton); all of it is sent with
+	// a single SendInput, so that no keystroke of the user gets in between.
+	class ExpansionCommand : public BaseKeystrokeCommand
+	{
+	private:
+
+		std::vector<INPUT> keystrokes;
+
+	public:
+
+		// eraseCount - number of characters to erase first
+		// text - replacement; line feeds are typed as Enter, and carriage returns are left out
+		ExpansionCommand(size_t eraseCount, const std::wstring& text);
+
+		KeystrokeOutputType getType() const override;
+
+		// Only a fresh press sends anything
+		bool execute(bool keyup, bool repeated) const override;
+
+		bool getInputs(bool keyup, bool repeated,
+			OUT const INPUT* *const out_inputs, OUT size_t *const out_count) const override;
+
+		~ExpansionCommand() override {}
 	};
 
 
 
+	// Compose key: the characters typed after it are looked up in its table of sequences, and
+	// the output of the sequence they make is sent instead of them. Unlike a dead key, sequences
+	// may be of any length. Like a dead key, it holds no state of its own; the keyboard that
+	// pressed it follows the sequence (see Keyboard::evaluateKey). By itself it types nothing.
+	class ComposeCommand : public BaseKeystrokeCommand
+	{
+	private:
+
+		const ComposeTable* const table;
+
+	public:
+
+		// table - its sequences; ownership is transferred to this command.
+		ComposeCommand(const ComposeTable* table);
+
+		const ComposeTable& getTable() const;
+
+		KeystrokeOutputType getType() const override;
+
+		bool execute(bool keyup, bool repeated) const override;
+
+		bool getInputs(bool keyup, bool repeated,
+			OUT const INPUT* *const out_inputs, OUT size_t *const out_count) const override;
+
+		~ComposeCommand() override;
+	};
+
+
 
 	// Dummy output that performs no action when executed (good for modifier keys)
 	class EmptyCommand : public BaseKeystrokeCommand
@@ -219,7 +405,15 @@ namespace Multikeys
 
 		EmptyCommand() : BaseKeystrokeCommand() {}
 		KeystrokeOutputType getType() const override { return KeystrokeOutputType::EmptyCommand; }
-		bool execute(bool keyup, bool repeated = FALSE) const override { return TRUE; }
+		bool execute(bool /*keyup*/, bool /*repeated*/ = FALSE) const override { return TRUE; }
+		bool getInputs(bool /*keyup*/, bool /*repeated*/,
+			OUT const INPUT* *const out_inputs, OUT size_t *const out_count) const override
+		{
+			*out_inputs = nullptr;
+			*out_count = 0;
+			return true;
+		}
+		bool hasEffect() const override { return false; }
 		~EmptyCommand() override {}
 	};
 
@@ -0,0 +1,216 @@
+#include "stdafx.h"
+
+/*--Implementations of methods in Launcher.h--*/
+#include "Launcher.h"
+
+#ifdef _WIN32
+#include <objbase.h>		// CoInitializeEx, required by ShellExecute
+#else
+#include <spawn.h>			// posix_spawnp
+#include <sys/wait.h>		// waitpid
+
+extern char** environ;
+#endif
+
+namespace Multikeys
+{
+	Launcher& Launcher::shared()
+	{
+		// Constructed on first use; its destructor waits for the worker at exit.
+		static Launcher instance;
+		return instance;
+	}
+
+	Launcher::Launcher()
+		: stopping(false), stats()
+	{ }
+
+	bool Launcher::enqueue(const std::wstring& filename, const std::wstring& arguments)
+	{
+		Request request;
+		request.filename = filename;
+		request.arguments = arguments;
+		request.requestTime = Clock::now();
+
+		// File name and arguments, separated by a character neither of them may contain
+		std::wstring key = filename + L'\0' + arguments;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			auto previous = lastAccepted.find(key);
+			if (previous != lastAccepted.end()
+				&& request.requestTime - previous->second < std::chrono::milliseconds(DEBOUNCE_TIME))
+			{
+				stats.debounced++;
+				return true;
+			}
+
+			if (requests.size() >= QUEUE_CAPACITY)
+			{
+				stats.dropped++;
+				return false;
+			}
+
+			lastAccepted[key] = request.requestTime;
+			requests.push_back(std::move(request));
+
+			if (!worker.joinable())
+				worker = std::thread(&Launcher::run, this);
+		}
+
+		requestAvailable.notify_one();
+		return true;
+	}
+
+	Launcher::Stats Launcher::getStats() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return stats;
+	}
+
+	void Launcher::run()
+	{
+#ifdef _WIN32
+		// ShellExecute may delegate to Shell extensions, which need COM on this thread
+		HRESULT comResult = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+#endif
+
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			requestAvailable.wait(lock, [this] { return stopping || !requests.empty(); });
+			if (requests.empty())
+				break;		// stopping, and nothing left to launch
+
+			Request request = std::move(requests.front());
+			requests.pop_front();
+
+			// Don't hold the lock while launching; that's the slow part
+			lock.unlock();
+
+			bool launched = _launch(request);
+			unsigned long long latency = (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(
+				Clock::now() - request.requestTime).count();
+
+			lock.lock();
+
+			if (launched)
+				stats.launched++;
+			else
+				stats.failed++;
+			stats.totalLatency += latency;
+			if (latency > stats.maxLatency)
+				stats.maxLatency = latency;
+		}
+
+#ifdef _WIN32
+		if (SUCCEEDED(comResult))
+			CoUninitialize();
+#endif
+	}
+
+#ifdef _WIN32
+
+	bool Launcher::_launch(const Request& request)
+	{
+		HINSTANCE retVal =
+			ShellExecute(NULL, L"open", request.filename.c_str(), request.arguments.c_str(), NULL, SW_SHOWNORMAL);
+
+		// ShellExecute returns a value greater than 32 if successful
+		return (INT_PTR)retVal > 32;
+	}
+
+#else
+
+	// Splits arguments at spaces, except inside double quotes, as a command line would be;
+	// \" is a quote that's part of the argument.
+	static std::vector<std::string> SplitArguments(const std::string& arguments)
+	{
+		std::vector<std::string> split;
+		std::string current;
+		bool quoted = false, pending = false;
+		for (size_t i = 0; i < arguments.size(); i++)
+		{
+			char c = arguments[i];
+			if (c == '\\' && i + 1 < arguments.size() && arguments[i + 1] == '"')
+			{
+				current += '"';
+				pending = true;
+				i++;
+			}
+			else if (c == '"')
+			{
+				quoted = !quoted;
+				pending = true;
+			}
+			else if (c == ' ' && !quoted)
+			{
+				if (pending)
+					split.push_back(current);
+				current.clear();
+				pending = false;
+			}
+			else
+			{
+				current += c;
+				pending = true;
+			}
+		}
+		if (pending)
+			split.push_back(current);
+		return split;
+	}
+
+	bool Launcher::_launch(const Request& request)
+	{
+		// Reap whatever was started earlier and has exited since, so they don't linger as zombies
+		for (size_t i = 0; i < children.size(); )
+		{
+			if (waitpid(children[i], nullptr, WNOHANG) != 0)
+			{
+				children[i] = children.back();
+				children.pop_back();
+			}
+			else
+				i++;
+		}
+
+		std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+		std::string filename = converter.to_bytes(request.filename);
+		std::vector<std::string> arguments = SplitArguments(converter.to_bytes(request.arguments));
+
+		std::vector<char*> argv;
+		argv.push_back(&filename[0]);
+		for (size_t i = 0; i < arguments.size(); i++)
+			argv.push_back(&arguments[i][0]);
+		argv.push_back(nullptr);
+
+		// Fails (instead of the child exiting) if the file can't be executed
+		pid_t child;
+		if (posix_spawnp(&child, filename.c_str(), nullptr, nullptr, argv.data(), environ) != 0)
+			return false;
+		children.push_back(child);
+		return true;
+	}
+
+#endif
+
+	Launcher::~Launcher()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		requestAvailable.notify_one();
+
+		if (worker.joinable())
+			worker.join();
+
+#ifndef _WIN32
+		// Those still running are left alone; they're reaped by whoever adopts them
+		for (size_t i = 0; i < children.size(); i++)
+			waitpid(children[i], nullptr, WNOHANG);
+#endif
+	}
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "stdafx.h"
+
+#ifndef _WIN32
+#include <sys/types.h>		// pid_t
+#endif
+
+namespace Multikeys
+{
+	/*
+	Launcher - Starts processes for ExecutableCommand on a worker thread of its own.
+	Starting a process may take long (tens to hundreds of milliseconds), and the thread
+	that executes commands is the one answering the keyboard hook, which must not wait
+	for that. Requests are queued and the caller returns immediately.
+	Processes are started with ShellExecute on Windows, and with posix_spawnp elsewhere
+	(where the launcher is only built for its tests and benchmark).
+	*/
+	class Launcher
+	{
+	public:
+
+		// Maximum number of launches waiting in the queue; more requests are dropped.
+		static const size_t QUEUE_CAPACITY = 16;
+
+		// Identical launches requested within this time (in ms) of the last accepted one
+		// are ignored; holding a key or bouncy switches shouldn't open several windows.
+		static const unsigned long long DEBOUNCE_TIME = 250;
+
+		// Launch statistics; latency is measured from the request to the launch returning,
+		// so it includes the time spent in the queue.
+		struct Stats
+		{
+			unsigned long long launched;		// Launches reported as successful
+			unsigned long long failed;			// Launches reported as failed
+			unsigned long long dropped;			// Requests refused because the queue was full
+			unsigned long long debounced;		// Requests ignored as duplicates
+			unsigned long long totalLatency;	// Sum of the latencies of all launches, in microseconds
+			unsigned long long maxLatency;		// Largest latency of a launch, in microseconds
+		};
+
+		// The launcher shared by all ExecutableCommands.
+		static Launcher& shared();
+
+		// Queues the file to be opened with the given arguments.
+		// Returns FALSE if the request was dropped because the queue is full;
+		// a debounced request counts as accepted.
+		bool enqueue(const std::wstring& filename, const std::wstring& arguments);
+
+		// Copy of the statistics gathered so far.
+		Stats getStats() const;
+
+		~Launcher();
+
+	private:
+
+		typedef std::chrono::steady_clock Clock;
+
+		struct Request
+		{
+			std::wstring filename;
+			std::wstring arguments;
+			Clock::time_point requestTime;
+		};
+
+		Launcher();
+		Launcher(const Launcher&) = delete;
+		Launcher& operator=(const Launcher&) = delete;
+
+		// Body of the worker thread
+		void run();
+
+		// Starts the process of a request; returns false if it couldn't be started.
+		// Called by the worker, without the lock.
+		bool _launch(const Request& request);
+
+		// Everything below is protected by mutex
+		mutable std::mutex mutex;
+		std::condition_variable requestAvailable;
+		std::deque<Request> requests;
+		bool stopping;
+
+		// Time each file and argument pair was last accepted, for debouncing
+		std::unordered_map<std::wstring, Clock::time_point> lastAccepted;
+
+		Stats stats;
+
+		// Started on the first request, so that configurations without executables never create it
+		std::thread worker;
+
+#ifndef _WIN32
+		// Processes started and not yet reaped; only used by the worker
+		std::vector<pid_t> children;
+#endif
+	};
+}
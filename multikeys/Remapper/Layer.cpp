@@ -1,35 +1,183 @@
 #include "stdafx.h"
 #include "Layer.h"
 
+#include <algorithm>	// for std::is_permutation
+
 // Implementation of methods defined in Layer.h
 
 namespace Multikeys
 {
 	Layer::Layer(const std::vector<std::wstring>& _modifierCombination,
-		const std::unordered_map<Scancode, BaseKeystrokeCommand*>& _layout)
-		:	modifierCombination(_modifierCombination),
-			layout(_layout)
-	{ }
+		const std::unordered_map<Scancode, BaseKeystrokeCommand*>& _layout,
+		const std::vector<ChordDefinition>& _chords,
+		std::shared_ptr<const Layer> _base, bool _transparent,
+		const std::vector<std::wstring>& _ignoredModifiers)
+		:	ownChords(!_chords.empty()), deadKeyTimeout(0), built(false), base(_base),
+			modifierCombination(_modifierCombination), ignoredModifiers(_ignoredModifiers), transparent(_transparent)
+	{
+		for (auto it = _layout.begin(); it != _layout.end(); it++)
+		{
+			DeadKeyCommand* deadKey = dynamic_cast<DeadKeyCommand*>(it->second);
+			if (deadKey && deadKey->timeout > 0 && (deadKeyTimeout == 0 || deadKey->timeout < deadKeyTimeout))
+				deadKeyTimeout = deadKey->timeout;
+		}
+		// Those of the base too, even if overridden; waking up early does no harm
+		if (base && base->deadKeyTimeout > 0 && (deadKeyTimeout == 0 || base->deadKeyTimeout < deadKeyTimeout))
+			deadKeyTimeout = base->deadKeyTimeout;
 
-	BaseKeystrokeCommand* Layer::getCommand(Scancode sc) const
+		// Built right away; nothing is left for the first lookup
+		std::call_once(builtFlag, [&]() { _index(_layout, _chords); });
+		built = true;
+	}
+
+	Layer::Layer(const std::vector<std::wstring>& _modifierCombination, std::unique_ptr<const LayerSource> _source,
+		bool hasChords, DWORD _deadKeyTimeout,
+		std::shared_ptr<const Layer> _base, bool _transparent,
+		const std::vector<std::wstring>& _ignoredModifiers)
+		:	ownChords(hasChords), deadKeyTimeout(_deadKeyTimeout), source(std::move(_source)), built(false), base(_base),
+			modifierCombination(_modifierCombination), ignoredModifiers(_ignoredModifiers), transparent(_transparent)
+	{
+		if (base && base->deadKeyTimeout > 0 && (deadKeyTimeout == 0 || base->deadKeyTimeout < deadKeyTimeout))
+			deadKeyTimeout = base->deadKeyTimeout;
+	}
+
+	void Layer::build() const
+	{
+		if (built.load(std::memory_order_acquire))
+			return;
+		if (base)
+			base->build();
+		std::call_once(builtFlag, [this]() {
+			std::unordered_map<Scancode, BaseKeystrokeCommand*> readLayout;
+			std::vector<ChordDefinition> readChords;
+			if (source->build(&readLayout, &readChords))
+				_index(readLayout, readChords);
+#if DEBUG
+			else
+				OutputDebugString(L"Could not build a layer; it's left without keys\n");
+#endif
+			source.reset();		// Its memory is only needed until now
+		});
+		built.store(true, std::memory_order_release);
+	}
+
+	bool Layer::isBuilt() const
+	{
+		return built.load(std::memory_order_acquire);
+	}
+
+	const Layer* Layer::getBase() const
 	{
-		// Because maps do not allow duplicate keys,
-		// unordered_map::count actually returns either 0 or 1
-		// and is used to tell whether a key exists in the map.
-		return (
-			layout.count(sc) == 0 ?		// <- true if not found
-			nullptr :
-			layout.at(sc)
-			);
+		return base.get();
 	}
 
-	Layer::~Layer()
+	void Layer::_index(const std::unordered_map<Scancode, BaseKeystrokeCommand*>& _layout,
+		const std::vector<ChordDefinition>& _chords) const
 	{
-		// Delete every command.
-		// No command appears in more than one layer, or in more than one keyboard.
-		for (auto it = this->layout.begin(); it != this->layout.end(); it++)
+		layout = _layout;
+
+		for (size_t i = 0; i < _chords.size(); i++)
 		{
-			delete it->second;
+			// Number the keys in the order they first appear
+			ChordMask keys = 0;
+			for (size_t k = 0; k < _chords[i].keys.size(); k++)
+			{
+				Scancode sc = _chords[i].keys[k];
+				if (chordKeys.count(sc) == 0 && chordKeys.size() < MAX_CHORD_KEYS_PER_LAYER)
+					chordKeys[sc] = 1ULL << chordKeys.size();
+				if (chordKeys.count(sc) != 0)
+					keys |= chordKeys[sc];
+			}
+			chords[keys] = _chords[i].command;
+
+			// Every nonempty proper subset of the chord's keys is a prefix:
+			// the keys of a chord may be pressed in any order.
+			for (ChordMask subset = (keys - 1) & keys; subset != 0; subset = (subset - 1) & keys)
+				chordPrefixes.insert(subset);
 		}
 	}
+
+	DWORD Layer::getDeadKeyTimeout() const
+	{
+		return deadKeyTimeout;
+	}
+
+	bool Layer::hasModifiers(const std::vector<std::wstring>& combination, const std::vector<std::wstring>& ignored) const
+	{
+		return modifierCombination.size() == combination.size()
+			&& std::is_permutation(modifierCombination.begin(), modifierCombination.end(), combination.begin())
+			&& ignoredModifiers.size() == ignored.size()
+			&& std::is_permutation(ignoredModifiers.begin(), ignoredModifiers.end(), ignored.begin());
+	}
+
+	BaseKeystrokeCommand* Layer::getCommand(Scancode sc) const
+	{
+		// Keys this layer doesn't override come from its base, if any
+		build();
+		auto found = layout.find(sc);
+		if (found != layout.end())
+			return found->second;
+		return base ? base->getCommand(sc) : nullptr;
+	}
+
+	void Layer::getMappings(OUT std::unordered_map<Scancode, BaseKeystrokeCommand*> *const out_mappings) const
+	{
+		// insert leaves existing keys alone, so this layer's keys win over its base's
+		build();
+		out_mappings->insert(layout.begin(), layout.end());
+		if (base)
+			base->getMappings(out_mappings);
+	}
+
+	size_t Layer::getMemoryUsage() const
+	{
+		// Hash nodes hold the pair and about two pointers; buckets hold a pointer or two each
+		const size_t nodeOverhead = 2 * sizeof(void*);
+		if (!isBuilt() && source)
+			return sizeof(*this) + source->getMemoryUsage();
+		return sizeof(*this)
+			+ layout.size() * (sizeof(std::pair<const Scancode, BaseKeystrokeCommand*>) + nodeOverhead)
+			+ layout.bucket_count() * 2 * sizeof(void*)
+			+ chordKeys.size() * (sizeof(std::pair<const Scancode, ChordMask>) + nodeOverhead)
+			+ chords.size() * (sizeof(std::pair<const ChordMask, BaseKeystrokeCommand*>) + nodeOverhead)
+			+ chordPrefixes.size() * (sizeof(ChordMask) + nodeOverhead);
+	}
+
+	// A layer with chords of its own replaces those of its base altogether
+
+	bool Layer::hasChords() const
+	{
+		if (!ownChords && base)
+			return base->hasChords();
+		return ownChords;
+	}
+
+	ChordMask Layer::getChordKey(Scancode sc) const
+	{
+		if (!ownChords && base)
+			return base->getChordKey(sc);
+		build();
+		auto found = chordKeys.find(sc);
+		return found == chordKeys.end() ? 0 : found->second;
+	}
+
+	bool Layer::isChordPrefix(ChordMask keys) const
+	{
+		if (!ownChords && base)
+			return base->isChordPrefix(keys);
+		build();
+		return chordPrefixes.count(keys) != 0;
+	}
+
+	BaseKeystrokeCommand* Layer::getChord(ChordMask keys) const
+	{
+		if (!ownChords && base)
+			return base->getChord(keys);
+		build();
+		auto found = chords.find(keys);
+		return found == chords.end() ? nullptr : found->second;
+	}
+
+	// Commands may appear in several layers and keyboards; they belong to the CommandPool.
+	Layer::~Layer() { }
 }
\ No newline at end of file
@@ -6,6 +6,43 @@
 
 namespace Multikeys
 {
+	// Set of keys of a possible chord, one bit per key. Each layer numbers the keys
+	// used in its chords, so a layer may use at most 64 different keys in chords.
+	typedef unsigned long long ChordMask;
+
+	// Maximum number of keys in a single chord
+	const size_t MAX_CHORD_KEYS = 8;
+
+	// Maximum number of different keys used in the chords of a single layer
+	const size_t MAX_CHORD_KEYS_PER_LAYER = 64;
+
+	// A command triggered by pressing several keys together (see Layer)
+	struct ChordDefinition
+	{
+		std::vector<Scancode> keys;			// From 2 to MAX_CHORD_KEYS different keys
+		BaseKeystrokeCommand* command;
+	};
+
+
+	// Where the keys and chords of a layer are read from, the first time the layer is activated.
+	// Layers that most sessions never switch to cost neither the time to read them nor the
+	// memory of their commands until then; reading one costs about as much as its size.
+	class LayerSource
+	{
+	public:
+
+		// Reads the keys and chords of the layer; false if they can't be read.
+		// Called once, by whichever thread first needs the layer: the first keystroke that
+		// activates it, or the remapper's background thread if the settings ask for it.
+		virtual bool build(OUT std::unordered_map<Scancode, BaseKeystrokeCommand*> *const out_layout,
+			OUT std::vector<ChordDefinition> *const out_chords) const = 0;
+
+		// Approximate memory kept until the layer is built, in bytes
+		virtual size_t getMemoryUsage() const = 0;
+
+		virtual ~LayerSource() { }
+	};
+
 
 	// This class represents the remaps associated with a specific
 	// modifier combination.
@@ -14,16 +51,53 @@ namespace Multikeys
 	private:
 
 		// Map from scancodes to keystroke command pointers.
-		// No command pointer is ever deleted at runtime.
-		const std::unordered_map<Scancode, BaseKeystrokeCommand*> layout;
+		// The commands belong to the CommandPool they were read into, and may be shared
+		// with other layers and keyboards; none is ever deleted at runtime.
+		// Empty until the layer is built; never modified afterwards.
+		mutable std::unordered_map<Scancode, BaseKeystrokeCommand*> layout;
+
+		// Chord index, built with the layout:
+		// the bit of each key used in chords,
+		mutable std::unordered_map<Scancode, ChordMask> chordKeys;
+		// the command of each chord, by its set of keys,
+		mutable std::unordered_map<ChordMask, BaseKeystrokeCommand*> chords;
+		// and every set of keys that is part of a chord without being all of it.
+		mutable std::unordered_set<ChordMask> chordPrefixes;
+
+		// Whether this layer defines chords of its own; known before it's built
+		const bool ownChords;
+
+		// Shortest timeout of the dead keys in layout; 0 if none of them has one.
+		DWORD deadKeyTimeout;
+
+		// Where layout and chords are read from; null once the layer is built, or if it was built
+		// in the constructor. Keystrokes on several keyboards and the remapper's background thread
+		// may need it at once, so the first of them builds the layer through builtFlag, the rest
+		// wait for it, and later ones only check built.
+		mutable std::unique_ptr<const LayerSource> source;
+		mutable std::once_flag builtFlag;
+		mutable std::atomic<bool> built;
+
+		// Layer of a template this one overrides, shared with every keyboard using the template;
+		// null if none. Keys missing from layout are looked up there, and so are chords if this
+		// layer has none of its own.
+		const std::shared_ptr<const Layer> base;
 
 	public:
 
 		// This identifies the combination of modifiers that trigger this layer,
 		// by name of the modifiers. Each modifier listed must be on,
-		// and every other must be off.
+		// and every other must be off, except those in ignoredModifiers.
 		const std::vector<std::wstring> modifierCombination;
 
+		// Modifiers whose state doesn't matter to this layer: it's triggered whether they're on or off.
+		const std::vector<std::wstring> ignoredModifiers;
+
+		// Whether keys this layer doesn't map fall through to the layer below it: the one with the
+		// most modifiers among those whose modifiers are all in this one's (the first in document order
+		// if there are several). The spec flattens the whole stack into a single table when it's built.
+		const bool transparent;
+
 		// Updated Constructor
 		// modifierCombination - vector of wstrings that contains the names of each
 		//		modifier that should be pressed down in order to activate this layer.
@@ -31,20 +105,82 @@ namespace Multikeys
 		//		not be pressed in order to activate this layer.
 		// layout - a hash map from scancode to its command. This object is used purely
 		//		for retrieval.
-		// The caller may delete either container, or let them go out of scope after calling this.
+		// chords - commands triggered by pressing keys together, which may also have commands
+		//		of their own in layout. At most MAX_CHORD_KEYS_PER_LAYER different keys.
+		// base - layer overridden by this one, or null. It must have the same modifiers.
+		// transparent - whether keys missing from layout (and from base) fall through to lower layers.
+		// ignoredModifiers - modifiers of the keyboard that may be either on or off.
+		// The caller may delete any container, or let them go out of scope after calling this.
+		// The commands in them must outlive this layer.
 		Layer(const std::vector<std::wstring>& _modifierCombination,
-			const std::unordered_map<Scancode, BaseKeystrokeCommand*>& _layout);
+			const std::unordered_map<Scancode, BaseKeystrokeCommand*>& _layout,
+			const std::vector<ChordDefinition>& _chords = std::vector<ChordDefinition>(),
+			std::shared_ptr<const Layer> _base = nullptr, bool _transparent = false,
+			const std::vector<std::wstring>& _ignoredModifiers = std::vector<std::wstring>());
+
+		// Layer whose keys and chords are read from source when build is called; the rest is known now.
+		// hasChords - whether source defines any chord.
+		// deadKeyTimeout - shortest timeout of the dead keys in source; 0 if none of them times out.
+		Layer(const std::vector<std::wstring>& _modifierCombination, std::unique_ptr<const LayerSource> _source,
+			bool hasChords, DWORD deadKeyTimeout,
+			std::shared_ptr<const Layer> _base = nullptr, bool _transparent = false,
+			const std::vector<std::wstring>& _ignoredModifiers = std::vector<std::wstring>());
+
+		// Reads the keys and chords of this layer and of its base, if they haven't been yet; waits
+		// if another thread is reading them. KeyboardSpec::findLayer does it when the layer is
+		// activated, and lookups do it too, so they never find a layer empty only for not being
+		// read yet. Layers that fail to be read are left without keys.
+		void build() const;
+
+		// Whether the keys and chords of this layer have been read
+		bool isBuilt() const;
+
+		// Layer this one overrides, or null; see the constructor.
+		const Layer* getBase() const;
 
 		// Receives a scancode and returns the command mapped to it.
 		// If there is no such command, a null pointer is returned.
 		BaseKeystrokeCommand* getCommand(Scancode sc) const;
 
+		// Adds every key this layer maps, with its command, to out_mappings; keys already
+		// there are left as they are. Builds the layer and its base first; only for loading.
+		void getMappings(OUT std::unordered_map<Scancode, BaseKeystrokeCommand*> *const out_mappings) const;
+
+		// Whether any chord is defined in this layer
+		bool hasChords() const;
+
+		// Bit of the key in this layer's chords; 0 if the key is part of no chord.
+		ChordMask getChordKey(Scancode sc) const;
+
+		// Whether more keys may still be added to these keys to make a chord.
+		bool isChordPrefix(ChordMask keys) const;
+
+		// The command of the chord made of exactly these keys, or null if there is none.
+		BaseKeystrokeCommand* getChord(ChordMask keys) const;
+
+		// Shortest timeout of the dead keys in this layer; 0 if none of them times out.
+		DWORD getDeadKeyTimeout() const;
+
+		// Whether this layer is triggered by exactly these modifiers, ignoring exactly these others,
+		// in any order
+		bool hasModifiers(const std::vector<std::wstring>& combination, const std::vector<std::wstring>& ignored) const;
+
+		// Approximate memory used by the tables of this layer (or by its source, until it's built),
+		// not counting its base nor the commands, in bytes
+		size_t getMemoryUsage() const;
+
 
 		
 
 		// Destructor
 		~Layer();
 
+	private:
+
+		// Fills the tables from the keys and chords read
+		void _index(const std::unordered_map<Scancode, BaseKeystrokeCommand*>& _layout,
+			const std::vector<ChordDefinition>& _chords) const;
+
 	};
 
 }
\ No newline at end of file
@@ -0,0 +1,276 @@
+#include "stdafx.h"
+
+/*--Implementations of methods in MacroScheduler.h--*/
+#include "MacroScheduler.h"
+#include "KeystrokeCommands.h"
+
+namespace Multikeys
+{
+	static TimerTime SchedulerClock()
+	{
+		return GetTickCount64();
+	}
+
+	// Where the shared scheduler is in its life; it's a function-local static, so commands
+	// destroyed at exit may outlive it.
+	enum SchedulerLifetime
+	{
+		NotConstructed,
+		Alive,
+		Destroyed
+	};
+	static std::atomic<int> sharedLifetime(NotConstructed);
+
+	MacroScheduler& MacroScheduler::shared()
+	{
+		// Constructed on first use; its destructor waits for the worker at exit.
+		static MacroScheduler instance;
+		return instance;
+	}
+
+	MacroScheduler::MacroScheduler()
+		: stopping(false), wheel(SchedulerClock), stats()
+	{
+		for (size_t i = 0; i < MAX_RUNS; i++)
+		{
+			runs[i].timer.callback = _onTimer;
+			runs[i].timer.context = i;
+			runs[i].macro = nullptr;
+			runs[i].nextStep = 0;
+			runs[i].dueTime = 0;
+			runs[i].sending = false;
+			runs[i].due = false;
+		}
+		sharedLifetime = Alive;
+	}
+
+	bool MacroScheduler::start(const TimedMacroCommand* macro)
+	{
+		bool stepSent;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			// Triggered again while still playing: start over in the same run
+			Run* run = nullptr;
+			for (size_t i = 0; i < MAX_RUNS && !run; i++)
+			{
+				if (runs[i].macro != macro)
+					continue;
+				_waitUntilSent(&runs[i], lock);
+				// Unless it finished meanwhile; then any free run will do
+				if (runs[i].macro == macro)
+				{
+					_stop(&runs[i], lock);
+					stats.restarted++;
+					run = &runs[i];
+				}
+			}
+			for (size_t i = 0; i < MAX_RUNS && !run; i++)
+			{
+				if (!runs[i].macro && !runs[i].sending)
+					run = &runs[i];
+			}
+			if (!run)
+			{
+				stats.dropped++;
+				return false;
+			}
+
+			run->macro = macro;
+			run->nextStep = 0;
+			run->dueTime = GetTickCount64();
+			stats.started++;
+
+			// The first step goes out now, from the caller's thread, as any other macro would
+			stepSent = _step(run, lock);
+
+			if (run->macro && !worker.joinable())
+				worker = std::thread(&MacroScheduler::run, this);
+		}
+
+		// The worker may be sleeping until a later timer, or for good
+		wake.notify_one();
+		return stepSent;
+	}
+
+	void MacroScheduler::cancel(const TimedMacroCommand* macro)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for (size_t i = 0; i < MAX_RUNS; i++)
+		{
+			if (runs[i].macro != macro)
+				continue;
+			_waitUntilSent(&runs[i], lock);
+			if (runs[i].macro == macro)
+				_stop(&runs[i], lock);
+		}
+	}
+
+	void MacroScheduler::cancelShared(const TimedMacroCommand* macro)
+	{
+		// Only ever destroyed at exit, by the thread destroying commands too; so it can't go
+		// away between checking and cancelling.
+		if (sharedLifetime == Alive)
+			shared().cancel(macro);
+	}
+
+	MacroScheduler::Stats MacroScheduler::getStats() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return stats;
+	}
+
+	void MacroScheduler::run()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!stopping)
+		{
+			// Waking up early is harmless: advance fires nothing before it's due
+			TimerTime delay = wheel.timeUntilNext();
+			if (delay == 0)
+				wake.wait(lock);
+			else
+				wake.wait_for(lock, std::chrono::milliseconds(delay));
+			if (stopping)
+				break;
+
+			// Timers only mark their runs as due; the steps are sent here, one run at a time.
+			// A run still sending its previous step is left due; its sender wakes this thread.
+			// The mutex is released while sending, so look again from the start after each one.
+			wheel.advance();
+			bool stepped = true;
+			while (stepped && !stopping)
+			{
+				stepped = false;
+				for (size_t i = 0; i < MAX_RUNS && !stepped; i++)
+				{
+					if (runs[i].due && !runs[i].sending)
+					{
+						runs[i].due = false;
+						if (runs[i].macro)
+						{
+							_step(&runs[i], lock);
+							stepped = true;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	bool MacroScheduler::_step(Run* run, std::unique_lock<std::mutex>& lock)
+	{
+		const TimedMacroCommand* macro = run->macro;
+		const MacroStep& step = macro->getStep(run->nextStep);
+		const INPUT* inputs = macro->getStepInputs(run->nextStep);
+
+		// Move on before sending, so that the state is consistent while the mutex is released;
+		// the macro can't be destroyed meanwhile, since cancel waits for the run to be sent.
+		run->nextStep++;
+		bool finished = run->nextStep >= macro->getStepCount();
+		if (!finished)
+		{
+			// Pauses count from when the previous step was due, so that lateness doesn't pile up
+			run->dueTime += step.pauseAfter;
+			ULONGLONG now = GetTickCount64();
+			wheel.arm(&run->timer, run->dueTime > now ? run->dueTime - now : 0);
+		}
+
+		run->sending = true;
+		lock.unlock();
+		UINT inputsSent = SendInput((UINT)step.inputCount, const_cast<INPUT*>(inputs), sizeof(INPUT));
+		lock.lock();
+		run->sending = false;
+		sent.notify_all();
+		if (run->due)
+			wake.notify_one();		// Its next step came due while this one was being sent
+
+		// Keep track of what's held down, to release it if the run is cut short
+		for (UINT i = 0; i < inputsSent; i++)
+		{
+			BYTE virtualKey = inputs[i].ki.wVk & 0xff;
+			run->heldKeys.set(virtualKey, (inputs[i].ki.dwFlags & KEYEVENTF_KEYUP) == 0);
+		}
+
+		if (inputsSent != step.inputCount)
+		{
+			// Input was blocked (e.g. by another desktop); don't leave keys stuck down
+			_stop(run, lock);
+			return false;
+		}
+
+		if (finished)
+		{
+			// Keys the macro itself left down are its author's choice, and stay so.
+			run->macro = nullptr;
+			run->heldKeys.reset();
+			stats.completed++;
+		}
+		return true;
+	}
+
+	void MacroScheduler::_stop(Run* run, std::unique_lock<std::mutex>& lock)
+	{
+		wheel.cancel(&run->timer);
+		run->due = false;
+
+		std::vector<INPUT> releases;
+		for (size_t virtualKey = 0; virtualKey < run->heldKeys.size(); virtualKey++)
+		{
+			if (run->heldKeys.test(virtualKey))
+				releases.push_back(run->macro->getRelease((BYTE)virtualKey));
+		}
+		run->macro = nullptr;
+		run->heldKeys.reset();
+
+		if (releases.empty())
+			return;
+
+		// Still sending, so that the run isn't reused before its keys are released
+		run->sending = true;
+		lock.unlock();
+		SendInput((UINT)releases.size(), releases.data(), sizeof(INPUT));
+		lock.lock();
+		run->sending = false;
+		sent.notify_all();
+	}
+
+	void MacroScheduler::_waitUntilSent(Run* run, std::unique_lock<std::mutex>& lock)
+	{
+		sent.wait(lock, [run] { return !run->sending; });
+	}
+
+	void MacroScheduler::_onTimer(TimerNode* node)
+	{
+		// Called from run(), with the mutex held
+		MacroScheduler& scheduler = shared();
+		Run* run = &scheduler.runs[node->context];
+
+		ULONGLONG now = GetTickCount64();
+		if (now > run->dueTime && now - run->dueTime > scheduler.stats.maxLateness)
+			scheduler.stats.maxLateness = now - run->dueTime;
+
+		run->due = true;
+	}
+
+	MacroScheduler::~MacroScheduler()
+	{
+		sharedLifetime = Destroyed;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			stopping = true;
+
+			// Nothing will send the rest of these; let go of their keys
+			for (size_t i = 0; i < MAX_RUNS; i++)
+			{
+				_waitUntilSent(&runs[i], lock);
+				if (runs[i].macro)
+					_stop(&runs[i], lock);
+			}
+		}
+		wake.notify_one();
+
+		if (worker.joinable())
+			worker.join();
+	}
+}
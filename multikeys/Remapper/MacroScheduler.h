@@ -0,0 +1,125 @@
+#pragma once
+
+#include "stdafx.h"
+#include "TimerWheel.h"
+
+namespace Multikeys
+{
+	class TimedMacroCommand;
+
+	/*
+	MacroScheduler - Plays macros that pause between their keystrokes (TimedMacroCommand).
+	The thread that executes commands is the one answering the keyboard hook, which must not
+	sleep through a macro's delays. The first step of a macro is sent right away; each later
+	one is sent by a worker thread of its own, when the timer of the macro's run fires.
+	A run is only a timer and a position in the macro, so any number of macros may be
+	playing at once without a thread or a stack each.
+	Input is never sent with the mutex held: a run is marked as sending instead, and nobody
+	else sends for it, nor reuses it, until that's done.
+	*/
+	class MacroScheduler
+	{
+	public:
+
+		// Maximum number of macros playing at once; more starts are dropped.
+		static const size_t MAX_RUNS = 64;
+
+		struct Stats
+		{
+			ULONGLONG started;			// Runs started
+			ULONGLONG restarted;		// Runs cut short because their macro was triggered again
+			ULONGLONG completed;		// Runs that sent every step
+			ULONGLONG dropped;			// Starts refused because every run was in use
+			ULONGLONG maxLateness;		// Longest a step was sent after it was due, in ms
+		};
+
+		// The scheduler shared by all TimedMacroCommands.
+		static MacroScheduler& shared();
+
+		// Sends the first step of the macro and schedules the others. If the macro is
+		// already playing, that run is stopped first (its held keys released), and the
+		// macro starts over. Returns false if the macro was dropped, or SendInput failed.
+		bool start(const TimedMacroCommand* macro);
+
+		// Stops the macro if it's playing, releasing the keys it holds down; waits for a step
+		// of it being sent by another thread.
+		void cancel(const TimedMacroCommand* macro);
+
+		// Same as shared().cancel(macro), if the shared scheduler exists and isn't being destroyed;
+		// otherwise there's nothing to cancel. Called when the command is destroyed, so that no
+		// run outlives it, which may be during exit, after the scheduler is gone.
+		static void cancelShared(const TimedMacroCommand* macro);
+
+		// Copy of the statistics gathered so far.
+		Stats getStats() const;
+
+		~MacroScheduler();
+
+	private:
+
+		// A macro being played
+		struct Run
+		{
+			// Fires when the next step is due; its context is the index of the run
+			TimerNode timer;
+
+			// Null while this run is free
+			const TimedMacroCommand* macro;
+
+			// Step to be sent when the timer fires
+			size_t nextStep;
+
+			// When that step is due (GetTickCount64)
+			ULONGLONG dueTime;
+
+			// Virtual keys this run pressed and didn't release yet
+			std::bitset<256> heldKeys;
+
+			// Set while a thread sends input for this run, without the mutex; nobody else
+			// may send for it, stop it or reuse it meanwhile.
+			bool sending;
+
+			// Set when the timer fires; the worker sends the step once the run isn't sending.
+			bool due;
+		};
+
+		MacroScheduler();
+		MacroScheduler(const MacroScheduler&) = delete;
+		MacroScheduler& operator=(const MacroScheduler&) = delete;
+
+		// Body of the worker thread
+		void run();
+
+		// Sends the run's next step, then arms its timer for the one after it, or frees the run
+		// if that was the last one. Returns false if SendInput failed.
+		// Called with the mutex held, through lock, and the run not sending; unlocks it to send.
+		bool _step(Run* run, std::unique_lock<std::mutex>& lock);
+
+		// Releases the keys held by the run, disarms its timer and frees it.
+		// Called with the mutex held, through lock, and the run not sending; unlocks it to send.
+		void _stop(Run* run, std::unique_lock<std::mutex>& lock);
+
+		// Waits until no thread is sending for the run.
+		void _waitUntilSent(Run* run, std::unique_lock<std::mutex>& lock);
+
+		// Callback of the runs' timers, called by wheel.advance with the mutex held;
+		// only marks the run as due.
+		static void _onTimer(TimerNode* node);
+
+		// Everything below is protected by mutex
+		mutable std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable sent;		// Some run stopped sending
+		bool stopping;
+
+		// Timers of the runs; only touched with the mutex held, so it's used from both threads
+		TimerWheel wheel;
+
+		Run runs[MAX_RUNS];
+
+		Stats stats;
+
+		// Started the first time a macro pauses, so that configurations without timed macros never create it
+		std::thread worker;
+	};
+}
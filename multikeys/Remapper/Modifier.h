@@ -2,10 +2,16 @@
 
 #include "stdafx.h"
 #include "Scancode.h"
-#include "Layer.h"
 
 namespace Multikeys
 {
+	// Set of pressed modifiers of a keyboard, one bit per modifier.
+	// Bit i stands for the i-th modifier in the keyboard's KeyboardSpec.
+	typedef unsigned long long ModifierMask;
+
+	// Maximum number of modifiers in a single keyboard; one per bit of ModifierMask.
+	const size_t MAX_MODIFIERS = 64;
+
 	// Abstract class
 	//
 	// Splitting modifiers into either simple or composite
@@ -19,6 +25,11 @@ namespace Multikeys
 		// This name should uniquely identify each modifier.
 		std::wstring name;
 
+		// For a dual-role modifier, the time (in ms) it must be held down to act as a modifier;
+		// released earlier, it's a tap, and does what its key is mapped to instead.
+		// 0 for a plain modifier.
+		DWORD tapTimeout;
+
 		// Check if a given scancode triggers this modifier
 		virtual bool matches(Scancode sc) const = 0;
 
@@ -57,43 +68,4 @@ namespace Multikeys
 
 		~CompositeModifier() override;
 	};
-
-
-	// This class is used for two purposes:
-	//		In a Keyboard to represent the internal state of its modifiers (mutable)
-	//		In a Layer to represent the required modifiers to trigger it (const)
-	class ModifierStateMap
-	{
-	private:
-
-		// ordered map allows for easy iteration
-		// The boolean value of each modifier is true if the key is currently pressed.
-		std::map<PModifier, bool> modifiers;
-
-		
-
-	public:
-
-		// Copy constructor
-		ModifierStateMap(const ModifierStateMap& original);
-
-		// STL constructor; sets all modifiers to unpressed
-		ModifierStateMap(const std::vector<PModifier>& modifiers);
-		
-
-		// Receives a scancode, and a flag for keypress up or down.
-		// If sc is a modifier contained in this object, its state is updated and true is returned
-		// otherwise, false is returned.
-		bool updateState(Scancode sc, bool keyDown);
-
-		// Returns true if layer is triggered by the current combination of modifiers in this object.
-		bool checkState(Layer* const layer) const;
-
-		void resetAllModifiers();
-
-
-		inline bool operator==(const ModifierStateMap& rhs) const;
-
-		~ModifierStateMap();
-	};
 }
\ No newline at end of file
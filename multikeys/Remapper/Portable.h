@@ -0,0 +1,155 @@
+// The part of the Windows API the remapper uses, for the builds of ../CMakeLists.txt that
+// test and benchmark it elsewhere; included by stdafx.h instead of Windows.h.
+//
+// Types and constants are those of Windows, with the sizes of a Windows build. Nothing is sent
+// anywhere: SendInput hands the inputs to whatever handler a test installs, and the foreground
+// window has no keyboard layout, so keys that aren't remapped type nothing.
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+#include <wchar.h>
+#include <wctype.h>
+
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef int64_t LONG64;
+typedef unsigned long long ULONGLONG;
+typedef unsigned int UINT;
+typedef unsigned short USHORT;
+typedef int BOOL;
+typedef wchar_t WCHAR;
+typedef WCHAR* LPWSTR;
+typedef const WCHAR* LPCWSTR;
+typedef uintptr_t ULONG_PTR;
+typedef void* HANDLE;
+typedef struct HWND__* HWND;
+typedef struct HKL__* HKL;
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+#ifndef OUT
+#define OUT
+#endif
+#define INFINITE 0xFFFFFFFF
+
+
+// Keystrokes, as sent by SendInput
+
+#define INPUT_KEYBOARD			1
+#define KEYEVENTF_EXTENDEDKEY	0x0001
+#define KEYEVENTF_KEYUP			0x0002
+#define KEYEVENTF_UNICODE		0x0004
+#define KEYEVENTF_SCANCODE		0x0008
+
+struct KEYBDINPUT
+{
+	WORD wVk;
+	WORD wScan;
+	DWORD dwFlags;
+	DWORD time;
+	ULONG_PTR dwExtraInfo;
+};
+
+struct INPUT
+{
+	DWORD type;
+	union
+	{
+		KEYBDINPUT ki;
+	};
+};
+
+
+// Keystrokes, as received from Raw Input
+
+#define RI_KEY_MAKE		0
+#define RI_KEY_BREAK	1
+#define RI_KEY_E0		2
+#define RI_KEY_E1		4
+
+struct RAWKEYBOARD
+{
+	USHORT MakeCode;
+	USHORT Flags;
+	USHORT Reserved;
+	USHORT VKey;
+	UINT Message;
+	ULONG ExtraInformation;
+};
+
+
+// Virtual keys the remapper treats specially
+
+#define VK_BACK		0x08
+#define VK_RETURN	0x0D
+#define VK_SHIFT	0x10
+#define VK_CONTROL	0x11
+#define VK_MENU		0x12
+#define VK_CAPITAL	0x14
+#define VK_LSHIFT	0xA0
+#define VK_RSHIFT	0xA1
+#define VK_LCONTROL	0xA2
+#define VK_RCONTROL	0xA3
+#define VK_LMENU	0xA4
+#define VK_RMENU	0xA5
+
+
+namespace Multikeys
+{
+	// Receives the inputs SendInput is given, and returns how many were sent
+	typedef UINT (*SendInputHandler)(UINT count, const INPUT* inputs);
+
+	// Handler of every SendInput of the process; null (the default) sends everything to nowhere
+	inline SendInputHandler& PortableSendInputHandler()
+	{
+		static SendInputHandler handler = nullptr;
+		return handler;
+	}
+}
+
+inline UINT SendInput(UINT count, INPUT* inputs, int)
+{
+	Multikeys::SendInputHandler handler = Multikeys::PortableSendInputHandler();
+	return handler ? handler(count, inputs) : count;
+}
+
+// Milliseconds of a monotonic clock; GetTickCount wraps around as it does on Windows
+inline DWORD GetTickCount()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (DWORD)((uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000);
+}
+
+inline ULONGLONG GetTickCount64()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (ULONGLONG)now.tv_sec * 1000 + (ULONGLONG)now.tv_nsec / 1000000;
+}
+
+// Debug output goes nowhere
+inline void OutputDebugString(LPCWSTR) { }
+
+// As on Windows, a pointer whose high word is clear is a single character, converted and returned
+inline LPWSTR CharLowerW(LPWSTR text)
+{
+	if (((ULONG_PTR)text >> 16) == 0)
+		return (LPWSTR)(ULONG_PTR)towlower((wchar_t)(ULONG_PTR)text);
+	for (LPWSTR c = text; *c; c++)
+		*c = towlower(*c);
+	return text;
+}
+
+// No window and no layout: ToUnicodeEx types nothing
+inline HWND GetForegroundWindow() { return nullptr; }
+inline DWORD GetWindowThreadProcessId(HWND, DWORD*) { return 0; }
+inline HKL GetKeyboardLayout(DWORD) { return nullptr; }
+inline int ToUnicodeEx(UINT, UINT, const BYTE*, LPWSTR, int, UINT, HKL) { return 0; }
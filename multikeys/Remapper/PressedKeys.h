@@ -0,0 +1,107 @@
+#pragma once
+
+#include "stdafx.h"
+#include "Scancode.h"
+#include "KeystrokeCommands.h"
+
+// PressedKeys is a data type. No cpp implementation file exists.
+
+namespace Multikeys
+{
+	// Keys currently held down on a keyboard, and the command each of them got when it was pressed,
+	// so that its repeats and its release go to that same command whatever happens in between.
+	// Every key has a bit; commands are kept in a few slots, which is more than any hand can hold down.
+	// Keys pressed while all slots are taken are still tracked, only without their command.
+	// Plain data: copying it takes a snapshot. Slots are kept a field per array, so that none of
+	// them is padded; the whole is 320 bytes in x64 builds, 96 of them the bits.
+	struct PressedKeys
+	{
+		// Number of distinct keys: a make code, optionally prefixed by E0 or E1
+		static const USHORT KEY_COUNT = 3 * 256;
+
+		// Number of pressed keys whose commands are remembered
+		static const size_t SLOT_COUNT = 16;
+
+		// Value of slotKeys for a slot not in use
+		static const USHORT FREE_SLOT = 0xffff;
+
+		// What findSlot returns for a key without a slot
+		static const size_t NO_SLOT = SLOT_COUNT;
+
+		// A key with no event for longer than this (in ms) can't be held down anymore, since the
+		// slowest typematic settings repeat within about a second; its release was lost somewhere
+		// (for instance, it happened on the secure desktop), and its next press is a fresh one.
+		static const DWORD MAX_REPEAT_INTERVAL = 1500;
+
+		unsigned long long bits[KEY_COUNT / 64];
+
+		// For each slot: the command chosen when its key was pressed, which may be null;
+		// the GetTickCount of the key's last press or repeat; and the key (see indexOf), or FREE_SLOT.
+		BaseKeystrokeCommand* slotCommands[SLOT_COUNT];
+		DWORD slotTimes[SLOT_COUNT];
+		USHORT slotKeys[SLOT_COUNT];
+
+		// Index of the key with this scancode, from 0 to KEY_COUNT - 1
+		static USHORT indexOf(Scancode sc)
+		{
+			return sc.makeCode + (sc.flgE0 ? 256 : sc.flgE1 ? 512 : 0);
+		}
+
+		// Releases every key
+		void clear()
+		{
+			memset(bits, 0, sizeof(bits));
+			for (size_t i = 0; i < SLOT_COUNT; i++)
+			{
+				slotCommands[i] = nullptr;
+				slotTimes[i] = 0;
+				slotKeys[i] = FREE_SLOT;
+			}
+		}
+
+		bool isPressed(USHORT key) const
+		{
+			return (bits[key / 64] >> (key % 64)) & 1;
+		}
+
+		// Slot remembering the command of a pressed key; NO_SLOT if the key isn't pressed,
+		// or if there was no free slot when it was.
+		size_t findSlot(USHORT key) const
+		{
+			for (size_t i = 0; i < SLOT_COUNT; i++)
+			{
+				if (slotKeys[i] == key)
+					return i;
+			}
+			return NO_SLOT;
+		}
+
+		// Marks the key as pressed at time, remembering its command if there's a free slot.
+		void press(USHORT key, DWORD time, BaseKeystrokeCommand* command)
+		{
+			bits[key / 64] |= 1ULL << (key % 64);
+
+			size_t slot = findSlot(key);
+			if (slot == NO_SLOT)
+				slot = findSlot(FREE_SLOT);
+			if (slot == NO_SLOT)
+				return;
+			slotCommands[slot] = command;
+			slotTimes[slot] = time;
+			slotKeys[slot] = key;
+		}
+
+		// Marks the key as released, and forgets its command
+		void release(USHORT key)
+		{
+			bits[key / 64] &= ~(1ULL << (key % 64));
+
+			size_t slot = findSlot(key);
+			if (slot != NO_SLOT)
+			{
+				slotCommands[slot] = nullptr;
+				slotKeys[slot] = FREE_SLOT;
+			}
+		}
+	};
+}
@@ -2,6 +2,8 @@
 
 // Implementation of Remapper methods
 #include "Remapper.h"
+#include "Launcher.h"
+#include "MacroScheduler.h"
 
 namespace Multikeys
 {
@@ -9,47 +11,149 @@ namespace Multikeys
 	// Pure virtual destructors need an implementation.
 	IRemapper::~IRemapper() { }
 
-	Remapper::Remapper() { }
+	Remapper::Remapper()
+		: stopPrewarm(false)
+	{ }
+
+	bool Remapper::loadFallback()
+	{
+		std::shared_ptr<const KeyboardSpec> spec = MakeFallbackSpec(&commandPool);
+
+		// Set!
+		_stopPrewarm();
+		for (size_t i = 0; i < keyboards.size(); i++)
+			delete keyboards[i];
+		keyboards.clear();
+		keyboards.push_back(new Keyboard(spec));
+
+		OutputDebugString((L"Fallback layout: " + std::to_wstring(spec->getLayers().size()) + L" layers\n").c_str());
+		return true;
+	}
 
 	bool Remapper::evaluateKey(
 		// Type RAWKEYBOARD is from the WinAPI
 		RAWKEYBOARD* const keypressed,
 		wchar_t* const deviceName,
-		OUT PKeystrokeCommand* const out_action)
+		OUT PKeystrokeCommand* const out_action,
+		OUT bool* const out_repeated)
 	{
-		// Check each keyboard until name matches,
-		// then call its method for checking a key
-		for (auto it = keyboards.begin();
-			it != keyboards.end();
-			it++)
+		int keyboardIndex = findKeyboard(deviceName);
+		// If no keyboard matches, there's no remap and input shouldn't be blocked:
+		if (keyboardIndex < 0)
+		{
+			*out_repeated = false;
+			return false;
+		}
+		return evaluateKeyOnKeyboard(keyboardIndex, keypressed, out_action, out_repeated);
+	}
+
+	int Remapper::getKeyboardCount() const
+	{
+		return (int)keyboards.size();
+	}
+
+	int Remapper::findKeyboard(const WCHAR* const deviceName) const
+	{
+		// The name is only read once, and then compared against each keyboard's pattern
+		DeviceIdentity identity = ParseDeviceName(deviceName);
+
+		// Check each keyboard until name matches
+		for (size_t i = 0; i < keyboards.size(); i++)
 		{
-			
+			// Keyboards with a pattern are only found by it, whatever their name
+			const DevicePattern& pattern = keyboards[i]->getDevicePattern();
+			if (!pattern.isEmpty())
+			{
+				if (pattern.matches(identity))
+					return (int)i;
+				continue;
+			}
+
 			// If keyboard name matches:
 			/*
 			* Update: Since an empty string is used to represent "remap any non-remapped keyboard",
 			* we check for that too. It's important that this keyboard with an empty string as name
 			* be the last in the list.
 			*/
-			if (wcscmp(deviceName, (*it)->deviceName.c_str()) == 0
-				|| wcscmp(L"", (*it)->deviceName.c_str()) == 0)
+			if (wcscmp(deviceName, keyboards[i]->getDeviceName().c_str()) == 0
+				|| wcscmp(L"", keyboards[i]->getDeviceName().c_str()) == 0)
+				return (int)i;
+		}
+		return -1;
+	}
+
+	bool Remapper::evaluateKeyOnKeyboard(
+		int keyboardIndex,
+		RAWKEYBOARD* const keypressed,
+		OUT PKeystrokeCommand* const out_action,
+		OUT bool* const out_repeated)
+	{
+		// Scratch lives on the stack, so concurrent calls don't share it
+		Scancode scancode;
+		scancode.flgE0 = keypressed->Flags & RI_KEY_E0;
+		scancode.flgE1 = keypressed->Flags & RI_KEY_E1;
+		scancode.makeCode = keypressed->MakeCode & 0xff;
+		return (
+				keyboards[keyboardIndex]->evaluateKey(scancode,
+						keypressed->VKey & 0xff,
+						(keypressed->Flags & RI_KEY_BREAK) == RI_KEY_BREAK,
+						out_action, out_repeated)
+			);
+	}
+
+	void Remapper::releaseAllKeys(int keyboardIndex)
+	{
+		keyboards[keyboardIndex]->releaseAllKeys();
+	}
+
+	DWORD Remapper::getTimeout(int keyboardIndex) const
+	{
+		return keyboards[keyboardIndex]->getSpec().getTimeout();
+	}
+
+	DWORD Remapper::expire(int keyboardIndex)
+	{
+		return keyboards[keyboardIndex]->expire();
+	}
+
+	bool Remapper::takeDeferredAction(int keyboardIndex, OUT PKeystrokeCommand* const out_action)
+	{
+		return keyboards[keyboardIndex]->takeDeferredAction(out_action);
+	}
+
+	void Remapper::_prewarmLayers()
+	{
+		// Keystrokes come first; this only uses time nothing else wants
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+
+		size_t layerCount = 0;
+		for (size_t i = 0; i < keyboards.size() && !stopPrewarm; i++)
+		{
+			const KeyboardSpec& spec = keyboards[i]->getSpec();
+			const std::vector<std::shared_ptr<const Layer>>& layers = spec.getLayers();
+			for (size_t j = 0; j < layers.size() && !stopPrewarm; j++)
 			{
-				this->workScancode.flgE0 = keypressed->Flags & RI_KEY_E0;
-				this->workScancode.flgE1 = keypressed->Flags & RI_KEY_E1;
-				this->workScancode.makeCode = keypressed->MakeCode & 0xff;
-				return (
-						(*it)->evaluateKey(this->workScancode,
-								keypressed->VKey & 0xff,
-								(keypressed->Flags & RI_KEY_BREAK) == RI_KEY_BREAK,
-								out_action)
-					);
+				// The layers of templates they override too, and the outputs of their dead keys
+				for (const Layer* layer = layers[j].get(); layer; layer = layer->getBase())
+					layerCount += layer->isBuilt() ? 0 : 1;
+				spec.buildLayer(j);
 			}
 		}
-		// If no keyboard matches, there's no remap and input shouldn't be blocked:
-		return false;
+		OutputDebugString((L"Prewarm: " + std::to_wstring(layerCount) + L" layers built\n").c_str());
+	}
+
+	void Remapper::_stopPrewarm()
+	{
+		if (!prewarmThread.joinable())
+			return;
+		stopPrewarm = true;
+		prewarmThread.join();		// at most one layer still being built
+		stopPrewarm = false;
 	}
 
 	Remapper::~Remapper()
 	{
+		_stopPrewarm();
 		for (auto it = keyboards.begin();
 			it != keyboards.end();
 			it++)
@@ -71,4 +175,22 @@ namespace Multikeys
 		*instance = nullptr;
 	}
 
+	void GetBackgroundStats(OUT BackgroundStats* out_stats)
+	{
+		Launcher::Stats launches = Launcher::shared().getStats();
+		out_stats->launched = launches.launched;
+		out_stats->launchFailed = launches.failed;
+		out_stats->launchDropped = launches.dropped;
+		out_stats->launchDebounced = launches.debounced;
+		out_stats->launchTotalLatency = launches.totalLatency;
+		out_stats->launchMaxLatency = launches.maxLatency;
+
+		MacroScheduler::Stats macros = MacroScheduler::shared().getStats();
+		out_stats->macrosStarted = macros.started;
+		out_stats->macrosRestarted = macros.restarted;
+		out_stats->macrosCompleted = macros.completed;
+		out_stats->macrosDropped = macros.dropped;
+		out_stats->macroMaxLateness = macros.maxLateness;
+	}
+
 }
\ No newline at end of file
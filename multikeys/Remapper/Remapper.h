@@ -4,6 +4,7 @@
 #include "RemapperAPI.h"
 #include "KeystrokeCommands.h"
 #include "Keyboard.h"
+#include "CommandPool.h"
 
 // method readSettings() implemented in a separate cpp.
 
@@ -14,9 +15,24 @@ namespace Multikeys
 	{
 	private:
 
-		mutable Scancode workScancode;
+		// Every command read by loadSettings, shared by the keyboards. Destroyed after them.
+		CommandPool commandPool;
+
+		// Never modified after loadSettings. Each Keyboard keeps its own state, so evaluateKey
+		// may be called concurrently as long as no two calls reach the same Keyboard.
 		std::vector<Keyboard*> keyboards;
 
+		// Builds every layer not built yet, in the background, if the settings ask for it;
+		// layers are otherwise built by the first keystroke that activates them.
+		std::thread prewarmThread;
+		std::atomic<bool> stopPrewarm;
+
+		// Body of prewarmThread
+		void _prewarmLayers();
+
+		// Stops prewarmThread, if it's running, and waits for it; keyboards may only change afterwards.
+		void _stopPrewarm();
+
 	public:
 		Remapper();
 
@@ -24,10 +40,35 @@ namespace Multikeys
 		// Implemented in XmlParser.cpp
 		bool loadSettings(const std::wstring filename) override;
 
+		// The keyboard of MakeFallbackSpec, in place of every loaded one
+		bool loadFallback() override;
+
+		// Thread-safe for keystrokes from devices that map to different keyboards.
+		// Keystrokes that map to the same keyboard (including every device that falls back
+		// to the keyboard with an empty name) must all be evaluated by the same thread.
 		bool evaluateKey(
 			RAWKEYBOARD* const keypressed,
 			wchar_t* const deviceName,
-			OUT PKeystrokeCommand* const out_action) override;
+			OUT PKeystrokeCommand* const out_action,
+			OUT bool* const out_repeated) override;
+
+		int getKeyboardCount() const override;
+
+		int findKeyboard(const WCHAR* const deviceName) const override;
+
+		bool evaluateKeyOnKeyboard(
+			int keyboardIndex,
+			RAWKEYBOARD* const keypressed,
+			OUT PKeystrokeCommand* const out_action,
+			OUT bool* const out_repeated) override;
+
+		void releaseAllKeys(int keyboardIndex) override;
+
+		DWORD getTimeout(int keyboardIndex) const override;
+
+		DWORD expire(int keyboardIndex) override;
+
+		bool takeDeferredAction(int keyboardIndex, OUT PKeystrokeCommand* const out_action) override;
 
 		~Remapper() override;
 
@@ -35,6 +76,10 @@ namespace Multikeys
 	};
 
 
+	// The spec of the layout built into this library, with its commands taken from pool.
+	// Implemented in FallbackLayout.cpp, from the tables generated into FallbackLayout.h.
+	std::shared_ptr<const KeyboardSpec> MakeFallbackSpec(CommandPool* const pool);
+
 	// Implementations of factory methods from this library's API are in Remapper.cpp
 
 
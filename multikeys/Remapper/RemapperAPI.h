@@ -7,6 +7,11 @@
 
 namespace Multikeys
 {
+	// Maximum number of deferred actions a single evaluation may leave behind (see IRemapper):
+	// every key of the longest chord, pressed by itself when the chord isn't completed, and the
+	// dead key before them, which may have timed out meanwhile.
+	const int MAX_DEFERRED_ACTIONS = 10;
+
 	// Class that represents a sequence of keystrokes or characters
 	// or an executable file.
 	typedef class IKeystrokeCommand
@@ -18,6 +23,10 @@ namespace Multikeys
 		// Execute this command. This method may have a variety of effects.
 		virtual bool execute(bool keyup, bool repeated) const = 0;
 
+		// Whether execute() may have any effect at all. Commands that never do anything
+		// (like the one returned for modifier keys) need not be executed.
+		virtual bool hasEffect() const { return true; }
+
 		// Virtual destructor
 		virtual ~IKeystrokeCommand() = 0;
 
@@ -35,21 +44,75 @@ namespace Multikeys
 		// error was encountered.
 		virtual bool loadSettings(const std::wstring xmlFilename) = 0;
 
+		// Loads the layout built into this library (generated from XML/Fallback.xml), in place of
+		// any loaded before. Nothing is read nor parsed, so it's ready right away; meant for when
+		// no settings file can be loaded, and for running in a safe mode.
+		virtual bool loadFallback() = 0;
+
 		// Evaluates a user keypress according to loaded remaps.
 		// -- Parameters --
 		// RAWKEYBOARD* keypressed - information about the user keypress
 		// WCHAR* deviceName - full name of the device that generated the input
 		// OUT IKeystrokeCommand** out_action - command to be executed instead
 		//			of the user input, in case it should be blocked.
+		// OUT bool* out_repeated - set to true if the keypress is a repeat of a key held down,
+		//			which is what execute() expects as its repeated parameter.
+		//			Repeats and releases get the same command as the key's press.
 		// -- Return value --
 		// TRUE - User input should be blocked, and out_action should be executed.
 		// FALSE - Do not block user input and do not execute out_action.
 		virtual bool evaluateKey(
 			RAWKEYBOARD* const keypressed,
 			WCHAR* const deviceName,
-			OUT PKeystrokeCommand* const out_action
+			OUT PKeystrokeCommand* const out_action,
+			OUT bool* const out_repeated
 		)= 0;
 
+		// Number of keyboards in the loaded settings.
+		virtual int getKeyboardCount() const = 0;
+
+		// Index (from 0 to getKeyboardCount() - 1) of the keyboard whose remaps apply to the device,
+		// or -1 if none of them does. The same device always gets the same index, so callers
+		// may keep it for as long as the device stays connected, instead of asking for every keystroke.
+		virtual int findKeyboard(const WCHAR* const deviceName) const = 0;
+
+		// Same as evaluateKey, for a keyboard already found with findKeyboard.
+		// Calls for different keyboard indices may run concurrently on different threads;
+		// calls for the same index must all come from the same thread.
+		virtual bool evaluateKeyOnKeyboard(
+			int keyboardIndex,
+			RAWKEYBOARD* const keypressed,
+			OUT PKeystrokeCommand* const out_action,
+			OUT bool* const out_repeated
+		) = 0;
+
+		// Forgets the keys held down on a keyboard, as if all of them had been released, without
+		// executing anything; for when the releases can't arrive (like on the secure desktop).
+		// Same threading rules as evaluateKeyOnKeyboard.
+		virtual void releaseAllKeys(int keyboardIndex) = 0;
+
+		// A keyboard may hold keystrokes back while it can't tell yet what they do (like the
+		// keys of a chord still being pressed); those keystrokes are blocked, with no action.
+		// Once they're resolved, by a later keystroke or by expire(), their commands become
+		// deferred actions: after each call to evaluateKeyOnKeyboard or expire, take them all
+		// with takeDeferredAction, and execute them (as fresh presses, in the order taken)
+		// before the action of the keystroke just evaluated. A single call never leaves more
+		// than MAX_DEFERRED_ACTIONS of them, so taking them all after each one never leaves any
+		// behind. Same threading rules as evaluateKeyOnKeyboard.
+
+		// Time (in ms) after a keystroke when expire() must be called, in case the keyboard
+		// held keystrokes back; 0 if the keyboard never does. Never changes, and may be called
+		// from any thread.
+		virtual DWORD getTimeout(int keyboardIndex) const = 0;
+
+		// Resolves the keystrokes held back by the keyboard whose time is up. Call it once
+		// getTimeout() has passed since the keyboard's last keystroke. Returns the time (in ms)
+		// until it must be called again for those still held back, or 0 if there are none.
+		virtual DWORD expire(int keyboardIndex) = 0;
+
+		// Takes the oldest deferred action of the keyboard. Returns false if there's none left.
+		virtual bool takeDeferredAction(int keyboardIndex, OUT PKeystrokeCommand* const out_action) = 0;
+
 		virtual ~IRemapper() = 0;
 
 	} *PRemapper;
@@ -60,4 +123,26 @@ namespace Multikeys
 
 	// Deletes the object located at *instance, then that pointer becomes null
 	void Destroy(PRemapper* instance);
+
+
+	// Statistics of the work commands hand to threads of this library, shared by every instance.
+	// Launch latencies are in microseconds, from the request until the launch returned.
+	struct BackgroundStats
+	{
+		unsigned long long launched;			// Executables launched successfully
+		unsigned long long launchFailed;		// Executables that failed to launch
+		unsigned long long launchDropped;		// Launches refused because the queue was full
+		unsigned long long launchDebounced;		// Launches ignored as repeats of the one just before
+		unsigned long long launchTotalLatency;	// Sum of the latencies of all launches
+		unsigned long long launchMaxLatency;	// Largest latency of a launch
+
+		unsigned long long macrosStarted;		// Timed macros started
+		unsigned long long macrosRestarted;		// Timed macros cut short by being triggered again
+		unsigned long long macrosCompleted;		// Timed macros that sent every step
+		unsigned long long macrosDropped;		// Timed macros refused because too many were playing
+		unsigned long long macroMaxLateness;	// Longest a step of a timed macro was sent late, in ms
+	};
+
+	// Copies the statistics gathered so far to *out_stats. May be called from any thread.
+	void GetBackgroundStats(OUT BackgroundStats* out_stats);
 }
\ No newline at end of file
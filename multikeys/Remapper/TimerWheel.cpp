@@ -0,0 +1,212 @@
+#include "stdafx.h"
+
+// Implementation of the timer wheel described in TimerWheel.h
+#include "TimerWheel.h"
+
+namespace Multikeys
+{
+	static const TimerTime SLOT_MASK = TimerWheel::SLOT_COUNT - 1;
+
+	// Index of the lowest set bit; bits must not be 0
+	static int LowestBit(unsigned long long bits)
+	{
+		// De Bruijn multiplication, so that this compiles the same anywhere
+		static const int positions[64] = {
+			0, 1, 2, 53, 3, 7, 54, 27, 4, 38, 41, 8, 34, 55, 48, 28,
+			62, 5, 39, 46, 44, 42, 22, 9, 24, 35, 59, 56, 49, 18, 29, 11,
+			63, 52, 6, 26, 37, 40, 33, 47, 61, 45, 43, 21, 23, 58, 17, 10,
+			51, 25, 36, 32, 60, 20, 57, 16, 50, 31, 19, 15, 30, 14, 13, 12 };
+		return positions[((bits & (~bits + 1)) * 0x022FDD63CC95386DULL) >> 58];
+	}
+
+
+	TimerWheel::TimerWheel(TimerClock clock)
+		: clock(clock), current(clock()), armedCount(0)
+	{
+		for (size_t level = 0; level < LEVEL_COUNT; level++)
+		{
+			occupied[level] = 0;
+			for (size_t slot = 0; slot < SLOT_COUNT; slot++)
+			{
+				slots[level][slot].prev = &slots[level][slot];
+				slots[level][slot].next = &slots[level][slot];
+			}
+		}
+	}
+
+
+	void TimerWheel::arm(TimerNode* node, TimerTime delay)
+	{
+		// Moving a timer counts it again below
+		cancel(node);
+
+		if (delay > MAX_DELAY)
+			delay = MAX_DELAY;
+		TimerTime now = clock();
+		// An empty wheel isn't advanced, and may be far behind the clock; nothing is lost catching it up
+		if (armedCount == 0)
+			current = now;
+		node->deadline = now + delay;
+		// The slot the wheel is on has already fired
+		_insert(node, node->deadline > current ? node->deadline : current + 1);
+		armedCount++;
+	}
+
+
+	void TimerWheel::cancel(TimerNode* node)
+	{
+		if (!node->isArmed())
+			return;
+		_unlink(node);
+		armedCount--;
+	}
+
+
+	void TimerWheel::advance()
+	{
+		TimerTime target = clock();
+		while (current < target)
+		{
+			if (armedCount == 0)
+			{
+				current = target;
+				break;
+			}
+
+			// Nothing due at the first level: skip to where the next level turns into it
+			if (occupied[0] == 0)
+			{
+				TimerTime turn = (current | SLOT_MASK) + 1;
+				if (turn > target)
+				{
+					current = target;
+					break;
+				}
+				current = turn;
+			}
+			else
+				current++;
+
+			if ((current & SLOT_MASK) == 0)
+				_cascade(1);
+			_fire((size_t)(current & SLOT_MASK));
+		}
+	}
+
+
+	TimerTime TimerWheel::timeUntilNext() const
+	{
+		if (armedCount == 0)
+			return 0;
+
+		// Earliest time at which advance has something to do, at any level
+		TimerTime next = 0;
+		for (size_t level = 0; level < LEVEL_COUNT; level++)
+		{
+			if (occupied[level] == 0)
+				continue;
+			size_t shift = SLOT_BITS * level;
+			TimerTime turn = current >> shift;		// Slots of this level passed so far
+
+			// Slots are processed once the wheel moves on to them, never the one it's on
+			int slot = _nextOccupied(level, (size_t)((turn + 1) & SLOT_MASK));
+			TimerTime distance = ((TimerTime)slot - turn) & SLOT_MASK;
+			if (distance == 0)
+				distance = SLOT_COUNT;
+			TimerTime time = (turn + distance) << shift;
+			if (next == 0 || time < next)
+				next = time;
+		}
+
+		TimerTime now = clock();
+		return next > now ? next - now : 1;
+	}
+
+
+	bool TimerWheel::isEmpty() const
+	{
+		return armedCount == 0;
+	}
+
+
+	void TimerWheel::_insert(TimerNode* node, TimerTime deadline)
+	{
+		TimerTime delta = deadline - current;
+
+		size_t level = 0;
+		while (level < LEVEL_COUNT - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1))))
+			level++;
+		size_t slot = (size_t)((deadline >> (SLOT_BITS * level)) & SLOT_MASK);
+
+		TimerNode* head = &slots[level][slot];
+		node->prev = head->prev;
+		node->next = head;
+		head->prev->next = node;
+		head->prev = node;
+		occupied[level] |= 1ULL << slot;
+	}
+
+
+	void TimerWheel::_unlink(TimerNode* node)
+	{
+		TimerNode* next = node->next;
+		node->prev->next = next;
+		next->prev = node->prev;
+
+		// If that left a sentinel alone, its slot is empty. The sentinel's position in the
+		// array tells which slot it is.
+		if (next->next == next)
+		{
+			size_t index = next - &slots[0][0];
+			if (index < LEVEL_COUNT * SLOT_COUNT)
+				occupied[index / SLOT_COUNT] &= ~(1ULL << (index % SLOT_COUNT));
+		}
+
+		node->prev = nullptr;
+		node->next = nullptr;
+	}
+
+
+	void TimerWheel::_cascade(size_t level)
+	{
+		if (level >= LEVEL_COUNT)
+			return;
+		size_t slot = (size_t)((current >> (SLOT_BITS * level)) & SLOT_MASK);
+
+		// The levels above turn over first, so their timers reach this one in time
+		if (slot == 0)
+			_cascade(level + 1);
+
+		TimerNode* head = &slots[level][slot];
+		while (head->next != head)
+		{
+			TimerNode* node = head->next;
+			_unlink(node);
+			_insert(node, node->deadline);		// to a lower level, now that it's closer
+		}
+	}
+
+
+	void TimerWheel::_fire(size_t slot)
+	{
+		TimerNode* head = &slots[0][slot];
+		while (head->next != head)
+		{
+			TimerNode* node = head->next;
+			_unlink(node);
+			armedCount--;
+			node->callback(node);	// may arm it again, even in this same slot's next turn
+		}
+	}
+
+
+	int TimerWheel::_nextOccupied(size_t level, size_t start) const
+	{
+		unsigned long long bits = occupied[level];
+		if (bits == 0)
+			return -1;
+		// Rotate so that start is bit 0
+		unsigned long long rotated = start == 0 ? bits : (bits >> start) | (bits << (SLOT_COUNT - start));
+		return (int)((LowestBit(rotated) + start) & SLOT_MASK);
+	}
+}
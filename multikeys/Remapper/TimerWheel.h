@@ -0,0 +1,114 @@
+#pragma once
+
+// Hierarchical timer wheel, for timers that are armed and cancelled far more often than they fire
+// (like the timeout of a keyboard, restarted by each of its keystrokes).
+// Only standard C++ is used here, so this header does not depend on the Windows API.
+
+#include <cstddef>
+
+namespace Multikeys
+{
+	// Time in milliseconds, from whatever origin the clock uses
+	typedef unsigned long long TimerTime;
+
+	// Source of the current time; GetTickCount64 in practice, anything else when testing.
+	typedef TimerTime(*TimerClock)();
+
+	// A timer. Its owner allocates it (usually inside some larger structure) and keeps it alive
+	// while it's armed; the wheel only links it into its lists, so arming never allocates.
+	struct TimerNode
+	{
+		// Called by TimerWheel::advance once the deadline has passed. The node is no longer
+		// armed by then, and the callback may arm it again.
+		void(*callback)(TimerNode* node);
+
+		// Free for the owner, e.g. to find what the timer is for
+		size_t context;
+
+		// Set by the wheel
+		TimerTime deadline;
+		TimerNode* prev;		// null while not armed
+		TimerNode* next;
+
+		TimerNode() : callback(nullptr), context(0), deadline(0), prev(nullptr), next(nullptr) { }
+
+		bool isArmed() const
+		{
+			return prev != nullptr;
+		}
+	};
+
+
+	// Timers sorted into levels of 64 slots each: the first level has a slot per millisecond,
+	// each other level a slot per whole turn of the level below it. Arming and cancelling are
+	// constant time. Timers in a coarse slot move down a level each time the level below it
+	// turns around, until they reach their exact millisecond.
+	// Not thread-safe: arm, cancel and advance must all be called from the same thread.
+	class TimerWheel
+	{
+	public:
+
+		// Number of levels, and of slots per level
+		static const size_t LEVEL_COUNT = 4;
+		static const size_t SLOT_BITS = 6;
+		static const size_t SLOT_COUNT = 1 << SLOT_BITS;
+
+		// Longest delay a timer may be armed for (about 4.6 hours); longer ones fire after this much.
+		static const TimerTime MAX_DELAY = (1ULL << (SLOT_BITS * LEVEL_COUNT)) - 1;
+
+		// clock - gives the current time to arm and advance; never null.
+		TimerWheel(TimerClock clock);
+
+		// Arms the timer to fire delay (in ms) from now. A timer already armed is moved.
+		void arm(TimerNode* node, TimerTime delay);
+
+		// Disarms the timer, if armed.
+		void cancel(TimerNode* node);
+
+		// Fires, in deadline order, every timer whose deadline has passed.
+		void advance();
+
+		// Time (in ms) from now until advance should be called next; may be earlier than the next
+		// deadline, when timers only need to move down a level. Returns 0 if no timer is armed,
+		// and at least 1 otherwise.
+		TimerTime timeUntilNext() const;
+
+		// Whether any timer is armed
+		bool isEmpty() const;
+
+	private:
+
+		TimerClock clock;
+
+		// Time up to which the wheel has advanced
+		TimerTime current;
+
+		// Number of armed timers
+		size_t armedCount;
+
+		// Each slot is a circular list with a sentinel head
+		TimerNode slots[LEVEL_COUNT][SLOT_COUNT];
+
+		// Bit i is set while slot i of the level isn't empty
+		unsigned long long occupied[LEVEL_COUNT];
+
+		TimerWheel(const TimerWheel&) = delete;
+		TimerWheel& operator=(const TimerWheel&) = delete;
+
+		// Links the node into the slot where it fires at deadline, which must not be before current.
+		// A deadline equal to current only fires if the first level's current slot hasn't fired yet.
+		void _insert(TimerNode* node, TimerTime deadline);
+
+		// Unlinks the node from its slot
+		void _unlink(TimerNode* node);
+
+		// Moves the timers of the level's current slot down a level; called as the level below turns around
+		void _cascade(size_t level);
+
+		// Fires every timer in a slot of the first level
+		void _fire(size_t slot);
+
+		// Index of the first occupied slot of the level at or after slot start, cyclically; -1 if none
+		int _nextOccupied(size_t level, size_t start) const;
+	};
+}
@@ -0,0 +1,227 @@
+#include "stdafx.h"
+
+// Implementation of the importer described in XComposeImport.h
+#include "XComposeImport.h"
+
+namespace Multikeys
+{
+	// Keysyms whose names aren't their character. Those of Latin-1 are the character's own code;
+	// letters and digits are named after themselves, and any character may be written U+hex.
+	struct NamedKeysym
+	{
+		const char* name;
+		unsigned int codepoint;
+	};
+
+	static const NamedKeysym NAMED_KEYSYMS[] = {
+		{ "space", 0x20 }, { "exclam", 0x21 }, { "quotedbl", 0x22 }, { "numbersign", 0x23 },
+		{ "dollar", 0x24 }, { "percent", 0x25 }, { "ampersand", 0x26 }, { "apostrophe", 0x27 },
+		{ "parenleft", 0x28 }, { "parenright", 0x29 }, { "asterisk", 0x2a }, { "plus", 0x2b },
+		{ "comma", 0x2c }, { "minus", 0x2d }, { "period", 0x2e }, { "slash", 0x2f },
+		{ "colon", 0x3a }, { "semicolon", 0x3b }, { "less", 0x3c }, { "equal", 0x3d },
+		{ "greater", 0x3e }, { "question", 0x3f }, { "at", 0x40 }, { "bracketleft", 0x5b },
+		{ "backslash", 0x5c }, { "bracketright", 0x5d }, { "asciicircum", 0x5e }, { "underscore", 0x5f },
+		{ "grave", 0x60 }, { "braceleft", 0x7b }, { "bar", 0x7c }, { "braceright", 0x7d },
+		{ "asciitilde", 0x7e },
+		{ "nobreakspace", 0xa0 }, { "exclamdown", 0xa1 }, { "cent", 0xa2 }, { "sterling", 0xa3 },
+		{ "currency", 0xa4 }, { "yen", 0xa5 }, { "brokenbar", 0xa6 }, { "section", 0xa7 },
+		{ "diaeresis", 0xa8 }, { "copyright", 0xa9 }, { "ordfeminine", 0xaa }, { "guillemotleft", 0xab },
+		{ "guillemetleft", 0xab }, { "notsign", 0xac }, { "hyphen", 0xad }, { "registered", 0xae },
+		{ "macron", 0xaf }, { "degree", 0xb0 }, { "plusminus", 0xb1 }, { "twosuperior", 0xb2 },
+		{ "threesuperior", 0xb3 }, { "acute", 0xb4 }, { "mu", 0xb5 }, { "paragraph", 0xb6 },
+		{ "periodcentered", 0xb7 }, { "cedilla", 0xb8 }, { "onesuperior", 0xb9 }, { "masculine", 0xba },
+		{ "ordmasculine", 0xba }, { "guillemotright", 0xbb }, { "guillemetright", 0xbb }, { "onequarter", 0xbc },
+		{ "onehalf", 0xbd }, { "threequarters", 0xbe }, { "questiondown", 0xbf },
+		{ "Agrave", 0xc0 }, { "Aacute", 0xc1 }, { "Acircumflex", 0xc2 }, { "Atilde", 0xc3 },
+		{ "Adiaeresis", 0xc4 }, { "Aring", 0xc5 }, { "AE", 0xc6 }, { "Ccedilla", 0xc7 },
+		{ "Egrave", 0xc8 }, { "Eacute", 0xc9 }, { "Ecircumflex", 0xca }, { "Ediaeresis", 0xcb },
+		{ "Igrave", 0xcc }, { "Iacute", 0xcd }, { "Icircumflex", 0xce }, { "Idiaeresis", 0xcf },
+		{ "ETH", 0xd0 }, { "Ntilde", 0xd1 }, { "Ograve", 0xd2 }, { "Oacute", 0xd3 },
+		{ "Ocircumflex", 0xd4 }, { "Otilde", 0xd5 }, { "Odiaeresis", 0xd6 }, { "multiply", 0xd7 },
+		{ "Oslash", 0xd8 }, { "Ooblique", 0xd8 }, { "Ugrave", 0xd9 }, { "Uacute", 0xda },
+		{ "Ucircumflex", 0xdb }, { "Udiaeresis", 0xdc }, { "Yacute", 0xdd }, { "THORN", 0xde },
+		{ "ssharp", 0xdf },
+		{ "agrave", 0xe0 }, { "aacute", 0xe1 }, { "acircumflex", 0xe2 }, { "atilde", 0xe3 },
+		{ "adiaeresis", 0xe4 }, { "aring", 0xe5 }, { "ae", 0xe6 }, { "ccedilla", 0xe7 },
+		{ "egrave", 0xe8 }, { "eacute", 0xe9 }, { "ecircumflex", 0xea }, { "ediaeresis", 0xeb },
+		{ "igrave", 0xec }, { "iacute", 0xed }, { "icircumflex", 0xee }, { "idiaeresis", 0xef },
+		{ "eth", 0xf0 }, { "ntilde", 0xf1 }, { "ograve", 0xf2 }, { "oacute", 0xf3 },
+		{ "ocircumflex", 0xf4 }, { "otilde", 0xf5 }, { "odiaeresis", 0xf6 }, { "division", 0xf7 },
+		{ "oslash", 0xf8 }, { "ooblique", 0xf8 }, { "ugrave", 0xf9 }, { "uacute", 0xfa },
+		{ "ucircumflex", 0xfb }, { "udiaeresis", 0xfc }, { "yacute", 0xfd }, { "thorn", 0xfe },
+		{ "ydiaeresis", 0xff },
+		// A few outside Latin-1 that compose files use often
+		{ "EuroSign", 0x20ac }, { "endash", 0x2013 }, { "emdash", 0x2014 }, { "ellipsis", 0x2026 },
+		{ "leftsinglequotemark", 0x2018 }, { "rightsinglequotemark", 0x2019 },
+		{ "leftdoublequotemark", 0x201c }, { "rightdoublequotemark", 0x201d },
+		{ "leftarrow", 0x2190 }, { "uparrow", 0x2191 }, { "rightarrow", 0x2192 }, { "downarrow", 0x2193 },
+	};
+
+
+	// Appends the UTF-16 of a code point
+	static void AppendCodepoint(unsigned int codepoint, OUT std::wstring *const text)
+	{
+		if (codepoint <= 0xffff)
+			text->push_back((wchar_t)codepoint);
+		else
+		{
+			text->push_back((wchar_t)(0xd800 + ((codepoint - 0x10000) >> 10)));
+			text->push_back((wchar_t)(0xdc00 + (codepoint & 0x3ff)));
+		}
+	}
+
+
+	// Appends the character of a keysym; false if the keysym has none known here
+	static bool AppendKeysym(const std::string& name, OUT std::wstring *const text)
+	{
+		if (name.size() == 1 && isalnum((unsigned char)name[0]))
+		{
+			text->push_back((wchar_t)name[0]);
+			return true;
+		}
+
+		// U followed by the code point in hexadecimal, e.g. U2022
+		if (name.size() > 1 && name[0] == 'U' && name.find_first_not_of("0123456789abcdefABCDEF", 1) == std::string::npos)
+		{
+			unsigned long codepoint = std::stoul(name.substr(1), 0, 16);
+			if (codepoint > 0x10ffff)
+				return false;
+			AppendCodepoint(codepoint, text);
+			return true;
+		}
+
+		for (size_t i = 0; i < sizeof(NAMED_KEYSYMS) / sizeof(NAMED_KEYSYMS[0]); i++)
+		{
+			if (name == NAMED_KEYSYMS[i].name)
+			{
+				AppendCodepoint(NAMED_KEYSYMS[i].codepoint, text);
+				return true;
+			}
+		}
+		return false;
+	}
+
+
+	// Reads a line like   <Multi_key> <o> <c> : "(c)" copyright   into the keysyms and the (UTF-8) string.
+	// Returns false if it's not in that form.
+	static bool ParseLine(const std::string& line, OUT std::vector<std::string> *const keysyms, OUT std::string *const output)
+	{
+		size_t position = 0;
+		while (true)
+		{
+			position = line.find_first_not_of(" \t", position);
+			if (position == std::string::npos)
+				return false;
+			if (line[position] != '<')
+				break;
+			size_t end = line.find('>', position);
+			if (end == std::string::npos)
+				return false;
+			keysyms->push_back(line.substr(position + 1, end - position - 1));
+			position = end + 1;
+		}
+
+		if (line[position] != ':')
+			return false;
+		position = line.find('"', position);
+		if (position == std::string::npos)
+			return false;
+
+		// The string, with C-like escapes; it ends at the first quote not escaped
+		for (position++; position < line.size(); position++)
+		{
+			char c = line[position];
+			if (c == '"')
+				return true;
+			if (c != '\\' || position + 1 == line.size())
+			{
+				output->push_back(c);
+				continue;
+			}
+
+			c = line[++position];
+			if (c >= '0' && c <= '7')
+			{
+				// Octal byte, up to three digits
+				int value = 0;
+				for (int digits = 0; digits < 3 && position < line.size() && line[position] >= '0' && line[position] <= '7'; digits++)
+					value = value * 8 + (line[position++] - '0');
+				position--;
+				output->push_back((char)value);
+			}
+			else if ((c == 'x' || c == 'X') && position + 1 < line.size() && isxdigit((unsigned char)line[position + 1]))
+			{
+				// Hexadecimal byte, up to two digits
+				int value = 0;
+				for (int digits = 0; digits < 2 && position + 1 < line.size() && isxdigit((unsigned char)line[position + 1]); digits++)
+				{
+					c = line[++position];
+					value = value * 16 + (isdigit((unsigned char)c) ? c - '0' : (tolower(c) - 'a' + 10));
+				}
+				output->push_back((char)value);
+			}
+			else
+				output->push_back(c);		// \" and \\, and anything else as itself
+		}
+		return false;		// No closing quote
+	}
+
+
+	bool ImportXCompose(const std::wstring& filename,
+		OUT std::vector<ComposeDefinition> *const out_definitions, OUT size_t *const out_skipped)
+	{
+#ifdef _WIN32
+		std::ifstream file(filename, std::ios::binary);
+#else
+		std::ifstream file(std::wstring_convert<std::codecvt_utf8<wchar_t>>().to_bytes(filename), std::ios::binary);
+#endif
+		if (!file)
+			return false;
+
+		std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> utf8;
+		*out_skipped = 0;
+
+		std::string line;
+		while (std::getline(file, line))
+		{
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+
+			// Blank lines and comments
+			size_t first = line.find_first_not_of(" \t");
+			if (first == std::string::npos || line[first] == '#')
+				continue;
+
+			std::vector<std::string> keysyms;
+			std::string output;
+			if (!ParseLine(line, &keysyms, &output) || keysyms.size() < 2 || keysyms[0] != "Multi_key")
+			{
+				(*out_skipped)++;		// include directives too; their paths are X11's
+				continue;
+			}
+
+			ComposeDefinition definition;
+			bool known = true;
+			for (size_t i = 1; i < keysyms.size() && known; i++)
+				known = AppendKeysym(keysyms[i], &definition.sequence);
+			if (!known)
+			{
+				(*out_skipped)++;
+				continue;
+			}
+
+			try
+			{
+				definition.output = utf8.from_bytes(output);
+			}
+			catch (std::range_error&)
+			{
+				// Not valid UTF-8
+				(*out_skipped)++;
+				continue;
+			}
+			out_definitions->push_back(definition);
+		}
+		return true;
+	}
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "stdafx.h"
+#include "ComposeTable.h"
+
+namespace Multikeys
+{
+	// Reads the compose sequences of a file in the X11 Compose format (like /usr/share/X11/locale/
+	// en_US.UTF-8/Compose, or a user's .XCompose), and appends them to out_definitions.
+	// Only sequences that begin with <Multi_key> are read, without it; that's the compose key.
+	// Lines that can't be used here are skipped and counted in out_skipped: sequences that begin
+	// with another key, keysyms that don't stand for a character, and include directives.
+	// Returns false if the file can't be read.
+	bool ImportXCompose(const std::wstring& filename,
+		OUT std::vector<ComposeDefinition> *const out_definitions, OUT size_t *const out_skipped);
+}
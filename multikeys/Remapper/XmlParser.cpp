@@ -7,14 +7,19 @@
 #include "Layer.h"
 #include "Scancode.h"
 #include "KeystrokeCommands.h"
+#include "CommandPool.h"
+#include "XComposeImport.h"
 
 #include <stdexcept>
 #include <algorithm>	// for string replacement
+#include <sstream>		// for splitting lists of scancodes
 
 // Xerces
 #include <xercesc/dom/DOM.hpp>
 #include <xercesc/parsers/XercesDOMParser.hpp>
 #include <xercesc/sax/HandlerBase.hpp>
+#include <xercesc/framework/MemBufInputSource.hpp>
+#include <xercesc/framework/MemBufFormatTarget.hpp>
 
 
 // helper function to convert a const XMLCh* into a wchar_t*
@@ -56,29 +61,103 @@ typedef xercesc::DOMElement			XmlElement, *PXmlElement;
 using namespace Multikeys;
 
 
+// What a keyboard may inherit from a template: its modifiers and layers
+struct KeyboardTemplate
+{
+	// The modifiers element, read again by each keyboard; null if there is none
+	PXmlElement modifiersElement;
+	// Layers in order of precedence, shared by every keyboard using the template
+	std::vector<std::shared_ptr<const Layer>> layers;
+};
+
+// Templates read so far, by name
+typedef std::map<std::wstring, KeyboardTemplate> TemplateMap;
+
+
+// A layer element kept as text, until the layer is first activated; then it's read like any other.
+// That may happen on any thread, long after loadSettings has let go of the document and of Xerces.
+class XmlLayerSource : public LayerSource
+{
+public:
+	// text - the layer element, in UTF-8
+	// pool - where the commands read go; it must outlive this source
+	XmlLayerSource(const std::string& text, CommandPool *const pool);
+
+	bool build(OUT std::unordered_map<Scancode, BaseKeystrokeCommand*> *const out_layout,
+		OUT std::vector<ChordDefinition> *const out_chords) const override;
+
+	size_t getMemoryUsage() const override;
+
+private:
+	const std::string text;
+	CommandPool *const pool;
+
+	// Layers take turns to be read: Xerces' initialization may not be shared.
+	static std::mutex buildMutex;
+};
+
+
 /*---Prototypes for functions used in this file---*/
 // Parses an entire document node and extracts an array of keyboards from it.
 // PXmlDocument document - node representing the entire document to be parsed
+// pool - owner of every command read; commands that only send keystrokes are shared through it
 // keyboardArray - array of Keyboard* (Keyboard pointers) that will contain the final result
 // keyboardCount - will contain the amount of keyboards read (length of keyboard array)
 bool ParseDocument(const PXmlDocument document,
+	CommandPool *const pool,
 	OUT Keyboard* **const keyboardArray,
 	OUT unsigned int *const keyboardCount);
 
+// Parses a template element, which may itself be based on one of templates (those before it).
+bool ParseTemplate(const PXmlElement tplElement, const TemplateMap& templates, CommandPool *const pool,
+	OUT KeyboardTemplate *const pTemplate);
+
+// Reads the modifiers element and the layers of a keyboard or template, over those of base (if not null):
+// its modifiers replace base's, and each layer overrides the one of base with the same modifiers, or is added.
+bool ParseLayout(const PXmlElement element, const KeyboardTemplate *const base, CommandPool *const pool,
+	OUT KeyboardTemplate *const pLayout);
+
 // Parses a keyboard element and places its data in a Keyboard class;
+// templates - templates the keyboard may be based on.
 // Keyboard* - (pointer to) keyboard structure that will hold this node's data.
-bool ParseKeyboard(const PXmlElement kbElement, OUT Keyboard* *const pKeyboard);
+bool ParseKeyboard(const PXmlElement kbElement, const TemplateMap& templates, CommandPool *const pool,
+	OUT Keyboard* *const pKeyboard);
 
-// Receives a keyboard element, and instantiates a modifier state map with its remap in it
-bool ParseModifier(const PXmlElement modElement, OUT ModifierStateMap* *const pModifiers);
+// Receives a modifiers element, and fills a vector with the modifiers in it (at most MAX_MODIFIERS)
+bool ParseModifier(const PXmlElement modElement, OUT std::vector<PModifier> *const pModifiers);
 
 // Parses a layer element and places its data in a Layer class;
+// inherited - layers of a template; the one with the same modifiers, if any, becomes the base of this one.
 // pLayer - (pointer to) layer structure that will hold this node's data
-bool ParseLayer(const PXmlElement lvlElement, OUT Layer* *const pLayer);
-bool ParseUnicode(const PXmlElement rmpElement, OUT BaseKeystrokeCommand* *const pCommand);
-bool ParseMacro(const PXmlElement rmpElement, OUT BaseKeystrokeCommand* *const pCommand);
-bool ParseExecutable(const PXmlElement rmpElement, OUT BaseKeystrokeCommand* *const pCommand);
-bool ParseDeadKey(const PXmlElement rmpElement, OUT BaseKeystrokeCommand* *const pCommand);
+bool ParseLayer(const PXmlElement lvlElement, const std::vector<std::shared_ptr<const Layer>>& inherited,
+	CommandPool *const pool, OUT Layer* *const pLayer);
+
+// Reads the keys and chords of a layer element; its modifiers are read by ParseLayer.
+bool ParseLayerContents(const PXmlElement lvlElement, CommandPool *const pool,
+	OUT std::unordered_map<Scancode, BaseKeystrokeCommand*> *const pLayout, OUT std::vector<ChordDefinition> *const pChords);
+
+// Finds what must be known of a layer element before it's read: whether it has chords,
+// and the shortest timeout of its dead keys (0 if none of them times out).
+bool ScanLayerContents(const PXmlElement lvlElement, OUT bool *const pHasChords, OUT DWORD *const pDeadKeyTimeout);
+
+// Writes an element, with everything in it, as UTF-8 text.
+bool SerializeElement(const PXmlElement element, OUT std::string *const pText);
+bool ParseUnicode(const PXmlElement rmpElement, CommandPool *const pool, OUT BaseKeystrokeCommand* *const pCommand);
+bool ParseMacro(const PXmlElement rmpElement, CommandPool *const pool, OUT BaseKeystrokeCommand* *const pCommand);
+bool ParseExecutable(const PXmlElement rmpElement, CommandPool *const pool, OUT BaseKeystrokeCommand* *const pCommand);
+bool ParseDeadKey(const PXmlElement rmpElement, CommandPool *const pool, OUT BaseKeystrokeCommand* *const pCommand);
+
+// Parses a compose element: the sequences of its file, if any, then its own.
+bool ParseCompose(const PXmlElement rmpElement, CommandPool *const pool, OUT BaseKeystrokeCommand* *const pCommand);
+
+// Parses a chord element: its keys, and the Unicode characters or macro it sends.
+bool ParseChord(const PXmlElement chordElement, CommandPool *const pool, OUT ChordDefinition *const pChord);
+
+// Reads a scancode written in hexadecimal, optionally with a colon between its bytes (e.g. E0:38).
+bool ParseScancode(std::wstring text, OUT Scancode *const pScancode);
+
+// Compiles the expansion elements of a keyboard; pExpansions is set to null if there are none.
+bool ParseExpansions(const PXmlElement kbElement, OUT ExpansionAutomaton* *const pExpansions);
 
 
 
@@ -87,6 +166,9 @@ namespace Multikeys
 {
 	bool Remapper::loadSettings(const std::wstring filename)
 	{
+		// The background thread reads layers into commandPool, through Xerces; neither may be shared
+		_stopPrewarm();
+
 		try
 		{
 			xercesc::XMLPlatformUtils::Initialize();
@@ -122,17 +204,55 @@ namespace Multikeys
 														// Actually loading stuff into this parser's list of keyboards is delegated into another function:
 		Keyboard** keyboards = nullptr;
 		unsigned int keyboardCount = 0;
-		ParseDocument(document, &keyboards, &keyboardCount);
+		ParseDocument(document, &commandPool, &keyboards, &keyboardCount);
 		if (keyboards == nullptr)
 		{
 			OutputDebugString(L"No keyboard found!");
 			return false;
 		}
 
+		// Optionally, layers not needed yet are built in the background once loaded
+		bool prewarm = u16wcscmp(document->getDocumentElement()->getAttribute(u"PrewarmLayers"), L"True") == 0;
+
 		// Set!
 		this->keyboards.clear();		// 'this' refers to this instance of Remapper.
 		this->keyboards.assign(keyboards, keyboards + keyboardCount);
 
+		// How much sharing the commands saved
+		CommandPool::Stats poolStats = commandPool.getStats();
+		OutputDebugString((L"Commands: " + std::to_wstring(poolStats.requested) + L" read, "
+			+ std::to_wstring(poolStats.created) + L" kept, "
+			+ std::to_wstring(commandPool.getMemoryUsage()) + L" bytes\n").c_str());
+
+		// Size of the tables flattened from transparent layers
+		size_t flattenedMemoryUsage = 0;
+		for (size_t i = 0; i < this->keyboards.size(); i++)
+			flattenedMemoryUsage += this->keyboards[i]->getSpec().getFlattenedMemoryUsage();
+		if (flattenedMemoryUsage > 0)
+			OutputDebugString((L"Flattened layers: " + std::to_wstring(flattenedMemoryUsage) + L" bytes\n").c_str());
+
+		// Layers left to be built on first activation, and the memory their text keeps meanwhile;
+		// layers of templates are counted once
+		std::unordered_set<const Layer*> layers;
+		size_t deferredCount = 0, deferredMemoryUsage = 0;
+		for (size_t i = 0; i < this->keyboards.size(); i++)
+		{
+			const std::vector<std::shared_ptr<const Layer>>& specLayers = this->keyboards[i]->getSpec().getLayers();
+			for (size_t j = 0; j < specLayers.size(); j++)
+			{
+				for (const Layer* layer = specLayers[j].get(); layer && layers.insert(layer).second; layer = layer->getBase())
+				{
+					if (!layer->isBuilt())
+					{
+						deferredCount++;
+						deferredMemoryUsage += layer->getMemoryUsage();
+					}
+				}
+			}
+		}
+		OutputDebugString((L"Layers: " + std::to_wstring(layers.size()) + L" read, " + std::to_wstring(deferredCount)
+			+ L" left until first activated (" + std::to_wstring(deferredMemoryUsage) + L" bytes)\n").c_str());
+
 																		// At the very end
 		
 		// apparently we can't free the parser and also release the document. Doing both causes an exception.
@@ -149,6 +269,9 @@ namespace Multikeys
 			return false;
 		}
 
+		if (prewarm && deferredCount > 0)
+			prewarmThread = std::thread(&Remapper::_prewarmLayers, this);
+
 		return true;
 	}
 }
@@ -161,12 +284,31 @@ namespace Multikeys
 
 
 bool ParseDocument(const PXmlDocument document,
+	CommandPool *const pool,
 	OUT Keyboard* **const keyboardArray,
 	OUT unsigned int *const keyboardCount)
 {
 	// Get root element
 	PXmlElement root = document->getDocumentElement();
 
+	// Templates come first; each may only be based on those before it
+	TemplateMap templates;
+	PXmlNodeList templateElements = document->getElementsByTagName(u"template");
+	for (XMLSize_t i = 0; i < templateElements->getLength(); i++)
+	{
+		if (templateElements->item(i)->getNodeType() != xercesc::DOMNode::ELEMENT_NODE)
+			return false;
+		PXmlElement templateElement = (PXmlElement)templateElements->item(i);
+		std::wstring templateName = xmlch_to_wstring(templateElement->getAttribute(u"Name"));
+		if (templates.count(templateName) != 0)
+			return false;		// two templates with the same name
+
+		KeyboardTemplate keyboardTemplate;
+		if (!ParseTemplate(templateElement, templates, pool, &keyboardTemplate))
+			return false;
+		templates[templateName] = keyboardTemplate;
+	}
+
 	// Get all children elements named "keyboard"
 	PXmlNodeList keyboardElements = document->getElementsByTagName(u"keyboard");
 
@@ -193,7 +335,7 @@ bool ParseDocument(const PXmlDocument document,
 		// 4. &((*keyboardArray)[i]) is a reference to a Keyboard* at position i
 		// 5. After this call, (*keyboardArray)[i] will be a Keyboard* pointing to
 		//			an instantiated Keyboard structure.
-		if (!ParseKeyboard(keyboardElement, &((*keyboardArray)[i])))
+		if (!ParseKeyboard(keyboardElement, templates, pool, &((*keyboardArray)[i])))
 			return false;
 	}
 
@@ -201,35 +343,48 @@ bool ParseDocument(const PXmlDocument document,
 }
 
 
-bool ParseKeyboard(const PXmlElement kbElement, OUT Keyboard* *const pKeyboard)
+bool ParseTemplate(const PXmlElement tplElement, const TemplateMap& templates, CommandPool *const pool,
+	OUT KeyboardTemplate *const pTemplate)
 {
-	// Get name
-	std::wstring keyboardName = xmlch_to_wstring( kbElement->getAttribute(u"Name") );
-	// Keyboards also have an alias attribute, but that's for the UI
+	// Optionally based on another template
+	const KeyboardTemplate* base = nullptr;
+	std::wstring baseName = xmlch_to_wstring(tplElement->getAttribute(u"Template"));
+	if (!baseName.empty())
+	{
+		auto found = templates.find(baseName);
+		if (found == templates.end())
+			return false;		// unknown, or defined after this one
+		base = &found->second;
+	}
 
-	// There should be one "modifiers" tag:
-	PXmlNodeList modifierElements = kbElement->getElementsByTagName(u"modifiers");
-	if (modifierElements->getLength() != 1)
-		return false;
-	PXmlNode modifierElement = modifierElements->item(0);
-	if (modifierElement->getNodeType() != XmlNode::ELEMENT_NODE)
-		return false;
-	// Get pointer to modifier state map
-	ModifierStateMap * ptrModStateMap = nullptr;
-	// Pass it to the function that will instantiate it
-	if (!ParseModifier((PXmlElement)modifierElement, &ptrModStateMap))
-		return false;
-	if (!ptrModStateMap) return false;
-	// ptrModStateMap should now point to an instantiated modifier state map.
-	// We'll instantiate it after making all layers
+	return ParseLayout(tplElement, base, pool, pTemplate);
+}
 
 
-	// Get all layers
-	PXmlNodeList layerElements = kbElement->getElementsByTagName(u"layer");
+bool ParseLayout(const PXmlElement element, const KeyboardTemplate *const base, CommandPool *const pool,
+	OUT KeyboardTemplate *const pLayout)
+{
+	// There may be one "modifiers" tag; without it, those of the base are used (or none at all)
+	PXmlNodeList modifierElements = element->getElementsByTagName(u"modifiers");
+	if (modifierElements->getLength() > 1)
+		return false;
+	if (modifierElements->getLength() == 1)
+	{
+		if (modifierElements->item(0)->getNodeType() != XmlNode::ELEMENT_NODE)
+			return false;
+		pLayout->modifiersElement = (PXmlElement)modifierElements->item(0);
+	}
+	else
+		pLayout->modifiersElement = base ? base->modifiersElement : nullptr;
 
-	// Allocate memory for layers
-	std::vector<Layer*> layerVector;
+	// Start from the layers of the base, shared as they are
+	std::vector<std::shared_ptr<const Layer>> inherited;
+	if (base)
+		inherited = base->layers;
+	pLayout->layers = inherited;
 
+	// Get all layers
+	PXmlNodeList layerElements = element->getElementsByTagName(u"layer");
 	for (XMLSize_t i = 0; i < layerElements->getLength(); i++)
 	{
 		if (layerElements->item(i)->getNodeType() != XmlNode::ELEMENT_NODE)
@@ -239,30 +394,107 @@ bool ParseKeyboard(const PXmlElement kbElement, OUT Keyboard* *const pKeyboard)
 		// Declare a pointer to layer
 		Layer* pLayer = nullptr;
 		// This call will place an actual instance there
-		if (!ParseLayer(layerElement, &pLayer))
+		if (!ParseLayer(layerElement, inherited, pool, &pLayer))
 			return false;
-		// Add the new instance into the vector
 		if (!pLayer) return false;
-		layerVector.push_back(pLayer);
-		// The pointer dies, but not the object.
+		std::shared_ptr<const Layer> layer(pLayer);
+
+		// A layer overriding an inherited one takes its place, the first time;
+		// any other is added after the rest.
+		size_t position = 0;
+		while (position < inherited.size() && !inherited[position]->hasModifiers(layer->modifierCombination, layer->ignoredModifiers))
+			position++;
+		if (position < inherited.size() && pLayout->layers[position] == inherited[position])
+			pLayout->layers[position] = layer;
+		else
+			pLayout->layers.push_back(layer);
 	}
 
-	// layerArray is ready, and so is the modifier state map
+	return true;
+}
+
+
+bool ParseKeyboard(const PXmlElement kbElement, const TemplateMap& templates, CommandPool *const pool,
+	OUT Keyboard* *const pKeyboard)
+{
+	// Get name
+	std::wstring keyboardName = xmlch_to_wstring( kbElement->getAttribute(u"Name") );
+	// Keyboards also have an alias attribute, but that's for the UI
+
+	// Optionally found by the fields of the device's name instead; then the name isn't compared
+	DevicePattern devicePattern;
+	if (!DevicePattern::parse(
+			xmlch_to_wstring(kbElement->getAttribute(u"VendorId")),
+			xmlch_to_wstring(kbElement->getAttribute(u"ProductId")),
+			xmlch_to_wstring(kbElement->getAttribute(u"Interface")),
+			xmlch_to_wstring(kbElement->getAttribute(u"Instance")),
+			&devicePattern))
+		return false;
+
+	// Optionally based on a template
+	const KeyboardTemplate* base = nullptr;
+	std::wstring templateName = xmlch_to_wstring(kbElement->getAttribute(u"Template"));
+	if (!templateName.empty())
+	{
+		auto found = templates.find(templateName);
+		if (found == templates.end())
+			return false;
+		base = &found->second;
+	}
+
+	// Modifiers and layers, of its own or inherited
+	KeyboardTemplate layout;
+	if (!ParseLayout(kbElement, base, pool, &layout))
+		return false;
+
+	// Pass a vector to the function that will fill it with modifiers
+	// Each keyboard gets modifiers of its own, even if they come from a template
+	std::vector<PModifier> modVector;
+	if (layout.modifiersElement && !ParseModifier(layout.modifiersElement, &modVector))
+		return false;
+	// modVector now holds the modifiers.
+	// We'll hand them to the keyboard spec after making all layers
+
+	// Time the keys of a chord may take to be all pressed; optional
+	DWORD chordWindow = DEFAULT_CHORD_WINDOW;
+	std::wstring chordWindowText = xmlch_to_wstring(kbElement->getAttribute(u"ChordWindow"));
+	if (!chordWindowText.empty())
+	{
+		try
+		{
+			chordWindow = std::stoul(chordWindowText);
+		}
+		catch (std::exception e)
+		{
+			return false;
+		}
+	}
+
+	// Text expansions; optional
+	ExpansionAutomaton* expansions = nullptr;
+	if (!ParseExpansions(kbElement, &expansions))
+		return false;
+
+	// layerArray is ready, and so are the modifiers; compile them into a spec
+	std::shared_ptr<const KeyboardSpec> spec =
+		std::make_shared<const KeyboardSpec>(keyboardName, layout.layers, modVector, chordWindow, expansions, pool, devicePattern);
 	*pKeyboard =
-		new Keyboard(keyboardName, layerVector, ptrModStateMap);
+		new Keyboard(spec);
 
 	return true;
 }
 
 
 
-bool ParseModifier(const PXmlElement modElement, OUT ModifierStateMap**const pModifiers)
+bool ParseModifier(const PXmlElement modElement, OUT std::vector<PModifier> *const pModifiers)
 {
 	// This element contains any number of "modifier" tags in it
 	PXmlNodeList modifierElements = modElement->getElementsByTagName(u"modifier");
 
 	// Get a multimap to place stuff in
 	std::multimap<std::wstring, unsigned int> modMultimap;
+	// Dual-role modifiers, by name; a modifier is dual-role if any of its keys has a TapTimeout
+	std::map<std::wstring, DWORD> tapTimeouts;
 
 	for (XMLSize_t i = 0; i < modifierElements->getLength(); i++)
 	{
@@ -274,9 +506,13 @@ bool ParseModifier(const PXmlElement modElement, OUT ModifierStateMap**const pMo
 		std::wstring modifierName = xmlch_to_wstring(thisElement->getAttribute(u"Name"));
 		// get value
 		std::wstring modifierScancode = xmlch_to_wstring(thisElement->getTextContent());
+		std::wstring tapTimeoutText = xmlch_to_wstring(thisElement->getAttribute(u"TapTimeout"));
 		unsigned int iModifierValue = 0;
 		try
 		{
+			if (!tapTimeoutText.empty())
+				tapTimeouts[modifierName] = std::stoul(tapTimeoutText);
+
 			// Some modifiers have E0 flags; in that case, there will be a ':' complicating things,
 			// so we must remove it to get a number like e038.
 			modifierScancode.erase(std::remove(modifierScancode.begin(), modifierScancode.end(), L':'), modifierScancode.end());
@@ -302,7 +538,9 @@ bool ParseModifier(const PXmlElement modElement, OUT ModifierStateMap**const pMo
 	// some keys are the same; the amount of keys is equal to the amount of modifiers
 	// pairs with the same key (name) are composite modifiers
 
-	std::vector<PModifier> modVector;		// getting a list of modifiers
+	// Each modifier takes a bit of the keyboard's ModifierMask
+	std::vector<PModifier>& modVector = *pModifiers;		// getting a list of modifiers
+	modVector.clear();
 	decltype(modMultimap.equal_range(L"")) range;	// range is of whatever type equal_range returns
 													// range will become an std::pair of unknown.
 													// range.second points to the first element that does not have a key of the specified parameter
@@ -339,27 +577,35 @@ bool ParseModifier(const PXmlElement modElement, OUT ModifierStateMap**const pMo
 			pModifier = new CompositeModifier(it->first, scVector);
 		}
 
+		auto tapTimeout = tapTimeouts.find(it->first);
+		if (tapTimeout != tapTimeouts.end())
+			pModifier->tapTimeout = tapTimeout->second;
+
 		// add to the vector
 		modVector.push_back(pModifier);
 	}
 
-	*pModifiers =
-		new ModifierStateMap(modVector);
+	if (modVector.size() > MAX_MODIFIERS)
+	{
+		for (size_t i = 0; i < modVector.size(); i++)
+			delete modVector[i];
+		modVector.clear();
+		return false;
+	}
 
 	return true;
 }
 
 
 
-bool ParseLayer(const PXmlElement lvlElement, OUT Layer** const pLayer)
+bool ParseLayer(const PXmlElement lvlElement, const std::vector<std::shared_ptr<const Layer>>& inherited,
+	CommandPool *const pool, OUT Layer** const pLayer)
 {
-	// Get a copy of the modifier state map
-	// ModifierStateMap * ptrLayerModMap = new ModifierStateMap(*pModifiers);
-	// no longer necessary to create a modifier state map
-
 	// This will contain the modifiers that are necessary to trigger this layer,
 	// identified only by name.
 	std::vector<std::wstring> modifierCombination;
+	// And those whose state doesn't matter
+	std::vector<std::wstring> ignoredModifiers;
 
 	// Get all modifiers that are required to trigger this layer
 	PXmlNodeList modifierList = lvlElement->getElementsByTagName(u"modifier");
@@ -369,15 +615,73 @@ bool ParseLayer(const PXmlElement lvlElement, OUT Layer** const pLayer)
 		if (modifier->getNodeType() != XmlNode::NodeType::ELEMENT_NODE)
 			return false;		// there was a non-element "modifier"
 		std::wstring modifierName = xmlch_to_wstring(modifier->getTextContent());
-		modifierCombination.push_back(modifierName);		// <- adds new modifier name to necessary modifiers
+
+		// Pressed by default; modifiers not listed must be released anyway, so saying it changes nothing
+		std::wstring state = xmlch_to_wstring(((PXmlElement)modifier)->getAttribute(u"State"));
+		if (state.empty() || state.compare(L"Pressed") == 0)
+			modifierCombination.push_back(modifierName);		// <- adds new modifier name to necessary modifiers
+		else if (state.compare(L"Ignored") == 0)
+			ignoredModifiers.push_back(modifierName);
+		else if (state.compare(L"Released") != 0)
+			return false;
 	}
 
 	// At this point, modifierCombination contains the modifiers and will only go out of scope at
 	// the end of this function.
 
+	// The inherited layer with the same modifiers, if any, provides every key this one doesn't map
+	std::shared_ptr<const Layer> base;
+	for (size_t i = 0; i < inherited.size() && !base; i++)
+	{
+		if (inherited[i]->hasModifiers(modifierCombination, ignoredModifiers))
+			base = inherited[i];
+	}
+
+	// Transparent layers let the keys they don't map fall through to the layers below;
+	// an override is transparent if its template layer is, unless it says otherwise
+	bool transparent = base ? base->transparent : false;
+	std::wstring transparentText = xmlch_to_wstring(lvlElement->getAttribute(u"Transparent"));
+	if (!transparentText.empty())
+		transparent = transparentText.compare(L"True") == 0;
+
+	// The layer without modifiers is used from the very first keystroke, so it's read now. The rest
+	// are only kept as text, and read the first time they're switched to; most sessions never use
+	// most of them.
+	if (!modifierCombination.empty())
+	{
+		bool hasChords = false;
+		DWORD deadKeyTimeout = 0;
+		std::string text;
+		if (!ScanLayerContents(lvlElement, &hasChords, &deadKeyTimeout) || !SerializeElement(lvlElement, &text))
+			return false;
+		std::unique_ptr<const LayerSource> source(new XmlLayerSource(text, pool));
+		*pLayer =
+			new Layer(modifierCombination, std::move(source), hasChords, deadKeyTimeout, base, transparent, ignoredModifiers);
+		return true;
+	}
+
+	std::unordered_map<Scancode, BaseKeystrokeCommand*> layout;
+	std::vector<ChordDefinition> chords;
+	if (!ParseLayerContents(lvlElement, pool, &layout, &chords))
+		return false;
+
+	*pLayer =
+		new Layer(modifierCombination, layout, chords, base, transparent, ignoredModifiers);
+	// It's okay that these containers die at the end of this function.
+	// Layer will copy them in its constructor.
+
+	return true;
+}
+
+
+bool ParseLayerContents(const PXmlElement lvlElement, CommandPool *const pool,
+	OUT std::unordered_map<Scancode, BaseKeystrokeCommand*> *const pLayout, OUT std::vector<ChordDefinition> *const pChords)
+{
 	// Read all remaps
 	PXmlNodeList allChildren = lvlElement->getChildNodes();
-	std::unordered_map<Scancode, BaseKeystrokeCommand*> layout;
+	std::unordered_map<Scancode, BaseKeystrokeCommand*>& layout = *pLayout;
+	std::vector<ChordDefinition>& chords = *pChords;
+	std::unordered_set<Scancode> chordKeys;		// every key used in chords, to check their amount
 
 	for (XMLSize_t i = 0; i < allChildren->getLength(); i++)
 	{
@@ -390,24 +694,41 @@ bool ParseLayer(const PXmlElement lvlElement, OUT Layer** const pLayer)
 
 		if (childTagName.compare(L"unicode") == 0)
 		{
-			if (!ParseUnicode((PXmlElement)child, &commandPointer))
+			if (!ParseUnicode((PXmlElement)child, pool, &commandPointer))
 				return false;
 		}
 		else if (childTagName.compare(L"macro") == 0)
 		{
-			if (!ParseMacro((PXmlElement)child, &commandPointer))
+			if (!ParseMacro((PXmlElement)child, pool, &commandPointer))
 				return false;
 		}
 		else if (childTagName.compare(L"execute") == 0)
 		{
-			if (!ParseExecutable((PXmlElement)child, &commandPointer))
+			if (!ParseExecutable((PXmlElement)child, pool, &commandPointer))
 				return false;
 		}
 		else if (childTagName.compare(L"deadkey") == 0)
 		{
-			if (!ParseDeadKey((PXmlElement)child, &commandPointer))
+			if (!ParseDeadKey((PXmlElement)child, pool, &commandPointer))
 				return false;
 		}
+		else if (childTagName.compare(L"compose") == 0)
+		{
+			if (!ParseCompose((PXmlElement)child, pool, &commandPointer))
+				return false;
+		}
+		else if (childTagName.compare(L"chord") == 0)
+		{
+			// Chords have several scancodes, and are kept apart from the layout
+			ChordDefinition chord;
+			if (!ParseChord((PXmlElement)child, pool, &chord))
+				return false;
+			chords.push_back(chord);
+			chordKeys.insert(chord.keys.begin(), chord.keys.end());
+			if (chordKeys.size() > MAX_CHORD_KEYS_PER_LAYER)
+				return false;
+			continue;
+		}
 		// The only other kind of node that can appear is a modifier,
 		// and those are read elsewhere.
 		else continue;
@@ -440,18 +761,132 @@ bool ParseLayer(const PXmlElement lvlElement, OUT Layer** const pLayer)
 
 	}
 
-	*pLayer =
-		new Layer(modifierCombination, layout);
-	// It's okay that these containers die at the end of this function.
-	// Layer will copy them in its constructor.
+	return true;
+}
+
+
+bool ScanLayerContents(const PXmlElement lvlElement, OUT bool *const pHasChords, OUT DWORD *const pDeadKeyTimeout)
+{
+	*pHasChords = false;
+	*pDeadKeyTimeout = 0;
 
+	PXmlNodeList allChildren = lvlElement->getChildNodes();
+	for (XMLSize_t i = 0; i < allChildren->getLength(); i++)
+	{
+		PXmlNode child = allChildren->item(i);
+		if (child->getNodeType() != XmlNode::NodeType::ELEMENT_NODE)
+			continue;
+
+		std::wstring childTagName = xmlch_to_wstring(child->getNodeName());
+		if (childTagName.compare(L"chord") == 0)
+			*pHasChords = true;
+		else if (childTagName.compare(L"deadkey") == 0)
+		{
+			// Same as ParseDeadKey; a dead key whose key is mapped again later still counts, but
+			// waking up early does no harm
+			std::wstring timeoutText = xmlch_to_wstring(((PXmlElement)child)->getAttribute(u"Timeout"));
+			if (timeoutText.empty())
+				continue;
+			try
+			{
+				DWORD timeout = std::stoul(timeoutText);
+				if (timeout > 0 && (*pDeadKeyTimeout == 0 || timeout < *pDeadKeyTimeout))
+					*pDeadKeyTimeout = timeout;
+			}
+			catch (std::exception e)
+			{
+				return false;
+			}
+		}
+	}
 	return true;
 }
 
 
+bool SerializeElement(const PXmlElement element, OUT std::string *const pText)
+{
+	xercesc::DOMImplementationLS* implementation =
+		xercesc::DOMImplementationRegistry::getDOMImplementation(u"LS");
+	xercesc::DOMLSSerializer* serializer = implementation->createLSSerializer();
+	xercesc::DOMLSOutput* output = implementation->createLSOutput();
+
+	xercesc::MemBufFormatTarget target;
+	output->setByteStream(&target);
+	output->setEncoding(u"UTF-8");
+	bool written = serializer->write(element, output);
+	if (written)
+		pText->assign((const char*)target.getRawBuffer(), target.getLen());
+
+	output->release();
+	serializer->release();
+	return written;
+}
+
+
+std::mutex XmlLayerSource::buildMutex;
+
+XmlLayerSource::XmlLayerSource(const std::string& text, CommandPool *const pool)
+	: text(text), pool(pool)
+{ }
+
+bool XmlLayerSource::build(OUT std::unordered_map<Scancode, BaseKeystrokeCommand*> *const out_layout,
+	OUT std::vector<ChordDefinition> *const out_chords) const
+{
+	std::lock_guard<std::mutex> lock(buildMutex);
+	try
+	{
+		xercesc::XMLPlatformUtils::Initialize();		// counted; loadSettings may have terminated it
+	}
+	catch (const xercesc::XMLException&)
+	{
+		return false;
+	}
+
+	bool result = false;
+	{
+		// The whole document was validated when it was loaded
+		XercesDOMParser parser;
+		parser.setValidationScheme(XercesDOMParser::Val_Never);
+		parser.setCreateCommentNodes(false);
+		xercesc::HandlerBase errorHandler;
+		parser.setErrorHandler(&errorHandler);
+
+		xercesc::MemBufInputSource input((const XMLByte*)text.data(), text.size(), u"layer");
+		try
+		{
+			parser.parse(input);
+			PXmlDocument document = parser.getDocument();
+			if (document && document->getDocumentElement())
+				result = ParseLayerContents(document->getDocumentElement(), pool, out_layout, out_chords);
+		}
+		catch (const xercesc::XMLException&)
+		{
+			result = false;
+		}
+		catch (const xercesc::SAXException&)
+		{
+			result = false;
+		}
+	}		// The parser and its document go before Xerces does
+
+	try
+	{
+		xercesc::XMLPlatformUtils::Terminate();
+	}
+	catch (const xercesc::XMLException&)
+	{ }
+	return result;
+}
+
+size_t XmlLayerSource::getMemoryUsage() const
+{
+	return sizeof(*this) + text.capacity();
+}
+
 
 
-bool ParseUnicode(const PXmlElement rmpElement, OUT BaseKeystrokeCommand* *const pCommand)
+
+bool ParseUnicode(const PXmlElement rmpElement, CommandPool *const pool, OUT BaseKeystrokeCommand* *const pCommand)
 {
 	// retrieve trigger on repeat attribute
 	bool triggerOnRepeat =
@@ -483,12 +918,12 @@ bool ParseUnicode(const PXmlElement rmpElement, OUT BaseKeystrokeCommand* *const
 	}
 
 	*pCommand =
-		new UnicodeCommand(codepointVector.data(), codepointVector.size(), triggerOnRepeat);
+		pool->internUnicode(codepointVector, triggerOnRepeat);
 	return true;
 
 }
 
-bool ParseMacro(const PXmlElement rmpElement, OUT BaseKeystrokeCommand* *const pCommand)
+bool ParseMacro(const PXmlElement rmpElement, CommandPool *const pool, OUT BaseKeystrokeCommand* *const pCommand)
 {
 	// retrieve trigger on repeat attribute
 	bool triggerOnRepeat =
@@ -496,31 +931,68 @@ bool ParseMacro(const PXmlElement rmpElement, OUT BaseKeystrokeCommand* *const p
 
 	std::vector<unsigned short> vkeyVector;
 
-	// read each vKey
-	PXmlNodeList vkeyElements = rmpElement->getElementsByTagName(u"vkey");
-	for (XMLSize_t i = 0; i < vkeyElements->getLength(); i++)
+	// Keystrokes are split into steps wherever the macro pauses, with a delay or a hold;
+	// the last step is still open.
+	std::vector<MacroStep> steps;
+	MacroStep currentStep = { 0, 0, 0 };
+
+	// read each vKey, delay and hold, in order
+	PXmlNodeList childNodes = rmpElement->getChildNodes();
+	for (XMLSize_t i = 0; i < childNodes->getLength(); i++)
 	{
-		if (vkeyElements->item(i)->getNodeType() != XmlNode::NodeType::ELEMENT_NODE)
+		if (childNodes->item(i)->getNodeType() != XmlNode::NodeType::ELEMENT_NODE)
 			continue;
 
+		PXmlElement childElement = (PXmlElement)childNodes->item(i);
+		std::wstring childTagName = xmlch_to_wstring(childElement->getNodeName());
+
 		try
 		{
-			unsigned short vkey = std::stoi(
-				xmlch_to_wcs(vkeyElements->item(i)->getTextContent()),
-				0,
-				16
-			);
+			if (childTagName.compare(L"vkey") == 0)
+			{
+				unsigned short vkey = std::stoi(
+					xmlch_to_wcs(childElement->getTextContent()),
+					0,
+					16
+				);
 
-			bool isKeyUp =
-				u16wcscmp(
-				((PXmlElement)vkeyElements->item(i))->getAttribute(u"Keypress"),
-					L"Up"
-				) == 0;
+				bool isKeyUp =
+					u16wcscmp(
+						childElement->getAttribute(u"Keypress"),
+						L"Up"
+					) == 0;
+
+				if (isKeyUp)		// turn on the most significant bit of a 16-bit variable
+					vkey |= 0x8000;
+
+				vkeyVector.push_back(vkey);
+				currentStep.inputCount++;
+			}
+			else if (childTagName.compare(L"delay") == 0)
+			{
+				// Pause, in ms, after the keystrokes so far
+				currentStep.pauseAfter = std::stoul(xmlch_to_wstring(childElement->getTextContent()));
+				steps.push_back(currentStep);
+				currentStep = { vkeyVector.size(), 0, 0 };
+			}
+			else if (childTagName.compare(L"hold") == 0)
+			{
+				// A key pressed, held down for Duration ms, then released
+				unsigned short vkey = std::stoi(
+					xmlch_to_wcs(childElement->getTextContent()),
+					0,
+					16
+				);
+				DWORD duration = std::stoul(xmlch_to_wstring(childElement->getAttribute(u"Duration")));
 
-			if (isKeyUp)		// turn on the most significant bit of a 16-bit variable
-				vkey |= 0x8000;
+				vkeyVector.push_back(vkey);
+				currentStep.inputCount++;
+				currentStep.pauseAfter = duration;
+				steps.push_back(currentStep);
 
-			vkeyVector.push_back(vkey);
+				vkeyVector.push_back(vkey | 0x8000);
+				currentStep = { vkeyVector.size() - 1, 1, 0 };
+			}
 		}
 		catch (std::exception e)
 		{
@@ -529,12 +1001,23 @@ bool ParseMacro(const PXmlElement rmpElement, OUT BaseKeystrokeCommand* *const p
 		}
 	}
 
+	// Without pauses, the whole macro is sent at once
+	if (steps.empty())
+	{
+		*pCommand =
+			pool->internMacro(vkeyVector, triggerOnRepeat);
+		return true;
+	}
+
+	if (currentStep.inputCount > 0)
+		steps.push_back(currentStep);
+
 	*pCommand =
-		new MacroCommand(vkeyVector.data(), vkeyVector.size(), triggerOnRepeat);
+		pool->adopt(new TimedMacroCommand(vkeyVector, steps, triggerOnRepeat));
 	return true;
 }
 
-bool ParseExecutable(const PXmlElement rmpElement, OUT BaseKeystrokeCommand* *const pCommand)
+bool ParseExecutable(const PXmlElement rmpElement, CommandPool *const pool, OUT BaseKeystrokeCommand* *const pCommand)
 {
 	// One "path" element, one "parameter" element
 	PXmlNodeList pathElementList = rmpElement->getElementsByTagName(u"path");
@@ -552,12 +1035,12 @@ bool ParseExecutable(const PXmlElement rmpElement, OUT BaseKeystrokeCommand* *co
 		std::wstring parameter = xmlch_to_wstring(parameterElementList->item(0)->getTextContent());
 
 		*pCommand =
-			new ExecutableCommand(path, parameter);
+			pool->adopt(new ExecutableCommand(path, parameter));
 	}
 	else
 	{
 		*pCommand =
-			new ExecutableCommand(path);
+			pool->adopt(new ExecutableCommand(path));
 	}
 
 	return true;
@@ -597,7 +1080,8 @@ bool ParseIndependentCodepoints(
 }
 bool ParseReplacements(
 	const PXmlNodeList replList,
-	OUT std::unordered_map<UnicodeCommand*, UnicodeCommand*>* replacements)	// <-should not be null
+	CommandPool *const pool,
+	OUT std::unordered_map<const UnicodeCommand*, UnicodeCommand*>* replacements)	// <-should not be null
 {
 	PXmlNodeList workList;
 	// Each node in replList is an element called <replacement> containing one <from> tag and a <to> tag.
@@ -625,21 +1109,22 @@ bool ParseReplacements(
 		if (workList->getLength() != 1) return false;
 		if (workList->item(0)->getNodeType() != XmlNode::NodeType::ELEMENT_NODE) return false;
 		if (!ParseIndependentCodepoints((PXmlElement)workList->item(0), &pToCodepoints)) return false;
-		// make both Unicode commands, store them in the map
-		UnicodeCommand * pFromCommand = new UnicodeCommand(pFromCodepoints, true);
-		UnicodeCommand * pToCommand = new UnicodeCommand(pToCodepoints, true);
-		(*replacements)[pFromCommand] = pToCommand;		// These UnicodeCommands don't die
+		// get both Unicode commands from the pool, store them in the map
+		// The key pressed after the dead key is looked up by pointer, whether it triggers on repeat or not
+		UnicodeCommand * pToCommand = pool->internUnicode(pToCodepoints, true);
+		(*replacements)[pool->internUnicode(pFromCodepoints, true)] = pToCommand;
+		(*replacements)[pool->internUnicode(pFromCodepoints, false)] = pToCommand;
 	}
 	// replacements have already been inserted
 	return true;
 }
-bool ParseDeadKey(const PXmlElement rmpElement, OUT BaseKeystrokeCommand* *const pCommand)
+bool ParseDeadKey(const PXmlElement rmpElement, CommandPool *const pool, OUT BaseKeystrokeCommand* *const pCommand)
 {
 	// Unicode characters that represent this key independently
 	std::vector<unsigned int> codepointVector;
 
 	// Map that contains all replacements this dead key can make
-	std::unordered_map<UnicodeCommand*, UnicodeCommand*> replacementsMap;
+	std::unordered_map<const UnicodeCommand*, UnicodeCommand*> replacementsMap;
 
 	// Retrieve independent codepoints
 	PXmlNodeList workList;
@@ -659,12 +1144,174 @@ bool ParseDeadKey(const PXmlElement rmpElement, OUT BaseKeystrokeCommand* *const
 		return false;*/
 	/*if (workList->item(0)->getNodeType() != XmlNode::NodeType::ELEMENT_NODE)
 		return false;*/
-	if (!ParseReplacements(workList, &replacementsMap))
+	if (!ParseReplacements(workList, pool, &replacementsMap))
 		return false;
 	// At this point, replacementsMap contains valid replacements
 
+	// Optional timeout, in ms
+	DWORD timeout = 0;
+	std::wstring timeoutText = xmlch_to_wstring(rmpElement->getAttribute(u"Timeout"));
+	if (!timeoutText.empty())
+	{
+		try
+		{
+			timeout = std::stoul(timeoutText);
+		}
+		catch (std::exception e)
+		{
+			return false;
+		}
+	}
+
+	// Optional combining mark, as a codepoint in hexadecimal; composes the characters without a replacement
+	unsigned int combiningMark = 0;
+	std::wstring combiningMarkText = xmlch_to_wstring(rmpElement->getAttribute(u"CombiningMark"));
+	if (!combiningMarkText.empty())
+	{
+		try
+		{
+			combiningMark = std::stoul(combiningMarkText, 0, 16);
+		}
+		catch (std::exception e)
+		{
+			return false;
+		}
+	}
+
 	// set dead key pointer
 	*pCommand =
-		new DeadKeyCommand(codepointVector, replacementsMap);
+		pool->adopt(new DeadKeyCommand(codepointVector, replacementsMap, timeout, combiningMark));
+	return true;
+}
+
+
+
+bool ParseScancode(std::wstring text, OUT Scancode *const pScancode)
+{
+	// the bytes of a scancode may be optionally separated by a colon, in which case we remove it
+	text.erase(std::remove(text.begin(), text.end(), L':'), text.end());
+	try
+	{
+		unsigned short iScancode = std::stoi(text.c_str(), 0, 16);
+		if (iScancode <= 0xFF)
+			*pScancode = Scancode(iScancode & 0xFF);
+		else
+			*pScancode = Scancode(iScancode >> 8, iScancode & 0xFF);
+	}
+	catch (std::exception e)
+	{
+		return false;
+	}
 	return true;
-}
\ No newline at end of file
+}
+
+bool ParseChord(const PXmlElement chordElement, CommandPool *const pool, OUT ChordDefinition *const pChord)
+{
+	// Keys are scancodes separated by spaces
+	std::wstringstream keys(xmlch_to_wstring(chordElement->getAttribute(u"Keys")));
+	std::wstring keyText;
+	pChord->keys.clear();
+	while (keys >> keyText)
+	{
+		Scancode sc;
+		if (!ParseScancode(keyText, &sc))
+			return false;
+		if (std::find(pChord->keys.begin(), pChord->keys.end(), sc) != pChord->keys.end())
+			return false;		// the same key twice
+		pChord->keys.push_back(sc);
+	}
+	if (pChord->keys.size() < 2 || pChord->keys.size() > MAX_CHORD_KEYS)
+		return false;
+
+	// The chord sends either characters or virtual keys, read like a unicode or macro element
+	if (chordElement->getElementsByTagName(u"codepoint")->getLength() > 0)
+		return ParseUnicode(chordElement, pool, &pChord->command);
+	if (chordElement->getElementsByTagName(u"vkey")->getLength() > 0)
+		return ParseMacro(chordElement, pool, &pChord->command);
+	return false;
+}
+
+bool ParseExpansions(const PXmlElement kbElement, OUT ExpansionAutomaton* *const pExpansions)
+{
+	*pExpansions = nullptr;
+
+	// Each expansion has its trigger in an attribute, and its replacement as text
+	std::vector<ExpansionDefinition> definitions;
+	PXmlNodeList expansionElements = kbElement->getElementsByTagName(u"expansion");
+	for (XMLSize_t i = 0; i < expansionElements->getLength(); i++)
+	{
+		if (expansionElements->item(i)->getNodeType() != XmlNode::NodeType::ELEMENT_NODE)
+			return false;
+		PXmlElement expansionElement = (PXmlElement)expansionElements->item(i);
+
+		ExpansionDefinition definition;
+		definition.trigger = xmlch_to_wstring(expansionElement->getAttribute(u"Trigger"));
+		definition.replacement = xmlch_to_wstring(expansionElement->getTextContent());
+		if (definition.trigger.empty())
+			return false;
+		definitions.push_back(definition);
+	}
+
+	if (!definitions.empty())
+		*pExpansions = new ExpansionAutomaton(definitions);
+	return true;
+}
+
+// Appends a code point to a UTF-16 string
+static void AppendUtf16(unsigned int codepoint, OUT std::wstring *const text)
+{
+	if (codepoint <= 0xffff)
+		text->push_back((wchar_t)codepoint);
+	else
+	{
+		text->push_back((wchar_t)(0xd800 + ((codepoint - 0x10000) >> 10)));
+		text->push_back((wchar_t)(0xdc00 + (codepoint & 0x3ff)));
+	}
+}
+
+bool ParseCompose(const PXmlElement rmpElement, CommandPool *const pool, OUT BaseKeystrokeCommand* *const pCommand)
+{
+	std::vector<ComposeDefinition> definitions;
+
+	// Sequences imported from an X11 compose file; optional
+	std::wstring filename = xmlch_to_wstring(rmpElement->getAttribute(u"File"));
+	if (!filename.empty())
+	{
+		size_t skipped = 0;
+		if (!ImportXCompose(filename, &definitions, &skipped))
+			return false;
+		if (skipped > 0)
+			OutputDebugString((L"Compose file " + filename + L": " + std::to_wstring(skipped)
+				+ L" lines skipped\n").c_str());
+	}
+
+	// Sequences of its own come after, so that they replace those of the file
+	PXmlNodeList sequenceElements = rmpElement->getElementsByTagName(u"sequence");
+	for (XMLSize_t i = 0; i < sequenceElements->getLength(); i++)
+	{
+		if (sequenceElements->item(i)->getNodeType() != XmlNode::NodeType::ELEMENT_NODE)
+			continue;
+		PXmlElement sequenceElement = (PXmlElement)sequenceElements->item(i);
+
+		// A <from> and a <to>, each with a list of <codepoint>s, as in a dead key replacement
+		std::vector<unsigned int> fromCodepoints;
+		std::vector<unsigned int> toCodepoints;
+		PXmlNodeList workList = sequenceElement->getElementsByTagName(u"from");
+		if (workList->getLength() != 1) return false;
+		if (!ParseIndependentCodepoints((PXmlElement)workList->item(0), &fromCodepoints)) return false;
+		workList = sequenceElement->getElementsByTagName(u"to");
+		if (workList->getLength() != 1) return false;
+		if (!ParseIndependentCodepoints((PXmlElement)workList->item(0), &toCodepoints)) return false;
+
+		ComposeDefinition definition;
+		for (size_t j = 0; j < fromCodepoints.size(); j++)
+			AppendUtf16(fromCodepoints[j], &definition.sequence);
+		for (size_t j = 0; j < toCodepoints.size(); j++)
+			AppendUtf16(toCodepoints[j], &definition.output);
+		definitions.push_back(definition);
+	}
+
+	*pCommand =
+		pool->adopt(new ComposeCommand(new ComposeTable(definitions)));
+	return true;
+}
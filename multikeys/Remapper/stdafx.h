@@ -5,27 +5,46 @@
 
 #pragma once
 
+// The remapper is also built elsewhere, for the tests and benchmarks in ../Tests; those builds
+// get what it uses of the Windows API from Portable.h instead of the Windows headers.
+#ifdef _WIN32
 #include "targetver.h"
 
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
+#endif
 
 
 
 // C Runtime header files
 #include <stdlib.h>
-#include <malloc.h>
 #include <memory.h>
+
+#ifdef _WIN32
+#include <malloc.h>
 #include <tchar.h>
+#include <Windows.h>			// for the Windows API
+#include <shellapi.h>			// to get arguments passed to main
+#else
+#include "Portable.h"			// the Windows API, elsewhere
+#endif
 
 // Additional headers
-#include <Windows.h>			// for the Windows API
 #include <string>				// std::string and std::wstring
 #include <vector>				// contiguous, iterable containers for keyboard structures
 #include <array>				// contiguous, fixed-length containers for modifiers
 #include <map>					// maps for dead keys
 #include <unordered_map>		// hash maps for storing the set of remaps for each keyboard
+#include <unordered_set>		// hash sets for the chord index
 #include <fstream>				// for reading the configuration file
 #include <locale>				// for setting locale if needed
 #include <codecvt>				// for converting strings between different encondings
 #include <cctype>				// make sure things like hex digit checking will work (that's also in locale)
-#include <shellapi.h>			// to get arguments passed to main
+#include <deque>				// queue of pending process launches
+#include <thread>				// launcher worker thread
+#include <mutex>				// synchronization with the launcher worker
+#include <condition_variable>	// waking the launcher worker
+#include <memory>				// keyboard specs shared between keyboards
+#include <bitset>				// keys held down by running macros
+#include <cwctype>				// case of device names
+#include <atomic>				// layers built on first activation
+#include <chrono>				// launch latencies, on any platform
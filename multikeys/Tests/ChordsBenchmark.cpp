@@ -0,0 +1,160 @@
+// Benchmark of chords (Layer chords, and their resolution in Keyboard::evaluateKey): a layer of
+// 40 keys with up to 496 chords, every pair of its first 32 keys. Three streams are typed: keys
+// in no chord, keys of chords typed alone, which are held back until released, and chords. Each
+// is timed with no chord defined, so the difference is what chords add. Then the latency chords
+// add to a key held alone, which waits for the chord window, as the core's timer resolves it.
+// Not run by ctest; run it by hand:
+//		ChordsBenchmark [keystrokes]
+
+#include "../Remapper/Keyboard.h"
+#include "../Remapper/CommandPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static const BYTE FIRST_KEY = 0x10;
+static const size_t KEY_COUNT = 40;
+static const size_t CHORD_KEY_COUNT = 32;	// Keys in chords: the first ones; the others are in none
+static const size_t MAX_PAIRS = CHORD_KEY_COUNT * (CHORD_KEY_COUNT - 1) / 2;
+
+
+static double Nanoseconds(Clock::duration duration, size_t count)
+{
+	return std::chrono::duration<double, std::nano>(duration).count() / count;
+}
+
+
+// A layer of characters, with chordCount chords of two keys each
+static std::shared_ptr<const KeyboardSpec> MakeSpec(CommandPool* pool, size_t chordCount, DWORD chordWindow)
+{
+	std::unordered_map<Scancode, BaseKeystrokeCommand*> layout;
+	for (size_t k = 0; k < KEY_COUNT; k++)
+		layout[Scancode((BYTE)(FIRST_KEY + k))] = pool->internUnicode(std::vector<unsigned int>(1, 0x21 + k), false);
+	std::vector<ChordDefinition> chords;
+	for (size_t a = 0; a < CHORD_KEY_COUNT && chords.size() < chordCount; a++)
+	{
+		for (size_t b = a + 1; b < CHORD_KEY_COUNT && chords.size() < chordCount; b++)
+		{
+			ChordDefinition chord;
+			chord.keys.push_back(Scancode((BYTE)(FIRST_KEY + a)));
+			chord.keys.push_back(Scancode((BYTE)(FIRST_KEY + b)));
+			chord.command = pool->internUnicode(std::vector<unsigned int>(1, 0x4e00 + chords.size()), false);
+			chords.push_back(chord);
+		}
+	}
+	std::vector<std::shared_ptr<const Layer>> layers(1,
+		std::make_shared<Layer>(std::vector<std::wstring>(), layout, chords));
+	return std::make_shared<KeyboardSpec>(L"Bench", layers, std::vector<PModifier>(), chordWindow, nullptr, pool);
+}
+
+
+enum class Stream { Plain, Alone, Chords };
+
+// Types count keystrokes of a stream; returns how many actions with an effect came out.
+static size_t Type(Keyboard& keyboard, Stream stream, size_t count)
+{
+	size_t sent = 0;
+	PKeystrokeCommand action;
+	bool repeated;
+	for (size_t i = 0; i < count; i++)
+	{
+		Scancode keys[2];
+		size_t keyCount = 1;
+		if (stream == Stream::Plain)
+			keys[0] = Scancode((BYTE)(FIRST_KEY + CHORD_KEY_COUNT + i % (KEY_COUNT - CHORD_KEY_COUNT)));
+		else if (stream == Stream::Alone)
+			keys[0] = Scancode((BYTE)(FIRST_KEY + i % CHORD_KEY_COUNT));
+		else
+		{
+			// The chord of keys a and b, for one of the first 16 keys a: always defined
+			size_t a = i % 16;
+			keys[0] = Scancode((BYTE)(FIRST_KEY + a));
+			keys[1] = Scancode((BYTE)(FIRST_KEY + a + 1 + i % (CHORD_KEY_COUNT - a - 1)));
+			keyCount = 2;
+		}
+		for (size_t k = 0; k < keyCount; k++)
+		{
+			if (keyboard.evaluateKey(keys[k], 0, false, &action, &repeated) && action->hasEffect())
+				sent++;
+		}
+		for (size_t k = 0; k < keyCount; k++)
+		{
+			keyboard.evaluateKey(keys[k], 0, true, &action, &repeated);
+			while (keyboard.takeDeferredAction(&action))
+				sent++;
+		}
+	}
+	return sent;
+}
+
+
+// Times a key of a chord held alone until the window is over, resolved by expire as the
+// core's timer would; returns the median time from its press to its output, in ms.
+static double HeldAloneLatency(DWORD chordWindow)
+{
+	CommandPool pool;
+	std::shared_ptr<const KeyboardSpec> spec = MakeSpec(&pool, MAX_PAIRS, chordWindow);
+	Keyboard keyboard(spec);
+	std::vector<double> latencies;
+	PKeystrokeCommand action;
+	bool repeated;
+	for (int i = 0; i < 20; i++)
+	{
+		Scancode key((BYTE)(FIRST_KEY + i % CHORD_KEY_COUNT));
+		Clock::time_point pressed = Clock::now();
+		keyboard.evaluateKey(key, 0, false, &action, &repeated);
+		while (!keyboard.takeDeferredAction(&action))
+		{
+			DWORD next = keyboard.expire();
+			if (next > 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(next));
+		}
+		latencies.push_back(std::chrono::duration<double, std::milli>(Clock::now() - pressed).count());
+		keyboard.evaluateKey(key, 0, true, &action, &repeated);
+	}
+	std::nth_element(latencies.begin(), latencies.begin() + latencies.size() / 2, latencies.end());
+	return latencies[latencies.size() / 2];
+}
+
+
+int main(int argc, char* argv[])
+{
+	long count = argc > 1 ? atol(argv[1]) : 1000000;
+	if (count <= 0)
+		count = 1000000;
+
+	printf("%ld keystrokes per stream; nanoseconds per keystroke (per chord, for chords):\n", count);
+	printf("  %8s  %12s  %12s  %12s  %12s\n", "chords", "plain keys", "keys alone", "chords", "memory");
+	const size_t chordCounts[] = { 0, 100, 300, MAX_PAIRS };
+	for (size_t i = 0; i < sizeof(chordCounts) / sizeof(chordCounts[0]); i++)
+	{
+		CommandPool pool;
+		std::shared_ptr<const KeyboardSpec> spec = MakeSpec(&pool, chordCounts[i], DEFAULT_CHORD_WINDOW);
+		Keyboard keyboard(spec);
+		double times[3];
+		const Stream streams[] = { Stream::Plain, Stream::Alone, Stream::Chords };
+		for (size_t s = 0; s < 3; s++)
+		{
+			Clock::time_point start = Clock::now();
+			size_t sent = Type(keyboard, streams[s], (size_t)count);
+			times[s] = Nanoseconds(Clock::now() - start, (size_t)count);
+			if (sent == 0)
+				printf("Nothing sent\n");
+		}
+		printf("  %8zu  %12.1f  %12.1f  %12.1f  %12zu\n", chordCounts[i], times[0], times[1], times[2],
+			spec->getLayers()[0]->getMemoryUsage());
+	}
+
+	printf("\nA key of a chord held alone, from its press to its output (median, in ms):\n");
+	const DWORD windows[] = { 20, DEFAULT_CHORD_WINDOW };
+	for (size_t i = 0; i < 2; i++)
+		printf("  window %3u ms: %6.1f\n", (unsigned)windows[i], HeldAloneLatency(windows[i]));
+	return 0;
+}
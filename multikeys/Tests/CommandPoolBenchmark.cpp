@@ -0,0 +1,160 @@
+// Benchmark of interning commands (Remapper/CommandPool.h) on a configuration of 20 keyboards
+// built from 3 layouts, which share most of their characters: 4 layers of 80 keys each, and 2
+// dead keys with 40 replacements. Loading is creating the commands of every keyboard and
+// compiling its spec, as the settings parser does; either with every command interned in the
+// pool, or with a new command for each, as before the pool, kept by it only to be deleted.
+// Each is loaded in a process of its own, for the memory resident afterwards.
+// Not run by ctest; run it by hand:
+//		CommandPoolBenchmark [keyboards]
+
+#include "../Remapper/Keyboard.h"
+#include "../Remapper/CommandPool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t LAYOUT_COUNT = 3;
+static const size_t LAYER_COUNT = 4;		// Plain, Shift, AltGr, Shift+AltGr
+static const size_t KEY_COUNT = 80;
+static const BYTE FIRST_KEY = 0x02;
+static const BYTE KEY_SHIFT = 0x2a;
+static const BYTE KEY_ALTGR = 0x38;
+static const size_t REPLACEMENT_COUNT = 40;
+
+
+// Resident memory of this process, in KiB
+static long ResidentKiB()
+{
+	long pages = 0, resident = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm)
+	{
+		if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(statm);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+// The command of a character, interned or new
+static UnicodeCommand* Unicode(CommandPool* pool, bool interned, unsigned int codepoint, bool triggerOnRepeat)
+{
+	if (interned)
+		return pool->internUnicode(std::vector<unsigned int>(1, codepoint), triggerOnRepeat);
+	return static_cast<UnicodeCommand*>(pool->adopt(new UnicodeCommand(std::vector<unsigned int>(1, codepoint), triggerOnRepeat)));
+}
+
+// The character of a key in a layer of a layout: the layouts differ in 8 keys of each layer
+static unsigned int CharacterOf(size_t layout, size_t layer, size_t key)
+{
+	if (key < 8)
+		return 0x100 + layout * 0x40 + layer * 8 + key;
+	return 0x21 + layer * 0x60 + key;
+}
+
+// The spec of a keyboard using a layout, read anew as the parser reads each keyboard
+static std::shared_ptr<const KeyboardSpec> MakeSpec(CommandPool* pool, bool interned, size_t layout)
+{
+	BaseKeystrokeCommand* deadKeys[2];
+	for (size_t d = 0; d < 2; d++)
+	{
+		std::unordered_map<const UnicodeCommand*, UnicodeCommand*> replacements;
+		for (size_t r = 0; r < REPLACEMENT_COUNT; r++)
+		{
+			UnicodeCommand* to = Unicode(pool, interned, 0x1e00 + d * 0x80 + r, true);
+			replacements[Unicode(pool, interned, CharacterOf(layout, r % LAYER_COUNT, 8 + r), false)] = to;
+			replacements[Unicode(pool, interned, CharacterOf(layout, r % LAYER_COUNT, 8 + r), true)] = to;
+		}
+		deadKeys[d] = pool->adopt(new DeadKeyCommand({ (unsigned int)(d ? 0xb4 : L'`') }, replacements));
+	}
+
+	const wchar_t* const names[] = { L"Shift", L"AltGr" };
+	std::vector<std::shared_ptr<const Layer>> layers;
+	for (size_t l = 0; l < LAYER_COUNT; l++)
+	{
+		std::unordered_map<Scancode, BaseKeystrokeCommand*> keys;
+		for (size_t k = 0; k < KEY_COUNT; k++)
+			keys[Scancode((BYTE)(FIRST_KEY + k))] = Unicode(pool, interned, CharacterOf(layout, l, k), false);
+		if (l < 2)
+			keys[Scancode((BYTE)(FIRST_KEY + KEY_COUNT - 1))] = deadKeys[l];
+		std::vector<std::wstring> modifiers;
+		for (size_t m = 0; m < 2; m++)
+		{
+			if (l & (1 << m))
+				modifiers.push_back(names[m]);
+		}
+		layers.push_back(std::make_shared<Layer>(modifiers, keys));
+	}
+	std::vector<PModifier> modifiers;
+	modifiers.push_back(new SimpleModifier(L"Shift", Scancode(KEY_SHIFT)));
+	modifiers.push_back(new SimpleModifier(L"AltGr", Scancode(false, true, KEY_ALTGR)));
+	std::shared_ptr<const KeyboardSpec> spec = std::make_shared<KeyboardSpec>(L"Bench", layers, modifiers, 0, nullptr, pool);
+	for (size_t l = 0; l < layers.size(); l++)
+		spec->buildLayer(l);
+	return spec;
+}
+
+
+// Loads every keyboard one way in this process; prints a row of the table.
+static void Load(size_t keyboardCount, bool interned)
+{
+	long residentBefore = ResidentKiB();
+	CommandPool* pool = new CommandPool();
+	std::vector<std::shared_ptr<const KeyboardSpec>> specs;
+	for (size_t k = 0; k < keyboardCount; k++)
+		specs.push_back(MakeSpec(pool, interned, k % LAYOUT_COUNT));
+	long resident = ResidentKiB() - residentBefore;
+	CommandPool::Stats stats = pool->getStats();
+
+	// Then again, timed, with the memory of the first load still taken
+	const size_t REPEATS = 20;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < REPEATS; i++)
+	{
+		CommandPool timedPool;
+		std::vector<std::shared_ptr<const KeyboardSpec>> timedSpecs;
+		for (size_t k = 0; k < keyboardCount; k++)
+			timedSpecs.push_back(MakeSpec(&timedPool, interned, k % LAYOUT_COUNT));
+	}
+	double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / REPEATS;
+
+	printf("  %-12s  %10zu  %10zu  %12zu  %10.2f  %10ld\n", interned ? "interned" : "new each", stats.requested,
+		stats.created, pool->getMemoryUsage(), milliseconds, resident);
+}
+
+
+int main(int argc, char* argv[])
+{
+	int keyboardCount = argc > 1 ? atoi(argv[1]) : 20;
+	if (keyboardCount <= 0)
+		keyboardCount = 20;
+
+	printf("%d keyboards, from %zu layouts of %zu layers of %zu keys; loading in ms, resident in KiB:\n",
+		keyboardCount, LAYOUT_COUNT, LAYER_COUNT, KEY_COUNT);
+	printf("  %-12s  %10s  %10s  %12s  %10s  %10s\n", "commands", "requested", "created", "pool bytes", "load", "resident");
+	const bool modes[] = { false, true };
+	for (size_t i = 0; i < 2; i++)
+	{
+		// A process each, so that one's memory isn't reused by the next
+		fflush(stdout);
+		pid_t child = fork();
+		if (child == 0)
+		{
+			Load((size_t)keyboardCount, modes[i]);
+			fflush(stdout);
+			_exit(0);
+		}
+		if (child > 0)
+			waitpid(child, nullptr, 0);
+	}
+	return 0;
+}
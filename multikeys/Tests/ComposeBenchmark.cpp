@@ -0,0 +1,178 @@
+// Benchmark of compose sequences (Remapper/ComposeTable.h) with a full system table, imported from
+// an X11 Compose file (Remapper/XComposeImport.h). First loading it: how long importing and
+// compiling take, how many sequences and nodes there are, and how much memory the trie and its
+// outputs take, by its own count and by the memory resident after building it, in a process of
+// its own. Then following sequences of the table, a character at a time, picked at random, against
+// looking each prefix typed so far up in a std::map of the sequences, as a table without a trie would.
+// Not run by ctest; run it by hand:
+//		ComposeBenchmark [Compose file] [steps]
+
+#include "../Remapper/ComposeTable.h"
+#include "../Remapper/XComposeImport.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static const wchar_t DEFAULT_FILE[] = L"/usr/share/X11/locale/en_US.UTF-8/Compose";
+
+
+// Resident memory of this process, in KiB
+static long ResidentKiB()
+{
+	long pages = 0, resident = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm)
+	{
+		if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(statm);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+// Imports and compiles the file in this process; prints what it took.
+static void Load(const std::wstring& filename)
+{
+	long residentBefore = ResidentKiB();
+	Clock::time_point start = Clock::now();
+	std::vector<ComposeDefinition> definitions;
+	size_t skipped = 0;
+	ImportXCompose(filename, &definitions, &skipped);
+	Clock::time_point imported = Clock::now();
+	ComposeTable* table = new ComposeTable(definitions);
+	Clock::time_point compiled = Clock::now();
+	long resident = ResidentKiB() - residentBefore;
+	definitions.clear();
+	definitions.shrink_to_fit();
+
+	printf("  %-26s  %10zu lines skipped\n", "read", skipped);
+	printf("  %-26s  %10zu\n", "sequences", table->getSequenceCount());
+	printf("  %-26s  %10zu\n", "nodes", table->getStateCount());
+	printf("  %-26s  %10.1f ms\n", "importing", std::chrono::duration<double, std::milli>(imported - start).count());
+	printf("  %-26s  %10.1f ms\n", "compiling", std::chrono::duration<double, std::milli>(compiled - imported).count());
+	printf("  %-26s  %10zu bytes\n", "trie and outputs", table->getMemoryUsage());
+	printf("  %-26s  %10ld KiB\n", "resident, once loaded", resident);
+	delete table;
+}
+
+
+// Sequences of the table, in the order they'll be typed
+static std::vector<std::wstring> PickSequences(const std::vector<ComposeDefinition>& definitions, size_t steps)
+{
+	std::mt19937 random(11);
+	std::vector<std::wstring> sequences;
+	size_t total = 0;
+	while (total < steps)
+	{
+		sequences.push_back(definitions[random() % definitions.size()].sequence);
+		total += sequences.back().size();
+	}
+	return sequences;
+}
+
+// Types the sequences in the trie; returns nanoseconds per character.
+static double TimeTrie(const ComposeTable& table, const std::vector<std::wstring>& sequences, size_t* out_completed)
+{
+	size_t steps = 0, completed = 0;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < sequences.size(); i++)
+	{
+		ComposeTable::State state = ComposeTable::START;
+		for (size_t c = 0; c < sequences[i].size() && state != ComposeTable::NO_STATE; c++)
+		{
+			state = table.next(state, sequences[i][c]);
+			steps++;
+		}
+		if (state != ComposeTable::NO_STATE && table.isComplete(state))
+			completed++;
+	}
+	double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	*out_completed = completed;
+	return elapsed / steps;
+}
+
+// Types the sequences looking each prefix up in a map; returns nanoseconds per character.
+static double TimeMap(const std::map<std::wstring, std::wstring>& map, const std::vector<std::wstring>& sequences,
+	size_t* out_completed)
+{
+	size_t steps = 0, completed = 0;
+	std::wstring typed;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < sequences.size(); i++)
+	{
+		typed.clear();
+		for (size_t c = 0; c < sequences[i].size(); c++)
+		{
+			typed += sequences[i][c];
+			steps++;
+			// The first sequence not before what's typed begins with it, if any does
+			std::map<std::wstring, std::wstring>::const_iterator found = map.lower_bound(typed);
+			if (found == map.end() || found->first.compare(0, typed.size(), typed) != 0)
+				break;
+			if (found->first.size() == typed.size())
+			{
+				completed++;
+				break;
+			}
+		}
+	}
+	double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	*out_completed = completed;
+	return elapsed / steps;
+}
+
+
+int main(int argc, char* argv[])
+{
+	std::wstring filename = DEFAULT_FILE;
+	if (argc > 1)
+		filename = std::wstring(argv[1], argv[1] + strlen(argv[1]));
+	long steps = argc > 2 ? atol(argv[2]) : 10000000;
+	if (steps <= 0)
+		steps = 10000000;
+
+	std::vector<ComposeDefinition> definitions;
+	size_t skipped = 0;
+	if (!ImportXCompose(filename, &definitions, &skipped) || definitions.empty())
+	{
+		printf("No compose sequences read from %ls\n", filename.c_str());
+		return 1;
+	}
+
+	printf("Loading %ls, in a process of its own:\n", filename.c_str());
+	fflush(stdout);
+	pid_t child = fork();
+	if (child == 0)
+	{
+		Load(filename);
+		fflush(stdout);
+		_exit(0);
+	}
+	if (child > 0)
+		waitpid(child, nullptr, 0);
+
+	ComposeTable table(definitions);
+	std::map<std::wstring, std::wstring> map;
+	for (size_t i = 0; i < definitions.size(); i++)
+		map[definitions[i].sequence] = definitions[i].output;
+	std::vector<std::wstring> sequences = PickSequences(definitions, (size_t)steps);
+
+	size_t trieCompleted, mapCompleted;
+	double trieTime = TimeTrie(table, sequences, &trieCompleted);
+	double mapTime = TimeMap(map, sequences, &mapCompleted);
+	printf("\n%zu sequences typed, %ld characters or so; nanoseconds per character:\n", sequences.size(), steps);
+	printf("  %-26s  %10.1f  (%zu completed)\n", "trie", trieTime, trieCompleted);
+	printf("  %-26s  %10.1f  (%zu completed)\n", "map of the sequences", mapTime, mapCompleted);
+	return 0;
+}
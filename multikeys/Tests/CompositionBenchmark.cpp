@@ -0,0 +1,208 @@
+// Benchmark of dead keys composing by their combining mark (DeadKeyCommand::combiningMark and
+// Remapper/CanonicalComposition.h), against the same dead keys listing a replacement for each
+// letter they accent, as layouts did before. A layout of letters, with and without Shift, and
+// 12 accent dead keys; explicitly, each has a replacement for every letter that composes with
+// its mark, so that both type the same. Loading is everything done from the settings on:
+// creating the commands, compiling the spec and its layers; each way is loaded in a process of
+// its own, for the memory resident afterwards. Then typing each dead key with each letter.
+// Not run by ctest; run it by hand:
+//		CompositionBenchmark [keystrokes]
+
+#include "../Remapper/Keyboard.h"
+#include "../Remapper/CommandPool.h"
+#include "../Remapper/CanonicalComposition.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static const BYTE FIRST_KEY = 0x10;
+static const size_t LETTER_COUNT = 26;
+static const BYTE FIRST_DEAD_KEY = 0x3b;		// F1 to F12
+static const BYTE KEY_SHIFT = 0x2a;
+
+// Grave, acute, circumflex, tilde, macron, breve, dot above, diaeresis, ring, caron, cedilla, ogonek
+static const unsigned int MARKS[] = { 0x300, 0x301, 0x302, 0x303, 0x304, 0x306, 0x307, 0x308, 0x30a, 0x30c, 0x327, 0x328 };
+static const size_t MARK_COUNT = sizeof(MARKS) / sizeof(MARKS[0]);
+
+
+// Resident memory of this process, in KiB
+static long ResidentKiB()
+{
+	long pages = 0, resident = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm)
+	{
+		if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(statm);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+// The layout, its dead keys composing by their mark or by replacements; out_replacements counts those.
+static std::shared_ptr<const KeyboardSpec> MakeSpec(CommandPool* pool, bool explicitReplacements, size_t* out_replacements)
+{
+	*out_replacements = 0;
+	std::unordered_map<Scancode, BaseKeystrokeCommand*> plain, shifted;
+	for (size_t m = 0; m < MARK_COUNT; m++)
+	{
+		std::unordered_map<const UnicodeCommand*, UnicodeCommand*> replacements;
+		if (explicitReplacements)
+		{
+			for (size_t i = 0; i < sizeof(CANONICAL_PAIRS) / sizeof(CANONICAL_PAIRS[0]); i++)
+			{
+				const CanonicalPair& pair = CANONICAL_PAIRS[i];
+				if (pair.mark != MARKS[m] || !((pair.base >= L'a' && pair.base <= L'z') || (pair.base >= L'A' && pair.base <= L'Z')))
+					continue;
+				replacements[pool->internUnicode({ pair.base }, false)] = pool->internUnicode({ pair.composed }, true);
+				replacements[pool->internUnicode({ pair.base }, true)] = pool->internUnicode({ pair.composed }, true);
+			}
+			*out_replacements += replacements.size() / 2;
+		}
+		BaseKeystrokeCommand* deadKey = pool->adopt(new DeadKeyCommand({ MARKS[m] }, replacements, 0,
+			explicitReplacements ? 0 : MARKS[m]));
+		plain[Scancode((BYTE)(FIRST_DEAD_KEY + m))] = shifted[Scancode((BYTE)(FIRST_DEAD_KEY + m))] = deadKey;
+	}
+	for (size_t k = 0; k < LETTER_COUNT; k++)
+	{
+		plain[Scancode((BYTE)(FIRST_KEY + k))] = pool->internUnicode({ (unsigned int)(L'a' + k) }, false);
+		shifted[Scancode((BYTE)(FIRST_KEY + k))] = pool->internUnicode({ (unsigned int)(L'A' + k) }, false);
+	}
+	std::vector<std::shared_ptr<const Layer>> layers;
+	layers.push_back(std::make_shared<Layer>(std::vector<std::wstring>(), plain));
+	layers.push_back(std::make_shared<Layer>(std::vector<std::wstring>(1, L"Shift"), shifted));
+	std::vector<PModifier> modifiers(1, new SimpleModifier(L"Shift", Scancode(KEY_SHIFT)));
+	std::shared_ptr<const KeyboardSpec> spec = std::make_shared<KeyboardSpec>(L"Bench", layers, modifiers, 0, nullptr, pool);
+	for (size_t i = 0; i < layers.size(); i++)
+		spec->buildLayer(i);
+	return spec;
+}
+
+
+// Loads the layout one way in this process; prints a row of the table.
+static void Load(bool explicitReplacements)
+{
+	const size_t REPEATS = 1000;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < REPEATS; i++)
+	{
+		CommandPool pool;
+		size_t replacements;
+		MakeSpec(&pool, explicitReplacements, &replacements);
+	}
+	double microseconds = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / REPEATS;
+
+	long residentBefore = ResidentKiB();
+	CommandPool* pool = new CommandPool();
+	size_t replacements;
+	std::shared_ptr<const KeyboardSpec> spec = MakeSpec(pool, explicitReplacements, &replacements);
+	printf("  %-14s  %12zu  %10zu  %10zu  %12zu  %10.1f  %10ld\n", explicitReplacements ? "replacements" : "mark",
+		replacements, pool->getStats().created, spec->getDeadKeyOutputCount(), pool->getMemoryUsage(),
+		microseconds, ResidentKiB() - residentBefore);
+}
+
+
+// Text of the press of an action
+static std::wstring TextOf(PKeystrokeCommand action)
+{
+	const INPUT* inputs = nullptr;
+	size_t count = 0;
+	if (!action || !static_cast<BaseKeystrokeCommand*>(action)->getInputs(false, false, &inputs, &count))
+		return std::wstring();
+	std::wstring text;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (inputs[i].ki.dwFlags & KEYEVENTF_UNICODE)
+			text += (wchar_t)inputs[i].ki.wScan;
+	}
+	return text;
+}
+
+// Types every dead key with every letter, small and capital, count times in all; returns
+// nanoseconds per pair, and the text of the first round in out_text.
+static double TimeTyping(bool explicitReplacements, size_t count, std::wstring* out_text)
+{
+	CommandPool pool;
+	size_t replacements;
+	std::shared_ptr<const KeyboardSpec> spec = MakeSpec(&pool, explicitReplacements, &replacements);
+	Keyboard keyboard(spec);
+	PKeystrokeCommand action;
+	bool repeated;
+	size_t round = MARK_COUNT * LETTER_COUNT * 2;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < count; i++)
+	{
+		Scancode deadKey((BYTE)(FIRST_DEAD_KEY + i % MARK_COUNT));
+		Scancode letter((BYTE)(FIRST_KEY + (i / MARK_COUNT) % LETTER_COUNT));
+		bool shift = (i / (MARK_COUNT * LETTER_COUNT)) % 2 == 1;
+		keyboard.evaluateKey(deadKey, 0, false, &action, &repeated);
+		keyboard.evaluateKey(deadKey, 0, true, &action, &repeated);
+		if (shift)
+			keyboard.evaluateKey(Scancode(KEY_SHIFT), 0, false, &action, &repeated);
+		bool remapped = keyboard.evaluateKey(letter, 0, false, &action, &repeated);
+		if (i < round)
+		{
+			PKeystrokeCommand deferred;
+			while (keyboard.takeDeferredAction(&deferred))
+				*out_text += TextOf(deferred);
+			if (remapped)
+				*out_text += TextOf(action);
+		}
+		else
+		{
+			while (keyboard.takeDeferredAction(&action))
+				;
+		}
+		keyboard.evaluateKey(letter, 0, true, &action, &repeated);
+		if (shift)
+			keyboard.evaluateKey(Scancode(KEY_SHIFT), 0, true, &action, &repeated);
+	}
+	return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / count;
+}
+
+
+int main(int argc, char* argv[])
+{
+	long count = argc > 1 ? atol(argv[1]) : 1000000;
+	if (count <= 0)
+		count = 1000000;
+
+	printf("%zu dead keys and %zu letters, small and capital; loading, in microseconds, and memory:\n",
+		MARK_COUNT, LETTER_COUNT);
+	printf("  %-14s  %12s  %10s  %10s  %12s  %10s  %10s\n", "dead keys by", "replacements", "commands",
+		"outputs", "pool bytes", "load", "KiB");
+	const bool modes[] = { true, false };
+	for (size_t i = 0; i < 2; i++)
+	{
+		// A process each, so that one's memory isn't reused by the next
+		fflush(stdout);
+		pid_t child = fork();
+		if (child == 0)
+		{
+			Load(modes[i]);
+			fflush(stdout);
+			_exit(0);
+		}
+		if (child > 0)
+			waitpid(child, nullptr, 0);
+	}
+
+	std::wstring explicitText, markText;
+	double explicitTime = TimeTyping(true, (size_t)count, &explicitText);
+	double markTime = TimeTyping(false, (size_t)count, &markText);
+	printf("\n%ld times a dead key and a letter; nanoseconds each:\n", count);
+	printf("  %-14s  %10.1f\n", "replacements", explicitTime);
+	printf("  %-14s  %10.1f\n", "mark", markTime);
+	if (explicitText != markText)
+		printf("They typed different text!\n");
+	return 0;
+}
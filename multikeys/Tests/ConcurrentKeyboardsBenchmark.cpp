@@ -0,0 +1,132 @@
+// Benchmark of keyboards evaluated by several threads at once (Remapper/Keyboard.h): 1 to 8
+// threads, each typing on a keyboard of its own, all sharing one spec. Each count is run twice:
+// with the keyboards evaluated freely, as they now are, and with every evaluation taking one
+// lock, as they had to when keyboards shared state. The total rate can only grow with the
+// threads up to the number of cores, which is printed first.
+// Not run by ctest; run it by hand:
+//		ConcurrentKeyboardsBenchmark [keystrokes per thread]
+
+#include "../Remapper/Keyboard.h"
+#include "../Remapper/CommandPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static const BYTE KEY_SHIFT = 0x2a;
+static const BYTE KEY_ACUTE = 0x1a;
+static const BYTE FIRST_KEY = 0x10;
+static const size_t KEY_COUNT = 26;
+
+
+// A plain layer and a shifted one, of letters, and an acute dead key in both
+static std::shared_ptr<const KeyboardSpec> MakeSpec(CommandPool* pool)
+{
+	BaseKeystrokeCommand* acute = pool->adopt(new DeadKeyCommand({ 0xb4 },
+		std::unordered_map<const UnicodeCommand*, UnicodeCommand*>(), 0, 0x301));
+	std::unordered_map<Scancode, BaseKeystrokeCommand*> plain, shifted;
+	for (size_t k = 0; k < KEY_COUNT; k++)
+	{
+		plain[Scancode((BYTE)(FIRST_KEY + k))] = pool->internUnicode(std::vector<unsigned int>(1, L'a' + k), false);
+		shifted[Scancode((BYTE)(FIRST_KEY + k))] = pool->internUnicode(std::vector<unsigned int>(1, L'A' + k), false);
+	}
+	plain[Scancode(KEY_ACUTE)] = acute;
+	shifted[Scancode(KEY_ACUTE)] = acute;
+
+	std::vector<std::shared_ptr<const Layer>> layers;
+	layers.push_back(std::make_shared<Layer>(std::vector<std::wstring>(), plain));
+	layers.push_back(std::make_shared<Layer>(std::vector<std::wstring>(1, L"Shift"), shifted));
+	std::vector<PModifier> modifiers(1, new SimpleModifier(L"Shift", Scancode(KEY_SHIFT)));
+	return std::make_shared<KeyboardSpec>(L"Bench", layers, modifiers, 0, nullptr, pool);
+}
+
+
+// Types count keystrokes: letters, a dead key every 8, Shift held every 16; returns what was
+// typed, so that none of it is optimized away.
+static size_t Type(Keyboard& keyboard, size_t count, std::mutex* lock)
+{
+	size_t typed = 0;
+	PKeystrokeCommand action;
+	bool repeated;
+	for (size_t i = 0; i < count; i++)
+	{
+		Scancode key((BYTE)(i % 8 == 7 ? KEY_ACUTE : FIRST_KEY + i % KEY_COUNT));
+		bool shift = i % 16 == 15;
+		if (lock)
+			lock->lock();
+		if (shift)
+			keyboard.evaluateKey(Scancode(KEY_SHIFT), 0, false, &action, &repeated);
+		typed += keyboard.evaluateKey(key, 0, false, &action, &repeated) ? 1 : 0;
+		keyboard.evaluateKey(key, 0, true, &action, &repeated);
+		if (shift)
+			keyboard.evaluateKey(Scancode(KEY_SHIFT), 0, true, &action, &repeated);
+		if (lock)
+			lock->unlock();
+	}
+	return typed;
+}
+
+
+// Runs threadCount threads typing count keystrokes each; returns millions of keystrokes a second.
+static double Run(const std::shared_ptr<const KeyboardSpec>& spec, size_t threadCount, size_t count, bool locked)
+{
+	std::mutex lock;
+	std::atomic<bool> start(false);
+	std::atomic<size_t> ready(0), typed(0);
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < threadCount; t++)
+	{
+		threads.push_back(std::thread([&]()
+		{
+			Keyboard keyboard(spec);
+			ready++;
+			while (!start.load())
+				std::this_thread::yield();
+			typed += Type(keyboard, count, locked ? &lock : nullptr);
+		}));
+	}
+	while (ready.load() < threadCount)
+		std::this_thread::yield();
+
+	Clock::time_point begin = Clock::now();
+	start = true;
+	for (size_t t = 0; t < threadCount; t++)
+		threads[t].join();
+	double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+	if (typed.load() == 0)
+		printf("Nothing typed\n");
+	return threadCount * count / seconds / 1e6;
+}
+
+
+int main(int argc, char* argv[])
+{
+	long count = argc > 1 ? atol(argv[1]) : 1000000;
+	if (count <= 0)
+		count = 1000000;
+
+	CommandPool pool;
+	std::shared_ptr<const KeyboardSpec> spec = MakeSpec(&pool);
+
+	printf("%u cores; %ld keystrokes per thread, in millions of keystrokes a second:\n",
+		std::thread::hardware_concurrency(), count);
+	printf("  %8s  %12s  %8s  %12s\n", "threads", "own state", "scaling", "one lock");
+	double single = 0;
+	const size_t threadCounts[] = { 1, 2, 4, 8 };
+	for (size_t i = 0; i < sizeof(threadCounts) / sizeof(threadCounts[0]); i++)
+	{
+		double free = Run(spec, threadCounts[i], (size_t)count, false);
+		double locked = Run(spec, threadCounts[i], (size_t)count, true);
+		if (i == 0)
+			single = free;
+		printf("  %8zu  %12.2f  %7.2fx  %12.2f\n", threadCounts[i], free, free / single, locked);
+	}
+	return 0;
+}
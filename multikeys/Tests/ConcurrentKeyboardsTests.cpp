@@ -0,0 +1,245 @@
+// Stress test of keyboards evaluated by several threads at once (Remapper/Keyboard.h): each thread
+// types a script of its own on a keyboard of its own, all of them sharing one spec, as the raw
+// input thread and the shards do with the keyboards of different devices. The spec's layers are
+// built on first activation, so threads race to build them and the outputs of their dead keys.
+// What each keyboard types must be exactly what it types when its script runs alone.
+
+#include "../Remapper/Keyboard.h"
+#include "../Remapper/KeystrokeCommands.h"
+#include "../Remapper/CommandPool.h"
+#include "TestHarness.h"
+
+#include <atomic>
+#include <random>
+#include <thread>
+
+using namespace Multikeys;
+
+
+static const size_t THREAD_COUNT = 8;
+static const size_t ROUND_COUNT = 200;	// Each with a new spec, whose layers are all unbuilt
+static const size_t EVENT_COUNT = 1000;		// Per thread and round
+
+static const size_t LAYER_COUNT = 8;
+static const size_t MODIFIER_COUNT = 3;		// Layer i is triggered by the modifiers of the bits of i
+static const BYTE FIRST_MODIFIER = 0x3b;	// F1 to F3
+static const BYTE FIRST_LETTER = 0x10;
+static const wchar_t LETTERS[] = L"aeoux";
+static const size_t LETTER_COUNT = 5;
+static const BYTE KEY_ACUTE = 0x1a;
+static const BYTE KEY_GRAVE = 0x1b;
+static const BYTE KEY_UNMAPPED = 0x2c;
+
+
+// Text typed by an action, as the characters of its keystrokes
+static std::wstring TextOf(PKeystrokeCommand action, bool repeated)
+{
+	const INPUT* inputs = nullptr;
+	size_t count = 0;
+	if (!action || !static_cast<BaseKeystrokeCommand*>(action)->getInputs(false, repeated, &inputs, &count))
+		return std::wstring();
+	std::wstring text;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (inputs[i].ki.dwFlags & KEYEVENTF_UNICODE)
+			text += (wchar_t)inputs[i].ki.wScan;
+	}
+	return text;
+}
+
+
+// A layer read when it's first activated, on whichever thread activates it: even layers type the
+// letters in lowercase, odd ones in uppercase; layers 2 and 3 have an acute dead key, the others
+// from 4 a grave one, and the first both.
+class StressLayerSource : public LayerSource
+{
+public:
+	StressLayerSource(size_t layer, CommandPool* pool, BaseKeystrokeCommand* acute, BaseKeystrokeCommand* grave,
+		std::atomic<int>* builds)
+		: layer(layer), pool(pool), acute(acute), grave(grave), builds(builds) { }
+
+	bool build(OUT std::unordered_map<Scancode, BaseKeystrokeCommand*> *const out_layout,
+		OUT std::vector<ChordDefinition> *const) const override
+	{
+		(*builds)++;
+		for (size_t k = 0; k < LETTER_COUNT; k++)
+		{
+			unsigned int letter = (layer & 1) ? towupper(LETTERS[k]) : LETTERS[k];
+			(*out_layout)[Scancode((BYTE)(FIRST_LETTER + k))] = pool->internUnicode(std::vector<unsigned int>(1, letter), false);
+			std::this_thread::yield();		// Gives other threads time to want the layer too
+		}
+		if (layer == 0 || layer == 2 || layer == 3)
+			(*out_layout)[Scancode(KEY_ACUTE)] = acute;
+		if (layer == 0 || layer >= 4)
+			(*out_layout)[Scancode(KEY_GRAVE)] = grave;
+		return true;
+	}
+
+	size_t getMemoryUsage() const override { return sizeof(*this); }
+
+private:
+	const size_t layer;
+	CommandPool* const pool;
+	BaseKeystrokeCommand* const acute;
+	BaseKeystrokeCommand* const grave;
+	std::atomic<int>* const builds;
+};
+
+
+// Builds a spec whose layers are all left until first activated; builds counts their readings.
+static std::shared_ptr<const KeyboardSpec> MakeSpec(CommandPool* pool, std::atomic<int>* builds)
+{
+	std::unordered_map<const UnicodeCommand*, UnicodeCommand*> replacements;
+	replacements[pool->internUnicode({ L'x' }, false)] = pool->internUnicode({ 0x1e8b }, true);
+	BaseKeystrokeCommand* acute = pool->adopt(new DeadKeyCommand({ 0xb4 }, replacements, 0, 0x301));
+	BaseKeystrokeCommand* grave = pool->adopt(new DeadKeyCommand({ L'`' },
+		std::unordered_map<const UnicodeCommand*, UnicodeCommand*>(), 0, 0x300));
+
+	std::vector<std::shared_ptr<const Layer>> layers;
+	for (size_t i = 0; i < LAYER_COUNT; i++)
+	{
+		std::vector<std::wstring> names;
+		for (size_t m = 0; m < MODIFIER_COUNT; m++)
+		{
+			if (i & (1 << m))
+				names.push_back(L"M" + std::to_wstring(m));
+		}
+		std::unique_ptr<const LayerSource> source(new StressLayerSource(i, pool, acute, grave, builds));
+		layers.push_back(std::make_shared<Layer>(names, std::move(source), false, 0));
+	}
+	std::vector<PModifier> modifiers;
+	for (size_t m = 0; m < MODIFIER_COUNT; m++)
+		modifiers.push_back(new SimpleModifier(L"M" + std::to_wstring(m), Scancode((BYTE)(FIRST_MODIFIER + m))));
+	return std::make_shared<KeyboardSpec>(L"Stress", layers, modifiers, 0, nullptr, pool);
+}
+
+
+struct Event
+{
+	BYTE makeCode;
+	bool keyUp;
+};
+
+// Random keystrokes: letters (some held long enough to repeat), dead keys, a key mapped nowhere,
+// and modifiers pressed and released in any order. Every key is released in the end.
+static std::vector<Event> MakeScript(unsigned int seed)
+{
+	std::mt19937 random(seed);
+	std::vector<Event> script;
+	bool held[MODIFIER_COUNT] = {};
+	while (script.size() < EVENT_COUNT)
+	{
+		unsigned int choice = random() % 16;
+		BYTE key;
+		if (choice < 3)
+		{
+			size_t m = random() % MODIFIER_COUNT;
+			script.push_back(Event{ (BYTE)(FIRST_MODIFIER + m), held[m] });
+			held[m] = !held[m];
+			continue;
+		}
+		else if (choice < 5)
+			key = KEY_ACUTE;
+		else if (choice < 7)
+			key = KEY_GRAVE;
+		else if (choice < 8)
+			key = KEY_UNMAPPED;
+		else
+			key = (BYTE)(FIRST_LETTER + random() % LETTER_COUNT);
+
+		script.push_back(Event{ key, false });
+		if (choice == 15)
+			script.push_back(Event{ key, false });		// Repeated
+		script.push_back(Event{ key, true });
+	}
+	for (size_t m = 0; m < MODIFIER_COUNT; m++)
+	{
+		if (held[m])
+			script.push_back(Event{ (BYTE)(FIRST_MODIFIER + m), true });
+	}
+	return script;
+}
+
+// Types a script; returns what its presses type, in the order it's sent, with '?' for keys let through.
+// interleave - whether to let other threads run after each keystroke, so that they take turns
+//		even on a single core.
+static std::wstring Run(Keyboard& keyboard, const std::vector<Event>& script, bool interleave)
+{
+	std::wstring text;
+	for (size_t i = 0; i < script.size(); i++)
+	{
+		PKeystrokeCommand action = nullptr;
+		bool repeated = false;
+		bool remapped = keyboard.evaluateKey(Scancode(script[i].makeCode), 0, script[i].keyUp, &action, &repeated);
+
+		// Deferred actions are executed before the action itself
+		PKeystrokeCommand deferred = nullptr;
+		while (keyboard.takeDeferredAction(&deferred))
+			text += TextOf(deferred, false);
+		if (interleave)
+			std::this_thread::yield();
+		if (script[i].keyUp)
+			continue;
+		if (remapped)
+			text += TextOf(action, repeated);
+		else
+			text += L'?';
+	}
+	return text;
+}
+
+
+static void TestConcurrentKeyboards()
+{
+	// What each script types alone, with a spec and a pool of its own
+	std::vector<std::vector<Event>> scripts;
+	std::vector<std::wstring> expected;
+	size_t expectedOutputs = 0;
+	for (size_t t = 0; t < THREAD_COUNT; t++)
+	{
+		scripts.push_back(MakeScript((unsigned int)t + 1));
+		CommandPool pool;
+		std::atomic<int> builds(0);
+		std::shared_ptr<const KeyboardSpec> spec = MakeSpec(&pool, &builds);
+		Keyboard keyboard(spec);
+		expected.push_back(Run(keyboard, scripts[t], false));
+		CHECK_EQUAL((int)LAYER_COUNT, builds.load());		// The scripts use every layer
+		expectedOutputs = spec->getDeadKeyOutputCount();
+	}
+
+	for (size_t round = 0; round < ROUND_COUNT; round++)
+	{
+		CommandPool pool;
+		std::atomic<int> builds(0);
+		std::shared_ptr<const KeyboardSpec> spec = MakeSpec(&pool, &builds);
+
+		std::atomic<bool> start(false);
+		std::vector<std::wstring> typed(THREAD_COUNT);
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < THREAD_COUNT; t++)
+		{
+			threads.push_back(std::thread([&, t]()
+			{
+				Keyboard keyboard(spec);
+				while (!start.load())
+					std::this_thread::yield();
+				typed[t] = Run(keyboard, scripts[t], true);
+			}));
+		}
+		start = true;
+		for (size_t t = 0; t < THREAD_COUNT; t++)
+			threads[t].join();
+
+		for (size_t t = 0; t < THREAD_COUNT; t++)
+			CHECK(typed[t] == expected[t]);
+		CHECK_EQUAL((int)LAYER_COUNT, builds.load());		// Each layer read once, by one of them
+		CHECK_EQUAL(expectedOutputs, spec->getDeadKeyOutputCount());
+	}
+}
+
+
+int main()
+{
+	TestConcurrentKeyboards();
+	return Tests::Result();
+}
@@ -0,0 +1,148 @@
+// Tests of the operational counters (MultikeysCore/Counters.h) and of CounterReader.
+//
+// A synthetic stream of pipeline events is replayed by several threads at once, the way the
+// raw input thread, the shards and the hook window count them in the core. The shared page
+// must then hold exactly what the stream implies, both as the core reads it and as another
+// process maps it.
+//	CountersTests <path of CounterReader>
+
+#include "../MultikeysCore/Counters.h"
+#include "TestHarness.h"
+
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace Multikeys;
+
+
+// What happened to a keystroke on its way through the core, as far as the counters are concerned
+enum SyntheticEvent
+{
+	PlainKeystroke,				// Nothing to count
+	HookTimedOut,
+	DecisionNeverMatched,
+	FakeShift,
+	PauseBreak,
+	PrintScreenKeyup,
+	SendInputFailed,
+	RawInputBufferGrew,
+	DeviceNameBufferGrew,
+	ClaimedByHook,
+	NewDevice,
+
+	SYNTHETIC_EVENT_COUNT
+};
+
+// Counter the core increments for each event; COUNTER_COUNT for none.
+static const Counters::Counter counterOf[SYNTHETIC_EVENT_COUNT] = {
+	Counters::COUNTER_COUNT,
+	Counters::HookTimeouts,
+	Counters::UnmatchedDecisions,
+	Counters::FakeShiftCorrections,
+	Counters::PauseBreakSpecialCases,
+	Counters::PrintScreenSpecialCases,
+	Counters::FailedCommands,
+	Counters::RawInputBufferRegrowths,
+	Counters::DeviceNameBufferRegrowths,
+	Counters::DecisionsClaimedByHook,
+	Counters::DeviceLookups
+};
+
+
+// Deterministic stream, mostly plain keystrokes like a real one
+static std::vector<SyntheticEvent> MakeStream(size_t length)
+{
+	std::vector<SyntheticEvent> stream;
+	unsigned int seed = 12345;
+	for (size_t i = 0; i < length; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		unsigned int roll = (seed >> 16) % 64;
+		stream.push_back(roll < SYNTHETIC_EVENT_COUNT ? (SyntheticEvent)roll : PlainKeystroke);
+	}
+	return stream;
+}
+
+
+// Counts the events from begin to end, taking one of every step
+static void Replay(const std::vector<SyntheticEvent>& stream, size_t begin, size_t end, size_t step)
+{
+	for (size_t i = begin; i < end; i += step)
+	{
+		if (counterOf[stream[i]] != Counters::COUNTER_COUNT)
+			Counters::Increment(counterOf[stream[i]]);
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	const size_t THREAD_COUNT = 4;
+	std::vector<SyntheticEvent> stream = MakeStream(400000);
+
+	uint64_t expected[Counters::COUNTER_COUNT] = { };
+	for (size_t i = 0; i < stream.size(); i++)
+	{
+		if (counterOf[stream[i]] != Counters::COUNTER_COUNT)
+			expected[counterOf[stream[i]]]++;
+	}
+
+	// Counted privately before the page exists, which must carry those over
+	Replay(stream, 0, 1000, 1);
+	CHECK(Counters::Initialize());
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < THREAD_COUNT; t++)
+		threads.push_back(std::thread(Replay, std::cref(stream), 1000 + t, stream.size(), THREAD_COUNT));
+	for (size_t t = 0; t < THREAD_COUNT; t++)
+		threads[t].join();
+
+	for (int i = 0; i < Counters::COUNTER_COUNT; i++)
+		CHECK_EQUAL(expected[i], Counters::Read((Counters::Counter)i));
+
+	// As another process sees it
+	int descriptor = shm_open(Counters::SHARED_PAGE_NAME, O_RDONLY, 0);
+	CHECK(descriptor >= 0);
+	if (descriptor >= 0)
+	{
+		void* mapped = mmap(nullptr, sizeof(Counters::CounterPage), PROT_READ, MAP_SHARED, descriptor, 0);
+		close(descriptor);
+		CHECK(mapped != MAP_FAILED);
+		if (mapped != MAP_FAILED)
+		{
+			const Counters::CounterPage* page = (const Counters::CounterPage*)mapped;
+			CHECK_EQUAL(Counters::LAYOUT_VERSION, page->version);
+			CHECK_EQUAL(Counters::COUNTER_COUNT, page->counterCount);
+			for (int i = 0; i < Counters::COUNTER_COUNT; i++)
+				CHECK_EQUAL(expected[i], page->counters[i].value.load());
+			munmap(mapped, sizeof(Counters::CounterPage));
+		}
+	}
+
+	// The reader finds the page while it exists, and fails once it's gone
+	if (argc > 1)
+	{
+		std::string command = std::string("\"") + argv[1] + "\" > /dev/null";
+		int status = system(command.c_str());
+		CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+		Counters::Release();
+		status = system((command + " 2>&1").c_str());
+		CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 1);
+	}
+	else
+		Counters::Release();
+
+	// Counting goes on after Release, into the same page
+	Counters::Increment(Counters::HookTimeouts);
+	CHECK_EQUAL(expected[Counters::HookTimeouts] + 1, Counters::Read(Counters::HookTimeouts));
+
+	return Tests::Result();
+}
@@ -0,0 +1,192 @@
+// Benchmark of the shared decision table (KeyboardHook/DecisionTable.h) across processes.
+// A core process publishes decisions and a hook process claims them, one keystroke at a time;
+// the time from publishing to claiming is compared with a round trip through a pair of pipes,
+// which stands for the SendMessage the hook falls back to. Also measures publishing and
+// claiming within one process, to show their cost apart from the handoff.
+// Not run by ctest; run it by hand:
+//		DecisionTableBenchmark [keystrokes]
+
+#include "../KeyboardHook/DecisionTable.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+
+typedef std::chrono::steady_clock Clock;
+
+
+// Monotonic time in nanoseconds; the same clock in every process
+static long long Now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+
+static void PrintLatencies(const char* name, std::vector<long long>& latencies)
+{
+	std::sort(latencies.begin(), latencies.end());
+	long long total = 0;
+	for (size_t i = 0; i < latencies.size(); i++)
+		total += latencies[i];
+	size_t count = latencies.size();
+	printf("  %-22s mean %8.2f   p50 %8.2f   p99 %8.2f   max %10.2f\n", name,
+		total / 1000.0 / count,
+		latencies[count / 2] / 1000.0,
+		latencies[count * 99 / 100] / 1000.0,
+		latencies[count - 1] / 1000.0);
+}
+
+
+// Shared by the two processes of the handoff
+struct Handoff
+{
+	std::atomic<long long> publishTime;		// When the decision being waited for was published
+	std::atomic<unsigned int> claimed;		// Decisions the hook has claimed
+};
+
+
+// Time from publishing a decision in one process until another process claims it.
+static void MeasureTable(int keystrokes)
+{
+	Handoff* handoff = (Handoff*)mmap(nullptr, sizeof(Handoff), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	long long* latencies = (long long*)mmap(nullptr, keystrokes * sizeof(long long), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	DecisionTable* table = DecisionTableCreate();
+	if (handoff == MAP_FAILED || latencies == MAP_FAILED || table == nullptr)
+	{
+		printf("The decision table could not be created\n");
+		return;
+	}
+
+	pid_t hook = fork();
+	if (hook == 0)
+	{
+		DecisionTable* hookTable = DecisionTableOpen();
+		for (int i = 0; hookTable != nullptr && i < keystrokes; i++)
+		{
+			BOOL block;
+			LONG64 key = DecisionTableKey(i & 0xff, (i >> 8) & 0xff, FALSE, FALSE);
+			while (!DecisionTableClaim(hookTable, key, &block))
+				std::this_thread::yield();
+			latencies[i] = Now() - handoff->publishTime.load();
+			handoff->claimed.store(i + 1);
+		}
+		_exit(0);
+	}
+
+	for (int i = 0; i < keystrokes; i++)
+	{
+		LONG slot;
+		LONG64 word;
+		handoff->publishTime.store(Now());
+		DecisionTablePublish(table, DecisionTableKey(i & 0xff, (i >> 8) & 0xff, FALSE, FALSE), TRUE, &slot, &word);
+		while (handoff->claimed.load() <= (unsigned int)i)
+			std::this_thread::yield();
+	}
+	waitpid(hook, nullptr, 0);
+
+	std::vector<long long> sorted(latencies, latencies + keystrokes);
+	PrintLatencies("Decision table", sorted);
+
+	DecisionTableDestroy(table);
+	munmap(latencies, keystrokes * sizeof(long long));
+	munmap(handoff, sizeof(Handoff));
+}
+
+
+// Round trip of a keystroke to another process and back through pipes, as the hook's message would be.
+static void MeasureRoundTrip(int keystrokes)
+{
+	int requests[2], replies[2];
+	if (pipe(requests) != 0 || pipe(replies) != 0)
+	{
+		printf("Pipes could not be created\n");
+		return;
+	}
+
+	pid_t core = fork();
+	if (core == 0)
+	{
+		// Only the ends it uses; otherwise it would never see the requests end
+		close(requests[1]);
+		close(replies[0]);
+		long long key;
+		while (read(requests[0], &key, sizeof(key)) == sizeof(key))
+		{
+			BOOL block = TRUE;
+			if (write(replies[1], &block, sizeof(block)) != sizeof(block))
+				break;
+		}
+		_exit(0);
+	}
+	close(requests[0]);
+	close(replies[1]);
+
+	std::vector<long long> latencies(keystrokes);
+	for (int i = 0; i < keystrokes; i++)
+	{
+		long long key = i;
+		BOOL block;
+		long long start = Now();
+		if (write(requests[1], &key, sizeof(key)) != sizeof(key) || read(replies[0], &block, sizeof(block)) != sizeof(block))
+		{
+			printf("The round trip failed\n");
+			latencies.resize(i > 0 ? i : 1);
+			break;
+		}
+		latencies[i] = Now() - start;
+	}
+	close(requests[1]);
+	waitpid(core, nullptr, 0);
+	close(replies[0]);
+
+	PrintLatencies("Message round trip", latencies);
+}
+
+
+// Publishing and claiming in the same process: the cost of the operations themselves.
+static void MeasureOperations(int keystrokes)
+{
+	DecisionTable* table = DecisionTableCreate();
+	if (table == nullptr)
+		return;
+
+	const int rounds = 20;
+	long long start = Now();
+	int claimed = 0;
+	for (int i = 0; i < keystrokes * rounds; i++)
+	{
+		LONG slot;
+		LONG64 word;
+		BOOL block;
+		LONG64 key = DecisionTableKey(i & 0xff, (i >> 8) & 0xff, FALSE, FALSE);
+		DecisionTablePublish(table, key, TRUE, &slot, &word);
+		claimed += DecisionTableClaim(table, key, &block) ? 1 : 0;
+	}
+	long long elapsed = Now() - start;
+	printf("  %-22s %.1f ns per publish and claim (%d claimed)\n", "Same process",
+		(double)elapsed / ((long long)keystrokes * rounds), claimed);
+
+	DecisionTableDestroy(table);
+}
+
+
+int main(int argc, char* argv[])
+{
+	int keystrokes = argc > 1 ? atoi(argv[1]) : 100000;
+	if (keystrokes <= 0)
+		keystrokes = 100000;
+
+	printf("%d keystrokes, from the core deciding to the hook knowing, in microseconds:\n", keystrokes);
+	MeasureTable(keystrokes);
+	MeasureRoundTrip(keystrokes);
+	MeasureOperations(keystrokes);
+	return 0;
+}
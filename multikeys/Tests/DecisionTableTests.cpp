@@ -0,0 +1,228 @@
+// Tests of the shared decision table (KeyboardHook/DecisionTable.h), through its POSIX
+// shared memory implementation.
+//
+// Besides the rules of a single table (keys, order, age, slot reuse), a core and a hook are
+// run as two processes sharing the table by name, as they do on Windows: the core publishes
+// decisions, and retires those the hook takes too long to claim, like the hook window does
+// when the hook falls back to its message; the hook claims them. Every decision must be
+// taken exactly once, by one side or the other, and the hook must get it intact.
+
+#include "../KeyboardHook/DecisionTable.h"
+#include "TestHarness.h"
+
+#include <atomic>
+#include <deque>
+#include <thread>
+
+#include <sys/wait.h>
+
+using namespace Multikeys;
+
+
+// Keys of the decisions published in the test across processes; unique among those in the table
+static LONG64 KeyOf(unsigned int decision)
+{
+	return DecisionTableKey(decision & 0xff, (decision >> 8) & 0xff, (decision >> 16) & 1, (decision >> 17) & 1);
+}
+
+
+static void TestClaim()
+{
+	DecisionTable* table = DecisionTableCreate();
+	CHECK(table != nullptr);
+	if (table == nullptr)
+		return;
+
+	LONG slot;
+	LONG64 word;
+	BOOL block = FALSE;
+	LONG64 keyA = DecisionTableKey(0x41, 0x1e, FALSE, FALSE);
+	LONG64 keyAUp = DecisionTableKey(0x41, 0x1e, FALSE, TRUE);
+
+	// Only the matching key is claimed, and only once
+	DecisionTablePublish(table, keyA, TRUE, &slot, &word);
+	CHECK(!DecisionTableClaim(table, keyAUp, &block));
+	CHECK(DecisionTableClaim(table, keyA, &block));
+	CHECK(block);
+	CHECK(!DecisionTableClaim(table, keyA, &block));
+	CHECK(!DecisionTableRetire(table, slot, word));		// The hook took it
+
+	// The oldest decision for a key is claimed first
+	LONG firstSlot, secondSlot;
+	LONG64 firstWord, secondWord;
+	DecisionTablePublish(table, keyA, FALSE, &firstSlot, &firstWord);
+	DecisionTablePublish(table, keyA, TRUE, &secondSlot, &secondWord);
+	CHECK(DecisionTableClaim(table, keyA, &block));
+	CHECK(!block);
+	CHECK(DecisionTableRetire(table, secondSlot, secondWord));		// The core takes the other one back
+	CHECK(!DecisionTableClaim(table, keyA, &block));
+
+	// Stale decisions are left alone
+	DecisionTablePublish(table, keyA, TRUE, &slot, &word);
+	table->entries[slot].publishTime = GetTickCount() - DECISION_TABLE_MAX_AGE - 1;
+	CHECK(!DecisionTableClaim(table, keyA, &block));
+	CHECK(DecisionTableRetire(table, slot, word));
+
+	// Once the slot is reused, the old word can't be retired
+	DecisionTablePublish(table, keyA, TRUE, &slot, &word);
+	LONG reusedSlot;
+	LONG64 reusedWord;
+	for (int i = 0; i < DECISION_TABLE_SIZE; i++)
+		DecisionTablePublish(table, keyAUp, FALSE, &reusedSlot, &reusedWord);
+	CHECK_EQUAL(slot, reusedSlot);
+	CHECK(!DecisionTableRetire(table, slot, word));
+	CHECK(!DecisionTableClaim(table, keyA, &block));
+
+	// Nothing is claimed while the core isn't publishing, or has another layout
+	DecisionTablePublish(table, keyA, TRUE, &slot, &word);
+	table->active = 0;
+	CHECK(!DecisionTableClaim(table, keyA, &block));
+	table->active = 1;
+	table->version = DECISION_TABLE_VERSION + 1;
+	CHECK(!DecisionTableClaim(table, keyA, &block));
+	table->version = DECISION_TABLE_VERSION;
+	CHECK(DecisionTableClaim(table, keyA, &block));
+
+	DecisionTableDestroy(table);
+	CHECK(DecisionTableOpen() == nullptr);		// Gone with the core
+}
+
+
+// What happened to each decision; shared by the two processes, apart from the table
+struct Outcomes
+{
+	static const unsigned int COUNT = 100000;
+
+	std::atomic<unsigned int> hookProgress;		// Decisions the hook is done with
+	std::atomic<unsigned char> claimed[COUNT];	// 1 if the hook claimed it, 2 if it also got the wrong decision
+	std::atomic<unsigned char> retired[COUNT];	// 1 if the core retired it
+};
+
+
+// The hook's side: claims every decision in order, unless the core retires it first.
+static int RunHook(Outcomes* outcomes)
+{
+	DecisionTable* table = DecisionTableOpen();
+	if (table == nullptr)
+		return 1;
+
+	for (unsigned int decision = 0; decision < Outcomes::COUNT; decision++)
+	{
+		BOOL block;
+		while (!DecisionTableClaim(table, KeyOf(decision), &block))
+		{
+			if (outcomes->retired[decision].load())
+				break;
+			std::this_thread::yield();
+		}
+		if (!outcomes->retired[decision].load())
+			outcomes->claimed[decision] = (block == (decision % 2 == 0)) ? 1 : 2;
+		outcomes->hookProgress.store(decision + 1);
+	}
+	munmap(table, sizeof(DecisionTable));
+	return 0;
+}
+
+
+static void TestAcrossProcesses()
+{
+	Outcomes* outcomes = (Outcomes*)mmap(nullptr, sizeof(Outcomes), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);		// Zero-filled
+	DecisionTable* table = DecisionTableCreate();
+	CHECK(outcomes != MAP_FAILED && table != nullptr);
+	if (outcomes == MAP_FAILED || table == nullptr)
+		return;
+
+	pid_t hook = fork();
+	if (hook == 0)
+		_exit(RunHook(outcomes));
+
+	// Published and not yet known to be done with, oldest first
+	struct Pending
+	{
+		unsigned int decision;
+		LONG slot;
+		LONG64 word;
+		DWORD publishTime;
+	};
+	std::deque<Pending> pending;
+
+	// Retires a decision, as the hook window does before acting on its record
+	auto retire = [&](const Pending& published)
+	{
+		if (DecisionTableRetire(table, published.slot, published.word))
+			outcomes->retired[published.decision] = 1;
+	};
+
+	for (unsigned int decision = 0; decision < Outcomes::COUNT; decision++)
+	{
+		// Keep well within the table, so that slots are only reused once the hook is done with them
+		while (decision - outcomes->hookProgress.load() >= DECISION_TABLE_SIZE / 2)
+		{
+			while (!pending.empty() && pending.front().decision < outcomes->hookProgress.load())
+				pending.pop_front();
+			// The hook is slow (or descheduled); take back what it hasn't claimed in a while
+			if (!pending.empty() && GetTickCount() - pending.front().publishTime > DECISION_TABLE_MAX_AGE / 2)
+			{
+				retire(pending.front());
+				pending.pop_front();
+			}
+			std::this_thread::yield();
+		}
+
+		Pending published;
+		published.decision = decision;
+		published.publishTime = GetTickCount();
+		DecisionTablePublish(table, KeyOf(decision), decision % 2 == 0, &published.slot, &published.word);
+
+		// Now and then, race the hook for it right away
+		if (decision % 7 == 0)
+			retire(published);
+		else
+			pending.push_back(published);
+	}
+
+	// Whatever the hook hasn't got to yet goes back to the core when it's too old
+	while (outcomes->hookProgress.load() < Outcomes::COUNT)
+	{
+		while (!pending.empty() && pending.front().decision < outcomes->hookProgress.load())
+			pending.pop_front();
+		if (!pending.empty() && GetTickCount() - pending.front().publishTime > DECISION_TABLE_MAX_AGE / 2)
+		{
+			retire(pending.front());
+			pending.pop_front();
+		}
+		std::this_thread::yield();
+	}
+
+	int status = -1;
+	waitpid(hook, &status, 0);
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	unsigned int exactlyOnce = 0, byHook = 0, intact = 0;
+	for (unsigned int decision = 0; decision < Outcomes::COUNT; decision++)
+	{
+		bool claimed = outcomes->claimed[decision].load() != 0;
+		bool retired = outcomes->retired[decision].load() != 0;
+		if (claimed != retired)
+			exactlyOnce++;
+		if (claimed)
+			byHook++;
+		if (outcomes->claimed[decision].load() != 2)
+			intact++;
+	}
+	CHECK_EQUAL(Outcomes::COUNT, exactlyOnce);
+	CHECK_EQUAL(Outcomes::COUNT, intact);
+	CHECK(byHook > 0);		// The hook did get to claim some
+
+	DecisionTableDestroy(table);
+	munmap(outcomes, sizeof(Outcomes));
+}
+
+
+int main()
+{
+	TestClaim();
+	TestAcrossProcesses();
+	return Tests::Result();
+}
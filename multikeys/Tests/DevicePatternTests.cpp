@@ -0,0 +1,159 @@
+// Tests of device patterns (Remapper/DevicePattern.h): the identity read from the names Raw Input
+// gives USB, Bluetooth and PS/2 keyboards, the patterns read from the texts of their fields, and
+// which identities those patterns match.
+
+#include "../Remapper/DevicePattern.h"
+#include "TestHarness.h"
+
+using namespace Multikeys;
+
+
+// A wireless receiver's keyboard, a composite USB device
+static const wchar_t* const USB_NAME =
+	L"\\\\?\\HID#VID_046D&PID_C52B&MI_00&Col01#8&16c55830&0&0000#{884b96c3-56ef-11d1-bc8c-00a0c91405dd}";
+
+// A classic Bluetooth keyboard: a source (0002) before the vendor ID, and '&' instead of '_'
+static const wchar_t* const BLUETOOTH_NAME =
+	L"\\\\?\\HID#{00001124-0000-1000-8000-00805f9b34fb}_VID&0002046d_PID&b342&Col01#"
+	L"9&2f3b8a6e&0&0000#{884b96c3-56ef-11d1-bc8c-00a0c91405dd}";
+
+// A Bluetooth Low Energy keyboard: a shorter source (02)
+static const wchar_t* const BLUETOOTH_LE_NAME =
+	L"\\\\?\\HID#{00001812-0000-1000-8000-00805f9b34fb}_Dev_VID&02046d_PID&b35b_REV&0010_d5a8c1f2e3b4&Col01#"
+	L"a&1c2d3e4f&0&0000#{884b96c3-56ef-11d1-bc8c-00a0c91405dd}";
+
+// A laptop's built-in keyboard, with no IDs at all
+static const wchar_t* const PS2_NAME =
+	L"\\\\?\\ACPI#PNP0303#4&1d401fb5&0#{884b96c3-56ef-11d1-bc8c-00a0c91405dd}";
+
+
+static void TestParseDeviceName()
+{
+	DeviceIdentity usb = ParseDeviceName(USB_NAME);
+	CHECK_EQUAL(0x046D, usb.vendorId);
+	CHECK_EQUAL(0xC52B, usb.productId);
+	CHECK_EQUAL(0, usb.interfaceNumber);
+	CHECK(usb.instance == L"8&16C55830&0&0000");
+
+	DeviceIdentity bluetooth = ParseDeviceName(BLUETOOTH_NAME);
+	CHECK_EQUAL(0x046D, bluetooth.vendorId);
+	CHECK_EQUAL(0xB342, bluetooth.productId);
+	CHECK_EQUAL(-1, bluetooth.interfaceNumber);
+	CHECK(bluetooth.instance == L"9&2F3B8A6E&0&0000");
+
+	DeviceIdentity bluetoothLE = ParseDeviceName(BLUETOOTH_LE_NAME);
+	CHECK_EQUAL(0x046D, bluetoothLE.vendorId);
+	CHECK_EQUAL(0xB35B, bluetoothLE.productId);
+	CHECK_EQUAL(-1, bluetoothLE.interfaceNumber);
+	CHECK(bluetoothLE.instance == L"A&1C2D3E4F&0&0000");
+
+	DeviceIdentity ps2 = ParseDeviceName(PS2_NAME);
+	CHECK_EQUAL(-1, ps2.vendorId);
+	CHECK_EQUAL(-1, ps2.productId);
+	CHECK_EQUAL(-1, ps2.interfaceNumber);
+	CHECK(ps2.instance == L"4&1D401FB5&0");
+
+	// Hexadecimal digits in the instance ID aren't taken for IDs
+	DeviceIdentity noIds = ParseDeviceName(L"\\\\?\\HID#KEYBOARD#VID_1234&PID_5678#{00}");
+	CHECK_EQUAL(-1, noIds.vendorId);
+	CHECK_EQUAL(-1, noIds.productId);
+	CHECK(noIds.instance == L"VID_1234&PID_5678");
+
+	// Names not in the usual form are searched whole, and have no instance
+	DeviceIdentity bare = ParseDeviceName(L"vid_abcd&pid_0001&mi_02");
+	CHECK_EQUAL(0xABCD, bare.vendorId);
+	CHECK_EQUAL(0x0001, bare.productId);
+	CHECK_EQUAL(2, bare.interfaceNumber);
+	CHECK(bare.instance.empty());
+
+	// A marker with no digits after it is no ID
+	DeviceIdentity empty = ParseDeviceName(L"\\\\?\\HID#VID_&PID_XYZ#1#{00}");
+	CHECK_EQUAL(-1, empty.vendorId);
+	CHECK_EQUAL(-1, empty.productId);
+}
+
+
+static void TestParsePattern()
+{
+	DevicePattern pattern;
+	CHECK(pattern.isEmpty());
+
+	CHECK(DevicePattern::parse(L"", L"", L"", L"", &pattern));
+	CHECK(pattern.isEmpty());
+
+	CHECK(DevicePattern::parse(L"046d", L"", L"", L"", &pattern));
+	CHECK(!pattern.isEmpty());
+	CHECK(DevicePattern::parse(L"", L"", L"", L"*", &pattern));
+	CHECK(!pattern.isEmpty());		// Any instance; still a pattern, unlike no fields at all
+
+	// IDs must be 16-bit hexadecimal numbers
+	CHECK(DevicePattern::parse(L"FFFF", L"0", L"00", L"", &pattern));
+	CHECK(!DevicePattern::parse(L"10000", L"", L"", L"", &pattern));
+	CHECK(!DevicePattern::parse(L"", L"C52G", L"", L"", &pattern));
+	CHECK(!DevicePattern::parse(L"", L"", L"0x1", L"", &pattern));
+	CHECK(!DevicePattern::parse(L"", L"", L"-1", L"", &pattern));
+
+	// A pattern that failed to parse is left alone
+	DevicePattern kept;
+	CHECK(DevicePattern::parse(L"046D", L"", L"", L"", &kept));
+	CHECK(!DevicePattern::parse(L"046D", L"nope", L"", L"", &kept));
+	CHECK(!kept.isEmpty());
+}
+
+
+static void TestMatches()
+{
+	DeviceIdentity usb = ParseDeviceName(USB_NAME);
+	DeviceIdentity bluetooth = ParseDeviceName(BLUETOOTH_NAME);
+	DeviceIdentity ps2 = ParseDeviceName(PS2_NAME);
+	DevicePattern pattern;
+
+	// Without fields, anything matches
+	CHECK(pattern.matches(usb));
+	CHECK(pattern.matches(ps2));
+
+	// By vendor, whatever the connection; IDs are compared as numbers
+	CHECK(DevicePattern::parse(L"46d", L"", L"", L"", &pattern));
+	CHECK(pattern.matches(usb));
+	CHECK(pattern.matches(bluetooth));
+	CHECK(!pattern.matches(ps2));
+
+	// Every field given must match
+	CHECK(DevicePattern::parse(L"046D", L"C52B", L"", L"", &pattern));
+	CHECK(pattern.matches(usb));
+	CHECK(!pattern.matches(bluetooth));
+	CHECK(DevicePattern::parse(L"046D", L"C52B", L"01", L"", &pattern));
+	CHECK(!pattern.matches(usb));
+	CHECK(DevicePattern::parse(L"", L"", L"0", L"", &pattern));
+	CHECK(pattern.matches(usb));
+	CHECK(!pattern.matches(bluetooth));		// Not a composite device
+
+	// Instances, ignoring case: whole, or by prefix
+	CHECK(DevicePattern::parse(L"", L"", L"", L"8&16c55830&0&0000", &pattern));
+	CHECK(pattern.matches(usb));
+	CHECK(!pattern.matches(bluetooth));
+	CHECK(DevicePattern::parse(L"", L"", L"", L"8&16C55830", &pattern));
+	CHECK(!pattern.matches(usb));			// Not the whole instance
+	CHECK(DevicePattern::parse(L"", L"", L"", L"8&16c55830*", &pattern));
+	CHECK(pattern.matches(usb));
+	CHECK(!pattern.matches(ps2));
+	CHECK(DevicePattern::parse(L"", L"", L"", L"4&1D401FB5&0&0000*", &pattern));
+	CHECK(!pattern.matches(ps2));			// Longer than the instance
+	CHECK(DevicePattern::parse(L"", L"", L"", L"*", &pattern));
+	CHECK(pattern.matches(ps2));
+	CHECK(pattern.matches(ParseDeviceName(L"VID_0001")));		// Even with no instance
+
+	// The built-in keyboard, found by its instance alone
+	CHECK(DevicePattern::parse(L"", L"", L"", L"4&1d401fb5&0", &pattern));
+	CHECK(pattern.matches(ps2));
+	CHECK(!pattern.matches(usb));
+}
+
+
+int main()
+{
+	TestParseDeviceName();
+	TestParsePattern();
+	TestMatches();
+	return Tests::Result();
+}
@@ -0,0 +1,226 @@
+// Benchmark of text expansions (Remapper/ExpansionAutomaton.h) with up to 10,000 triggers, each
+// a semicolon and 3 to 8 letters replaced by a paragraph. First the automaton alone: how long it
+// takes to build, its size, the bytes of its transition table, and how much memory it and its
+// commands take, by its own count and by the memory resident after building it, in a process
+// of its own. Then following text typed a character at a time, against looking every end of the
+// text typed so far up in a hash set of the triggers. Then whole keystrokes evaluated by a
+// keyboard, with no expansions and with them.
+// Not run by ctest; run it by hand:
+//		ExpansionsBenchmark [characters]
+
+#include "../Remapper/Keyboard.h"
+#include "../Remapper/CommandPool.h"
+#include "../Remapper/ExpansionAutomaton.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <unordered_set>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static const BYTE FIRST_KEY = 0x10;
+static const size_t KEY_COUNT = 26;
+static const BYTE KEY_SEMICOLON = 0x27;
+static const size_t MAX_TRIGGER = 9;
+
+
+// Resident memory of this process, in KiB
+static long ResidentKiB()
+{
+	long pages = 0, resident = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm)
+	{
+		if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(statm);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+// Different triggers, with replacements of about 200 characters
+static std::vector<ExpansionDefinition> MakeDefinitions(size_t count)
+{
+	std::mt19937 random(3);
+	std::unordered_set<std::wstring> triggers;
+	std::vector<ExpansionDefinition> definitions;
+	while (definitions.size() < count)
+	{
+		std::wstring trigger = L";";
+		size_t length = 3 + random() % 6;
+		for (size_t i = 0; i < length; i++)
+			trigger += (wchar_t)(L'a' + random() % KEY_COUNT);
+		if (!triggers.insert(trigger).second)
+			continue;
+		std::wstring replacement = L"Expansion of " + trigger + L": ";
+		while (replacement.size() < 200)
+			replacement += L"the quick brown fox jumps over the lazy dog. ";
+		definitions.push_back(ExpansionDefinition{ trigger, replacement });
+	}
+	return definitions;
+}
+
+// Random text typed: letters and spaces, with a semicolon now and then
+static std::wstring MakeText(size_t count)
+{
+	std::mt19937 random(5);
+	std::wstring text;
+	for (size_t i = 0; i < count; i++)
+	{
+		unsigned int choice = random() % 32;
+		text += choice < 5 ? L' ' : choice == 5 ? L';' : (wchar_t)(L'a' + random() % KEY_COUNT);
+	}
+	return text;
+}
+
+
+// Builds the automaton in this process; prints a row of the table.
+static void Build(size_t count)
+{
+	std::vector<ExpansionDefinition> definitions = MakeDefinitions(count);
+	long residentBefore = ResidentKiB();
+	Clock::time_point start = Clock::now();
+	ExpansionAutomaton* automaton = new ExpansionAutomaton(definitions);
+	double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	size_t table = automaton->getStateCount() * automaton->getAlphabetSize() * sizeof(ExpansionAutomaton::State);
+	printf("  %8zu  %10.1f  %8zu  %8zu  %12zu  %12zu  %10ld\n", count, milliseconds, automaton->getStateCount(),
+		automaton->getAlphabetSize(), table, automaton->getMemoryUsage(), ResidentKiB() - residentBefore);
+	delete automaton;
+}
+
+
+// Follows the text through the automaton; returns nanoseconds per character.
+static double TimeAutomaton(const ExpansionAutomaton& automaton, const std::wstring& text, size_t* out_found)
+{
+	ExpansionAutomaton::State state = ExpansionAutomaton::START;
+	size_t found = 0;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		state = automaton.next(state, text[i]);
+		if (automaton.getExpansion(state))
+			found++;
+	}
+	double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	*out_found = found;
+	return elapsed / text.size();
+}
+
+// Looks every end of the text typed so far, up to the longest trigger, up in a set; returns nanoseconds per character.
+static double TimeHashSet(const std::vector<ExpansionDefinition>& definitions, const std::wstring& text, size_t* out_found)
+{
+	std::unordered_set<std::wstring> triggers;
+	for (size_t i = 0; i < definitions.size(); i++)
+		triggers.insert(definitions[i].trigger);
+	std::wstring window;
+	size_t found = 0;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		window += text[i];
+		if (window.size() > MAX_TRIGGER)
+			window.erase(0, 1);
+		for (size_t length = window.size(); length > 0; length--)
+		{
+			if (triggers.count(window.substr(window.size() - length)))
+			{
+				found++;
+				break;
+			}
+		}
+	}
+	double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	*out_found = found;
+	return elapsed / text.size();
+}
+
+
+// A layer of letters, space and semicolon
+static std::shared_ptr<const KeyboardSpec> MakeSpec(CommandPool* pool, const ExpansionAutomaton* expansions)
+{
+	std::unordered_map<Scancode, BaseKeystrokeCommand*> layout;
+	for (size_t k = 0; k < KEY_COUNT; k++)
+		layout[Scancode((BYTE)(FIRST_KEY + k))] = pool->internUnicode(std::vector<unsigned int>(1, L'a' + k), false);
+	layout[Scancode(KEY_SEMICOLON)] = pool->internUnicode(std::vector<unsigned int>(1, L';'), false);
+	layout[Scancode(0x39)] = pool->internUnicode(std::vector<unsigned int>(1, L' '), false);
+	std::vector<std::shared_ptr<const Layer>> layers(1, std::make_shared<Layer>(std::vector<std::wstring>(), layout));
+	return std::make_shared<KeyboardSpec>(L"Bench", layers, std::vector<PModifier>(), 0, expansions, pool);
+}
+
+// Types the text on a keyboard, a press and a release per character; returns nanoseconds per keystroke.
+static double TimeKeyboard(const ExpansionAutomaton* expansions, const std::wstring& text, size_t* out_expanded)
+{
+	CommandPool pool;
+	std::shared_ptr<const KeyboardSpec> spec = MakeSpec(&pool, expansions);
+	Keyboard keyboard(spec);
+	std::vector<Scancode> keys;
+	for (size_t i = 0; i < text.size(); i++)
+		keys.push_back(Scancode((BYTE)(text[i] == L' ' ? 0x39 : text[i] == L';' ? KEY_SEMICOLON : FIRST_KEY + (text[i] - L'a'))));
+
+	PKeystrokeCommand action;
+	bool repeated;
+	size_t expanded = 0;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		if (keyboard.evaluateKey(keys[i], 0, false, &action, &repeated)
+			&& static_cast<BaseKeystrokeCommand*>(action)->getType() == KeystrokeOutputType::ExpansionCommand)
+			expanded++;
+		keyboard.evaluateKey(keys[i], 0, true, &action, &repeated);
+	}
+	double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	*out_expanded = expanded;
+	return elapsed / keys.size();
+}
+
+
+int main(int argc, char* argv[])
+{
+	long count = argc > 1 ? atol(argv[1]) : 2000000;
+	if (count <= 0)
+		count = 2000000;
+
+	printf("Building the automaton; memory in bytes by its count, and KiB resident:\n");
+	printf("  %8s  %10s  %8s  %8s  %12s  %12s  %10s\n", "triggers", "ms", "states", "columns", "table", "memory", "resident");
+	const size_t triggerCounts[] = { 100, 1000, 10000 };
+	for (size_t i = 0; i < sizeof(triggerCounts) / sizeof(triggerCounts[0]); i++)
+	{
+		// A process each, so that one's memory isn't reused by the next
+		fflush(stdout);
+		pid_t child = fork();
+		if (child == 0)
+		{
+			Build(triggerCounts[i]);
+			fflush(stdout);
+			_exit(0);
+		}
+		if (child > 0)
+			waitpid(child, nullptr, 0);
+	}
+
+	std::wstring text = MakeText((size_t)count);
+	printf("\n%ld characters typed; nanoseconds per character (per keystroke, for the keyboard):\n", count);
+	printf("  %8s  %10s  %10s  %10s  %10s\n", "triggers", "automaton", "hash set", "keyboard", "found");
+	size_t expanded;
+	printf("  %8s  %10s  %10s  %10.1f\n", "none", "", "", TimeKeyboard(nullptr, text, &expanded));
+	for (size_t i = 0; i < sizeof(triggerCounts) / sizeof(triggerCounts[0]); i++)
+	{
+		std::vector<ExpansionDefinition> definitions = MakeDefinitions(triggerCounts[i]);
+		ExpansionAutomaton* automaton = new ExpansionAutomaton(definitions);
+		size_t found, foundInSet;
+		double automatonTime = TimeAutomaton(*automaton, text, &found);
+		double setTime = TimeHashSet(definitions, text, &foundInSet);
+		double keyboardTime = TimeKeyboard(automaton, text, &expanded);		// The spec deletes it
+		printf("  %8zu  %10.1f  %10.1f  %10.1f  %10zu%s\n", triggerCounts[i], automatonTime, setTime, keyboardTime,
+			found, found == foundInSet ? "" : "  (the set found a different number)");
+	}
+	return 0;
+}
@@ -0,0 +1,279 @@
+// Benchmark of the layout built into the remapper (MakeFallbackSpec, from the tables generated into
+// Remapper/FallbackLayout.h), against reading the same layout from XML/Fallback.xml, from the
+// start of a process to its first remapped keystroke: AltGr and the key of '-', which types an
+// en dash. Each run is a new process, started by this one; the time from before starting it to
+// its main is the same either way. Xerces-C isn't built here, so libxml2 stands in for it:
+// parsing the file into a DOM, validated against XML/Multikeys.xsd or not, and reading the
+// keyboard from it as XmlParser.cpp does (only what Fallback.xml has: modifiers and unicode
+// remaps). Xerces also validates the settings it reads.
+// Not run by ctest; run it by hand, from the directory above XML:
+//		FallbackBenchmark [XML directory] [runs]
+
+#include "../Remapper/Remapper.h"
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include <libxml/xmlschemas.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static const BYTE KEY_ALTGR = 0x38;
+static const BYTE KEY_MINUS = 0x0c;
+static const unsigned int EN_DASH = 0x2013;
+
+enum Source { TABLES, XML, XML_VALIDATED, SOURCE_COUNT };
+static const char* const SOURCE_NAMES[SOURCE_COUNT] = { "built in", "XML", "XML, validated" };
+
+
+// Resident memory of this process, in KiB
+static long ResidentKiB()
+{
+	long pages = 0, resident = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm)
+	{
+		if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(statm);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static double Microseconds(Clock::duration duration)
+{
+	return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+
+static std::wstring TextOf(const xmlNode* node)
+{
+	xmlChar* content = xmlNodeGetContent(node);
+	std::string text = content ? (const char*)content : "";
+	xmlFree(content);
+	return std::wstring(text.begin(), text.end());
+}
+
+static std::wstring AttributeOf(const xmlNode* node, const char* name)
+{
+	xmlChar* value = xmlGetProp(node, (const xmlChar*)name);
+	std::string text = value ? (const char*)value : "";
+	xmlFree(value);
+	return std::wstring(text.begin(), text.end());
+}
+
+static bool IsElement(const xmlNode* node, const char* name)
+{
+	return node->type == XML_ELEMENT_NODE && strcmp((const char*)node->name, name) == 0;
+}
+
+// A scancode as written in settings files, e.g. 2A or E0:38
+static Scancode ReadScancode(std::wstring text)
+{
+	text.erase(std::remove(text.begin(), text.end(), L':'), text.end());
+	unsigned int code = std::stoul(text, 0, 16);
+	if (code <= 0xff)
+		return Scancode((BYTE)code);
+	return Scancode((BYTE)(code >> 8), (BYTE)(code & 0xff));
+}
+
+// The spec of the only keyboard of a settings file, read as ParseModifier and ParseUnicode do
+static std::shared_ptr<const KeyboardSpec> ReadSpec(xmlDoc* document, CommandPool* pool)
+{
+	xmlNode* keyboard = xmlDocGetRootElement(document)->children;
+	while (keyboard && !IsElement(keyboard, "keyboard"))
+		keyboard = keyboard->next;
+	if (!keyboard)
+		return nullptr;
+
+	std::map<std::wstring, std::vector<Scancode>> modifierKeys;
+	std::vector<std::shared_ptr<const Layer>> layers;
+	for (xmlNode* child = keyboard->children; child; child = child->next)
+	{
+		if (IsElement(child, "modifiers"))
+		{
+			for (xmlNode* modifier = child->children; modifier; modifier = modifier->next)
+			{
+				if (IsElement(modifier, "modifier"))
+					modifierKeys[AttributeOf(modifier, "Name")].push_back(ReadScancode(TextOf(modifier)));
+			}
+		}
+		else if (IsElement(child, "layer"))
+		{
+			std::vector<std::wstring> modifierCombination;
+			std::unordered_map<Scancode, BaseKeystrokeCommand*> layout;
+			for (xmlNode* remap = child->children; remap; remap = remap->next)
+			{
+				if (IsElement(remap, "modifier"))
+					modifierCombination.push_back(TextOf(remap));
+				else if (IsElement(remap, "unicode"))
+				{
+					std::vector<unsigned int> codepoints;
+					for (xmlNode* codepoint = remap->children; codepoint; codepoint = codepoint->next)
+					{
+						if (IsElement(codepoint, "codepoint"))
+							codepoints.push_back(std::stoul(TextOf(codepoint), 0, 16));
+					}
+					layout[ReadScancode(AttributeOf(remap, "Scancode"))] =
+						pool->internUnicode(codepoints, AttributeOf(remap, "TriggerOnRepeat") == L"True");
+				}
+			}
+			layers.push_back(std::make_shared<const Layer>(modifierCombination, layout));
+		}
+	}
+
+	std::vector<PModifier> modifiers;
+	for (auto it = modifierKeys.begin(); it != modifierKeys.end(); it++)
+	{
+		if (it->second.size() == 1)
+			modifiers.push_back(new SimpleModifier(it->first, it->second[0]));
+		else
+			modifiers.push_back(new CompositeModifier(it->first, it->second));
+	}
+	return std::make_shared<const KeyboardSpec>(AttributeOf(keyboard, "Name"), layers, modifiers, DEFAULT_CHORD_WINDOW,
+		nullptr, pool);
+}
+
+// Reads Fallback.xml, as loadSettings would
+static std::shared_ptr<const KeyboardSpec> LoadXml(const std::string& directory, bool validated, CommandPool* pool)
+{
+	xmlInitParser();
+	xmlDoc* document = xmlReadFile((directory + "/Fallback.xml").c_str(), nullptr, XML_PARSE_NOBLANKS | XML_PARSE_NONET);
+	if (!document)
+		return nullptr;
+	if (validated)
+	{
+		xmlSchemaParserCtxt* schemaParser = xmlSchemaNewParserCtxt((directory + "/Multikeys.xsd").c_str());
+		xmlSchema* schema = xmlSchemaParse(schemaParser);
+		xmlSchemaValidCtxt* validator = schema ? xmlSchemaNewValidCtxt(schema) : nullptr;
+		bool valid = validator && xmlSchemaValidateDoc(validator, document) == 0;
+		if (validator)
+			xmlSchemaFreeValidCtxt(validator);
+		if (schema)
+			xmlSchemaFree(schema);
+		xmlSchemaFreeParserCtxt(schemaParser);
+		if (!valid)
+		{
+			xmlFreeDoc(document);
+			return nullptr;
+		}
+	}
+	std::shared_ptr<const KeyboardSpec> spec = ReadSpec(document, pool);
+	xmlFreeDoc(document);
+	xmlCleanupParser();
+	return spec;
+}
+
+
+// The run in a new process: loads the layout one way and types the first key. Prints the time
+// since the parent started it, its load and its first keystroke, in microseconds, and what's resident.
+static int Child(Source source, const std::string& directory, long long startedAt)
+{
+	Clock::time_point main = Clock::now();
+	CommandPool* pool = new CommandPool();
+	std::shared_ptr<const KeyboardSpec> spec = source == TABLES ? MakeFallbackSpec(pool) :
+		LoadXml(directory, source == XML_VALIDATED, pool);
+	if (!spec)
+		return 1;
+	Keyboard* keyboard = new Keyboard(spec);
+	Clock::time_point loaded = Clock::now();
+
+	PKeystrokeCommand action = nullptr;
+	bool repeated;
+	keyboard->evaluateKey(Scancode(false, true, KEY_ALTGR), 0, false, &action, &repeated);
+	bool remapped = keyboard->evaluateKey(Scancode(KEY_MINUS), 0, false, &action, &repeated);
+	Clock::time_point typed = Clock::now();
+
+	const INPUT* inputs = nullptr;
+	size_t count = 0;
+	if (!remapped || !static_cast<BaseKeystrokeCommand*>(action)->getInputs(false, false, &inputs, &count)
+		|| count == 0 || inputs[0].ki.wScan != EN_DASH)
+		return 1;
+
+	Clock::time_point started = Clock::time_point(Clock::duration(startedAt));
+	printf("%f %f %f %ld\n", Microseconds(main - started), Microseconds(loaded - main), Microseconds(typed - loaded),
+		ResidentKiB());
+	return 0;
+}
+
+// Starts a run; returns whether it typed the en dash, with its times in out_times and what's
+// resident in out_resident.
+static bool Run(Source source, const std::string& directory, double* out_times, long* out_resident)
+{
+	int pipeEnds[2];
+	if (pipe(pipeEnds) != 0)
+		return false;
+	std::string sourceText = std::to_string((int)source);
+	std::string startedAt = std::to_string((long long)Clock::now().time_since_epoch().count());
+	pid_t child = fork();
+	if (child == 0)
+	{
+		dup2(pipeEnds[1], STDOUT_FILENO);
+		close(pipeEnds[0]);
+		close(pipeEnds[1]);
+		execl("/proc/self/exe", "FallbackBenchmark", "--run", sourceText.c_str(), directory.c_str(), startedAt.c_str(), (char*)nullptr);
+		_exit(1);
+	}
+	close(pipeEnds[1]);
+	char line[200] = {};
+	ssize_t length = read(pipeEnds[0], line, sizeof(line) - 1);
+	close(pipeEnds[0]);
+	int status = 1;
+	if (child > 0)
+		waitpid(child, &status, 0);
+	return length > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0
+		&& sscanf(line, "%lf %lf %lf %ld", &out_times[0], &out_times[1], &out_times[2], out_resident) == 4;
+}
+
+static double Median(std::vector<double> values)
+{
+	std::sort(values.begin(), values.end());
+	return values[values.size() / 2];
+}
+
+
+int main(int argc, char* argv[])
+{
+	if (argc == 5 && strcmp(argv[1], "--run") == 0)
+		return Child((Source)atoi(argv[2]), argv[3], atoll(argv[4]));
+
+	std::string directory = argc > 1 ? argv[1] : "XML";
+	int runs = argc > 2 ? atoi(argv[2]) : 100;
+	if (runs <= 0)
+		runs = 100;
+
+	printf("%d new processes each, up to their first remapped keystroke; medians in microseconds:\n", runs);
+	printf("  %-16s  %10s  %10s  %12s  %10s  %12s\n", "layout", "to main", "load", "first key", "in all", "resident KiB");
+	for (int s = 0; s < SOURCE_COUNT; s++)
+	{
+		std::vector<double> times[3], total;
+		long resident = 0;
+		for (int r = 0; r < runs; r++)
+		{
+			double run[3];
+			if (!Run((Source)s, directory, run, &resident))
+			{
+				printf("  %-16s  failed; is %s/Fallback.xml there?\n", SOURCE_NAMES[s], directory.c_str());
+				return 1;
+			}
+			for (int t = 0; t < 3; t++)
+				times[t].push_back(run[t]);
+			total.push_back(run[0] + run[1] + run[2]);
+		}
+		printf("  %-16s  %10.1f  %10.1f  %12.1f  %10.1f  %12ld\n", SOURCE_NAMES[s], Median(times[0]), Median(times[1]),
+			Median(times[2]), Median(total), resident);
+	}
+	return 0;
+}
@@ -0,0 +1,244 @@
+// Benchmark of layers ignoring modifiers (State="Ignored" in XML/Multikeys.xsd, and Layer's
+// ignoredModifiers), against duplicating every layer for each combination of them, as layouts had
+// to before. A layout of 4 layers of 80 keys (plain, Shift, AltGr, Shift+AltGr), on a keyboard with
+// 0 to 6 more modifiers (like CapsLock or Fn) that change none of its keys. Ignoring them, the
+// layout keeps its 4 layers; duplicating, each layer is written out once for every combination of
+// them. Loading is creating the layers and compiling the spec, with its layers built; each way is
+// loaded in a process of its own, for the memory resident afterwards. Then finding the layer of
+// random states of the modifiers, and whole keystrokes evaluated by a keyboard.
+// Not run by ctest; run it by hand:
+//		IgnoredModifiersBenchmark [lookups]
+
+#include "../Remapper/Keyboard.h"
+#include "../Remapper/CommandPool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t LAYER_COUNT = 4;		// Plain, Shift, AltGr, Shift+AltGr
+static const size_t KEY_COUNT = 80;
+static const BYTE FIRST_KEY = 0x02;
+static const BYTE KEY_SHIFT = 0x2a;
+static const BYTE KEY_ALTGR = 0x38;
+static const BYTE FIRST_EXTRA = 0x80;		// Extra modifier i is E0 FIRST_EXTRA + i
+static const size_t MAX_EXTRA = 6;
+
+
+// Resident memory of this process, in KiB
+static long ResidentKiB()
+{
+	long pages = 0, resident = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm)
+	{
+		if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(statm);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static std::wstring ExtraName(size_t i)
+{
+	return L"X" + std::to_wstring(i);
+}
+
+
+// The layout, its layers ignoring the extra modifiers or written out for each combination of them
+static std::shared_ptr<const KeyboardSpec> MakeSpec(CommandPool* pool, size_t extraCount, bool ignored)
+{
+	std::vector<std::wstring> extras;
+	for (size_t i = 0; i < extraCount; i++)
+		extras.push_back(ExtraName(i));
+
+	std::vector<std::shared_ptr<const Layer>> layers;
+	size_t combinations = ignored ? 1 : (size_t)1 << extraCount;
+	for (size_t l = 0; l < LAYER_COUNT; l++)
+	{
+		for (size_t c = 0; c < combinations; c++)
+		{
+			std::unordered_map<Scancode, BaseKeystrokeCommand*> keys;
+			for (size_t k = 0; k < KEY_COUNT; k++)
+				keys[Scancode((BYTE)(FIRST_KEY + k))] = pool->internUnicode(std::vector<unsigned int>(1, 0x21 + l * 0x60 + k), false);
+			std::vector<std::wstring> modifiers;
+			if (l & 1)
+				modifiers.push_back(L"Shift");
+			if (l & 2)
+				modifiers.push_back(L"AltGr");
+			for (size_t i = 0; i < extraCount && !ignored; i++)
+			{
+				if (c & ((size_t)1 << i))
+					modifiers.push_back(extras[i]);
+			}
+			layers.push_back(std::make_shared<Layer>(modifiers, keys, std::vector<ChordDefinition>(), nullptr, false,
+				ignored ? extras : std::vector<std::wstring>()));
+		}
+	}
+
+	std::vector<PModifier> modifiers;
+	modifiers.push_back(new SimpleModifier(L"Shift", Scancode(KEY_SHIFT)));
+	modifiers.push_back(new SimpleModifier(L"AltGr", Scancode(false, true, KEY_ALTGR)));
+	for (size_t i = 0; i < extraCount; i++)
+		modifiers.push_back(new SimpleModifier(extras[i], Scancode(false, true, (BYTE)(FIRST_EXTRA + i))));
+	std::shared_ptr<const KeyboardSpec> spec = std::make_shared<KeyboardSpec>(L"Bench", layers, modifiers, 0, nullptr, pool);
+	for (size_t i = 0; i < layers.size(); i++)
+		spec->buildLayer(i);
+	return spec;
+}
+
+
+// Loads the layout one way in this process; prints a row of the table.
+static void Load(size_t extraCount, bool ignored)
+{
+	long residentBefore = ResidentKiB();
+	CommandPool* pool = new CommandPool();
+	std::shared_ptr<const KeyboardSpec> spec = MakeSpec(pool, extraCount, ignored);
+	long resident = ResidentKiB() - residentBefore;
+
+	size_t layerBytes = 0;
+	for (size_t l = 0; l < spec->getLayers().size(); l++)
+		layerBytes += spec->getLayers()[l]->getMemoryUsage();
+
+	// Then again, timed, with the memory of the first load still taken
+	const size_t REPEATS = 50;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < REPEATS; i++)
+	{
+		CommandPool timedPool;
+		MakeSpec(&timedPool, extraCount, ignored);
+	}
+	double microseconds = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / REPEATS;
+
+	printf("  %6zu  %-10s  %8zu  %12zu  %10.1f  %10ld\n", extraCount, ignored ? "ignored" : "duplicated",
+		spec->getLayers().size(), layerBytes, microseconds, resident);
+}
+
+
+// Character typed by the press of an action, or 0
+static unsigned int CharacterOf(PKeystrokeCommand action)
+{
+	const INPUT* inputs = nullptr;
+	size_t count = 0;
+	if (!action || !static_cast<BaseKeystrokeCommand*>(action)->getInputs(false, false, &inputs, &count) || count == 0)
+		return 0;
+	return inputs[0].ki.wScan;
+}
+
+static double Nanoseconds(Clock::duration duration, size_t count)
+{
+	return std::chrono::duration<double, std::nano>(duration).count() / count;
+}
+
+// Finds the layer of each state of the modifiers, then types a key in each; returns nanoseconds per
+// lookup and per keystroke, and a sum of the characters typed in out_typed.
+static void TimeLookups(size_t extraCount, bool ignored, const std::vector<ModifierMask>& states,
+	double* out_lookup, double* out_keystroke, unsigned long long* out_typed)
+{
+	CommandPool pool;
+	std::shared_ptr<const KeyboardSpec> spec = MakeSpec(&pool, extraCount, ignored);
+	size_t found = 0;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < states.size(); i++)
+	{
+		if (spec->findLayer(states[i]))
+			found++;
+	}
+	*out_lookup = Nanoseconds(Clock::now() - start, states.size());
+
+	// Each modifier of the state held while typing a key
+	std::vector<Scancode> modifierKeys;
+	modifierKeys.push_back(Scancode(KEY_SHIFT));
+	modifierKeys.push_back(Scancode(false, true, KEY_ALTGR));
+	for (size_t i = 0; i < extraCount; i++)
+		modifierKeys.push_back(Scancode(false, true, (BYTE)(FIRST_EXTRA + i)));
+	Keyboard keyboard(spec);
+	PKeystrokeCommand action;
+	bool repeated;
+	unsigned long long typed = 0;
+	size_t keystrokes = 0;
+	start = Clock::now();
+	for (size_t i = 0; i < states.size(); i++)
+	{
+		for (size_t m = 0; m < modifierKeys.size(); m++)
+		{
+			if (states[i] & (1ULL << m))
+			{
+				keyboard.evaluateKey(modifierKeys[m], 0, false, &action, &repeated);
+				keystrokes++;
+			}
+		}
+		Scancode key((BYTE)(FIRST_KEY + i % KEY_COUNT));
+		if (keyboard.evaluateKey(key, 0, false, &action, &repeated))
+			typed += CharacterOf(action);
+		keyboard.evaluateKey(key, 0, true, &action, &repeated);
+		keystrokes += 2;
+		for (size_t m = 0; m < modifierKeys.size(); m++)
+		{
+			if (states[i] & (1ULL << m))
+			{
+				keyboard.evaluateKey(modifierKeys[m], 0, true, &action, &repeated);
+				keystrokes++;
+			}
+		}
+	}
+	*out_keystroke = Nanoseconds(Clock::now() - start, keystrokes);
+	*out_typed = found == states.size() ? typed : 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+	long count = argc > 1 ? atol(argv[1]) : 1000000;
+	if (count <= 0)
+		count = 1000000;
+
+	printf("%zu layers of %zu keys, and extra modifiers changing none of them; loading in microseconds, resident in KiB:\n",
+		LAYER_COUNT, KEY_COUNT);
+	printf("  %6s  %-10s  %8s  %12s  %10s  %10s\n", "extras", "layers", "count", "layer bytes", "load", "resident");
+	for (size_t extraCount = 0; extraCount <= MAX_EXTRA; extraCount += 2)
+	{
+		const bool modes[] = { false, true };
+		for (size_t i = 0; i < 2; i++)
+		{
+			// A process each, so that one's memory isn't reused by the next
+			fflush(stdout);
+			pid_t child = fork();
+			if (child == 0)
+			{
+				Load(extraCount, modes[i]);
+				fflush(stdout);
+				_exit(0);
+			}
+			if (child > 0)
+				waitpid(child, nullptr, 0);
+		}
+	}
+
+	printf("\n%ld random states of the modifiers; nanoseconds per layer found, and per key pressed or released:\n", count);
+	printf("  %6s  %-10s  %10s  %10s\n", "extras", "layers", "lookup", "keystroke");
+	for (size_t extraCount = 0; extraCount <= MAX_EXTRA; extraCount += 2)
+	{
+		std::mt19937 random(3);
+		std::vector<ModifierMask> states;
+		for (long i = 0; i < count; i++)
+			states.push_back(random() & ((1ULL << (2 + extraCount)) - 1));
+		double lookups[2], keystrokes[2];
+		unsigned long long typed[2];
+		TimeLookups(extraCount, false, states, &lookups[0], &keystrokes[0], &typed[0]);
+		TimeLookups(extraCount, true, states, &lookups[1], &keystrokes[1], &typed[1]);
+		printf("  %6zu  %-10s  %10.1f  %10.1f\n", extraCount, "duplicated", lookups[0], keystrokes[0]);
+		printf("  %6zu  %-10s  %10.1f  %10.1f%s\n", extraCount, "ignored", lookups[1], keystrokes[1],
+			typed[0] == typed[1] ? "" : "  (they typed different keys)");
+	}
+	return 0;
+}
@@ -0,0 +1,362 @@
+// Tests of keyboards (Remapper/Keyboard.h) evaluating keystrokes: remapped keys, layers built on
+// first activation, and dead keys followed by a key they replace, compose with or just come before.
+// Two keyboards share one spec, and with it the same dead key, while keys are typed on both of
+// them in turn; what dead keys send is made by the spec, when it compiles the layers. Text
+// expansions are found whatever the case their triggers are typed in.
+
+#include "../Remapper/Keyboard.h"
+#include "../Remapper/KeystrokeCommands.h"
+#include "../Remapper/CommandPool.h"
+#include "../Remapper/ExpansionAutomaton.h"
+#include "TestHarness.h"
+
+using namespace Multikeys;
+
+
+static const BYTE KEY_Q = 0x10;
+static const BYTE KEY_E = 0x12;
+static const BYTE KEY_X = 0x2d;
+static const BYTE KEY_ACUTE = 0x1a;		// Dead key: ´, with U+0301; x is replaced by ẋ
+static const BYTE KEY_GRAVE = 0x1b;		// Dead key: `, with U+0300
+static const BYTE KEY_UNMAPPED = 0x2c;
+static const BYTE KEY_SHIFT = 0x2a;
+
+
+// Text typed by an action, as the characters of its keystrokes
+static std::wstring TextOf(PKeystrokeCommand action, bool repeated)
+{
+	const INPUT* inputs = nullptr;
+	size_t count = 0;
+	if (!action || !static_cast<BaseKeystrokeCommand*>(action)->getInputs(false, repeated, &inputs, &count))
+		return std::wstring();
+	std::wstring text;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (inputs[i].ki.dwFlags & KEYEVENTF_UNICODE)
+			text += (wchar_t)inputs[i].ki.wScan;
+	}
+	return text;
+}
+
+// Presses a key and returns the text the press types; "?" if the key is let through.
+static std::wstring Press(Keyboard& keyboard, BYTE makeCode, BYTE vKey = 0)
+{
+	PKeystrokeCommand action = nullptr;
+	bool repeated = false;
+	if (!keyboard.evaluateKey(Scancode(makeCode), vKey, false, &action, &repeated))
+		return L"?";
+	return TextOf(action, repeated);
+}
+
+static void Release(Keyboard& keyboard, BYTE makeCode, BYTE vKey = 0)
+{
+	PKeystrokeCommand action = nullptr;
+	bool repeated = false;
+	keyboard.evaluateKey(Scancode(makeCode), vKey, true, &action, &repeated);
+}
+
+// Presses and releases a key; returns the text the press types.
+static std::wstring Type(Keyboard& keyboard, BYTE makeCode)
+{
+	std::wstring text = Press(keyboard, makeCode);
+	Release(keyboard, makeCode);
+	return text;
+}
+
+
+// A layout with two dead keys, and a shifted layer
+static std::shared_ptr<const KeyboardSpec> MakeSpec(CommandPool& pool)
+{
+	// Characters aren't sent again on repeat, unless they're replacements; see XmlParser.cpp
+	UnicodeCommand* q = pool.internUnicode({ L'q' }, false);
+	UnicodeCommand* e = pool.internUnicode({ L'e' }, false);
+	UnicodeCommand* x = pool.internUnicode({ L'x' }, false);
+	UnicodeCommand* shiftedE = pool.internUnicode({ L'E' }, false);
+
+	std::unordered_map<const UnicodeCommand*, UnicodeCommand*> acuteReplacements;
+	acuteReplacements[x] = pool.internUnicode({ 0x1e8b }, true);
+	acuteReplacements[pool.internUnicode({ L'x' }, true)] = acuteReplacements[x];
+	BaseKeystrokeCommand* acute = pool.adopt(new DeadKeyCommand({ 0xb4 }, acuteReplacements, 0, 0x301));
+	BaseKeystrokeCommand* grave = pool.adopt(new DeadKeyCommand({ L'`' },
+		std::unordered_map<const UnicodeCommand*, UnicodeCommand*>(), 0, 0x300));
+
+	std::unordered_map<Scancode, BaseKeystrokeCommand*> base;
+	base[KEY_Q] = q;
+	base[KEY_E] = e;
+	base[KEY_X] = x;
+	base[KEY_ACUTE] = acute;
+	base[KEY_GRAVE] = grave;
+	std::unordered_map<Scancode, BaseKeystrokeCommand*> shifted;
+	shifted[KEY_E] = shiftedE;
+	shifted[KEY_ACUTE] = acute;
+
+	std::vector<std::shared_ptr<const Layer>> layers;
+	layers.push_back(std::make_shared<Layer>(std::vector<std::wstring>(), base));
+	layers.push_back(std::make_shared<Layer>(std::vector<std::wstring>(1, L"Shift"), shifted));
+	std::vector<PModifier> modifiers(1, new CompositeModifier(L"Shift", { Scancode(KEY_SHIFT), Scancode(0x36) }));
+	return std::make_shared<KeyboardSpec>(L"Test", layers, modifiers, 0, nullptr, &pool);
+}
+
+
+static void TestRemappedKeys()
+{
+	CommandPool pool;
+	Keyboard keyboard(MakeSpec(pool));
+
+	CHECK(Type(keyboard, KEY_Q) == L"q");
+	CHECK(Type(keyboard, KEY_UNMAPPED) == L"?");
+
+	// Shift selects its layer; keys it doesn't map do nothing
+	CHECK(Press(keyboard, KEY_SHIFT, VK_SHIFT) == L"");
+	CHECK(Type(keyboard, KEY_E) == L"E");
+	CHECK(Type(keyboard, KEY_Q) == L"?");
+	Release(keyboard, KEY_SHIFT, VK_SHIFT);
+	CHECK(Type(keyboard, KEY_E) == L"e");
+}
+
+
+// A layer read when it's first needed, like XmlLayerSource's
+class CountingLayerSource : public LayerSource
+{
+public:
+	CountingLayerSource(BaseKeystrokeCommand* command, int* builds) : command(command), builds(builds) { }
+
+	bool build(OUT std::unordered_map<Scancode, BaseKeystrokeCommand*> *const out_layout,
+		OUT std::vector<ChordDefinition> *const) const override
+	{
+		(*builds)++;
+		(*out_layout)[Scancode(KEY_E)] = command;
+		return true;
+	}
+
+	size_t getMemoryUsage() const override { return sizeof(*this); }
+
+private:
+	BaseKeystrokeCommand* const command;
+	int* const builds;
+};
+
+static void TestLayerBuiltOnActivation()
+{
+	CommandPool pool;
+	int builds = 0;
+	std::unordered_map<Scancode, BaseKeystrokeCommand*> base;
+	base[KEY_E] = pool.internUnicode({ L'e' }, false);
+	std::vector<std::shared_ptr<const Layer>> layers;
+	layers.push_back(std::make_shared<Layer>(std::vector<std::wstring>(), base));
+	layers.push_back(std::make_shared<Layer>(std::vector<std::wstring>(1, L"Shift"),
+		std::unique_ptr<const LayerSource>(new CountingLayerSource(pool.internUnicode({ L'E' }, false), &builds)), false, 0));
+	std::vector<PModifier> modifiers(1, new CompositeModifier(L"Shift", { Scancode(KEY_SHIFT) }));
+	std::shared_ptr<const KeyboardSpec> spec = std::make_shared<KeyboardSpec>(L"Test", layers, modifiers, 0, nullptr, &pool);
+	Keyboard first(spec);
+	Keyboard second(spec);
+
+	// Not read until a keyboard activates it, then read once for all of them
+	CHECK(Type(first, KEY_E) == L"e");
+	CHECK_EQUAL(0, builds);
+	CHECK(!layers[1]->isBuilt());
+	CHECK(Press(first, KEY_SHIFT, VK_SHIFT) == L"");
+	CHECK_EQUAL(1, builds);
+	CHECK(Type(first, KEY_E) == L"E");
+	CHECK(Press(second, KEY_SHIFT, VK_SHIFT) == L"");
+	CHECK(Type(second, KEY_E) == L"E");
+	CHECK_EQUAL(1, builds);
+
+	// Looking a key up in it reads it too, if nothing activated it first
+	builds = 0;
+	std::shared_ptr<const Layer> unbuilt = std::make_shared<Layer>(std::vector<std::wstring>(),
+		std::unique_ptr<const LayerSource>(new CountingLayerSource(pool.internUnicode({ L'E' }, false), &builds)), false, 0);
+	CHECK(unbuilt->getCommand(Scancode(KEY_E)) == pool.internUnicode({ L'E' }, false));
+	CHECK_EQUAL(1, builds);
+}
+
+
+static void TestDeadKeys()
+{
+	CommandPool pool;
+	Keyboard keyboard(MakeSpec(pool));
+
+	// Waiting for the next key, the dead key types nothing
+	CHECK(Type(keyboard, KEY_ACUTE) == L"");
+	CHECK(Type(keyboard, KEY_X) == L"\x1e8b");		// Replaced
+	CHECK(Type(keyboard, KEY_X) == L"x");			// Only the next key
+
+	CHECK(Type(keyboard, KEY_ACUTE) == L"");
+	CHECK(Type(keyboard, KEY_E) == L"\xe9");		// Composed with its combining mark
+
+	// Across layers: the dead key of the shifted layer, then a key of the plain one
+	CHECK(Press(keyboard, KEY_SHIFT, VK_SHIFT) == L"");
+	CHECK(Type(keyboard, KEY_ACUTE) == L"");
+	Release(keyboard, KEY_SHIFT, VK_SHIFT);
+	CHECK(Type(keyboard, KEY_E) == L"\xe9");
+
+	// The other way around
+	CHECK(Type(keyboard, KEY_ACUTE) == L"");
+	CHECK(Press(keyboard, KEY_SHIFT, VK_SHIFT) == L"");
+	CHECK(Type(keyboard, KEY_E) == L"\xc9");
+	Release(keyboard, KEY_SHIFT, VK_SHIFT);
+
+	// Nothing to combine with: both are sent, as a single output
+	CHECK(Type(keyboard, KEY_ACUTE) == L"");
+	CHECK(Type(keyboard, KEY_Q) == L"\xb4q");
+	CHECK(Type(keyboard, KEY_GRAVE) == L"");
+	CHECK(Type(keyboard, KEY_ACUTE) == L"`\xb4");	// Dead keys don't compose with each other
+	CHECK(Type(keyboard, KEY_ACUTE) == L"");
+	CHECK(Type(keyboard, KEY_ACUTE) == L"\xb4\xb4");	// Pressed twice, sent twice
+	CHECK(Type(keyboard, KEY_ACUTE) == L"");
+	CHECK(Type(keyboard, KEY_UNMAPPED) == L"\xb4");	// Only the dead key
+	CHECK(Type(keyboard, KEY_Q) == L"q");
+}
+
+
+static void TestRepeatAfterDeadKey()
+{
+	CommandPool pool;
+	Keyboard keyboard(MakeSpec(pool));
+
+	// Repeats send the replacement again, or the key alone
+	CHECK(Type(keyboard, KEY_ACUTE) == L"");
+	CHECK(Press(keyboard, KEY_E) == L"\xe9");
+	CHECK(Press(keyboard, KEY_E) == L"\xe9");
+	Release(keyboard, KEY_E);
+
+	CHECK(Type(keyboard, KEY_ACUTE) == L"");
+	CHECK(Press(keyboard, KEY_Q) == L"\xb4q");
+	CHECK(Press(keyboard, KEY_Q) == L"");		// q isn't sent again on repeat
+	Release(keyboard, KEY_Q);
+}
+
+
+static void TestSharedDeadKey()
+{
+	CommandPool pool;
+	std::shared_ptr<const KeyboardSpec> spec = MakeSpec(pool);
+	Keyboard first(spec);
+	Keyboard second(spec);
+
+	// The dead key pressed on one keyboard is left waiting there alone
+	CHECK(Type(first, KEY_ACUTE) == L"");
+	CHECK(Type(second, KEY_E) == L"e");
+	CHECK(Type(second, KEY_X) == L"x");
+	CHECK(Type(first, KEY_E) == L"\xe9");
+
+	// Both waiting at once, each for its own next key
+	CHECK(Type(first, KEY_ACUTE) == L"");
+	CHECK(Type(second, KEY_ACUTE) == L"");
+	CHECK(Type(second, KEY_X) == L"\x1e8b");
+	CHECK(Type(first, KEY_Q) == L"\xb4q");
+
+	// Pressed twice in a row on one keyboard, while the other one uses it once
+	CHECK(Type(first, KEY_ACUTE) == L"");
+	CHECK(Type(second, KEY_ACUTE) == L"");
+	CHECK(Type(first, KEY_ACUTE) == L"\xb4\xb4");
+	CHECK(Type(second, KEY_E) == L"\xe9");
+
+	// Different dead keys on each
+	CHECK(Type(first, KEY_GRAVE) == L"");
+	CHECK(Type(second, KEY_ACUTE) == L"");
+	CHECK(Type(first, KEY_E) == L"\xe8");
+	CHECK(Type(second, KEY_E) == L"\xe9");
+
+	// Interleaved presses and releases: each key's repeats stay with the keyboard it was pressed on
+	CHECK(Type(first, KEY_ACUTE) == L"");
+	CHECK(Press(first, KEY_E) == L"\xe9");
+	CHECK(Press(second, KEY_E) == L"e");
+	CHECK(Press(first, KEY_E) == L"\xe9");
+	CHECK(Press(second, KEY_E) == L"");
+	Release(first, KEY_E);
+	Release(second, KEY_E);
+
+	// A snapshot restored keeps its dead key waiting
+	CHECK(Type(first, KEY_ACUTE) == L"");
+	KeyboardState waiting = first.snapshotState();
+	CHECK(Type(first, KEY_E) == L"\xe9");
+	second.restoreState(waiting);
+	CHECK(Type(second, KEY_X) == L"\x1e8b");
+	CHECK(Type(first, KEY_X) == L"x");
+}
+
+
+static void TestDeadKeyOutputsPrecomputed()
+{
+	CommandPool pool;
+	std::shared_ptr<const KeyboardSpec> spec = MakeSpec(pool);
+	Keyboard first(spec);
+	Keyboard second(spec);
+	CHECK(spec->getDeadKeyOutputCount() > 0);
+
+	// Typing creates nothing, and both keyboards get the very same commands
+	size_t created = pool.getStats().created;
+	PKeystrokeCommand actions[2];
+	Keyboard* keyboards[2] = { &first, &second };
+	for (int i = 0; i < 2; i++)
+	{
+		bool repeated = false;
+		Type(*keyboards[i], KEY_ACUTE);
+		keyboards[i]->evaluateKey(Scancode(KEY_Q), 0, false, &actions[i], &repeated);
+		Release(*keyboards[i], KEY_Q);
+		CHECK(Type(*keyboards[i], KEY_ACUTE) == L"");
+		CHECK(Type(*keyboards[i], KEY_E) == L"\xe9");
+	}
+	CHECK(actions[0] == actions[1]);
+	CHECK(TextOf(actions[0], false) == L"\xb4q");
+	CHECK_EQUAL(created, pool.getStats().created);
+
+	// A dead key in a layer built on first activation combines with the keys of every layer
+	int builds = 0;
+	std::unordered_map<Scancode, BaseKeystrokeCommand*> base;
+	base[KEY_E] = pool.internUnicode({ L'e' }, false);
+	base[KEY_Q] = pool.internUnicode({ L'q' }, false);
+	BaseKeystrokeCommand* acute = pool.adopt(new DeadKeyCommand({ 0xb4 }, {}, 0, 0x301));
+	std::vector<std::shared_ptr<const Layer>> layers;
+	layers.push_back(std::make_shared<Layer>(std::vector<std::wstring>(), base));
+	layers.push_back(std::make_shared<Layer>(std::vector<std::wstring>(1, L"Shift"),
+		std::unique_ptr<const LayerSource>(new CountingLayerSource(acute, &builds)), false, 0));
+	std::vector<PModifier> modifiers(1, new CompositeModifier(L"Shift", { Scancode(KEY_SHIFT) }));
+	std::shared_ptr<const KeyboardSpec> lazy = std::make_shared<KeyboardSpec>(L"Test", layers, modifiers, 0, nullptr, &pool);
+	Keyboard keyboard(lazy);
+	CHECK_EQUAL(0u, lazy->getDeadKeyOutputCount());
+
+	CHECK(Press(keyboard, KEY_SHIFT, VK_SHIFT) == L"");
+	CHECK_EQUAL(1, builds);
+	CHECK(lazy->getDeadKeyOutputCount() > 0);
+	CHECK(Type(keyboard, KEY_E) == L"");
+	Release(keyboard, KEY_SHIFT, VK_SHIFT);
+	CHECK(Type(keyboard, KEY_E) == L"\xe9");
+	CHECK(Press(keyboard, KEY_SHIFT, VK_SHIFT) == L"");
+	CHECK(Type(keyboard, KEY_E) == L"");
+	Release(keyboard, KEY_SHIFT, VK_SHIFT);
+	CHECK(Type(keyboard, KEY_Q) == L"\xb4q");
+	CHECK_EQUAL(1, builds);
+}
+
+
+static void TestExpansionCase()
+{
+	ExpansionAutomaton automaton(std::vector<ExpansionDefinition>(1, ExpansionDefinition{ L";Addr", L"Street" }));
+	const wchar_t* const typed[] = { L";addr", L";ADDR", L"x;aDdR" };
+	for (size_t i = 0; i < 3; i++)
+	{
+		ExpansionAutomaton::State state = ExpansionAutomaton::START;
+		for (const wchar_t* c = typed[i]; *c; c++)
+			state = automaton.next(state, *c);
+		CHECK(automaton.getExpansion(state) != nullptr);
+	}
+	ExpansionAutomaton::State state = ExpansionAutomaton::START;
+	for (const wchar_t* c = L";adr"; *c; c++)
+		state = automaton.next(state, *c);
+	CHECK(automaton.getExpansion(state) == nullptr);
+}
+
+
+int main()
+{
+	TestRemappedKeys();
+	TestLayerBuiltOnActivation();
+	TestDeadKeys();
+	TestRepeatAfterDeadKey();
+	TestSharedDeadKey();
+	TestDeadKeyOutputsPrecomputed();
+	TestExpansionCase();
+	return Tests::Result();
+}
@@ -0,0 +1,94 @@
+// Benchmark of the launcher (Remapper/Launcher.h): how long the thread executing a command
+// is held up by a launch, queued through the launcher, against starting the process
+// itself as ExecutableCommand used to. Not run by ctest; run it by hand:
+//		LauncherBenchmark [launches]
+
+#include "../Remapper/Launcher.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+
+static double Microseconds(Clock::duration duration)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count() / 1000.0;
+}
+
+
+int main(int argc, char* argv[])
+{
+	int launches = argc > 1 ? atoi(argv[1]) : 200;
+	if (launches <= 0)
+		launches = 200;
+
+	// Directly: the caller waits for posix_spawnp to return
+	char program[] = "true";
+	char* arguments[] = { program, nullptr };
+	Clock::duration directTotal = Clock::duration::zero(), directMax = Clock::duration::zero();
+	for (int i = 0; i < launches; i++)
+	{
+		Clock::time_point start = Clock::now();
+		pid_t child;
+		posix_spawnp(&child, program, nullptr, nullptr, arguments, environ);
+		Clock::duration elapsed = Clock::now() - start;
+		waitpid(child, nullptr, 0);
+
+		directTotal += elapsed;
+		if (elapsed > directMax)
+			directMax = elapsed;
+	}
+
+	// Through the launcher: the caller only waits for the request to be queued.
+	// Requests are paced so that the queue never fills up, as keystrokes would be.
+	Launcher& launcher = Launcher::shared();
+	Clock::duration queuedTotal = Clock::duration::zero(), queuedMax = Clock::duration::zero();
+	for (int i = 0; i < launches; i++)
+	{
+		std::wstring distinct = std::to_wstring(i);		// Not debounced
+		Clock::time_point start = Clock::now();
+		launcher.enqueue(L"true", distinct);
+		Clock::duration elapsed = Clock::now() - start;
+
+		queuedTotal += elapsed;
+		if (elapsed > queuedMax)
+			queuedMax = elapsed;
+
+		while (true)
+		{
+			Launcher::Stats stats = launcher.getStats();
+			if (i + 1 - (stats.launched + stats.failed) < Launcher::QUEUE_CAPACITY / 2)
+				break;
+			std::this_thread::yield();
+		}
+	}
+	while (true)
+	{
+		Launcher::Stats stats = launcher.getStats();
+		if (stats.launched + stats.failed + stats.dropped >= (unsigned long long)launches)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	Launcher::Stats stats = launcher.getStats();
+	printf("%d launches of 'true'; time the caller is held up, in microseconds:\n", launches);
+	printf("  posix_spawnp directly    mean %10.1f   max %10.1f\n",
+		Microseconds(directTotal) / launches, Microseconds(directMax));
+	printf("  Launcher::enqueue        mean %10.1f   max %10.1f\n",
+		Microseconds(queuedTotal) / launches, Microseconds(queuedMax));
+	printf("Launcher, from request to launch: mean %.1f, max %llu (%llu launched, %llu failed, %llu dropped)\n",
+		(double)stats.totalLatency / (stats.launched + stats.failed), stats.maxLatency,
+		stats.launched, stats.failed, stats.dropped);
+	return 0;
+}
@@ -0,0 +1,125 @@
+// Tests of the launcher (Remapper/Launcher.h), through its posix_spawn implementation:
+// requests return at once, duplicates are debounced, a full queue drops requests, and
+// arguments reach the process as a command line would pass them.
+
+#include "../Remapper/Launcher.h"
+#include "TestHarness.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace Multikeys;
+
+
+// Waits until the launcher has finished this many launches (successful or not); false on timeout.
+static bool WaitForLaunches(unsigned long long count)
+{
+	for (int i = 0; i < 1000; i++)
+	{
+		Launcher::Stats stats = Launcher::shared().getStats();
+		if (stats.launched + stats.failed >= count)
+			return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return false;
+}
+
+
+static void TestDebounce()
+{
+	Launcher& launcher = Launcher::shared();
+	CHECK(launcher.enqueue(L"true", L"debounce"));
+	CHECK(launcher.enqueue(L"true", L"debounce"));		// Same request, right away
+	CHECK(launcher.enqueue(L"true", L"other"));			// Not the same arguments
+	CHECK(WaitForLaunches(2));
+
+	Launcher::Stats stats = launcher.getStats();
+	CHECK_EQUAL(2, stats.launched);
+	CHECK_EQUAL(1, stats.debounced);
+
+	// Accepted again once the debounce time is over
+	std::this_thread::sleep_for(std::chrono::milliseconds(Launcher::DEBOUNCE_TIME + 50));
+	CHECK(launcher.enqueue(L"true", L"debounce"));
+	CHECK(WaitForLaunches(3));
+	CHECK_EQUAL(1, launcher.getStats().debounced);
+}
+
+
+static void TestFailure()
+{
+	Launcher& launcher = Launcher::shared();
+	Launcher::Stats before = launcher.getStats();
+	CHECK(launcher.enqueue(L"/nonexistent/multikeys-test", L""));		// Accepted; fails later
+	CHECK(WaitForLaunches(before.launched + before.failed + 1));
+	CHECK_EQUAL(before.failed + 1, launcher.getStats().failed);
+}
+
+
+static void TestArguments()
+{
+	char path[] = "/tmp/multikeys-launcher-XXXXXX";
+	int descriptor = mkstemp(path);
+	CHECK(descriptor >= 0);
+	close(descriptor);
+
+	// The shell gets three arguments: -c, the script, and two words for $0 and $1
+	std::wstring arguments = L"-c \"printf '%s|%s' \\\"$0\\\" \\\"$1\\\" > " + std::wstring(path, path + strlen(path))
+		+ L"\" first \"second word\"";
+
+	Launcher::Stats before = Launcher::shared().getStats();
+	CHECK(Launcher::shared().enqueue(L"sh", arguments));
+	CHECK(WaitForLaunches(before.launched + before.failed + 1));
+
+	// The process runs on its own; give it a moment to write
+	std::string written;
+	for (int i = 0; i < 200 && written.empty(); i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		std::ifstream file(path);
+		std::getline(file, written);
+	}
+	CHECK(written == "first|second word");
+	remove(path);
+}
+
+
+static void TestFullQueue()
+{
+	Launcher& launcher = Launcher::shared();
+	Launcher::Stats before = launcher.getStats();
+
+	// Far faster than processes can be started, so the queue fills up
+	const int REQUESTS = 200;
+	bool anyRefused = false;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < REQUESTS; i++)
+		anyRefused = !launcher.enqueue(L"true", L"full " + std::to_wstring(i)) || anyRefused;
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	CHECK(anyRefused);
+	// Requests never wait for a launch; 200 of them take far less than a single one
+	CHECK(elapsed < std::chrono::milliseconds(50));
+
+	Launcher::Stats after = launcher.getStats();
+	CHECK(after.dropped > before.dropped);
+	unsigned long long accepted = REQUESTS - (after.dropped - before.dropped);
+	CHECK(accepted >= Launcher::QUEUE_CAPACITY);
+	CHECK(WaitForLaunches(before.launched + before.failed + accepted));
+	CHECK_EQUAL(before.launched + accepted, launcher.getStats().launched);
+}
+
+
+int main()
+{
+	TestDebounce();
+	TestFailure();
+	TestArguments();
+	TestFullQueue();
+	return Tests::Result();
+}
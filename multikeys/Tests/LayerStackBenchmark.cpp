@@ -0,0 +1,153 @@
+// Benchmark of transparent layers (Layer::transparent), which the spec flattens into a table each
+// when it's built (KeyboardSpec::_flattenTransparentLayers). A stack of 1 to 16 layers over a base
+// layer of 100 keys: layer k is triggered by modifiers M1 to Mk, so the one below it is layer
+// k - 1, and maps 3 keys of its own. With every modifier held, the top layer is active, and
+// most keys fall through to the base. For each depth: the time to compile the spec, the memory
+// of the flattened tables, and the cost of looking keys up in the top layer, against walking
+// the stack down to the first layer mapping the key, as without flattening; then whole
+// keystrokes evaluated by a keyboard.
+// Not run by ctest; run it by hand:
+//		LayerStackBenchmark [lookups]
+
+#include "../Remapper/Keyboard.h"
+#include "../Remapper/CommandPool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static const BYTE FIRST_KEY = 0x02;
+static const size_t KEY_COUNT = 100;
+static const size_t KEYS_PER_LAYER = 3;
+static const BYTE FIRST_MODIFIER = 0x80;		// Modifier k is E0 FIRST_MODIFIER + k
+
+
+static std::wstring ModifierName(size_t k)
+{
+	return L"M" + std::to_wstring(k);
+}
+
+// The base layer and depth transparent layers over it, in order; the top one is last.
+static std::vector<std::shared_ptr<const Layer>> MakeLayers(CommandPool* pool, size_t depth)
+{
+	std::vector<std::shared_ptr<const Layer>> layers;
+	std::unordered_map<Scancode, BaseKeystrokeCommand*> base;
+	for (size_t k = 0; k < KEY_COUNT; k++)
+		base[Scancode((BYTE)(FIRST_KEY + k))] = pool->internUnicode(std::vector<unsigned int>(1, 0x21 + k), false);
+	layers.push_back(std::make_shared<Layer>(std::vector<std::wstring>(), base));
+
+	std::vector<std::wstring> modifiers;
+	for (size_t d = 1; d <= depth; d++)
+	{
+		modifiers.push_back(ModifierName(d));
+		std::unordered_map<Scancode, BaseKeystrokeCommand*> keys;
+		for (size_t k = 0; k < KEYS_PER_LAYER; k++)
+		{
+			size_t key = ((d - 1) * KEYS_PER_LAYER + k) % KEY_COUNT;
+			keys[Scancode((BYTE)(FIRST_KEY + key))] = pool->internUnicode(std::vector<unsigned int>(1, 0x100 * d + k), false);
+		}
+		layers.push_back(std::make_shared<Layer>(modifiers, keys, std::vector<ChordDefinition>(), nullptr, true));
+	}
+	return layers;
+}
+
+static std::shared_ptr<const KeyboardSpec> MakeSpec(CommandPool* pool, const std::vector<std::shared_ptr<const Layer>>& layers,
+	size_t depth)
+{
+	std::vector<PModifier> modifiers;
+	for (size_t d = 1; d <= depth; d++)
+		modifiers.push_back(new SimpleModifier(ModifierName(d), Scancode(false, true, (BYTE)(FIRST_MODIFIER + d))));
+	return std::make_shared<KeyboardSpec>(L"Bench", layers, modifiers, 0, nullptr, pool);
+}
+
+
+static double Nanoseconds(Clock::duration duration, size_t count)
+{
+	return std::chrono::duration<double, std::nano>(duration).count() / count;
+}
+
+// Runs the lookups for a stack of the given depth; prints a row of the table.
+static void Run(size_t depth, const std::vector<Scancode>& keys)
+{
+	CommandPool pool;
+	std::vector<std::shared_ptr<const Layer>> layers = MakeLayers(&pool, depth);
+
+	const size_t BUILDS = 200;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < BUILDS; i++)
+		MakeSpec(&pool, layers, depth);
+	double buildTime = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / BUILDS;
+
+	std::shared_ptr<const KeyboardSpec> spec = MakeSpec(&pool, layers, depth);
+	ModifierMask all = ((ModifierMask)1 << depth) - 1;
+	const Layer* top = spec->findLayer(all);
+
+	// The flattened top layer: a single lookup
+	size_t found = 0;
+	start = Clock::now();
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		if (top->getCommand(keys[i]))
+			found++;
+	}
+	double flattenedTime = Nanoseconds(Clock::now() - start, keys.size());
+
+	// Down the stack of the original layers, to the first one mapping the key
+	size_t walked = 0;
+	start = Clock::now();
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		for (size_t l = layers.size(); l > 0; l--)
+		{
+			if (layers[l - 1]->getCommand(keys[i]))
+			{
+				walked++;
+				break;
+			}
+		}
+	}
+	double walkTime = Nanoseconds(Clock::now() - start, keys.size());
+
+	// A keyboard with every modifier held
+	Keyboard keyboard(spec);
+	PKeystrokeCommand action;
+	bool repeated;
+	for (size_t d = 1; d <= depth; d++)
+		keyboard.evaluateKey(Scancode(false, true, (BYTE)(FIRST_MODIFIER + d)), 0, false, &action, &repeated);
+	start = Clock::now();
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		keyboard.evaluateKey(keys[i], 0, false, &action, &repeated);
+		keyboard.evaluateKey(keys[i], 0, true, &action, &repeated);
+	}
+	double keyboardTime = Nanoseconds(Clock::now() - start, keys.size());
+
+	printf("  %6zu  %10.1f  %12zu  %12.1f  %12.1f  %12.1f%s\n", depth, buildTime, spec->getFlattenedMemoryUsage(),
+		flattenedTime, walkTime, keyboardTime, found == walked ? "" : "  (walking found other keys)");
+}
+
+
+int main(int argc, char* argv[])
+{
+	long count = argc > 1 ? atol(argv[1]) : 2000000;
+	if (count <= 0)
+		count = 2000000;
+
+	std::mt19937 random(9);
+	std::vector<Scancode> keys;
+	for (long i = 0; i < count; i++)
+		keys.push_back(Scancode((BYTE)(FIRST_KEY + random() % KEY_COUNT)));
+
+	printf("%ld keys looked up in the top layer of each stack; compiling in microseconds, lookups in nanoseconds:\n", count);
+	printf("  %6s  %10s  %12s  %12s  %12s  %12s\n", "depth", "compile", "table bytes", "flattened", "walked", "keystroke");
+	const size_t depths[] = { 1, 2, 4, 8, 16 };
+	for (size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); i++)
+		Run(depths[i], keys);
+	return 0;
+}
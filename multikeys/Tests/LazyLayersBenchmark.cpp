@@ -0,0 +1,199 @@
+// Benchmark of layers built on first activation (Layer::build): a keyboard with 40 layers, of
+// which a session only uses 3, loaded with every layer built up front, with layers left until
+// first activated, and with those also built by a background thread right after loading.
+// Each is measured in a process of its own: the time until the first keystroke is evaluated,
+// what the first keystroke in each other layer costs, and the memory resident afterwards.
+// Layers are read from a text of their keys, parsed here; the settings file, and Xerces, aren't.
+// Not run by ctest; run it by hand:
+//		LazyLayersBenchmark [keys per layer]
+
+#include "../Remapper/Keyboard.h"
+#include "../Remapper/CommandPool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t LAYER_COUNT = 40;
+static const size_t MODIFIER_COUNT = 6;		// Enough for a combination per layer
+static const BYTE FIRST_MODIFIER = 0x3b;	// F1 to F6
+static const BYTE FIRST_KEY = 0x02;
+
+
+static double Microseconds(Clock::duration duration)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count() / 1000.0;
+}
+
+// Resident memory of this process, in KiB
+static long ResidentKiB()
+{
+	long pages = 0, resident = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm)
+	{
+		if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(statm);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+// A layer kept as the text of its keys ("scancode codepoint" pairs, in hexadecimal), the way
+// XmlLayerSource keeps its element; reading it interns each character.
+class TextLayerSource : public LayerSource
+{
+public:
+	TextLayerSource(const std::string& text, CommandPool* pool) : text(text), pool(pool) { }
+
+	bool build(OUT std::unordered_map<Scancode, BaseKeystrokeCommand*> *const out_layout,
+		OUT std::vector<ChordDefinition> *const) const override
+	{
+		std::istringstream keys(text);
+		unsigned int scancode, codepoint;
+		while (keys >> std::hex >> scancode >> codepoint)
+			(*out_layout)[Scancode((BYTE)scancode)] = pool->internUnicode(std::vector<unsigned int>(1, codepoint), false);
+		return true;
+	}
+
+	size_t getMemoryUsage() const override
+	{
+		return sizeof(*this) + text.capacity();
+	}
+
+private:
+	const std::string text;
+	CommandPool* const pool;
+};
+
+
+// Text of a layer: each key types a character of its own
+static std::string LayerText(size_t layer, size_t keyCount)
+{
+	std::ostringstream text;
+	for (size_t k = 0; k < keyCount; k++)
+		text << std::hex << FIRST_KEY + k << ' ' << 0x4e00 + layer * 256 + k << ' ';
+	return text.str();
+}
+
+// Names of the modifiers of a layer: layer i is triggered by the modifiers of the bits of i
+static std::vector<std::wstring> LayerModifiers(size_t layer)
+{
+	std::vector<std::wstring> names;
+	for (size_t m = 0; m < MODIFIER_COUNT; m++)
+	{
+		if (layer & (1 << m))
+			names.push_back(L"M" + std::to_wstring(m));
+	}
+	return names;
+}
+
+
+enum class Mode { Eager, Lazy, Prewarm };
+
+// Loads the keyboard, then types a key in the layer without modifiers and in two others.
+// Prints a row of the table.
+static void Run(Mode mode, size_t keyCount)
+{
+	long residentBefore = ResidentKiB();
+	Clock::time_point start = Clock::now();
+
+	// Load. As the parser does, the layer without modifiers is built right away in every mode.
+	CommandPool* pool = new CommandPool();
+	std::vector<std::shared_ptr<const Layer>> layers;
+	for (size_t i = 0; i < LAYER_COUNT; i++)
+	{
+		std::unique_ptr<const LayerSource> source(new TextLayerSource(LayerText(i, keyCount), pool));
+		std::shared_ptr<Layer> layer = std::make_shared<Layer>(LayerModifiers(i), std::move(source), false, 0);
+		if (i == 0 || mode == Mode::Eager)
+			layer->build();
+		layers.push_back(layer);
+	}
+	std::vector<PModifier> modifiers;
+	for (size_t m = 0; m < MODIFIER_COUNT; m++)
+		modifiers.push_back(new SimpleModifier(L"M" + std::to_wstring(m), Scancode((BYTE)(FIRST_MODIFIER + m))));
+	std::shared_ptr<const KeyboardSpec> spec = std::make_shared<KeyboardSpec>(L"Bench", layers, modifiers, 0, nullptr, pool);
+	Keyboard* keyboard = new Keyboard(spec);
+
+	std::thread prewarm;
+	if (mode == Mode::Prewarm)
+	{
+		prewarm = std::thread([&spec, &layers]() {
+			for (size_t i = 0; i < layers.size(); i++)
+				spec->buildLayer(i);
+		});
+	}
+
+	// The first keystroke
+	PKeystrokeCommand action;
+	bool repeated;
+	keyboard->evaluateKey(Scancode(FIRST_KEY), 0, false, &action, &repeated);
+	Clock::duration firstKeystroke = Clock::now() - start;
+	keyboard->evaluateKey(Scancode(FIRST_KEY), 0, true, &action, &repeated);
+
+	// Then in two more layers: the modifier activates it, and the key is looked up in it
+	Clock::duration activation[2];
+	for (size_t l = 0; l < 2; l++)
+	{
+		Scancode modifier((BYTE)(FIRST_MODIFIER + l));
+		Clock::time_point pressed = Clock::now();
+		keyboard->evaluateKey(modifier, 0, false, &action, &repeated);
+		keyboard->evaluateKey(Scancode(FIRST_KEY), 0, false, &action, &repeated);
+		activation[l] = Clock::now() - pressed;
+		keyboard->evaluateKey(Scancode(FIRST_KEY), 0, true, &action, &repeated);
+		keyboard->evaluateKey(modifier, 0, true, &action, &repeated);
+	}
+
+	if (prewarm.joinable())
+		prewarm.join();
+	size_t built = 0;
+	for (size_t i = 0; i < layers.size(); i++)
+		built += layers[i]->isBuilt() ? 1 : 0;
+
+	const char* names[] = { "built at load", "on activation", "with prewarm" };
+	printf("  %-14s  %10.0f  %10.1f  %10.1f  %8zu  %10ld\n", names[(int)mode], Microseconds(firstKeystroke),
+		Microseconds(activation[0]), Microseconds(activation[1]), built, ResidentKiB() - residentBefore);
+
+	delete keyboard;
+	spec.reset();
+	layers.clear();
+	delete pool;
+}
+
+
+int main(int argc, char* argv[])
+{
+	int keyCount = argc > 1 ? atoi(argv[1]) : 80;
+	if (keyCount <= 0 || keyCount > 0x50)
+		keyCount = 80;
+
+	printf("%zu layers of %d keys, 3 used; times in microseconds, memory in KiB:\n", LAYER_COUNT, keyCount);
+	printf("  %-14s  %10s  %10s  %10s  %8s  %10s\n", "layers", "first key", "layer 2", "layer 3", "built", "resident");
+	const Mode modes[] = { Mode::Eager, Mode::Lazy, Mode::Prewarm };
+	for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+	{
+		// A process each, so that one's memory isn't reused by the next
+		fflush(stdout);
+		pid_t child = fork();
+		if (child == 0)
+		{
+			Run(modes[i], (size_t)keyCount);
+			fflush(stdout);
+			_exit(0);
+		}
+		if (child > 0)
+			waitpid(child, nullptr, 0);
+	}
+	return 0;
+}
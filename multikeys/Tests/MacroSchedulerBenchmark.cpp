@@ -0,0 +1,220 @@
+// Benchmark of the macro scheduler (Remapper/MacroScheduler.h). First its overhead on the thread
+// that executes commands: starting a timed macro and cancelling it, against sending a plain
+// macro of the same keystrokes at once. Then its jitter: up to 64 macros playing at once, each
+// pressing and releasing a key of its own every few ms, with every keystroke timestamped as
+// SendInput gets it. Lateness is how long after it was due each step is sent; the threads of
+// the process are counted while they play, and the CPU time they take, per step.
+// Not run by ctest; run it by hand:
+//		MacroSchedulerBenchmark [steps per macro] [milliseconds between steps]
+
+#include "../Remapper/KeystrokeCommands.h"
+#include "../Remapper/MacroScheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <sys/resource.h>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static const BYTE FIRST_VIRTUAL_KEY = 0x30;		// Macro i presses FIRST_VIRTUAL_KEY + i
+
+
+// Keystrokes SendInput got: when, and which virtual key
+struct Sent
+{
+	Clock::time_point at;
+	BYTE virtualKey;
+};
+
+static std::mutex sentMutex;
+static std::vector<Sent> sent;
+
+static UINT RecordInputs(UINT count, const INPUT* inputs)
+{
+	Clock::time_point now = Clock::now();
+	std::lock_guard<std::mutex> lock(sentMutex);
+	for (UINT i = 0; i < count; i++)
+		sent.push_back(Sent{ now, (BYTE)inputs[i].ki.wVk });
+	return count;
+}
+
+static UINT DiscardInputs(UINT count, const INPUT*)
+{
+	return count;
+}
+
+
+// Presses and releases a key, stepCount keystrokes in all, a step each, pause ms apart
+static TimedMacroCommand* MakeMacro(BYTE virtualKey, size_t stepCount, DWORD pause)
+{
+	std::vector<unsigned short> keypresses;
+	std::vector<MacroStep> steps;
+	for (size_t i = 0; i < stepCount; i++)
+	{
+		keypresses.push_back((unsigned short)(virtualKey | (i % 2 ? 0x8000 : 0)));
+		steps.push_back(MacroStep{ i, 1, pause });
+	}
+	return new TimedMacroCommand(keypresses, steps, false);
+}
+
+
+// Threads of this process, from /proc/self/status
+static int ThreadCount()
+{
+	int threads = 0;
+	FILE* status = fopen("/proc/self/status", "r");
+	if (status)
+	{
+		char line[256];
+		while (fgets(line, sizeof(line), status))
+		{
+			if (strncmp(line, "Threads:", 8) == 0)
+				threads = atoi(line + 8);
+		}
+		fclose(status);
+	}
+	return threads;
+}
+
+// User and system CPU time of this process, in microseconds
+static double CpuMicroseconds()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec * 1e6 + usage.ru_utime.tv_usec + usage.ru_stime.tv_sec * 1e6 + usage.ru_stime.tv_usec;
+}
+
+
+static double Percentile(std::vector<double>& values, double fraction)
+{
+	if (values.empty())
+		return 0;
+	size_t index = std::min(values.size() - 1, (size_t)(values.size() * fraction));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+
+// Times starting and cancelling a timed macro, and sending a plain one, with nothing recorded
+static void TimeOverhead(size_t stepCount)
+{
+	const size_t REPEATS = 200000;
+	PortableSendInputHandler() = DiscardInputs;
+	TimedMacroCommand* timed = MakeMacro(FIRST_VIRTUAL_KEY, stepCount, 1000);
+	std::vector<unsigned short> keypresses;
+	for (size_t i = 0; i < stepCount; i++)
+		keypresses.push_back((unsigned short)(FIRST_VIRTUAL_KEY | (i % 2 ? 0x8000 : 0)));
+	MacroCommand plain(&keypresses, false);
+
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < REPEATS; i++)
+	{
+		timed->execute(false, false);
+		MacroScheduler::shared().cancel(timed);
+	}
+	double timedTime = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / REPEATS;
+
+	start = Clock::now();
+	for (size_t i = 0; i < REPEATS; i++)
+		timed->execute(false, false);		// Starts over each time
+	double restartTime = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / REPEATS;
+	MacroScheduler::shared().cancel(timed);
+
+	start = Clock::now();
+	for (size_t i = 0; i < REPEATS; i++)
+		plain.execute(false, false);
+	double plainTime = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / REPEATS;
+	delete timed;
+
+	printf("On the thread executing commands, in nanoseconds, macros of %zu keystrokes:\n", stepCount);
+	printf("  %-36s  %8.1f\n", "timed: start and cancel", timedTime);
+	printf("  %-36s  %8.1f\n", "timed: triggered again while playing", restartTime);
+	printf("  %-36s  %8.1f\n", "plain: sent at once", plainTime);
+}
+
+
+// Plays macroCount macros at once until they're done; prints a row of the table.
+static void TimeJitter(size_t macroCount, size_t stepCount, DWORD pause)
+{
+	std::vector<TimedMacroCommand*> macros;
+	for (size_t m = 0; m < macroCount; m++)
+		macros.push_back(MakeMacro((BYTE)(FIRST_VIRTUAL_KEY + m), stepCount, pause));
+	{
+		std::lock_guard<std::mutex> lock(sentMutex);
+		sent.clear();
+		sent.reserve(macroCount * stepCount);
+	}
+	PortableSendInputHandler() = RecordInputs;
+	MacroScheduler::Stats before = MacroScheduler::shared().getStats();
+
+	// Started a little apart, as keys pressed one after another would start them
+	std::vector<Clock::time_point> starts;
+	double cpuBefore = CpuMicroseconds();
+	for (size_t m = 0; m < macroCount; m++)
+	{
+		starts.push_back(Clock::now());
+		macros[m]->execute(false, false);
+	}
+	int threads = 0;
+	while (true)
+	{
+		threads = std::max(threads, ThreadCount());
+		std::this_thread::sleep_for(std::chrono::milliseconds(pause));
+		std::lock_guard<std::mutex> lock(sentMutex);
+		if (sent.size() >= macroCount * stepCount)
+			break;
+	}
+	double cpu = CpuMicroseconds() - cpuBefore;
+	MacroScheduler::Stats after = MacroScheduler::shared().getStats();
+
+	// The n-th keystroke of a macro's key is its n-th step, due n pauses after it started
+	std::vector<double> lateness;
+	std::vector<size_t> stepsSent(macroCount, 0);
+	for (size_t i = 0; i < sent.size(); i++)
+	{
+		size_t m = sent[i].virtualKey - FIRST_VIRTUAL_KEY;
+		Clock::time_point due = starts[m] + std::chrono::milliseconds(pause * stepsSent[m]);
+		stepsSent[m]++;
+		if (stepsSent[m] > 1)		// The first is sent by start itself
+			lateness.push_back(std::chrono::duration<double, std::milli>(sent[i].at - due).count());
+	}
+	printf("  %8zu  %8.2f  %8.2f  %8.2f  %8.2f  %8llu  %8d  %10.1f\n", macroCount,
+		Percentile(lateness, 0.5), Percentile(lateness, 0.99),
+		lateness.empty() ? 0.0 : *std::max_element(lateness.begin(), lateness.end()),
+		lateness.empty() ? 0.0 : *std::min_element(lateness.begin(), lateness.end()),
+		after.completed - before.completed, threads, cpu / (macroCount * stepCount));
+
+	PortableSendInputHandler() = nullptr;
+	for (size_t m = 0; m < macroCount; m++)
+		delete macros[m];
+}
+
+
+int main(int argc, char* argv[])
+{
+	int stepCount = argc > 1 ? atoi(argv[1]) : 20;
+	if (stepCount <= 0)
+		stepCount = 20;
+	int pause = argc > 2 ? atoi(argv[2]) : 10;
+	if (pause <= 0)
+		pause = 10;
+
+	TimeOverhead((size_t)stepCount);
+
+	printf("\nMacros of %d steps, %d ms apart; lateness of the steps in ms; CPU in microseconds per step:\n",
+		stepCount, pause);
+	printf("  %8s  %8s  %8s  %8s  %8s  %8s  %8s  %10s\n", "macros", "p50", "p99", "max", "min",
+		"done", "threads", "CPU");
+	const size_t macroCounts[] = { 1, 16, 64 };
+	for (size_t i = 0; i < sizeof(macroCounts) / sizeof(macroCounts[0]); i++)
+		TimeJitter(macroCounts[i], (size_t)stepCount, (DWORD)pause);
+	return 0;
+}
@@ -0,0 +1,184 @@
+// Benchmark of finding the modifier a key triggers (KeyboardSpec::findModifier), which every
+// keystroke does, for keyboards of 1 to 64 modifiers. Three ways:
+//	- asking each modifier in turn, through BaseModifier::matches, as findModifier did before its
+//	  table of scancodes;
+//	- specialised by capacity, as Keyboard templated on its modifier count would be: the modifiers'
+//	  scancodes in an array of 8, 16 or 64, compared all at once in a loop the compiler unrolls,
+//	  into a mask of 8, 16 or 64 bits; the class is picked when the keyboard is loaded, and
+//	  reached through a virtual call, as a type-erased Keyboard would be;
+//	- the table of scancodes findModifier now looks modifiers up in.
+// A quarter of the keys are modifiers, the rest plain keys, which every modifier has to be asked
+// about. Then whole keystrokes of the same keys, evaluated by a keyboard.
+// Not run by ctest; run it by hand:
+//		ModifierLookupBenchmark [lookups]
+
+#include "../Remapper/Keyboard.h"
+#include "../Remapper/CommandPool.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static const BYTE FIRST_KEY = 0x02;
+static const size_t KEY_COUNT = 48;
+static const BYTE FIRST_MODIFIER = 0x80;		// Modifier i is E0 FIRST_MODIFIER + i
+
+
+// A scancode as a number, to be compared without branches
+static unsigned int CodeOf(Scancode sc)
+{
+	return sc.makeCode | (sc.flgE0 << 8) | (sc.flgE1 << 9);
+}
+
+// What a Keyboard templated on its modifiers would reach through its type-erased interface
+class ModifierFinder
+{
+public:
+	virtual ModifierMask find(Scancode sc) const = 0;
+	virtual ~ModifierFinder() { }
+};
+
+// The modifiers of a keyboard in a class of capacity: as many as there are bits in Mask
+template <typename Mask>
+class CapacityFinder : public ModifierFinder
+{
+	static const size_t CAPACITY = sizeof(Mask) * 8;
+	unsigned int codes[CAPACITY];
+
+public:
+	explicit CapacityFinder(const std::vector<Scancode>& scancodes)
+	{
+		for (size_t i = 0; i < CAPACITY; i++)
+			codes[i] = i < scancodes.size() ? CodeOf(scancodes[i]) : ~0u;		// matching no scancode
+	}
+
+	ModifierMask find(Scancode sc) const override
+	{
+		unsigned int code = CodeOf(sc);
+		Mask mask = 0;
+		for (size_t i = 0; i < CAPACITY; i++)
+			mask |= (Mask)(codes[i] == code) << i;
+		return mask & (~mask + 1);		// the first one, as findModifier gives
+	}
+};
+
+// The class of capacity of a number of modifiers, as it would be picked on loading
+static ModifierFinder* MakeFinder(const std::vector<Scancode>& scancodes)
+{
+	if (scancodes.size() <= 8)
+		return new CapacityFinder<uint8_t>(scancodes);
+	if (scancodes.size() <= 16)
+		return new CapacityFinder<uint16_t>(scancodes);
+	return new CapacityFinder<uint64_t>(scancodes);
+}
+
+static const char* CapacityOf(size_t modifierCount)
+{
+	return modifierCount <= 8 ? "8" : modifierCount <= 16 ? "16" : "64";
+}
+
+
+// Findings of all keys, so that none of the lookups is left out
+static volatile ModifierMask sink;
+
+static double Nanoseconds(Clock::duration duration, size_t count)
+{
+	return std::chrono::duration<double, std::nano>(duration).count() / count;
+}
+
+// Looks the keys up every way for a number of modifiers; prints a row of the table.
+static void Run(size_t modifierCount, const std::vector<Scancode>& keys)
+{
+	std::vector<Scancode> scancodes;
+	std::vector<PModifier> modifiers;
+	for (size_t i = 0; i < modifierCount; i++)
+	{
+		scancodes.push_back(Scancode(false, true, (BYTE)(FIRST_MODIFIER + i)));
+		modifiers.push_back(new SimpleModifier(L"M" + std::to_wstring(i), scancodes.back()));
+	}
+	CommandPool pool;
+	std::unordered_map<Scancode, BaseKeystrokeCommand*> layout;
+	for (size_t k = 0; k < KEY_COUNT; k++)
+		layout[Scancode((BYTE)(FIRST_KEY + k))] = pool.internUnicode(std::vector<unsigned int>(1, 0x21 + k), false);
+	std::vector<std::shared_ptr<const Layer>> layers(1, std::make_shared<Layer>(std::vector<std::wstring>(), layout));
+	std::shared_ptr<const KeyboardSpec> spec = std::make_shared<KeyboardSpec>(L"Bench", layers, modifiers, 0, nullptr, &pool);
+
+	// Asking each modifier; the spec owns them, and keeps them as long as it lives
+	ModifierMask found = 0, virtualFound = 0;
+	Clock::time_point start = Clock::now();
+	for (size_t k = 0; k < keys.size(); k++)
+	{
+		for (size_t i = 0; i < modifiers.size(); i++)
+		{
+			if (modifiers[i]->matches(keys[k]))
+			{
+				virtualFound += 1ULL << i;
+				break;
+			}
+		}
+	}
+	double virtualTime = Nanoseconds(Clock::now() - start, keys.size());
+
+	ModifierFinder* finder = MakeFinder(scancodes);
+	ModifierMask specialisedFound = 0;
+	start = Clock::now();
+	for (size_t k = 0; k < keys.size(); k++)
+		specialisedFound += finder->find(keys[k]);
+	double specialisedTime = Nanoseconds(Clock::now() - start, keys.size());
+	delete finder;
+
+	start = Clock::now();
+	for (size_t k = 0; k < keys.size(); k++)
+		found += spec->findModifier(keys[k]);
+	double tableTime = Nanoseconds(Clock::now() - start, keys.size());
+	sink = found + virtualFound + specialisedFound;
+
+	Keyboard keyboard(spec);
+	PKeystrokeCommand action;
+	bool repeated;
+	start = Clock::now();
+	for (size_t k = 0; k < keys.size(); k++)
+	{
+		keyboard.evaluateKey(keys[k], 0, false, &action, &repeated);
+		keyboard.evaluateKey(keys[k], 0, true, &action, &repeated);
+	}
+	double keyboardTime = Nanoseconds(Clock::now() - start, keys.size());
+
+	printf("  %9zu  %12.1f  %8s  %12.1f  %8.1f  %10.1f%s\n", modifierCount, virtualTime, CapacityOf(modifierCount),
+		specialisedTime, tableTime, keyboardTime,
+		found == virtualFound && found == specialisedFound ? "" : "  (they found different modifiers)");
+}
+
+
+int main(int argc, char* argv[])
+{
+	long count = argc > 1 ? atol(argv[1]) : 10000000;
+	if (count <= 0)
+		count = 10000000;
+
+	printf("%ld keys, a quarter of them modifiers; nanoseconds per key:\n", count);
+	printf("  %9s  %12s  %8s  %12s  %8s  %10s\n", "modifiers", "each asked", "capacity", "specialised", "table",
+		"keystroke");
+	const size_t modifierCounts[] = { 1, 2, 4, 8, 16, 32, 64 };
+	for (size_t c = 0; c < sizeof(modifierCounts) / sizeof(modifierCounts[0]); c++)
+	{
+		// The same plain keys for every count, and its own modifiers
+		std::mt19937 random(5);
+		std::vector<Scancode> keys;
+		for (long i = 0; i < count; i++)
+		{
+			if (random() % 4 == 0)
+				keys.push_back(Scancode(false, true, (BYTE)(FIRST_MODIFIER + random() % modifierCounts[c])));
+			else
+				keys.push_back(Scancode((BYTE)(FIRST_KEY + random() % KEY_COUNT)));
+		}
+		Run(modifierCounts[c], keys);
+	}
+	return 0;
+}
@@ -0,0 +1,163 @@
+// Benchmark of the table of pressed keys (Remapper/PressedKeys.h), through which repeats and
+// releases go to the command their key got when pressed. First the table alone: a press, a
+// repeat and a release, with more and more other keys held down, since slots are scanned.
+// Then whole keystrokes evaluated by a keyboard, against what evaluation did before the table:
+// find whether the key is a modifier, then look every event up in the active layer.
+// Not run by ctest; run it by hand:
+//		PressedKeysBenchmark [keystrokes]
+
+#include "../Remapper/Keyboard.h"
+#include "../Remapper/CommandPool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static const BYTE FIRST_KEY = 0x10;
+static const size_t KEY_COUNT = 26;
+static const BYTE KEY_SHIFT = 0x2a;
+
+
+static double Nanoseconds(Clock::duration duration, size_t count)
+{
+	return std::chrono::duration<double, std::nano>(duration).count() / count;
+}
+
+
+// A plain layer and a shifted one, of letters
+static std::shared_ptr<const KeyboardSpec> MakeSpec(CommandPool* pool)
+{
+	std::unordered_map<Scancode, BaseKeystrokeCommand*> plain, shifted;
+	for (size_t k = 0; k < KEY_COUNT; k++)
+	{
+		plain[Scancode((BYTE)(FIRST_KEY + k))] = pool->internUnicode(std::vector<unsigned int>(1, L'a' + k), false);
+		shifted[Scancode((BYTE)(FIRST_KEY + k))] = pool->internUnicode(std::vector<unsigned int>(1, L'A' + k), false);
+	}
+	std::vector<std::shared_ptr<const Layer>> layers;
+	layers.push_back(std::make_shared<Layer>(std::vector<std::wstring>(), plain));
+	layers.push_back(std::make_shared<Layer>(std::vector<std::wstring>(1, L"Shift"), shifted));
+	std::vector<PModifier> modifiers(1, new SimpleModifier(L"Shift", Scancode(KEY_SHIFT)));
+	return std::make_shared<KeyboardSpec>(L"Bench", layers, modifiers, 0, nullptr, pool);
+}
+
+
+// Press, repeat and release of a key while other keys stay held down
+static void TimeTable(size_t count, size_t held)
+{
+	PressedKeys keys;
+	keys.clear();
+	for (size_t h = 0; h < held; h++)
+		keys.press((USHORT)(0x40 + h), 0, nullptr);
+
+	size_t found = 0;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < count; i++)
+	{
+		USHORT key = (USHORT)(FIRST_KEY + i % KEY_COUNT);
+		if (!keys.isPressed(key))
+			keys.press(key, (DWORD)i, nullptr);
+		size_t slot = keys.findSlot(key);		// The repeat
+		if (slot != PressedKeys::NO_SLOT)
+		{
+			keys.slotTimes[slot] = (DWORD)i;
+			found++;
+		}
+		keys.release(key);
+	}
+	Clock::duration elapsed = Clock::now() - start;
+
+	// Each time with a key down, so that there's something to release
+	volatile unsigned long long sink = 0;
+	start = Clock::now();
+	for (size_t i = 0; i < count; i++)
+	{
+		keys.press((USHORT)(i % PressedKeys::KEY_COUNT), 0, nullptr);
+		keys.clear();
+		sink = sink + keys.bits[i % (PressedKeys::KEY_COUNT / 64)];
+	}
+	Clock::duration cleared = Clock::now() - start;
+
+	printf("  %8zu  %14.1f  %14.1f%s\n", held, Nanoseconds(elapsed, count), Nanoseconds(cleared, count),
+		found == count ? "" : "  (slots full)");
+}
+
+
+// Evaluates count keystrokes, each a press, a repeat and a release, Shift held every 4th
+static Clock::duration TimeKeyboard(Keyboard& keyboard, size_t count)
+{
+	PKeystrokeCommand action;
+	bool repeated;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < count; i++)
+	{
+		Scancode key((BYTE)(FIRST_KEY + i % KEY_COUNT));
+		bool shift = i % 4 == 3;
+		if (shift)
+			keyboard.evaluateKey(Scancode(KEY_SHIFT), 0, false, &action, &repeated);
+		keyboard.evaluateKey(key, 0, false, &action, &repeated);
+		keyboard.evaluateKey(key, 0, false, &action, &repeated);
+		keyboard.evaluateKey(key, 0, true, &action, &repeated);
+		if (shift)
+			keyboard.evaluateKey(Scancode(KEY_SHIFT), 0, true, &action, &repeated);
+	}
+	return Clock::now() - start;
+}
+
+// The same events, each looked up in the layer its modifiers select, as before the table
+static Clock::duration TimeLayerLookups(const KeyboardSpec& spec, size_t count)
+{
+	ModifierMask modifiers = 0;
+	const Layer* layer = spec.findLayer(0);
+	size_t found = 0;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < count; i++)
+	{
+		Scancode key((BYTE)(FIRST_KEY + i % KEY_COUNT));
+		bool shift = i % 4 == 3;
+		Scancode events[5] = { Scancode(KEY_SHIFT), key, key, key, Scancode(KEY_SHIFT) };
+		bool keyUps[5] = { false, false, false, true, true };
+		for (size_t e = shift ? 0 : 1; e < (shift ? 5u : 4u); e++)
+		{
+			ModifierMask modifier = spec.findModifier(events[e]);
+			if (modifier)
+			{
+				modifiers = keyUps[e] ? modifiers & ~modifier : modifiers | modifier;
+				layer = spec.findLayer(modifiers);
+			}
+			else if (layer && layer->getCommand(events[e]))
+				found++;
+		}
+	}
+	Clock::duration elapsed = Clock::now() - start;
+	if (found == 0)
+		printf("Nothing found\n");
+	return elapsed;
+}
+
+
+int main(int argc, char* argv[])
+{
+	long count = argc > 1 ? atol(argv[1]) : 2000000;
+	if (count <= 0)
+		count = 2000000;
+
+	printf("Table alone, in nanoseconds: a press, a repeat and a release; a press, then releasing every key\n");
+	printf("  %8s  %14s  %14s\n", "held", "keystroke", "release all");
+	const size_t heldCounts[] = { 0, 4, 10, 15, 16 };
+	for (size_t i = 0; i < sizeof(heldCounts) / sizeof(heldCounts[0]); i++)
+		TimeTable((size_t)count, heldCounts[i]);
+
+	CommandPool pool;
+	std::shared_ptr<const KeyboardSpec> spec = MakeSpec(&pool);
+	Keyboard keyboard(spec);
+	Clock::duration evaluated = TimeKeyboard(keyboard, (size_t)count);
+	Clock::duration lookedUp = TimeLayerLookups(*spec, (size_t)count);
+	printf("\nKeystrokes of a press, a repeat and a release, in nanoseconds each:\n");
+	printf("  %-26s  %10.1f\n", "evaluated by a keyboard", Nanoseconds(evaluated, (size_t)count));
+	printf("  %-26s  %10.1f\n", "layer lookups only", Nanoseconds(lookedUp, (size_t)count));
+	return 0;
+}
@@ -0,0 +1,302 @@
+// Benchmark of sharded evaluation (MultikeysCore/EvaluationShards.h) with 8 devices: a macro pad
+// repeating a key in long bursts, as fast as keystrokes can come, and 7 keyboards typing in
+// between. The core's pipeline is rebuilt here with its own queues: one thread (raw input)
+// numbers the keystrokes and hands each to its device's shard, waiting on an event when the
+// shard is full; shards evaluate their keyboards; one thread (the hook window) puts decisions
+// back in arrival order. With no shards, the raw input thread evaluates every keystroke itself.
+// Latency is from a keystroke's arrival to its decision being taken in order, so it includes
+// the wait behind the bursts; it's reported apart for the macro pad and for the keyboards.
+// The shards can only evaluate in parallel on as many cores as there are, which is printed first.
+// Not run by ctest; run it by hand:
+//		ShardsBenchmark [keystrokes]
+
+#include "../Remapper/Keyboard.h"
+#include "../Remapper/CommandPool.h"
+#include "../MultikeysCore/SpscQueue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <thread>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t DEVICE_COUNT = 8;		// Device 0 is the macro pad
+static const size_t MAX_SHARDS = 8;
+static const size_t QUEUE_CAPACITY = 256;	// As SHARD_QUEUE_CAPACITY
+static const size_t BURST_LENGTH = 64;		// Repeats of the macro key in a row
+static const BYTE FIRST_KEY = 0x10;
+static const size_t KEY_COUNT = 26;
+static const BYTE KEY_ACUTE = 0x1a;
+
+
+// Auto-reset event, like those CreateEvent(NULL, FALSE, FALSE, NULL) makes
+class Event
+{
+public:
+	Event() : signaled(false) { }
+
+	void set()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		signaled = true;
+		condition.notify_one();
+	}
+
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		condition.wait(lock, [this]() { return signaled; });
+		signaled = false;
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool signaled;
+};
+
+
+struct Job
+{
+	unsigned long long sequence;
+	Clock::time_point arrival;
+	size_t device;
+	BYTE makeCode;
+	bool keyUp;
+	bool stop;
+};
+
+struct Decision
+{
+	unsigned long long sequence;
+	Clock::time_point arrival;
+	size_t device;
+	PKeystrokeCommand action;
+	bool remapped;
+};
+
+// A queue whose producer sleeps while it's full, as SubmitToShard and the shards do: the
+// consumer signals space when it takes an item while the producer is waiting.
+template <typename T>
+struct WaitingQueue
+{
+	SpscQueue<T, QUEUE_CAPACITY> queue;
+	std::atomic<bool> producerWaiting;
+	Event space;
+
+	WaitingQueue() : producerWaiting(false) { }
+
+	// consumerWake - set after pushing, and before waiting, in case the consumer missed it
+	void push(const T& item, Event& consumerWake)
+	{
+		while (!queue.tryPush(item))
+		{
+			producerWaiting.store(true);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (queue.tryPush(item))
+				break;
+			consumerWake.set();
+			space.wait();
+		}
+		consumerWake.set();
+	}
+
+	bool pop(T* item)
+	{
+		if (!queue.tryPop(item))
+			return false;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (producerWaiting.exchange(false))
+			space.set();
+		return true;
+	}
+};
+
+struct Shard
+{
+	WaitingQueue<Job> jobs;
+	WaitingQueue<Decision> decisions;
+	Event jobEvent;
+	std::thread thread;
+};
+
+
+// Letters, and an acute dead key, in a single layer shared by every device
+static std::shared_ptr<const KeyboardSpec> MakeSpec(CommandPool* pool)
+{
+	std::unordered_map<Scancode, BaseKeystrokeCommand*> layout;
+	for (size_t k = 0; k < KEY_COUNT; k++)
+		layout[Scancode((BYTE)(FIRST_KEY + k))] = pool->internUnicode(std::vector<unsigned int>(1, L'a' + k), false);
+	layout[Scancode(KEY_ACUTE)] = pool->adopt(new DeadKeyCommand({ 0xb4 },
+		std::unordered_map<const UnicodeCommand*, UnicodeCommand*>(), 0, 0x301));
+	std::vector<std::shared_ptr<const Layer>> layers(1, std::make_shared<Layer>(std::vector<std::wstring>(), layout));
+	return std::make_shared<KeyboardSpec>(L"Bench", layers, std::vector<PModifier>(), 0, nullptr, pool);
+}
+
+// The keystrokes, in arrival order: a burst of the macro key after every 32 keystrokes of the
+// keyboards, which take turns. A press and its release are two keystrokes.
+static std::vector<Job> MakeJobs(size_t count)
+{
+	std::vector<Job> jobs;
+	size_t typed = 0;
+	while (jobs.size() < count)
+	{
+		if (typed % 32 == 0)
+		{
+			for (size_t i = 0; i < BURST_LENGTH; i++)
+				jobs.push_back(Job{ 0, Clock::time_point(), 0, FIRST_KEY, false, false });
+			jobs.push_back(Job{ 0, Clock::time_point(), 0, FIRST_KEY, true, false });
+		}
+		size_t device = 1 + typed % (DEVICE_COUNT - 1);
+		BYTE key = (BYTE)(typed % 8 == 7 ? KEY_ACUTE : FIRST_KEY + typed % KEY_COUNT);
+		jobs.push_back(Job{ 0, Clock::time_point(), device, key, false, false });
+		jobs.push_back(Job{ 0, Clock::time_point(), device, key, true, false });
+		typed++;
+	}
+	for (size_t i = 0; i < jobs.size(); i++)
+		jobs[i].sequence = i;
+	return jobs;
+}
+
+static Decision Evaluate(Keyboard* keyboards[], const Job& job)
+{
+	Decision decision;
+	decision.sequence = job.sequence;
+	decision.arrival = job.arrival;
+	decision.device = job.device;
+	decision.action = nullptr;
+	bool repeated = false;
+	decision.remapped = keyboards[job.device]->evaluateKey(Scancode(job.makeCode), 0, job.keyUp, &decision.action, &repeated);
+	PKeystrokeCommand deferred;
+	while (keyboards[job.device]->takeDeferredAction(&deferred))
+		;
+	return decision;
+}
+
+
+static double Percentile(std::vector<double>& values, double fraction)
+{
+	if (values.empty())
+		return 0;
+	size_t index = std::min(values.size() - 1, (size_t)(values.size() * fraction));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+// Runs every job through shardCount shards (none: the raw input thread evaluates them); prints a row.
+static void Run(const std::shared_ptr<const KeyboardSpec>& spec, std::vector<Job> jobs, size_t shardCount)
+{
+	Keyboard* keyboards[DEVICE_COUNT];
+	for (size_t d = 0; d < DEVICE_COUNT; d++)
+		keyboards[d] = new Keyboard(spec);
+	static Shard shards[MAX_SHARDS];
+	Event decisionEvent;
+	WaitingQueue<Decision> rawDecisions;		// Evaluated by the raw input thread itself
+
+	for (size_t s = 0; s < shardCount; s++)
+	{
+		Shard* shard = &shards[s];
+		shard->thread = std::thread([shard, &keyboards, &decisionEvent]()
+		{
+			while (true)
+			{
+				shard->jobEvent.wait();
+				Job job;
+				while (shard->jobs.pop(&job))
+				{
+					if (job.stop)
+						return;
+					shard->decisions.push(Evaluate(keyboards, job), decisionEvent);
+				}
+			}
+		});
+	}
+
+	// The hook window: takes decisions from every queue, and hands them on in arrival order
+	std::vector<double> padLatencies, keyboardLatencies;
+	padLatencies.reserve(jobs.size());
+	keyboardLatencies.reserve(jobs.size());
+	size_t total = jobs.size();
+	std::thread collector([&]()
+	{
+		std::map<unsigned long long, Decision> early;
+		unsigned long long next = 0;
+		while (next < total)
+		{
+			decisionEvent.wait();
+			Decision decision;
+			for (size_t s = 0; s < std::max<size_t>(shardCount, 1); s++)
+			{
+				WaitingQueue<Decision>& queue = shardCount ? shards[s].decisions : rawDecisions;
+				while (queue.pop(&decision))
+					early.emplace(decision.sequence, decision);
+			}
+			Clock::time_point now = Clock::now();
+			while (!early.empty() && early.begin()->first == next)
+			{
+				const Decision& taken = early.begin()->second;
+				double latency = std::chrono::duration<double, std::micro>(now - taken.arrival).count();
+				(taken.device == 0 ? padLatencies : keyboardLatencies).push_back(latency);
+				early.erase(early.begin());
+				next++;
+			}
+		}
+	});
+
+	// The raw input thread: keystrokes arrive as fast as it takes them
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		jobs[i].arrival = Clock::now();
+		if (shardCount == 0)
+			rawDecisions.push(Evaluate(keyboards, jobs[i]), decisionEvent);
+		else
+		{
+			Shard& shard = shards[jobs[i].device % shardCount];
+			shard.jobs.push(jobs[i], shard.jobEvent);
+		}
+	}
+	collector.join();
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	for (size_t s = 0; s < shardCount; s++)
+	{
+		Job stop = Job{ 0, Clock::time_point(), 0, 0, false, true };
+		shards[s].jobs.push(stop, shards[s].jobEvent);
+		shards[s].thread.join();
+	}
+	for (size_t d = 0; d < DEVICE_COUNT; d++)
+		delete keyboards[d];
+
+	printf("  %8zu  %12.2f  %10.1f  %10.1f  %10.1f  %10.1f\n", shardCount, total / seconds / 1e6,
+		Percentile(keyboardLatencies, 0.5), Percentile(keyboardLatencies, 0.99),
+		Percentile(padLatencies, 0.5), Percentile(padLatencies, 0.99));
+}
+
+
+int main(int argc, char* argv[])
+{
+	long count = argc > 1 ? atol(argv[1]) : 1000000;
+	if (count <= 0)
+		count = 1000000;
+
+	CommandPool pool;
+	std::shared_ptr<const KeyboardSpec> spec = MakeSpec(&pool);
+	std::vector<Job> jobs = MakeJobs((size_t)count);
+
+	printf("%u cores; %zu keystrokes from %zu devices, in millions a second; latencies in microseconds:\n",
+		std::thread::hardware_concurrency(), jobs.size(), DEVICE_COUNT);
+	printf("  %8s  %12s  %10s  %10s  %10s  %10s\n", "shards", "rate", "keys p50", "keys p99", "pad p50", "pad p99");
+	const size_t shardCounts[] = { 0, 1, 2, 4, 8 };
+	for (size_t i = 0; i < sizeof(shardCounts) / sizeof(shardCounts[0]); i++)
+		Run(spec, jobs, shardCounts[i]);
+	return 0;
+}
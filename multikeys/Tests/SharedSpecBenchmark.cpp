@@ -0,0 +1,190 @@
+// Benchmark of keyboards sharing a compiled spec (Remapper/KeyboardSpec.h): 100 instances of
+// one layout, each with a spec of its own as when every device loaded the layout, and all
+// sharing a single spec. Each is measured in a process of its own, by the memory resident
+// afterwards; then the cost of creating, snapshotting and resetting an instance's state.
+// Not run by ctest; run it by hand:
+//		SharedSpecBenchmark [instances]
+
+#include "../Remapper/Keyboard.h"
+#include "../Remapper/CommandPool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t LAYER_COUNT = 4;		// Plain, Shift, AltGr, Shift+AltGr
+static const size_t KEY_COUNT = 80;
+static const BYTE FIRST_KEY = 0x02;
+static const BYTE KEY_SHIFT = 0x2a;
+static const BYTE KEY_ALTGR = 0x38;
+
+
+// Resident memory of this process, in KiB
+static long ResidentKiB()
+{
+	long pages = 0, resident = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm)
+	{
+		if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(statm);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+// A layout of four layers of characters, two of them with dead keys
+static std::shared_ptr<const KeyboardSpec> MakeSpec(CommandPool* pool)
+{
+	BaseKeystrokeCommand* deadKeys[2] = {
+		pool->adopt(new DeadKeyCommand({ 0xb4 }, std::unordered_map<const UnicodeCommand*, UnicodeCommand*>(), 0, 0x301)),
+		pool->adopt(new DeadKeyCommand({ L'`' }, std::unordered_map<const UnicodeCommand*, UnicodeCommand*>(), 0, 0x300)) };
+	const wchar_t* const names[] = { L"Shift", L"AltGr" };
+
+	std::vector<std::shared_ptr<const Layer>> layers;
+	for (size_t l = 0; l < LAYER_COUNT; l++)
+	{
+		std::unordered_map<Scancode, BaseKeystrokeCommand*> layout;
+		for (size_t k = 0; k < KEY_COUNT; k++)
+			layout[Scancode((BYTE)(FIRST_KEY + k))] = pool->internUnicode(std::vector<unsigned int>(1, 0x21 + l * 0x60 + k), false);
+		if (l < 2)
+			layout[Scancode((BYTE)(FIRST_KEY + KEY_COUNT - 1))] = deadKeys[l];
+		std::vector<std::wstring> modifiers;
+		for (size_t m = 0; m < 2; m++)
+		{
+			if (l & (1 << m))
+				modifiers.push_back(names[m]);
+		}
+		layers.push_back(std::make_shared<Layer>(modifiers, layout));
+	}
+	std::vector<PModifier> modifiers;
+	modifiers.push_back(new SimpleModifier(L"Shift", Scancode(KEY_SHIFT)));
+	modifiers.push_back(new SimpleModifier(L"AltGr", Scancode(false, true, KEY_ALTGR)));
+	return std::make_shared<KeyboardSpec>(L"Bench", layers, modifiers, 0, nullptr, pool);
+}
+
+// Types a few keys, so that each keyboard's state has been written to
+static void TypeSome(Keyboard* keyboard)
+{
+	PKeystrokeCommand action;
+	bool repeated;
+	keyboard->evaluateKey(Scancode(KEY_SHIFT), 0, false, &action, &repeated);
+	keyboard->evaluateKey(Scancode(FIRST_KEY), 0, false, &action, &repeated);
+	keyboard->evaluateKey(Scancode(FIRST_KEY), 0, true, &action, &repeated);
+	keyboard->evaluateKey(Scancode(KEY_SHIFT), 0, true, &action, &repeated);
+}
+
+
+// Loads count instances, sharing a spec or not; prints a row of the table.
+static void Run(size_t count, bool shared)
+{
+	long residentBefore = ResidentKiB();
+
+	std::vector<CommandPool*> pools;
+	std::vector<std::shared_ptr<const KeyboardSpec>> specs;
+	std::vector<Keyboard*> keyboards;
+	size_t specMemory = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (!shared || specs.empty())
+		{
+			pools.push_back(new CommandPool());
+			specs.push_back(MakeSpec(pools.back()));
+			specMemory += pools.back()->getMemoryUsage();
+			const std::vector<std::shared_ptr<const Layer>>& layers = specs.back()->getLayers();
+			for (size_t l = 0; l < layers.size(); l++)
+				specMemory += layers[l]->getMemoryUsage();
+		}
+		keyboards.push_back(new Keyboard(specs.back()));
+		TypeSome(keyboards.back());
+	}
+
+	printf("  %-14s  %8zu  %12zu  %14zu  %10ld\n", shared ? "one spec" : "a spec each", specs.size(),
+		specMemory, count * sizeof(Keyboard), ResidentKiB() - residentBefore);
+
+	for (size_t i = 0; i < keyboards.size(); i++)
+		delete keyboards[i];
+	specs.clear();
+	for (size_t i = 0; i < pools.size(); i++)
+		delete pools[i];
+}
+
+
+// Times the operations on an instance's state
+static void TimeState()
+{
+	const size_t REPEATS = 1000000;
+	CommandPool pool;
+	std::shared_ptr<const KeyboardSpec> spec = MakeSpec(&pool);
+	Keyboard keyboard(spec);
+	TypeSome(&keyboard);
+
+	Clock::time_point start = Clock::now();
+	volatile size_t sink = 0;		// Keeps the copies from being optimized away
+	for (size_t i = 0; i < REPEATS; i++)
+	{
+		Keyboard* created = new Keyboard(spec);
+		sink += (size_t)created;
+		delete created;
+	}
+	Clock::duration create = Clock::now() - start;
+
+	start = Clock::now();
+	KeyboardState snapshot;
+	for (size_t i = 0; i < REPEATS; i++)
+	{
+		snapshot = keyboard.snapshotState();
+		sink += snapshot.pressedKeys.slotKeys[0];
+	}
+	Clock::duration copy = Clock::now() - start;
+
+	start = Clock::now();
+	for (size_t i = 0; i < REPEATS; i++)
+	{
+		keyboard.resetState();
+		keyboard.restoreState(snapshot);
+	}
+	Clock::duration reset = Clock::now() - start;
+
+	printf("\nIn nanoseconds, each: create and delete a keyboard %.0f, snapshot %.0f, reset and restore %.0f\n",
+		std::chrono::duration<double, std::nano>(create).count() / REPEATS,
+		std::chrono::duration<double, std::nano>(copy).count() / REPEATS,
+		std::chrono::duration<double, std::nano>(reset).count() / REPEATS);
+}
+
+
+int main(int argc, char* argv[])
+{
+	int count = argc > 1 ? atoi(argv[1]) : 100;
+	if (count <= 0)
+		count = 100;
+
+	printf("%d instances of %zu layers of %zu keys; KeyboardState is %zu bytes, Keyboard %zu:\n",
+		count, LAYER_COUNT, KEY_COUNT, sizeof(KeyboardState), sizeof(Keyboard));
+	printf("  %-14s  %8s  %12s  %14s  %10s\n", "instances", "specs", "spec bytes", "keyboard bytes", "resident");
+	const bool modes[] = { false, true };
+	for (size_t i = 0; i < 2; i++)
+	{
+		// A process each, so that one's memory isn't reused by the next
+		fflush(stdout);
+		pid_t child = fork();
+		if (child == 0)
+		{
+			Run((size_t)count, modes[i]);
+			fflush(stdout);
+			_exit(0);
+		}
+		if (child > 0)
+			waitpid(child, nullptr, 0);
+	}
+	TimeState();
+	return 0;
+}
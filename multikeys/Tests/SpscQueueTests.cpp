@@ -0,0 +1,206 @@
+// Stress tests of the lock-free handoff (MultikeysCore/SpscQueue.h).
+//
+// Besides the basic bounds, this simulates the core's pipeline: evaluating threads (the raw
+// input thread, or shards) each publish decisions through a queue of their own, numbered in
+// the order the keystrokes arrived, and a single collecting thread (the hook window) takes
+// them from every queue and puts them back in order, as AcceptDecision does. Every decision
+// must arrive exactly once, intact, and in order, however the threads interleave.
+
+#include "../MultikeysCore/SpscQueue.h"
+#include "TestHarness.h"
+
+#include <atomic>
+#include <map>
+#include <thread>
+#include <vector>
+
+using namespace Multikeys;
+
+
+// Stands for a DecisionRecord: a sequence number, and a payload derived from it to detect torn copies
+struct FakeDecision
+{
+	unsigned long long sequence;
+	unsigned long long payload[6];
+
+	static FakeDecision make(unsigned long long sequence)
+	{
+		FakeDecision decision;
+		decision.sequence = sequence;
+		for (int i = 0; i < 6; i++)
+			decision.payload[i] = sequence * 0x9E3779B97F4A7C15ULL + i;
+		return decision;
+	}
+
+	bool isIntact() const
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			if (payload[i] != sequence * 0x9E3779B97F4A7C15ULL + i)
+				return false;
+		}
+		return true;
+	}
+};
+
+
+// Counts live instances, to check that the queue destroys exactly what it constructs
+struct Tracked
+{
+	static std::atomic<int> live;
+	int value;
+
+	Tracked() : value(0) { live++; }
+	Tracked(int value) : value(value) { live++; }
+	Tracked(const Tracked& other) : value(other.value) { live++; }
+	Tracked& operator=(const Tracked& other) { value = other.value; return *this; }
+	~Tracked() { live--; }
+};
+std::atomic<int> Tracked::live(0);
+
+
+static void TestBounds()
+{
+	SpscQueue<int, 8> queue;
+	int item = -1;
+	CHECK(!queue.tryPop(&item));
+	for (int i = 0; i < 8; i++)
+		CHECK(queue.tryPush(i));
+	CHECK(!queue.tryPush(8));			// Full
+	CHECK_EQUAL(8, queue.size());
+
+	// Wraps around many times, always in order
+	for (int i = 8; i < 1000; i++)
+	{
+		CHECK(queue.tryPop(&item));
+		CHECK_EQUAL(i - 8, item);
+		CHECK(queue.tryPush(i));
+	}
+	for (int i = 992; i < 1000; i++)
+	{
+		CHECK(queue.tryPop(&item));
+		CHECK_EQUAL(i, item);
+	}
+	CHECK(!queue.tryPop(&item));
+	CHECK_EQUAL(0, queue.size());
+}
+
+
+static void TestLifetimes()
+{
+	{
+		SpscQueue<Tracked, 16> queue;
+		Tracked item;
+		for (int i = 0; i < 10; i++)
+			queue.tryPush(Tracked(i));
+		for (int i = 0; i < 4; i++)
+			queue.tryPop(&item);
+		CHECK_EQUAL(7, Tracked::live.load());		// item, plus the six never taken
+	}
+	CHECK_EQUAL(0, Tracked::live.load());			// The queue destroyed what was left in it
+}
+
+
+// One producer, one consumer, as fast as they go; the consumer checks every item.
+static void TestSinglePair()
+{
+	const unsigned long long COUNT = 2000000;
+	// Static, like the core's queues: they're over-aligned, and large
+	static SpscQueue<FakeDecision, 1024> queue;
+	std::atomic<bool> inOrder(true);
+
+	std::thread consumer([&]()
+	{
+		FakeDecision decision;
+		for (unsigned long long expected = 0; expected < COUNT; )
+		{
+			if (!queue.tryPop(&decision))
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			if (decision.sequence != expected || !decision.isIntact())
+				inOrder = false;
+			expected++;
+		}
+	});
+
+	for (unsigned long long i = 0; i < COUNT; i++)
+	{
+		while (!queue.tryPush(FakeDecision::make(i)))
+			std::this_thread::yield();		// The raw input thread waits for space the same way
+	}
+	consumer.join();
+
+	CHECK(inOrder.load());
+	CHECK_EQUAL(0, queue.size());
+}
+
+
+// Several evaluating threads, each with its own queue, and one collector merging them by sequence.
+static void TestPipeline()
+{
+	const size_t PRODUCER_COUNT = 4;
+	const unsigned long long COUNT = 1000000;
+	typedef SpscQueue<FakeDecision, 64> ShardQueue;		// Small, so that it's often full
+
+	static ShardQueue queues[PRODUCER_COUNT];
+
+	// Keystrokes go to the shards in a fixed pattern, as keyboards are assigned to shards
+	std::vector<std::thread> producers;
+	for (size_t shard = 0; shard < PRODUCER_COUNT; shard++)
+	{
+		producers.push_back(std::thread([shard]()
+		{
+			for (unsigned long long sequence = shard; sequence < COUNT; sequence += PRODUCER_COUNT)
+			{
+				while (!queues[shard].tryPush(FakeDecision::make(sequence)))
+					std::this_thread::yield();
+			}
+		}));
+	}
+
+	// The collector, as CollectDecisions and AcceptDecision do it
+	std::map<unsigned long long, FakeDecision> early;
+	unsigned long long nextSequence = 0;
+	bool intact = true;
+	while (nextSequence < COUNT)
+	{
+		FakeDecision decision;
+		bool collected = false;
+		for (size_t shard = 0; shard < PRODUCER_COUNT; shard++)
+		{
+			while (queues[shard].tryPop(&decision))
+			{
+				collected = true;
+				intact = intact && decision.isIntact() && decision.sequence >= nextSequence
+					&& early.find(decision.sequence) == early.end();
+				early.emplace(decision.sequence, decision);
+			}
+		}
+		while (!early.empty() && early.begin()->first == nextSequence)
+		{
+			early.erase(early.begin());
+			nextSequence++;
+		}
+		if (!collected)
+			std::this_thread::yield();		// The hook window would wait for an event instead
+	}
+
+	for (size_t shard = 0; shard < PRODUCER_COUNT; shard++)
+		producers[shard].join();
+
+	CHECK(intact);
+	CHECK_EQUAL(COUNT, nextSequence);
+	CHECK(early.empty());
+}
+
+
+int main()
+{
+	TestBounds();
+	TestLifetimes();
+	TestSinglePair();
+	TestPipeline();
+	return Tests::Result();
+}
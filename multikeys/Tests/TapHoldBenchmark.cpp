@@ -0,0 +1,270 @@
+// Benchmark of dual-role modifiers (BaseModifier::tapTimeout, resolved in Keyboard::evaluateKey):
+// Space as Shift while typing fast, against a plain Space and a Shift key of its own. Words are
+// typed with keys rolling over, so the next letter is often down before Space is up; a letter
+// pressed while Space may still be a tap is held back until it's resolved, and that delay is
+// the latency measured here, with the events played in real time and expire() called as the
+// core's timer would. Every 8th word is capitalised, by holding Space (or Shift) over its first
+// letter. Then the cost of evaluating the same events, played as fast as they can be.
+// Not run by ctest; run it by hand:
+//		TapHoldBenchmark [words] [milliseconds between keys]
+
+#include "../Remapper/Keyboard.h"
+#include "../Remapper/CommandPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static const BYTE FIRST_KEY = 0x10;
+static const size_t KEY_COUNT = 26;
+static const BYTE KEY_SHIFT = 0x2a;
+static const BYTE KEY_SPACE = 0x39;
+static const DWORD TAP_TIMEOUT = 200;
+
+
+struct Event
+{
+	double at;		// In ms from the start
+	BYTE makeCode;
+	bool keyUp;
+	bool typed;		// Whether its press types something: not Space held for a capital
+};
+
+
+// Letters, and their capitals in a Shift layer; Space types a space in both, and is Shift too if dualRole.
+static std::shared_ptr<const KeyboardSpec> MakeSpec(CommandPool* pool, bool dualRole)
+{
+	std::unordered_map<Scancode, BaseKeystrokeCommand*> plain, shifted;
+	for (size_t k = 0; k < KEY_COUNT; k++)
+	{
+		plain[Scancode((BYTE)(FIRST_KEY + k))] = pool->internUnicode(std::vector<unsigned int>(1, L'a' + k), false);
+		shifted[Scancode((BYTE)(FIRST_KEY + k))] = pool->internUnicode(std::vector<unsigned int>(1, L'A' + k), false);
+	}
+	plain[Scancode(KEY_SPACE)] = shifted[Scancode(KEY_SPACE)] = pool->internUnicode(std::vector<unsigned int>(1, L' '), false);
+	std::vector<std::shared_ptr<const Layer>> layers;
+	layers.push_back(std::make_shared<Layer>(std::vector<std::wstring>(), plain));
+	layers.push_back(std::make_shared<Layer>(std::vector<std::wstring>(1, L"Shift"), shifted));
+
+	PModifier shift = new SimpleModifier(L"Shift", Scancode(dualRole ? KEY_SPACE : KEY_SHIFT));
+	if (dualRole)
+		shift->tapTimeout = TAP_TIMEOUT;
+	return std::make_shared<KeyboardSpec>(L"Bench", layers, std::vector<PModifier>(1, shift), 0, nullptr, pool);
+}
+
+
+// Random words, as events, and the text they should type. Each key is held 50 to 100 ms, and
+// pressed gap ms after the previous one on average, so keys often overlap.
+static std::vector<Event> MakeEvents(size_t wordCount, double gap, bool dualRole, std::wstring* out_text)
+{
+	std::mt19937 random(1);
+	std::vector<Event> events;
+	double at = 0;
+	double spaceUp = 0;
+	BYTE last = 0;
+	for (size_t w = 0; w < wordCount; w++)
+	{
+		size_t length = 3 + random() % 5;
+		for (size_t i = 0; i < length; i++)
+		{
+			BYTE key;
+			do
+				key = (BYTE)(FIRST_KEY + random() % KEY_COUNT);
+			while (key == last);
+			last = key;
+			double hold = 50 + random() % 51;
+
+			if (i == 0 && w % 8 == 7)
+			{
+				// Capitalised: the modifier is held over the letter, once the space before is up
+				BYTE modifier = dualRole ? KEY_SPACE : KEY_SHIFT;
+				at = std::max(at, spaceUp + 10);
+				events.push_back(Event{ at, modifier, false, false });
+				events.push_back(Event{ at + gap, key, false, true });
+				events.push_back(Event{ at + gap + hold, key, true, false });
+				events.push_back(Event{ at + gap + hold + 20, modifier, true, false });
+				at += gap + hold + 40;
+				*out_text += (wchar_t)(L'A' + key - FIRST_KEY);
+				continue;
+			}
+			events.push_back(Event{ at, key, false, true });
+			events.push_back(Event{ at + hold, key, true, false });
+			at += gap * (0.75 + (random() % 51) / 100.0);
+			*out_text += (wchar_t)(L'a' + key - FIRST_KEY);
+		}
+		// Then a space, held over the next letter's press
+		spaceUp = at + 50 + random() % 51;
+		events.push_back(Event{ at, KEY_SPACE, false, true });
+		events.push_back(Event{ spaceUp, KEY_SPACE, true, false });
+		at += gap * (0.75 + (random() % 51) / 100.0);
+		last = KEY_SPACE;
+		*out_text += L' ';
+	}
+	std::stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.at < b.at; });
+	return events;
+}
+
+
+// Text of the press of an action
+static std::wstring TextOf(PKeystrokeCommand action)
+{
+	const INPUT* inputs = nullptr;
+	size_t count = 0;
+	if (!action || !static_cast<BaseKeystrokeCommand*>(action)->getInputs(false, false, &inputs, &count))
+		return std::wstring();
+	std::wstring text;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (inputs[i].ki.dwFlags & KEYEVENTF_UNICODE)
+			text += (wchar_t)inputs[i].ki.wScan;
+	}
+	return text;
+}
+
+
+static double Percentile(std::vector<double>& values, double fraction)
+{
+	if (values.empty())
+		return 0;
+	size_t index = std::min(values.size() - 1, (size_t)(values.size() * fraction));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+
+// Plays the events in real time; prints how long letters and spaces wait to be typed.
+static void RunTimed(const char* name, bool dualRole, size_t wordCount, double gap)
+{
+	CommandPool pool;
+	std::shared_ptr<const KeyboardSpec> spec = MakeSpec(&pool, dualRole);
+	Keyboard keyboard(spec);
+	std::wstring expected, typed;
+	std::vector<Event> events = MakeEvents(wordCount, gap, dualRole, &expected);
+
+	// Times of the presses of each character still to be typed, to match with what's typed
+	std::map<wchar_t, std::deque<Clock::time_point>> pending;
+	std::vector<double> letterLatencies, spaceLatencies;
+	auto typedText = [&](const std::wstring& text)
+	{
+		Clock::time_point now = Clock::now();
+		for (size_t i = 0; i < text.size(); i++)
+		{
+			wchar_t c = (wchar_t)towlower(text[i]);
+			std::deque<Clock::time_point>& times = pending[c];
+			if (!times.empty())
+			{
+				double latency = std::chrono::duration<double, std::milli>(now - times.front()).count();
+				(c == L' ' ? spaceLatencies : letterLatencies).push_back(latency);
+				times.pop_front();
+			}
+		}
+		typed += text;
+	};
+
+	PKeystrokeCommand action;
+	bool repeated;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		// Until the event is due, the core's timer resolves what times out
+		Clock::time_point due = start + std::chrono::microseconds((long long)(events[i].at * 1000));
+		while (Clock::now() < due)
+		{
+			DWORD next = keyboard.expire();
+			while (keyboard.takeDeferredAction(&action))
+				typedText(TextOf(action));
+			Clock::time_point wake = next ? std::min(due, Clock::now() + std::chrono::milliseconds(next)) : due;
+			std::this_thread::sleep_until(wake);
+		}
+
+		const Event& event = events[i];
+		if (event.typed)
+		{
+			wchar_t c = event.makeCode == KEY_SPACE ? L' ' : (wchar_t)(L'a' + event.makeCode - FIRST_KEY);
+			pending[c].push_back(Clock::now());
+		}
+		bool remapped = keyboard.evaluateKey(Scancode(event.makeCode), 0, event.keyUp, &action, &repeated);
+		PKeystrokeCommand deferred;
+		while (keyboard.takeDeferredAction(&deferred))
+			typedText(TextOf(deferred));
+		if (remapped && !event.keyUp)
+			typedText(TextOf(action));
+	}
+	while (keyboard.expire())
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	while (keyboard.takeDeferredAction(&action))
+		typedText(TextOf(action));
+
+	// A capitalised letter that came out small, or the other way round, was mistaken for a tap or a hold
+	size_t mistaken = typed.size() != expected.size() ? expected.size() : 0;
+	for (size_t i = 0; i < typed.size() && i < expected.size(); i++)
+	{
+		if (typed[i] != expected[i])
+			mistaken++;
+	}
+	printf("  %-22s  %8.1f  %8.1f  %8.1f  %8.1f  %8.1f  %9zu\n", name,
+		Percentile(letterLatencies, 0.5), Percentile(letterLatencies, 0.99),
+		letterLatencies.empty() ? 0.0 : *std::max_element(letterLatencies.begin(), letterLatencies.end()),
+		Percentile(spaceLatencies, 0.5), Percentile(spaceLatencies, 0.99), mistaken);
+}
+
+
+// Evaluates the events as fast as they can be, repeats times; returns nanoseconds per event.
+static double TimeEvaluation(bool dualRole, size_t wordCount, double gap, size_t repeats)
+{
+	CommandPool pool;
+	std::shared_ptr<const KeyboardSpec> spec = MakeSpec(&pool, dualRole);
+	Keyboard keyboard(spec);
+	std::wstring expected;
+	std::vector<Event> events = MakeEvents(wordCount, gap, dualRole, &expected);
+
+	PKeystrokeCommand action;
+	bool repeated;
+	size_t sent = 0;
+	Clock::time_point start = Clock::now();
+	for (size_t r = 0; r < repeats; r++)
+	{
+		for (size_t i = 0; i < events.size(); i++)
+		{
+			if (keyboard.evaluateKey(Scancode(events[i].makeCode), 0, events[i].keyUp, &action, &repeated) && !events[i].keyUp)
+				sent++;
+			while (keyboard.takeDeferredAction(&action))
+				sent++;
+		}
+	}
+	double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	if (sent == 0)
+		printf("Nothing sent\n");
+	return elapsed / (events.size() * repeats);
+}
+
+
+int main(int argc, char* argv[])
+{
+	int wordCount = argc > 1 ? atoi(argv[1]) : 50;
+	if (wordCount <= 0)
+		wordCount = 50;
+	double gap = argc > 2 ? atof(argv[2]) : 60;
+	if (gap <= 0)
+		gap = 60;
+
+	printf("%d words, a key every %.0f ms or so; in ms, from a key's press to what it types:\n", wordCount, gap);
+	printf("  %-22s  %8s  %8s  %8s  %8s  %8s  %9s\n", "", "keys p50", "keys p99", "keys max",
+		"spc p50", "spc p99", "mistaken");
+	RunTimed("plain Space and Shift", false, (size_t)wordCount, gap);
+	RunTimed("Space as Shift", true, (size_t)wordCount, gap);
+
+	printf("\nIn nanoseconds per event, played without waiting:\n");
+	printf("  %-22s  %8.1f\n", "plain Space and Shift", TimeEvaluation(false, (size_t)wordCount, gap, 2000));
+	printf("  %-22s  %8.1f\n", "Space as Shift", TimeEvaluation(true, (size_t)wordCount, gap, 2000));
+	return 0;
+}
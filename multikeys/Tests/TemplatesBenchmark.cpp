@@ -0,0 +1,241 @@
+// Benchmark of keyboard templates (<template> in XML/Multikeys.xsd, and Layer's base) on a
+// configuration of 50 devices with one layout of 4 layers of 80 keys, each device overriding
+// 4 keys of it. Before templates, each <keyboard> spelt the whole layout out, and was read into
+// layers of its own; with a template, the layout is read once into layers every keyboard shares,
+// and each keyboard only has a layer with its own 4 keys, over the template's. The size of both
+// settings files is that of the XML written here; loading is what the parser does after
+// reading the XML: creating the commands and layers, and compiling the specs. Each way is
+// loaded in a process of its own, for the memory resident afterwards.
+// Not run by ctest; run it by hand:
+//		TemplatesBenchmark [devices]
+
+#include "../Remapper/Keyboard.h"
+#include "../Remapper/CommandPool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t LAYER_COUNT = 4;		// Plain, Shift, AltGr, Shift+AltGr
+static const size_t KEY_COUNT = 80;
+static const BYTE FIRST_KEY = 0x02;
+static const BYTE KEY_SHIFT = 0x2a;
+static const BYTE KEY_ALTGR = 0x38;
+static const size_t OVERRIDE_COUNT = 4;		// Keys of the plain layer each device changes
+
+static const char* const LAYER_MODIFIERS[LAYER_COUNT][2] = { { nullptr, nullptr }, { "Shift", nullptr },
+	{ "AltGr", nullptr }, { "Shift", "AltGr" } };
+
+
+// Resident memory of this process, in KiB
+static long ResidentKiB()
+{
+	long pages = 0, resident = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm)
+	{
+		if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(statm);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+// Character of a key in a layer; the keys a device overrides type characters of its own
+static unsigned int CharacterOf(size_t device, size_t layer, size_t key, bool overridden)
+{
+	if (overridden)
+		return 0x2460 + device * OVERRIDE_COUNT + key;
+	return 0x21 + layer * 0x60 + key;
+}
+
+static std::vector<std::wstring> ModifiersOf(size_t layer)
+{
+	std::vector<std::wstring> names;
+	for (size_t m = 0; m < 2 && LAYER_MODIFIERS[layer][m]; m++)
+		names.push_back(std::wstring(LAYER_MODIFIERS[layer][m], LAYER_MODIFIERS[layer][m] + strlen(LAYER_MODIFIERS[layer][m])));
+	return names;
+}
+
+
+// XML of a layer of a device: its first count keys, overridden or not
+static void AppendLayer(std::string* xml, size_t device, size_t layer, size_t count, bool overridden)
+{
+	*xml += "\t\t<layer>\n";
+	for (size_t m = 0; m < 2 && LAYER_MODIFIERS[layer][m]; m++)
+		*xml += std::string("\t\t\t<modifier>") + LAYER_MODIFIERS[layer][m] + "</modifier>\n";
+	char line[200];
+	for (size_t k = 0; k < count; k++)
+	{
+		bool keyOverridden = overridden || (device != (size_t)-1 && layer == 0 && k < OVERRIDE_COUNT);
+		snprintf(line, sizeof(line), "\t\t\t<unicode Scancode=\"%02X\" TriggerOnRepeat=\"True\">\n\t\t\t\t<codepoint>%X</codepoint>\n\t\t\t</unicode>\n",
+			(unsigned)(FIRST_KEY + k), CharacterOf(device, layer, k, keyOverridden));
+		*xml += line;
+	}
+	*xml += "\t\t</layer>\n";
+}
+
+static const char MODIFIERS_XML[] = "\t\t<modifiers>\n\t\t\t<modifier Name=\"Shift\">2A</modifier>\n"
+	"\t\t\t<modifier Name=\"AltGr\">E0:38</modifier>\n\t\t</modifiers>\n";
+
+// The settings file of every device, with a template or without
+static std::string MakeXml(size_t deviceCount, bool templated)
+{
+	std::string xml = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<Multikeys>\n";
+	if (templated)
+	{
+		xml += "\t<template Name=\"Office\">\n";
+		xml += MODIFIERS_XML;
+		for (size_t l = 0; l < LAYER_COUNT; l++)
+			AppendLayer(&xml, (size_t)-1, l, KEY_COUNT, false);
+		xml += "\t</template>\n";
+	}
+	char line[200];
+	for (size_t d = 0; d < deviceCount; d++)
+	{
+		snprintf(line, sizeof(line), "\t<keyboard Name=\"\\\\?\\HID#VID_04D9&amp;PID_A0F8&amp;MI_00#8&amp;%zx&amp;0&amp;0000\"%s>\n",
+			0x695bdd8 + d, templated ? " Template=\"Office\"" : "");
+		xml += line;
+		if (templated)
+			AppendLayer(&xml, d, 0, OVERRIDE_COUNT, true);
+		else
+		{
+			xml += MODIFIERS_XML;
+			for (size_t l = 0; l < LAYER_COUNT; l++)
+				AppendLayer(&xml, d, l, KEY_COUNT, false);
+		}
+		xml += "\t</keyboard>\n";
+	}
+	xml += "</Multikeys>\n";
+	return xml;
+}
+
+
+static std::vector<PModifier> MakeModifiers()
+{
+	std::vector<PModifier> modifiers;
+	modifiers.push_back(new SimpleModifier(L"Shift", Scancode(KEY_SHIFT)));
+	modifiers.push_back(new SimpleModifier(L"AltGr", Scancode(false, true, KEY_ALTGR)));
+	return modifiers;
+}
+
+// A layer of a device: its first count keys, all of them if it's the whole layout
+static std::shared_ptr<const Layer> MakeLayer(CommandPool* pool, size_t device, size_t layer, size_t count,
+	bool overridden, std::shared_ptr<const Layer> base)
+{
+	std::unordered_map<Scancode, BaseKeystrokeCommand*> keys;
+	for (size_t k = 0; k < count; k++)
+	{
+		bool keyOverridden = overridden || (device != (size_t)-1 && layer == 0 && k < OVERRIDE_COUNT);
+		keys[Scancode((BYTE)(FIRST_KEY + k))] =
+			pool->internUnicode(std::vector<unsigned int>(1, CharacterOf(device, layer, k, keyOverridden)), true);
+	}
+	return std::make_shared<Layer>(ModifiersOf(layer), keys, std::vector<ChordDefinition>(), base);
+}
+
+// Every device's spec, from the whole layout each or from a template, whose layers go to out_templateLayers
+static std::vector<std::shared_ptr<const KeyboardSpec>> MakeSpecs(CommandPool* pool, size_t deviceCount, bool templated,
+	OUT std::vector<std::shared_ptr<const Layer>> *const out_templateLayers)
+{
+	std::vector<std::shared_ptr<const Layer>>& templateLayers = *out_templateLayers;
+	if (templated)
+	{
+		for (size_t l = 0; l < LAYER_COUNT; l++)
+			templateLayers.push_back(MakeLayer(pool, (size_t)-1, l, KEY_COUNT, false, nullptr));
+	}
+	std::vector<std::shared_ptr<const KeyboardSpec>> specs;
+	for (size_t d = 0; d < deviceCount; d++)
+	{
+		std::vector<std::shared_ptr<const Layer>> layers;
+		for (size_t l = 0; l < LAYER_COUNT; l++)
+		{
+			if (!templated)
+				layers.push_back(MakeLayer(pool, d, l, KEY_COUNT, false, nullptr));
+			else if (l == 0)
+				layers.push_back(MakeLayer(pool, d, l, OVERRIDE_COUNT, true, templateLayers[l]));
+			else
+				layers.push_back(templateLayers[l]);
+		}
+		specs.push_back(std::make_shared<KeyboardSpec>(L"Bench", layers, MakeModifiers(), 0, nullptr, pool));
+		for (size_t l = 0; l < layers.size(); l++)
+			specs.back()->buildLayer(l);
+	}
+	return specs;
+}
+
+
+// Loads every device one way in this process; prints a row of the table.
+static void Load(size_t deviceCount, bool templated)
+{
+	long residentBefore = ResidentKiB();
+	CommandPool* pool = new CommandPool();
+	std::vector<std::shared_ptr<const Layer>> templateLayers;
+	std::vector<std::shared_ptr<const KeyboardSpec>> specs = MakeSpecs(pool, deviceCount, templated, &templateLayers);
+	long resident = ResidentKiB() - residentBefore;
+
+	// Memory of the layers, each counted once however many specs share it
+	std::set<const Layer*> layers;
+	size_t layerBytes = 0;
+	for (size_t s = 0; s <= specs.size(); s++)
+	{
+		const std::vector<std::shared_ptr<const Layer>>& some = s < specs.size() ? specs[s]->getLayers() : templateLayers;
+		for (size_t l = 0; l < some.size(); l++)
+		{
+			if (layers.insert(some[l].get()).second)
+				layerBytes += some[l]->getMemoryUsage();
+		}
+	}
+
+	// Then again, timed, with the memory of the first load still taken
+	const size_t REPEATS = 20;
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < REPEATS; i++)
+	{
+		CommandPool timedPool;
+		std::vector<std::shared_ptr<const Layer>> timedLayers;
+		MakeSpecs(&timedPool, deviceCount, templated, &timedLayers);
+	}
+	double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / REPEATS;
+
+	printf("  %-10s  %12zu  %8zu  %12zu  %10.2f  %10ld\n", templated ? "template" : "full", MakeXml(deviceCount, templated).size(),
+		layers.size(), layerBytes, milliseconds, resident);
+}
+
+
+int main(int argc, char* argv[])
+{
+	int deviceCount = argc > 1 ? atoi(argv[1]) : 50;
+	if (deviceCount <= 0)
+		deviceCount = 50;
+
+	printf("%d devices, %zu layers of %zu keys, %zu of them overridden by each; loading in ms, resident in KiB:\n",
+		deviceCount, LAYER_COUNT, KEY_COUNT, OVERRIDE_COUNT);
+	printf("  %-10s  %12s  %8s  %12s  %10s  %10s\n", "layouts", "XML bytes", "layers", "layer bytes", "load", "resident");
+	const bool modes[] = { false, true };
+	for (size_t i = 0; i < 2; i++)
+	{
+		// A process each, so that one's memory isn't reused by the next
+		fflush(stdout);
+		pid_t child = fork();
+		if (child == 0)
+		{
+			Load((size_t)deviceCount, modes[i]);
+			fflush(stdout);
+			_exit(0);
+		}
+		if (child > 0)
+			waitpid(child, nullptr, 0);
+	}
+	return 0;
+}
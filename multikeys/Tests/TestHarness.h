@@ -0,0 +1,53 @@
+#pragma once
+
+// Minimal checks for the tests of the portable parts of Multikeys (see ../CMakeLists.txt).
+// Each test is an executable of its own; it prints every failed check and exits with 1
+// if there was any, which is all ctest looks at.
+
+#include <cstdio>
+
+namespace Multikeys
+{
+	namespace Tests
+	{
+		// Number of checks that failed so far
+		inline int& Failures()
+		{
+			static int failures = 0;
+			return failures;
+		}
+
+		// Exit code of the test
+		inline int Result()
+		{
+			if (Failures() == 0)
+				printf("All checks passed\n");
+			else
+				printf("%d checks failed\n", Failures());
+			return Failures() == 0 ? 0 : 1;
+		}
+	}
+}
+
+// Reports the condition, with where it is, if it's false; the test goes on either way.
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) \
+		{ \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			Multikeys::Tests::Failures()++; \
+		} \
+	} while (0)
+
+// Like CHECK, for values that are printed when different.
+#define CHECK_EQUAL(expected, actual) \
+	do { \
+		unsigned long long expectedValue = (unsigned long long)(expected); \
+		unsigned long long actualValue = (unsigned long long)(actual); \
+		if (expectedValue != actualValue) \
+		{ \
+			printf("%s:%d: check failed: %s == %s (%llu != %llu)\n", __FILE__, __LINE__, #expected, #actual, \
+				expectedValue, actualValue); \
+			Multikeys::Tests::Failures()++; \
+		} \
+	} while (0)
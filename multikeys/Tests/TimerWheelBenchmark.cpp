@@ -0,0 +1,142 @@
+// Benchmark of the timer wheel (Remapper/TimerWheel.h): millions of timers armed and cancelled,
+// the way keystrokes restart the timeouts of their keyboards, against the same work done with
+// a std::multimap ordered by deadline. Time is simulated, so only the timers' own cost is measured.
+// Not run by ctest; run it by hand:
+//		TimerWheelBenchmark [operations]
+
+#include "../Remapper/TimerWheel.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace Multikeys;
+
+typedef std::chrono::steady_clock Clock;
+
+static TimerTime now = 0;
+
+static TimerTime FakeClock()
+{
+	return now;
+}
+
+static unsigned long long fired = 0;
+
+static void OnTimer(TimerNode*)
+{
+	fired++;
+}
+
+
+// Delays of the operations, the same for both: mostly short timeouts, some long ones
+static std::vector<TimerTime> MakeDelays(size_t count)
+{
+	std::mt19937_64 random(7);
+	std::vector<TimerTime> delays(count);
+	for (size_t i = 0; i < count; i++)
+		delays[i] = random() % 8 == 0 ? 1 + random() % 600000 : 20 + random() % 200;
+	return delays;
+}
+
+
+// Each operation re-arms one of the timers; every tenth one cancels another instead.
+// The clock moves a millisecond every 16 operations, and the timers due are fired.
+static double RunWheel(const std::vector<TimerTime>& delays, size_t timerCount)
+{
+	now = 0;
+	fired = 0;
+	TimerWheel* wheel = new TimerWheel(FakeClock);		// Large; not on the stack
+	std::vector<TimerNode> timers(timerCount);
+	for (size_t i = 0; i < timerCount; i++)
+		timers[i].callback = OnTimer;
+
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < delays.size(); i++)
+	{
+		TimerNode* timer = &timers[i % timerCount];
+		if (i % 10 == 9)
+			wheel->cancel(&timers[(i * 7) % timerCount]);
+		else
+			wheel->arm(timer, delays[i]);
+
+		if (i % 16 == 15)
+		{
+			now++;
+			wheel->advance();
+		}
+	}
+	double elapsed = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+	delete wheel;
+	return elapsed / delays.size();
+}
+
+
+// The same with a multimap from deadlines to timers, and an iterator kept per timer to cancel it.
+static double RunMultimap(const std::vector<TimerTime>& delays, size_t timerCount)
+{
+	typedef std::multimap<TimerTime, size_t> Timers;
+	Timers deadlines;
+	std::vector<Timers::iterator> armed(timerCount, deadlines.end());
+	now = 0;
+	fired = 0;
+
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < delays.size(); i++)
+	{
+		size_t timer = i % timerCount;
+		if (i % 10 == 9)
+		{
+			size_t cancelled = (i * 7) % timerCount;
+			if (armed[cancelled] != deadlines.end())
+			{
+				deadlines.erase(armed[cancelled]);
+				armed[cancelled] = deadlines.end();
+			}
+		}
+		else
+		{
+			if (armed[timer] != deadlines.end())
+				deadlines.erase(armed[timer]);
+			armed[timer] = deadlines.insert(std::make_pair(now + delays[i], timer));
+		}
+
+		if (i % 16 == 15)
+		{
+			now++;
+			while (!deadlines.empty() && deadlines.begin()->first <= now)
+			{
+				armed[deadlines.begin()->second] = deadlines.end();
+				deadlines.erase(deadlines.begin());
+				fired++;
+			}
+		}
+	}
+	double elapsed = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+	return elapsed / delays.size();
+}
+
+
+int main(int argc, char* argv[])
+{
+	long long operations = argc > 1 ? atoll(argv[1]) : 10000000;
+	if (operations <= 0)
+		operations = 10000000;
+	std::vector<TimerTime> delays = MakeDelays((size_t)operations);
+
+	printf("%lld arms and cancels, nanoseconds per operation:\n", operations);
+	const size_t timerCounts[] = { 16, 1024, 65536 };
+	for (size_t i = 0; i < sizeof(timerCounts) / sizeof(timerCounts[0]); i++)
+	{
+		double wheel = RunWheel(delays, timerCounts[i]);
+		unsigned long long wheelFired = fired;
+		double multimap = RunMultimap(delays, timerCounts[i]);
+		printf("  %6zu timers:   wheel %7.1f   multimap %7.1f   (%llu and %llu fired)\n",
+			timerCounts[i], wheel, multimap, wheelFired, fired);
+	}
+	return 0;
+}
@@ -0,0 +1,305 @@
+// Tests of the timer wheel (Remapper/TimerWheel.h), on a clock the tests move by hand.
+//
+// Timers must fire exactly once, never before their deadline, in deadline order, and, when
+// the wheel is advanced whenever timeUntilNext says, exactly at their deadline; across every
+// level of the wheel, and however they're armed, moved and cancelled in between.
+
+#include "../Remapper/TimerWheel.h"
+#include "TestHarness.h"
+
+#include <random>
+#include <vector>
+
+using namespace Multikeys;
+
+
+// The clock of every wheel in these tests
+static TimerTime now = 1000;
+
+static TimerTime FakeClock()
+{
+	return now;
+}
+
+
+// Timers that remember when they fired
+struct TestTimer
+{
+	TimerNode node;
+	int fireCount;
+	TimerTime firedAt;
+};
+
+// Order in which the timers fired; deadlines must never go down in it
+static std::vector<TimerTime> firedDeadlines;
+
+static void OnTimer(TimerNode* node)
+{
+	TestTimer* timer = (TestTimer*)node->context;
+	timer->fireCount++;
+	timer->firedAt = now;
+	firedDeadlines.push_back(node->deadline);
+}
+
+static void InitTimers(std::vector<TestTimer>& timers)
+{
+	for (size_t i = 0; i < timers.size(); i++)
+	{
+		timers[i].node.callback = OnTimer;
+		timers[i].node.context = (size_t)&timers[i];
+		timers[i].fireCount = 0;
+		timers[i].firedAt = 0;
+	}
+}
+
+static bool DeadlinesInOrder()
+{
+	for (size_t i = 1; i < firedDeadlines.size(); i++)
+	{
+		if (firedDeadlines[i] < firedDeadlines[i - 1])
+			return false;
+	}
+	return true;
+}
+
+
+static void TestSingleTimer()
+{
+	now = 1000;
+	TimerWheel wheel(FakeClock);
+	std::vector<TestTimer> timers(1);
+	InitTimers(timers);
+
+	CHECK(wheel.isEmpty());
+	CHECK_EQUAL(0, wheel.timeUntilNext());
+
+	wheel.arm(&timers[0].node, 5);
+	CHECK(!wheel.isEmpty());
+	CHECK(timers[0].node.isArmed());
+	CHECK_EQUAL(5, wheel.timeUntilNext());
+
+	now += 4;
+	wheel.advance();
+	CHECK_EQUAL(0, timers[0].fireCount);
+	CHECK_EQUAL(1, wheel.timeUntilNext());
+
+	now += 1;
+	wheel.advance();
+	CHECK_EQUAL(1, timers[0].fireCount);
+	CHECK_EQUAL(1005, timers[0].firedAt);
+	CHECK(!timers[0].node.isArmed());
+	CHECK(wheel.isEmpty());
+
+	// Nothing fires twice
+	now += 100;
+	wheel.advance();
+	CHECK_EQUAL(1, timers[0].fireCount);
+}
+
+
+static void TestCancelAndMove()
+{
+	now = 5000;
+	TimerWheel wheel(FakeClock);
+	std::vector<TestTimer> timers(3);
+	InitTimers(timers);
+
+	wheel.arm(&timers[0].node, 10);
+	wheel.arm(&timers[1].node, 10);
+	wheel.arm(&timers[2].node, 10000);
+	wheel.cancel(&timers[1].node);
+	CHECK(!timers[1].node.isArmed());
+	wheel.cancel(&timers[1].node);		// Cancelling twice is harmless
+
+	// Restarted before it's due, as each keystroke restarts a keyboard's timeout
+	now += 8;
+	wheel.advance();
+	wheel.arm(&timers[0].node, 10);
+
+	now += 5;
+	wheel.advance();
+	CHECK_EQUAL(0, timers[0].fireCount);
+	now += 5;
+	wheel.advance();
+	CHECK_EQUAL(1, timers[0].fireCount);
+	CHECK_EQUAL(5018, timers[0].firedAt);
+	CHECK_EQUAL(0, timers[1].fireCount);
+
+	// A timer in a coarse level, cancelled after moving down
+	now += 9000;
+	wheel.advance();
+	CHECK(timers[2].node.isArmed());
+	wheel.cancel(&timers[2].node);
+	CHECK(wheel.isEmpty());
+	now += 5000;
+	wheel.advance();
+	CHECK_EQUAL(0, timers[2].fireCount);
+}
+
+
+// A callback that arms its timer again, the way a macro arms the timer of its next step
+static int rearmsLeft;
+static TimerWheel* rearmingWheel;
+
+static void OnRearmingTimer(TimerNode* node)
+{
+	OnTimer(node);
+	if (--rearmsLeft > 0)
+		rearmingWheel->arm(node, 3);
+}
+
+static void TestRearmFromCallback()
+{
+	now = 200;
+	TimerWheel wheel(FakeClock);
+	TestTimer timer;
+	timer.node.callback = OnRearmingTimer;
+	timer.node.context = (size_t)&timer;
+	timer.fireCount = 0;
+	rearmingWheel = &wheel;
+	rearmsLeft = 4;
+
+	wheel.arm(&timer.node, 3);
+	for (int i = 0; i < 20; i++)
+	{
+		now++;
+		wheel.advance();
+	}
+	CHECK_EQUAL(4, timer.fireCount);
+	CHECK_EQUAL(212, timer.firedAt);
+	CHECK(wheel.isEmpty());
+}
+
+
+static void TestLongDelays()
+{
+	now = 77;
+	TimerWheel wheel(FakeClock);
+	std::vector<TestTimer> timers(2);
+	InitTimers(timers);
+
+	// Longer than the wheel covers: fires after MAX_DELAY
+	wheel.arm(&timers[0].node, TimerWheel::MAX_DELAY * 3);
+	wheel.arm(&timers[1].node, TimerWheel::MAX_DELAY);
+	while (!wheel.isEmpty())
+	{
+		now += wheel.timeUntilNext();
+		wheel.advance();
+	}
+	CHECK_EQUAL(77 + TimerWheel::MAX_DELAY, timers[0].firedAt);
+	CHECK_EQUAL(77 + TimerWheel::MAX_DELAY, timers[1].firedAt);
+
+	// An empty wheel left far behind the clock catches up when armed again
+	now += 123456789;
+	wheel.arm(&timers[0].node, 2);
+	now += 2;
+	wheel.advance();
+	CHECK_EQUAL(2, timers[0].fireCount);
+	CHECK_EQUAL(now, timers[0].firedAt);
+}
+
+
+// Thousands of timers over every level, armed, moved and cancelled at random while the clock moves.
+// With the clock advanced as timeUntilNext says, each must fire exactly at its deadline.
+static void TestRandomSchedule(bool exactSteps)
+{
+	now = 123456;
+	TimerWheel wheel(FakeClock);
+	std::vector<TestTimer> timers(5000);
+	InitTimers(timers);
+	firedDeadlines.clear();
+
+	std::mt19937_64 random(exactSteps ? 1 : 2);
+	std::vector<TimerTime> deadlines(timers.size(), 0);
+	std::vector<bool> cancelled(timers.size(), false);
+	std::vector<int> expectedFires(timers.size(), 0);
+
+	// Delays spread over every level: up to 64 ms, 4 s, 4 min, and the rest of the wheel
+	auto randomDelay = [&]()
+	{
+		static const TimerTime limits[4] = { 64, 4096, 262144, TimerWheel::MAX_DELAY };
+		return 1 + random() % limits[random() % 4];
+	};
+
+	for (size_t i = 0; i < timers.size(); i++)
+	{
+		deadlines[i] = now + randomDelay();
+		wheel.arm(&timers[i].node, deadlines[i] - now);
+	}
+
+	bool late = false, early = false;
+	for (int step = 0; step < 20000 && !wheel.isEmpty(); step++)
+	{
+		// Check those that fired since the last step
+		for (size_t i = 0; i < timers.size(); i++)
+		{
+			if (timers[i].fireCount > expectedFires[i])
+			{
+				early = early || timers[i].firedAt < deadlines[i];
+				late = late || (exactSteps && timers[i].firedAt != deadlines[i]);
+				expectedFires[i]++;
+			}
+		}
+
+		// Move or cancel a few of those still armed
+		for (int change = 0; change < 5; change++)
+		{
+			size_t i = (size_t)(random() % timers.size());
+			if (!timers[i].node.isArmed())
+				continue;
+			if (random() % 3 == 0)
+			{
+				wheel.cancel(&timers[i].node);
+				cancelled[i] = true;
+			}
+			else
+			{
+				deadlines[i] = now + randomDelay();
+				wheel.arm(&timers[i].node, deadlines[i] - now);
+			}
+		}
+
+		if (exactSteps)
+			now += wheel.timeUntilNext();
+		else
+			now += random() % 5000;
+		wheel.advance();
+	}
+
+	// Drain what's left
+	while (!wheel.isEmpty())
+	{
+		now += exactSteps ? wheel.timeUntilNext() : random() % 500000;
+		wheel.advance();
+	}
+
+	size_t wrongCount = 0;
+	for (size_t i = 0; i < timers.size(); i++)
+	{
+		if (timers[i].fireCount > expectedFires[i])
+		{
+			early = early || timers[i].firedAt < deadlines[i];
+			late = late || (exactSteps && timers[i].firedAt != deadlines[i]);
+			expectedFires[i]++;
+		}
+		// Each fires once, unless it was cancelled before firing
+		if (timers[i].fireCount != (cancelled[i] ? 0 : 1))
+			wrongCount++;
+	}
+	CHECK_EQUAL(0, wrongCount);
+	CHECK(!early);
+	CHECK(!late);
+	CHECK(DeadlinesInOrder());
+}
+
+
+int main()
+{
+	TestSingleTimer();
+	TestCancelAndMove();
+	TestRearmFromCallback();
+	TestLongDelays();
+	TestRandomSchedule(true);
+	TestRandomSchedule(false);
+	return Tests::Result();
+}